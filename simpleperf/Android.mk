@@ -54,7 +54,6 @@ simpleperf_static_libraries_target := \
   libLLVMCore \
   libLLVMSupport \
   libprotobuf-cpp-lite \
-  libevent \
 
 simpleperf_static_libraries_with_libc_target := \
   $(simpleperf_static_libraries_target) \
@@ -83,7 +82,6 @@ simpleperf_static_libraries_host_linux := \
   libdexfile_external \
   libdexfile \
   libcutils \
-  libevent \
 
 simpleperf_ldlibs_host_linux := -lrt
 
@@ -95,10 +93,13 @@ libsimpleperf_src_files := \
   cmd_kmem.cpp \
   cmd_report.cpp \
   cmd_report_sample.cpp \
+  ColumnarSampleFile.cpp \
   command.cpp \
   dso.cpp \
   event_attr.cpp \
   event_type.cpp \
+  JITSymfileContainer.cpp \
+  KernelSymbolIndex.cpp \
   perf_regs.cpp \
   read_apk.cpp \
   read_elf.cpp \
@@ -119,6 +120,7 @@ libsimpleperf_src_files_linux := \
   environment.cpp \
   event_fd.cpp \
   event_selection_set.cpp \
+  FlightRecorder.cpp \
   InplaceSamplerClient.cpp \
   IOEventLoop.cpp \
   JITDebugReader.cpp \
@@ -127,6 +129,7 @@ libsimpleperf_src_files_linux := \
   record_file_writer.cpp \
   RecordReadThread.cpp \
   UnixSocket.cpp \
+  UnwindingWorkerPool.cpp \
   workload.cpp \
 
 libsimpleperf_src_files_darwin := \
@@ -365,9 +368,12 @@ simpleperf_unit_test_src_files := \
   cmd_kmem_test.cpp \
   cmd_report_test.cpp \
   cmd_report_sample_test.cpp \
+  ColumnarSampleFile_test.cpp \
   command_test.cpp \
   dso_test.cpp \
   gtest_main.cpp \
+  JITSymfileContainer_test.cpp \
+  KernelSymbolIndex_test.cpp \
   read_apk_test.cpp \
   read_elf_test.cpp \
   record_test.cpp \
@@ -384,11 +390,14 @@ simpleperf_unit_test_src_files_linux := \
   cmd_stat_test.cpp \
   cmd_trace_sched_test.cpp \
   environment_test.cpp \
+  FlightRecorder_test.cpp \
   IOEventLoop_test.cpp \
+  OfflineUnwinder_test.cpp \
   read_dex_file_test.cpp \
   record_file_test.cpp \
   RecordReadThread_test.cpp \
   UnixSocket_test.cpp \
+  UnwindingWorkerPool_test.cpp \
   workload_test.cpp \
 
 # simpleperf_unit_test target
@@ -457,6 +466,42 @@ include $(LLVM_HOST_BUILD_MK)
 include $(BUILD_HOST_NATIVE_TEST)
 
 
+# simpleperf_benchmark
+# =========================================================
+simpleperf_benchmark_src_files := \
+  benchmark_main.cpp \
+  IOEventLoop_benchmark.cpp \
+  sample_tree_benchmark.cpp \
+  thread_tree_benchmark.cpp \
+
+# simpleperf_benchmark target
+include $(CLEAR_VARS)
+LOCAL_MODULE := simpleperf_benchmark
+LOCAL_CFLAGS := $(simpleperf_cflags_target)
+LOCAL_SRC_FILES := $(simpleperf_benchmark_src_files)
+# libevent is only used by the reference loop in IOEventLoop_benchmark.cpp.
+LOCAL_STATIC_LIBRARIES := libsimpleperf $(simpleperf_static_libraries_with_libc_target) \
+  libgoogle-benchmark libevent
+LOCAL_MULTILIB := both
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+include $(LLVM_DEVICE_BUILD_MK)
+include $(BUILD_NATIVE_BENCHMARK)
+
+# simpleperf_benchmark linux host
+include $(CLEAR_VARS)
+LOCAL_MODULE := simpleperf_benchmark
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_CFLAGS := $(simpleperf_cflags_host)
+LOCAL_CFLAGS_linux := $(simpleperf_cflags_host_linux)
+LOCAL_SRC_FILES := $(simpleperf_benchmark_src_files)
+LOCAL_STATIC_LIBRARIES := libsimpleperf $(simpleperf_static_libraries_host) libgoogle-benchmark
+LOCAL_STATIC_LIBRARIES_linux := $(simpleperf_static_libraries_host_linux) libevent
+LOCAL_LDLIBS_linux := $(simpleperf_ldlibs_host_linux)
+LOCAL_MULTILIB := first
+include $(LLVM_HOST_BUILD_MK)
+include $(BUILD_HOST_NATIVE_BENCHMARK)
+
+
 # libsimpleperf_cts_test
 # =========================================================
 libsimpleperf_cts_test_src_files := \
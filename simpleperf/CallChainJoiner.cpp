@@ -16,6 +16,8 @@
 
 #include "CallChainJoiner.h"
 
+#include <string.h>
+
 #include <android-base/logging.h>
 
 #include "environment.h"
@@ -170,14 +172,100 @@ void LRUCache::UnlinkParent(CacheNode* child) {
   child->parent_index = 0;
 }
 
+static FILE* CreateTempFp() {
+  std::unique_ptr<TemporaryFile> tmpfile = ScopedTempFiles::CreateTempFile();
+  FILE* fp = fdopen(tmpfile->release(), "web+");
+  if (fp == nullptr) {
+    PLOG(ERROR) << "fdopen";
+    return nullptr;
+  }
+  return fp;
+}
+
+CallChainStore::~CallChainStore() {
+  *memory_used_ -= data_.size();
+  if (fp_ != nullptr) {
+    fclose(fp_);
+  }
+}
+
+bool CallChainStore::Write(const void* data, size_t size) {
+  if (fp_ == nullptr) {
+    if (*memory_used_ + size > memory_budget_) {
+      if (!SpillToFile()) {
+        return false;
+      }
+    } else {
+      const char* p = static_cast<const char*>(data);
+      data_.insert(data_.end(), p, p + size);
+      pos_ = data_.size();
+      *memory_used_ += size;
+      return true;
+    }
+  }
+  if (fwrite(data, size, 1, fp_) != 1) {
+    PLOG(ERROR) << "fwrite";
+    return false;
+  }
+  return true;
+}
+
+bool CallChainStore::Read(void* data, size_t size) {
+  if (fp_ != nullptr) {
+    if (fread(data, size, 1, fp_) != 1) {
+      PLOG(ERROR) << "fread";
+      return false;
+    }
+    return true;
+  }
+  if (size > data_.size() - pos_) {
+    LOG(ERROR) << "failed to read call chains at " << pos_;
+    return false;
+  }
+  memcpy(data, data_.data() + pos_, size);
+  pos_ += size;
+  return true;
+}
+
+bool CallChainStore::Seek(int64_t offset, int whence) {
+  if (fp_ != nullptr) {
+    if (fseek(fp_, offset, whence) != 0) {
+      PLOG(ERROR) << "fseek";
+      return false;
+    }
+    return true;
+  }
+  int64_t base = whence == SEEK_SET ? 0 : (whence == SEEK_CUR ? pos_ : data_.size());
+  if (base + offset < 0 || base + offset > static_cast<int64_t>(data_.size())) {
+    LOG(ERROR) << "failed to seek call chains to " << (base + offset);
+    return false;
+  }
+  pos_ = base + offset;
+  return true;
+}
+
+bool CallChainStore::SpillToFile() {
+  fp_ = CreateTempFp();
+  if (fp_ == nullptr) {
+    return false;
+  }
+  if (!data_.empty() && fwrite(data_.data(), data_.size(), 1, fp_) != 1) {
+    PLOG(ERROR) << "fwrite";
+    return false;
+  }
+  *memory_used_ -= data_.size();
+  std::vector<char>().swap(data_);
+  pos_ = 0;
+  return true;
+}
+
 }  // call_chain_joiner_impl
 
 using namespace call_chain_joiner_impl;
 
-static bool WriteCallChain(FILE* fp, pid_t pid, pid_t tid, CallChainJoiner::ChainType type,
-                           const std::vector<uint64_t>& ips,
-                           const std::vector<uint64_t>& sps,
-                           size_t ip_count) {
+static bool WriteCallChain(CallChainStore* store, pid_t pid, pid_t tid,
+                           CallChainJoiner::ChainType type, const std::vector<uint64_t>& ips,
+                           const std::vector<uint64_t>& sps, size_t ip_count) {
   // Below is the content of a call chain stored in file.
   //   uint32_t pid;
   //   uint32_t tid;
@@ -196,18 +284,14 @@ static bool WriteCallChain(FILE* fp, pid_t pid, pid_t tid, CallChainJoiner::Chai
   MoveToBinaryFormat(ips.data(), ip_count, p);
   MoveToBinaryFormat(sps.data(), ip_count, p);
   MoveToBinaryFormat(size, p);
-  if (fwrite(data.data(), size, 1, fp) != 1) {
-    PLOG(ERROR) << "fwrite";
-    return false;
-  }
-  return true;
+  return store->Write(data.data(), size);
 }
 
-static bool ReadCallChain(FILE* fp, pid_t& pid, pid_t& tid, CallChainJoiner::ChainType& type,
-                          std::vector<uint64_t>& ips, std::vector<uint64_t>& sps) {
+static bool ReadCallChain(CallChainStore* store, pid_t& pid, pid_t& tid,
+                          CallChainJoiner::ChainType& type, std::vector<uint64_t>& ips,
+                          std::vector<uint64_t>& sps) {
   std::vector<char> data(4 * sizeof(uint32_t));
-  if (fread(data.data(), data.size(), 1, fp) != 1) {
-    PLOG(ERROR) << "fread";
+  if (!store->Read(data.data(), data.size())) {
     return false;
   }
   const char* p = data.data();
@@ -217,8 +301,7 @@ static bool ReadCallChain(FILE* fp, pid_t& pid, pid_t& tid, CallChainJoiner::Cha
   uint32_t ip_count;
   MoveFromBinaryFormat(ip_count, p);
   data.resize(sizeof(uint64_t) * ip_count * 2 + sizeof(uint32_t));
-  if (fread(data.data(), data.size(), 1, fp) != 1) {
-    PLOG(ERROR) << "fread";
+  if (!store->Read(data.data(), data.size())) {
     return false;
   }
   p = data.data();
@@ -229,20 +312,18 @@ static bool ReadCallChain(FILE* fp, pid_t& pid, pid_t& tid, CallChainJoiner::Cha
   return true;
 }
 
-static bool ReadCallChainInReverseOrder(FILE* fp, pid_t& pid, pid_t& tid,
+static bool ReadCallChainInReverseOrder(CallChainStore* store, pid_t& pid, pid_t& tid,
                                         CallChainJoiner::ChainType& type,
                                         std::vector<uint64_t>& ips,
                                         std::vector<uint64_t>& sps) {
   uint32_t size;
-  if (fseek(fp, -4, SEEK_CUR) != 0 || fread(&size, sizeof(size), 1, fp) != 1) {
-    PLOG(ERROR) << "fread";
+  if (!store->Seek(-4, SEEK_CUR) || !store->Read(&size, sizeof(size))) {
     return false;
   }
   std::vector<char> data(size - 4);
-  if (fseek(fp, -static_cast<int>(size), SEEK_CUR) != 0 ||
-      fread(data.data(), data.size(), 1, fp) != 1 ||
-      fseek(fp, -static_cast<int>(data.size()), SEEK_CUR) != 0) {
-    PLOG(ERROR) << "fread";
+  if (!store->Seek(-static_cast<int>(size), SEEK_CUR) ||
+      !store->Read(data.data(), data.size()) ||
+      !store->Seek(-static_cast<int>(data.size()), SEEK_CUR)) {
     return false;
   }
   const char* p = data.data();
@@ -258,34 +339,17 @@ static bool ReadCallChainInReverseOrder(FILE* fp, pid_t& pid, pid_t& tid,
   return true;
 }
 
-static FILE* CreateTempFp() {
-  std::unique_ptr<TemporaryFile> tmpfile = ScopedTempFiles::CreateTempFile();
-  FILE* fp = fdopen(tmpfile->release(), "web+");
-  if (fp == nullptr) {
-    PLOG(ERROR) << "fdopen";
-    return nullptr;
-  }
-  return fp;
-}
-
 CallChainJoiner::CallChainJoiner(size_t cache_size, size_t matched_node_count_to_extend_callchain,
-                                 bool keep_original_callchains)
+                                 bool keep_original_callchains, size_t memory_budget)
     : keep_original_callchains_(keep_original_callchains),
-      original_chains_fp_(nullptr),
-      joined_chains_fp_(nullptr),
+      memory_budget_(memory_budget),
+      memory_used_(0u),
       next_chain_index_(0u) {
   cache_stat_.cache_size = cache_size;
   cache_stat_.matched_node_count_to_extend_callchain = matched_node_count_to_extend_callchain;
 }
 
-CallChainJoiner::~CallChainJoiner() {
-  if (original_chains_fp_ != nullptr) {
-    fclose(original_chains_fp_);
-  }
-  if (joined_chains_fp_ != nullptr) {
-    fclose(joined_chains_fp_);
-  }
-}
+CallChainJoiner::~CallChainJoiner() {}
 
 bool CallChainJoiner::AddCallChain(pid_t pid, pid_t tid, ChainType type,
                                    const std::vector<uint64_t>& ips,
@@ -314,44 +378,36 @@ bool CallChainJoiner::AddCallChain(pid_t pid, pid_t tid, ChainType type,
     }
   }
 
-  if (original_chains_fp_ == nullptr) {
-    original_chains_fp_ = CreateTempFp();
-    if (original_chains_fp_ == nullptr) {
-      return false;
-    }
+  if (!original_chains_) {
+    original_chains_.reset(new CallChainStore(memory_budget_, &memory_used_));
   }
   stat_.chain_count++;
-  return WriteCallChain(original_chains_fp_, pid, tid, type, ips, sps, ip_count);
+  return WriteCallChain(original_chains_.get(), pid, tid, type, ips, sps, ip_count);
 }
 
 bool CallChainJoiner::JoinCallChains() {
   if (stat_.chain_count == 0u) {
     return true;
   }
+  uint64_t start_time = GetSystemClock();
   LRUCache cache(cache_stat_.cache_size, cache_stat_.matched_node_count_to_extend_callchain);
-  std::unique_ptr<FILE, decltype(&fclose)> tmp_fp(CreateTempFp(), fclose);
-  if (!tmp_fp) {
-    return false;
-  }
-  joined_chains_fp_ = CreateTempFp();
-  if (joined_chains_fp_ == nullptr) {
-    return false;
-  }
+  std::unique_ptr<CallChainStore> tmp_chains(new CallChainStore(memory_budget_, &memory_used_));
+  joined_chains_.reset(new CallChainStore(memory_budget_, &memory_used_));
   pid_t pid;
   pid_t tid;
   ChainType type;
   std::vector<uint64_t> ips;
   std::vector<uint64_t> sps;
-  if (fseek(original_chains_fp_, 0, SEEK_END) != 0) {
-    PLOG(ERROR) << "fseek";
+  if (!original_chains_->Seek(0, SEEK_END)) {
     return false;
   }
-  std::vector<std::pair<FILE*, FILE*>> file_pairs = {
-      std::make_pair(original_chains_fp_, tmp_fp.get()),
-      std::make_pair(tmp_fp.get(), joined_chains_fp_)
+  bool joined_in_memory = original_chains_->InMemory();
+  std::vector<std::pair<CallChainStore*, CallChainStore*>> store_pairs = {
+      std::make_pair(original_chains_.get(), tmp_chains.get()),
+      std::make_pair(tmp_chains.get(), joined_chains_.get())
   };
   for (size_t pass = 0; pass < 2u; ++pass) {
-    auto& pair = file_pairs[pass];
+    auto& pair = store_pairs[pass];
     for (size_t i = 0; i < stat_.chain_count; ++i) {
       if (!ReadCallChainInReverseOrder(pair.first, pid, tid, type, ips, sps)) {
         return false;
@@ -376,8 +432,15 @@ bool CallChainJoiner::JoinCallChains() {
         return false;
       }
     }
+    joined_in_memory = joined_in_memory && pair.second->InMemory();
+    if (pass == 0u && !keep_original_callchains_) {
+      // Original chains are no longer needed, release their memory for joined chains.
+      original_chains_.reset();
+    }
   }
   cache_stat_ = cache.Stat();
+  stat_.join_time_in_ns = GetSystemClock() - start_time;
+  stat_.joined_in_memory = joined_in_memory;
   return true;
 }
 
@@ -389,21 +452,20 @@ bool CallChainJoiner::GetNextCallChain(pid_t& pid, pid_t& tid, ChainType& type,
     return false;
   }
   if (next_chain_index_ == 0u) {
-    if (fseek(original_chains_fp_, 0, SEEK_SET) != 0 ||
-        fseek(joined_chains_fp_, 0, SEEK_SET) != 0) {
-      PLOG(ERROR) << "fseek";
+    if ((original_chains_ && !original_chains_->Seek(0, SEEK_SET)) ||
+        !joined_chains_->Seek(0, SEEK_SET)) {
       return false;
     }
   }
-  FILE* fp;
+  CallChainStore* store;
   if (keep_original_callchains_) {
-    fp = (next_chain_index_ & 1) ? joined_chains_fp_ : original_chains_fp_;
+    store = (next_chain_index_ & 1) ? joined_chains_.get() : original_chains_.get();
     next_chain_index_++;
   } else {
-    fp = joined_chains_fp_;
+    store = joined_chains_.get();
     next_chain_index_ += 2;
   }
-  return ReadCallChain(fp, pid, tid, type, ips, sps);
+  return ReadCallChain(store, pid, tid, type, ips, sps);
 }
 
 void CallChainJoiner::DumpStat() {
@@ -426,6 +488,11 @@ void CallChainJoiner::DumpStat() {
                << (stat_.after_join_node_count * 1.0 / stat_.chain_count);
   }
   LOG(DEBUG) << "  after_join_max_chain_length: " << stat_.after_join_max_chain_length;
+  LOG(DEBUG) << "  joined_in_memory: " << (stat_.joined_in_memory ? "true" : "false");
+  if (stat_.join_time_in_ns > 0u) {
+    LOG(DEBUG) << "  join_time: " << (stat_.join_time_in_ns / 1e6) << " ms, "
+               << (stat_.chain_count * 1e9 / stat_.join_time_in_ns) << " chains/s";
+  }
 }
 
 }  // namespace simpleperf
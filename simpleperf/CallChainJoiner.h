@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <memory>
 #include <unordered_set>
 #include <vector>
 
@@ -132,6 +133,33 @@ class LRUCache {
   LRUCacheStat cache_stat_;
 };
 
+// CallChainStore keeps serialized call chains for CallChainJoiner. Chains are kept in memory
+// while the memory used by all stores sharing [memory_used] is within [memory_budget]. Past the
+// budget, the store spills its data to a temporary file and continues there. It supports
+// fseek/fread like access, so chains can be read forward or backward.
+class CallChainStore {
+ public:
+  CallChainStore(size_t memory_budget, size_t* memory_used)
+      : memory_budget_(memory_budget), memory_used_(memory_used) {}
+  ~CallChainStore();
+
+  // Append data at the end of the store.
+  bool Write(const void* data, size_t size);
+  bool Read(void* data, size_t size);
+  // Same as fseek().
+  bool Seek(int64_t offset, int whence);
+  bool InMemory() const { return fp_ == nullptr; }
+
+ private:
+  bool SpillToFile();
+
+  const size_t memory_budget_;
+  size_t* memory_used_;
+  std::vector<char> data_;
+  size_t pos_ = 0;
+  FILE* fp_ = nullptr;
+};
+
 }  // namespace call_chain_joiner_impl
 
 // CallChainJoiner is used to join callchains of samples in the same thread, in order to get
@@ -143,9 +171,11 @@ class LRUCache {
 //   sample 2: (ip A, sp A) -> (ip B, sp B) -> (ip C, sp C) -> ...
 class CallChainJoiner {
  public:
-  // The parameters are used in LRUCache.
+  // cache_size and matched_node_count_to_extend_callchain are used in LRUCache.
+  // Call chains are kept in memory as long as they fit in memory_budget bytes, otherwise they are
+  // spilled to temporary files.
   CallChainJoiner(size_t cache_size, size_t matched_node_count_to_extend_callchain,
-                  bool keep_original_callchains);
+                  bool keep_original_callchains, size_t memory_budget = 0);
   ~CallChainJoiner();
 
   enum ChainType {
@@ -166,6 +196,9 @@ class CallChainJoiner {
     size_t before_join_node_count = 0u;
     size_t after_join_node_count = 0u;
     size_t after_join_max_chain_length = 0u;
+    uint64_t join_time_in_ns = 0u;
+    // Whether all chains are joined without spilling to temporary files.
+    bool joined_in_memory = false;
   };
   void DumpStat();
   const Stat& GetStat() {
@@ -178,8 +211,10 @@ class CallChainJoiner {
  private:
 
   bool keep_original_callchains_;
-  FILE* original_chains_fp_;
-  FILE* joined_chains_fp_;
+  size_t memory_budget_;
+  size_t memory_used_;
+  std::unique_ptr<call_chain_joiner_impl::CallChainStore> original_chains_;
+  std::unique_ptr<call_chain_joiner_impl::CallChainStore> joined_chains_;
   size_t next_chain_index_;
   call_chain_joiner_impl::LRUCacheStat cache_stat_;
   Stat stat_;
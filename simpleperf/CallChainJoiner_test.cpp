@@ -263,3 +263,38 @@ TEST_F(CallChainJoinerTest, no_chains) {
   ASSERT_FALSE(joiner.GetNextCallChain(pid, tid, type, ips, sps));
   joiner.DumpStat();
 }
+
+TEST_F(CallChainJoinerTest, memory_budget) {
+  // Chains are the same whether they are joined in memory, spilled to files in the middle, or
+  // kept in files.
+  std::vector<std::vector<uint64_t>> expected_chains;
+  for (size_t memory_budget : {static_cast<size_t>(1024 * 1024), static_cast<size_t>(500),
+                               static_cast<size_t>(0)}) {
+    CallChainJoiner joiner(sizeof(CacheNode) * 1024, 1, false, memory_budget);
+    for (pid_t pid = 0; pid < 10; ++pid) {
+      ASSERT_TRUE(joiner.AddCallChain(pid, pid, CallChainJoiner::ORIGINAL_OFFLINE,
+                                      {1, 2, 3}, {1, 2, 3}));
+      ASSERT_TRUE(joiner.AddCallChain(pid, pid, CallChainJoiner::ORIGINAL_OFFLINE,
+                                      {3, 4, 5}, {3, 4, 5}));
+    }
+    ASSERT_TRUE(joiner.JoinCallChains());
+    ASSERT_EQ(joiner.GetStat().joined_in_memory, memory_budget == 1024 * 1024);
+    pid_t pid;
+    pid_t tid;
+    CallChainJoiner::ChainType type;
+    std::vector<uint64_t> ips;
+    std::vector<uint64_t> sps;
+    std::vector<std::vector<uint64_t>> chains;
+    while (joiner.GetNextCallChain(pid, tid, type, ips, sps)) {
+      ASSERT_EQ(type, CallChainJoiner::JOINED_OFFLINE);
+      chains.push_back(ips);
+    }
+    ASSERT_EQ(chains.size(), 20u);
+    ASSERT_EQ(chains[0], std::vector<uint64_t>({1, 2, 3, 4, 5}));
+    if (expected_chains.empty()) {
+      expected_chains = chains;
+    } else {
+      ASSERT_EQ(chains, expected_chains);
+    }
+  }
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ColumnarSampleFile.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "utils.h"
+
+namespace simpleperf {
+
+// Integers are written in host byte order, which the format defines as little endian.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "columnar sample files are only written on little endian hosts");
+
+namespace {
+
+constexpr char COLUMNAR_FILE_MAGIC[8] = {'S', 'P', 'C', 'O', 'L', 'U', 'M', 'N'};
+// Version 2 adds meta flags and the app package name in META chunks, and mangled symbol names in
+// FILE chunks.
+constexpr uint32_t COLUMNAR_FILE_VERSION = 2;
+// Reject chunks larger than it, to avoid allocating huge buffers for corrupted files.
+constexpr uint64_t MAX_CHUNK_SIZE = 1ULL << 32;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct ChunkHeader {
+  uint32_t type;
+  uint32_t count;
+  uint64_t size;
+};
+
+template <class T>
+void AppendArray(std::vector<char>& payload, const T* data, size_t n) {
+  const char* p = reinterpret_cast<const char*>(data);
+  payload.insert(payload.end(), p, p + n * sizeof(T));
+}
+
+void AppendStringTable(std::vector<char>& payload, const std::vector<const char*>& strings) {
+  std::vector<uint32_t> offsets;
+  uint32_t offset = 0;
+  for (const char* s : strings) {
+    offsets.push_back(offset);
+    offset += strlen(s) + 1;
+  }
+  offsets.push_back(offset);
+  AppendArray(payload, offsets.data(), offsets.size());
+  for (const char* s : strings) {
+    AppendArray(payload, s, strlen(s) + 1);
+  }
+}
+
+}  // namespace
+
+ColumnarSampleWriter::ColumnarSampleWriter(FILE* fp, size_t samples_per_chunk)
+    : fp_(fp), samples_per_chunk_(std::max<size_t>(samples_per_chunk, 1)) {
+  callchain_offsets_.push_back(0);
+}
+
+bool ColumnarSampleWriter::WriteHeader(const ColumnarMetaInfo& meta_info) {
+  FileHeader header;
+  memcpy(header.magic, COLUMNAR_FILE_MAGIC, sizeof(header.magic));
+  header.version = COLUMNAR_FILE_VERSION;
+  header.reserved = 0;
+  if (fwrite(&header, sizeof(header), 1, fp_) != 1) {
+    PLOG(ERROR) << "failed to write columnar file header";
+    return false;
+  }
+  uint32_t fields[2] = {meta_info.trace_offcpu ? COLUMNAR_META_TRACE_OFFCPU : 0u, 0u};
+  std::vector<const char*> strings;
+  strings.push_back(meta_info.app_package_name.c_str());
+  for (auto& event_type : meta_info.event_types) {
+    strings.push_back(event_type.c_str());
+  }
+  std::vector<char> payload;
+  AppendArray(payload, fields, 2);
+  AppendStringTable(payload, strings);
+  return WriteChunk(COLUMNAR_CHUNK_META, meta_info.event_types.size(), payload);
+}
+
+bool ColumnarSampleWriter::AddSample(uint64_t time, uint64_t event_count, uint32_t tid,
+                                     uint32_t event_type_id,
+                                     const std::vector<ColumnarFrame>& callchain) {
+  times_.push_back(time);
+  event_counts_.push_back(event_count);
+  tids_.push_back(tid);
+  event_type_ids_.push_back(event_type_id);
+  for (const ColumnarFrame& frame : callchain) {
+    callchain_frames_.push_back(GetFrameId(frame));
+  }
+  callchain_offsets_.push_back(callchain_frames_.size());
+  if (times_.size() == samples_per_chunk_) {
+    return FlushSamples();
+  }
+  return true;
+}
+
+uint32_t ColumnarSampleWriter::GetFrameId(const ColumnarFrame& frame) {
+  auto it = frame_ids_.find(frame);
+  if (it != frame_ids_.end()) {
+    return it->second;
+  }
+  uint32_t id = frame_ids_.size();
+  frame_ids_.emplace(frame, id);
+  new_frames_.push_back(frame);
+  return id;
+}
+
+bool ColumnarSampleWriter::FlushSamples() {
+  if (!new_frames_.empty()) {
+    std::vector<char> payload;
+    for (auto& frame : new_frames_) {
+      AppendArray(payload, &frame.vaddr_in_file, 1);
+    }
+    for (auto& frame : new_frames_) {
+      AppendArray(payload, &frame.file_id, 1);
+    }
+    for (auto& frame : new_frames_) {
+      AppendArray(payload, &frame.symbol_id, 1);
+    }
+    if (!WriteChunk(COLUMNAR_CHUNK_FRAMES, new_frames_.size(), payload)) {
+      return false;
+    }
+    new_frames_.clear();
+  }
+  if (!times_.empty()) {
+    std::vector<char> payload;
+    AppendArray(payload, times_.data(), times_.size());
+    AppendArray(payload, event_counts_.data(), event_counts_.size());
+    AppendArray(payload, tids_.data(), tids_.size());
+    AppendArray(payload, event_type_ids_.data(), event_type_ids_.size());
+    AppendArray(payload, callchain_offsets_.data(), callchain_offsets_.size());
+    AppendArray(payload, callchain_frames_.data(), callchain_frames_.size());
+    if (!WriteChunk(COLUMNAR_CHUNK_SAMPLES, times_.size(), payload)) {
+      return false;
+    }
+    times_.clear();
+    event_counts_.clear();
+    tids_.clear();
+    event_type_ids_.clear();
+    callchain_offsets_.assign(1, 0);
+    callchain_frames_.clear();
+  }
+  return true;
+}
+
+bool ColumnarSampleWriter::WriteFile(const std::string& path,
+                                     const std::vector<ColumnarSymbol>& symbols) {
+  if (!FlushSamples()) {
+    return false;
+  }
+  std::vector<const char*> strings;
+  strings.push_back(path.c_str());
+  for (auto& symbol : symbols) {
+    strings.push_back(symbol.name.c_str());
+  }
+  for (auto& symbol : symbols) {
+    strings.push_back(symbol.mangled_name.c_str());
+  }
+  std::vector<char> payload;
+  AppendStringTable(payload, strings);
+  return WriteChunk(COLUMNAR_CHUNK_FILE, strings.size(), payload);
+}
+
+bool ColumnarSampleWriter::WriteThreads(const std::vector<ColumnarThread>& threads) {
+  if (!FlushSamples()) {
+    return false;
+  }
+  std::vector<char> payload;
+  for (auto& thread : threads) {
+    AppendArray(payload, &thread.tid, 1);
+  }
+  for (auto& thread : threads) {
+    AppendArray(payload, &thread.pid, 1);
+  }
+  std::vector<const char*> names;
+  for (auto& thread : threads) {
+    names.push_back(thread.name.c_str());
+  }
+  AppendStringTable(payload, names);
+  return WriteChunk(COLUMNAR_CHUNK_THREADS, threads.size(), payload);
+}
+
+bool ColumnarSampleWriter::WriteLostSituation(uint64_t sample_count, uint64_t lost_count) {
+  if (!FlushSamples()) {
+    return false;
+  }
+  std::vector<char> payload;
+  AppendArray(payload, &sample_count, 1);
+  AppendArray(payload, &lost_count, 1);
+  return WriteChunk(COLUMNAR_CHUNK_LOST, 0, payload);
+}
+
+bool ColumnarSampleWriter::Finish() {
+  if (!FlushSamples() || !WriteChunk(COLUMNAR_CHUNK_END, 0, {})) {
+    return false;
+  }
+  if (fflush(fp_) != 0) {
+    PLOG(ERROR) << "failed to write columnar file";
+    return false;
+  }
+  return true;
+}
+
+bool ColumnarSampleWriter::WriteChunk(uint32_t type, uint32_t count,
+                                      const std::vector<char>& payload) {
+  ChunkHeader header;
+  header.type = type;
+  header.count = count;
+  header.size = Align(payload.size(), 8);
+  static const char padding[8] = {};
+  size_t padding_size = header.size - payload.size();
+  if (fwrite(&header, sizeof(header), 1, fp_) != 1 ||
+      (!payload.empty() && fwrite(payload.data(), payload.size(), 1, fp_) != 1) ||
+      (padding_size != 0 && fwrite(padding, padding_size, 1, fp_) != 1)) {
+    PLOG(ERROR) << "failed to write columnar file";
+    return false;
+  }
+  return true;
+}
+
+bool ColumnarSampleReader::ReadHeader() {
+  FileHeader header;
+  if (fread(&header, sizeof(header), 1, fp_) != 1 ||
+      memcmp(header.magic, COLUMNAR_FILE_MAGIC, sizeof(header.magic)) != 0) {
+    LOG(ERROR) << "not a columnar sample file";
+    return false;
+  }
+  if (header.version != COLUMNAR_FILE_VERSION) {
+    LOG(ERROR) << "unsupported columnar sample file version " << header.version;
+    return false;
+  }
+  return true;
+}
+
+bool ColumnarSampleReader::ReadChunk(Chunk* chunk) {
+  ChunkHeader header;
+  if (fread(&header, sizeof(header), 1, fp_) != 1) {
+    LOG(ERROR) << "failed to read chunk header, the file may be truncated";
+    return false;
+  }
+  if (header.size % 8 != 0 || header.size > MAX_CHUNK_SIZE) {
+    LOG(ERROR) << "invalid chunk size " << header.size;
+    return false;
+  }
+  chunk->type = header.type;
+  chunk->count = header.count;
+  chunk->payload.resize(header.size);
+  if (header.size != 0 && fread(chunk->payload.data(), header.size, 1, fp_) != 1) {
+    LOG(ERROR) << "failed to read chunk payload, the file may be truncated";
+    return false;
+  }
+  return true;
+}
+
+bool ColumnarSampleReader::ParseStringTable(const char* data, size_t size, uint32_t count,
+                                            std::vector<const char*>* strings) {
+  uint64_t offsets_size = (static_cast<uint64_t>(count) + 1) * sizeof(uint32_t);
+  if (size < offsets_size) {
+    return false;
+  }
+  const uint32_t* offsets = reinterpret_cast<const uint32_t*>(data);
+  const char* string_data = data + offsets_size;
+  size_t string_size = size - offsets_size;
+  strings->clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (offsets[i] >= offsets[i + 1] || offsets[i + 1] > string_size ||
+        string_data[offsets[i + 1] - 1] != '\0') {
+      return false;
+    }
+    strings->push_back(string_data + offsets[i]);
+  }
+  return true;
+}
+
+bool ColumnarSampleReader::ParseFrames(const Chunk& chunk, std::vector<ColumnarFrame>* frames) {
+  size_t n = chunk.count;
+  if (chunk.payload.size() < n * (sizeof(uint64_t) + 2 * sizeof(uint32_t))) {
+    return false;
+  }
+  const char* p = chunk.payload.data();
+  frames->resize(n);
+  for (auto& frame : *frames) {
+    MoveFromBinaryFormat(frame.vaddr_in_file, p);
+  }
+  for (auto& frame : *frames) {
+    MoveFromBinaryFormat(frame.file_id, p);
+  }
+  for (auto& frame : *frames) {
+    MoveFromBinaryFormat(frame.symbol_id, p);
+  }
+  return true;
+}
+
+bool ColumnarSampleReader::ParseMetaInfo(const Chunk& chunk, MetaInfo* meta_info) {
+  constexpr size_t fields_size = 2 * sizeof(uint32_t);
+  std::vector<const char*> strings;
+  if (chunk.payload.size() < fields_size ||
+      !ParseStringTable(chunk.payload.data() + fields_size, chunk.payload.size() - fields_size,
+                        chunk.count + 1, &strings)) {
+    return false;
+  }
+  memcpy(&meta_info->flags, chunk.payload.data(), sizeof(meta_info->flags));
+  meta_info->app_package_name = strings[0];
+  meta_info->event_types.assign(strings.begin() + 1, strings.end());
+  return true;
+}
+
+bool ColumnarSampleReader::ParseFile(const Chunk& chunk, File* file) {
+  std::vector<const char*> strings;
+  if (chunk.count % 2 != 1 ||
+      !ParseStringTable(chunk.payload.data(), chunk.payload.size(), chunk.count, &strings)) {
+    return false;
+  }
+  size_t symbol_count = chunk.count / 2;
+  file->path = strings[0];
+  file->symbols.assign(strings.begin() + 1, strings.begin() + 1 + symbol_count);
+  file->mangled_symbols.assign(strings.begin() + 1 + symbol_count, strings.end());
+  return true;
+}
+
+bool ColumnarSampleReader::ParseSamples(const Chunk& chunk, Samples* samples) {
+  uint64_t n = chunk.count;
+  uint64_t fixed_size = n * (2 * sizeof(uint64_t) + 3 * sizeof(uint32_t)) + sizeof(uint32_t);
+  if (chunk.payload.size() < fixed_size) {
+    return false;
+  }
+  const char* p = chunk.payload.data();
+  samples->time = reinterpret_cast<const uint64_t*>(p);
+  samples->event_count = samples->time + n;
+  samples->tid = reinterpret_cast<const uint32_t*>(samples->event_count + n);
+  samples->event_type_id = samples->tid + n;
+  samples->callchain_offset = samples->event_type_id + n;
+  samples->frames = samples->callchain_offset + n + 1;
+  uint64_t frame_count = (chunk.payload.size() - fixed_size) / sizeof(uint32_t);
+  for (uint64_t i = 0; i < n; ++i) {
+    if (samples->callchain_offset[i] > samples->callchain_offset[i + 1]) {
+      return false;
+    }
+  }
+  return samples->callchain_offset[0] == 0 && samples->callchain_offset[n] <= frame_count;
+}
+
+}  // namespace simpleperf
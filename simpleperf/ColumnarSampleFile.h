@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace simpleperf {
+
+// The columnar sample file is an alternative output format of the report-sample command. It is
+// designed for exporting many samples: sample fields are stored in columns, and callchains refer
+// to an interned frame table, so readers can mmap the file and scan columns without decoding
+// each sample. All integers are little endian, which is the byte order of all hosts writing the
+// file.
+//
+// The file format is as below:
+//   char magic[8] = "SPCOLUMN";
+//   uint32_t version = 2;
+//   uint32_t reserved = 0;
+//   Chunk chunk_0;
+//   ...
+//   Chunk chunk_N;  // An END chunk.
+//
+// Each chunk is:
+//   uint32_t type;   // A ColumnarChunkType value.
+//   uint32_t count;  // Item count, meaning depends on the chunk type.
+//   uint64_t size;   // Payload size, a multiple of 8.
+//   char payload[size];
+// Payloads start at 8 byte aligned file offsets, and arrays in a payload are naturally aligned.
+//
+// A string table of n strings is stored as uint32_t offsets[n + 1] followed by the string data.
+// String i is at [offsets[i], offsets[i + 1]) of the string data, and is terminated by '\0'.
+//
+// Payloads of chunk types are:
+//   META: uint32_t flags, uint32_t reserved, string table of [count + 1] strings. The first
+//     string is the app package name, or empty if not known. Others are event type names, and
+//     samples refer to them by event_type_id. flags is a bitwise or of ColumnarMetaFlags.
+//   FRAMES: uint64_t vaddr_in_file[count], uint32_t file_id[count], int32_t symbol_id[count].
+//     Frames are numbered across all FRAMES chunks in file order. A FRAMES chunk always comes
+//     before SAMPLES chunks using its frames. symbol_id is -1 if the symbol isn't known.
+//   SAMPLES: uint64_t time[count], uint64_t event_count[count], uint32_t tid[count],
+//     uint32_t event_type_id[count], uint32_t callchain_offset[count + 1], uint32_t frames[].
+//     The callchain of sample i is frames[callchain_offset[i]..callchain_offset[i + 1]), from
+//     the sampled frame to its callers.
+//   FILE: string table of [count] strings, the first is the path of the file, followed by
+//     (count - 1) / 2 demangled symbol names in symbol_id order, and then the mangled names of
+//     the same symbols. The file id of the nth FILE chunk is n.
+//   THREADS: uint32_t tid[count], uint32_t pid[count], string table of [count] thread names.
+//   LOST: uint64_t sample_count, uint64_t lost_count.
+//   END: empty. Marks a complete file.
+enum ColumnarChunkType : uint32_t {
+  COLUMNAR_CHUNK_META = 1,
+  COLUMNAR_CHUNK_FRAMES = 2,
+  COLUMNAR_CHUNK_SAMPLES = 3,
+  COLUMNAR_CHUNK_FILE = 4,
+  COLUMNAR_CHUNK_THREADS = 5,
+  COLUMNAR_CHUNK_LOST = 6,
+  COLUMNAR_CHUNK_END = 7,
+};
+
+enum ColumnarMetaFlags : uint32_t {
+  // Samples are recorded with `simpleperf record --trace-offcpu`.
+  COLUMNAR_META_TRACE_OFFCPU = 1 << 0,
+};
+
+struct ColumnarMetaInfo {
+  std::vector<std::string> event_types;
+  std::string app_package_name;
+  bool trace_offcpu = false;
+};
+
+struct ColumnarSymbol {
+  std::string name;
+  std::string mangled_name;
+};
+
+struct ColumnarFrame {
+  uint32_t file_id;
+  int32_t symbol_id;
+  uint64_t vaddr_in_file;
+};
+
+struct ColumnarThread {
+  uint32_t tid;
+  uint32_t pid;
+  std::string name;
+};
+
+class ColumnarSampleWriter {
+ public:
+  // Samples are buffered, and written in one SAMPLES chunk for every [samples_per_chunk]
+  // samples.
+  explicit ColumnarSampleWriter(FILE* fp, size_t samples_per_chunk = 65536);
+
+  bool WriteHeader(const ColumnarMetaInfo& meta_info);
+  bool AddSample(uint64_t time, uint64_t event_count, uint32_t tid, uint32_t event_type_id,
+                 const std::vector<ColumnarFrame>& callchain);
+  // Below functions write remaining samples first. Files should be written in file id order.
+  bool WriteFile(const std::string& path, const std::vector<ColumnarSymbol>& symbols);
+  bool WriteThreads(const std::vector<ColumnarThread>& threads);
+  bool WriteLostSituation(uint64_t sample_count, uint64_t lost_count);
+  bool Finish();
+
+ private:
+  struct FrameHash {
+    size_t operator()(const ColumnarFrame& f) const {
+      return std::hash<uint64_t>()(f.vaddr_in_file) ^ (static_cast<size_t>(f.file_id) << 20) ^
+             static_cast<size_t>(f.symbol_id);
+    }
+  };
+  struct FrameEqual {
+    bool operator()(const ColumnarFrame& f1, const ColumnarFrame& f2) const {
+      return f1.vaddr_in_file == f2.vaddr_in_file && f1.file_id == f2.file_id &&
+             f1.symbol_id == f2.symbol_id;
+    }
+  };
+
+  uint32_t GetFrameId(const ColumnarFrame& frame);
+  bool FlushSamples();
+  bool WriteChunk(uint32_t type, uint32_t count, const std::vector<char>& payload);
+
+  FILE* fp_;
+  const size_t samples_per_chunk_;
+  std::unordered_map<ColumnarFrame, uint32_t, FrameHash, FrameEqual> frame_ids_;
+  // Frames not written yet.
+  std::vector<ColumnarFrame> new_frames_;
+  // Sample columns not written yet.
+  std::vector<uint64_t> times_;
+  std::vector<uint64_t> event_counts_;
+  std::vector<uint32_t> tids_;
+  std::vector<uint32_t> event_type_ids_;
+  std::vector<uint32_t> callchain_offsets_;
+  std::vector<uint32_t> callchain_frames_;
+
+  DISALLOW_COPY_AND_ASSIGN(ColumnarSampleWriter);
+};
+
+// ColumnarSampleReader reads a columnar sample file chunk by chunk.
+class ColumnarSampleReader {
+ public:
+  struct Chunk {
+    uint32_t type;
+    uint32_t count;
+    std::vector<char> payload;
+  };
+
+  explicit ColumnarSampleReader(FILE* fp) : fp_(fp) {}
+
+  bool ReadHeader();
+  // Return false on error. Check chunk->type for COLUMNAR_CHUNK_END.
+  bool ReadChunk(Chunk* chunk);
+
+  // Helpers decoding chunk payloads. They check the payload size, and return false if the
+  // payload is invalid.
+  static bool ParseStringTable(const char* data, size_t size, uint32_t count,
+                               std::vector<const char*>* strings);
+  static bool ParseFrames(const Chunk& chunk, std::vector<ColumnarFrame>* frames);
+
+  // Contents of a META chunk. Pointers refer to the chunk payload.
+  struct MetaInfo {
+    uint32_t flags;
+    const char* app_package_name;
+    std::vector<const char*> event_types;
+  };
+  static bool ParseMetaInfo(const Chunk& chunk, MetaInfo* meta_info);
+
+  // Contents of a FILE chunk. Pointers refer to the chunk payload.
+  struct File {
+    const char* path;
+    std::vector<const char*> symbols;
+    std::vector<const char*> mangled_symbols;
+  };
+  static bool ParseFile(const Chunk& chunk, File* file);
+
+  // Columns of a SAMPLES chunk. Pointers refer to the chunk payload.
+  struct Samples {
+    const uint64_t* time;
+    const uint64_t* event_count;
+    const uint32_t* tid;
+    const uint32_t* event_type_id;
+    const uint32_t* callchain_offset;
+    const uint32_t* frames;
+  };
+  static bool ParseSamples(const Chunk& chunk, Samples* samples);
+
+ private:
+  FILE* fp_;
+
+  DISALLOW_COPY_AND_ASSIGN(ColumnarSampleReader);
+};
+
+}  // namespace simpleperf
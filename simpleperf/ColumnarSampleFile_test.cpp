@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ColumnarSampleFile.h"
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+using namespace simpleperf;
+
+TEST(ColumnarSampleFile, write_and_read) {
+  TemporaryFile tmpfile;
+  std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(tmpfile.path, "wb"), fclose);
+  ASSERT_TRUE(fp);
+  // Use a small chunk size to write samples in multiple chunks.
+  ColumnarSampleWriter writer(fp.get(), 2);
+  ColumnarMetaInfo meta_info;
+  meta_info.event_types = {"cpu-cycles", "cpu-clock"};
+  meta_info.app_package_name = "com.example.app";
+  meta_info.trace_offcpu = true;
+  ASSERT_TRUE(writer.WriteHeader(meta_info));
+  std::vector<ColumnarFrame> callchain1 = {{0, 0, 0x100}, {1, -1, 0x200}};
+  std::vector<ColumnarFrame> callchain2 = {{1, -1, 0x200}};
+  ASSERT_TRUE(writer.AddSample(1000, 10, 1, 0, callchain1));
+  ASSERT_TRUE(writer.AddSample(2000, 20, 2, 1, callchain2));
+  ASSERT_TRUE(writer.AddSample(3000, 30, 1, 0, callchain1));
+  ASSERT_TRUE(writer.WriteFile("/system/lib64/libc.so", {{"test::foo()", "_ZN4test3fooEv"}}));
+  ASSERT_TRUE(writer.WriteFile("/system/lib64/libm.so", {}));
+  ASSERT_TRUE(writer.WriteThreads({{1, 1, "main"}, {2, 1, "worker"}}));
+  ASSERT_TRUE(writer.WriteLostSituation(3, 0));
+  ASSERT_TRUE(writer.Finish());
+  fp.reset(fopen(tmpfile.path, "rb"));
+  ASSERT_TRUE(fp);
+
+  ColumnarSampleReader reader(fp.get());
+  ASSERT_TRUE(reader.ReadHeader());
+  ColumnarSampleReader::Chunk chunk;
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_META);
+  ColumnarSampleReader::MetaInfo read_meta_info;
+  ASSERT_TRUE(ColumnarSampleReader::ParseMetaInfo(chunk, &read_meta_info));
+  ASSERT_EQ(read_meta_info.flags, COLUMNAR_META_TRACE_OFFCPU);
+  ASSERT_STREQ(read_meta_info.app_package_name, "com.example.app");
+  ASSERT_EQ(read_meta_info.event_types.size(), 2u);
+  ASSERT_STREQ(read_meta_info.event_types[1], "cpu-clock");
+
+  // Frames used by the first two samples are interned.
+  std::vector<ColumnarFrame> frames;
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_FRAMES);
+  ASSERT_TRUE(ColumnarSampleReader::ParseFrames(chunk, &frames));
+  ASSERT_EQ(frames.size(), 2u);
+  ASSERT_EQ(frames[1].file_id, 1u);
+  ASSERT_EQ(frames[1].symbol_id, -1);
+  ASSERT_EQ(frames[1].vaddr_in_file, 0x200u);
+
+  ColumnarSampleReader::Samples samples;
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_SAMPLES);
+  ASSERT_EQ(chunk.count, 2u);
+  ASSERT_TRUE(ColumnarSampleReader::ParseSamples(chunk, &samples));
+  ASSERT_EQ(samples.time[1], 2000u);
+  ASSERT_EQ(samples.event_count[1], 20u);
+  ASSERT_EQ(samples.tid[1], 2u);
+  ASSERT_EQ(samples.event_type_id[1], 1u);
+  ASSERT_EQ(samples.callchain_offset[1], 2u);
+  ASSERT_EQ(samples.callchain_offset[2], 3u);
+  ASSERT_EQ(samples.frames[2], 1u);
+
+  // The third sample doesn't add new frames.
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_SAMPLES);
+  ASSERT_EQ(chunk.count, 1u);
+  ASSERT_TRUE(ColumnarSampleReader::ParseSamples(chunk, &samples));
+  ASSERT_EQ(samples.time[0], 3000u);
+  ASSERT_EQ(samples.callchain_offset[1], 2u);
+  ASSERT_EQ(samples.frames[0], 0u);
+
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_FILE);
+  ColumnarSampleReader::File file;
+  ASSERT_TRUE(ColumnarSampleReader::ParseFile(chunk, &file));
+  ASSERT_STREQ(file.path, "/system/lib64/libc.so");
+  ASSERT_EQ(file.symbols.size(), 1u);
+  ASSERT_STREQ(file.symbols[0], "test::foo()");
+  ASSERT_EQ(file.mangled_symbols.size(), 1u);
+  ASSERT_STREQ(file.mangled_symbols[0], "_ZN4test3fooEv");
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_FILE);
+  ASSERT_EQ(chunk.count, 1u);
+  ASSERT_TRUE(ColumnarSampleReader::ParseFile(chunk, &file));
+  ASSERT_TRUE(file.symbols.empty());
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_THREADS);
+  ASSERT_EQ(chunk.count, 2u);
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_LOST);
+  ASSERT_TRUE(reader.ReadChunk(&chunk));
+  ASSERT_EQ(chunk.type, COLUMNAR_CHUNK_END);
+  // Payloads are 8 byte aligned.
+  ASSERT_EQ(ftell(fp.get()) % 8, 0);
+}
+
+TEST(ColumnarSampleFile, reject_invalid_file) {
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(android::base::WriteStringToFile("SIMPLEPERF", tmpfile.path));
+  std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(tmpfile.path, "rb"), fclose);
+  ColumnarSampleReader reader(fp.get());
+  ASSERT_FALSE(reader.ReadHeader());
+
+  const char bad_table[] = {1, 0, 0, 0, 0, 0, 0, 0, 'a', '\0'};
+  std::vector<const char*> strings;
+  ASSERT_FALSE(ColumnarSampleReader::ParseStringTable(bad_table, sizeof(bad_table), 1, &strings));
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorder.h"
+
+#include <string.h>
+
+#include "perf_event.h"
+#include "record.h"
+
+namespace simpleperf {
+
+FlightRecorder::FlightRecorder(uint64_t window_in_ns, size_t sample_buffer_size,
+                               size_t other_record_buffer_size)
+    : window_in_ns_(window_in_ns),
+      other_record_buffer_size_(other_record_buffer_size),
+      sample_buffer_(sample_buffer_size) {}
+
+void FlightRecorder::AddRecord(const char* data, uint64_t time) {
+  // Records generated by simpleperf (like kernel symbols) can be bigger than 64K, so use the
+  // size in RecordHeader instead of perf_event_header.
+  RecordHeader header(data);
+  if (header.type == PERF_RECORD_SAMPLE) {
+    AddSample(data, header.size, time);
+  } else {
+    AddOtherRecord(data, header.size);
+  }
+}
+
+void FlightRecorder::PinRecords() {
+  pinned_records_.insert(pinned_records_.end(), other_records_.begin() + other_records_start_,
+                         other_records_.end());
+  pinned_record_seqs_.insert(pinned_record_seqs_.end(), other_record_seqs_.begin(),
+                             other_record_seqs_.end());
+  other_records_.clear();
+  other_records_start_ = 0;
+  other_record_seqs_.clear();
+}
+
+void FlightRecorder::AddOtherRecord(const char* data, size_t size) {
+  if (size > other_record_buffer_size_) {
+    dropped_other_records_++;
+    return;
+  }
+  // Drop the oldest records until there is room.
+  while (other_records_.size() - other_records_start_ + size > other_record_buffer_size_) {
+    other_records_start_ += RecordHeader(other_records_.data() + other_records_start_).size;
+    other_record_seqs_.pop_front();
+    dropped_other_records_++;
+  }
+  if (other_records_start_ > other_records_.size() / 2) {
+    other_records_.erase(other_records_.begin(), other_records_.begin() + other_records_start_);
+    other_records_start_ = 0;
+  }
+  other_records_.insert(other_records_.end(), data, data + size);
+  other_record_seqs_.push_back(next_seq_++);
+}
+
+void FlightRecorder::AddSample(const char* data, size_t size, uint64_t time) {
+  // Drop samples out of the window.
+  while (!samples_.empty() && samples_.front().time + window_in_ns_ < time) {
+    samples_.pop_front();
+  }
+  if (size > sample_buffer_.size()) {
+    dropped_samples_++;
+    return;
+  }
+  if (samples_.empty()) {
+    sample_write_pos_ = 0;
+  }
+  size_t pos = sample_write_pos_;
+  if (pos + size > sample_buffer_.size()) {
+    // Wrap to the start of the buffer. Samples after pos are the oldest ones, drop them first.
+    while (!samples_.empty() && samples_.front().pos >= pos) {
+      samples_.pop_front();
+      dropped_samples_++;
+    }
+    pos = 0;
+  }
+  // Samples overlapping with [pos, pos + size) are the oldest ones, and are ordered by pos.
+  while (!samples_.empty() && samples_.front().pos >= pos && samples_.front().pos < pos + size) {
+    samples_.pop_front();
+    dropped_samples_++;
+  }
+  memcpy(sample_buffer_.data() + pos, data, size);
+  samples_.push_back(SampleEntry{next_seq_++, time, pos, size});
+  sample_write_pos_ = pos + size;
+}
+
+bool FlightRecorder::ForEachRecord(const std::function<bool(const char*)>& callback) const {
+  const char* pinned_record = pinned_records_.data();
+  auto pinned_seq_it = pinned_record_seqs_.begin();
+  const char* other_record = other_records_.data() + other_records_start_;
+  auto seq_it = other_record_seqs_.begin();
+  auto sample_it = samples_.begin();
+  while (true) {
+    uint64_t pinned_seq =
+        pinned_seq_it != pinned_record_seqs_.end() ? *pinned_seq_it : UINT64_MAX;
+    uint64_t other_seq = seq_it != other_record_seqs_.end() ? *seq_it : UINT64_MAX;
+    uint64_t sample_seq = sample_it != samples_.end() ? sample_it->seq : UINT64_MAX;
+    if (pinned_seq == UINT64_MAX && other_seq == UINT64_MAX && sample_seq == UINT64_MAX) {
+      break;
+    }
+    if (pinned_seq < other_seq && pinned_seq < sample_seq) {
+      if (!callback(pinned_record)) {
+        return false;
+      }
+      pinned_record += RecordHeader(pinned_record).size;
+      ++pinned_seq_it;
+    } else if (other_seq < sample_seq) {
+      if (!callback(other_record)) {
+        return false;
+      }
+      other_record += RecordHeader(other_record).size;
+      ++seq_it;
+    } else {
+      if (!callback(sample_buffer_.data() + sample_it->pos)) {
+        return false;
+      }
+      ++sample_it;
+    }
+  }
+  return true;
+}
+
+}  // namespace simpleperf
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace simpleperf {
+
+// FlightRecorder keeps records in memory for the flight recorder mode of the record command, so
+// recording doesn't write files until a dump is requested.
+// Sample records are kept in a circular buffer of fixed size, and only samples in the last
+// [window_in_ns] are kept. Other records (like mmap, comm and fork records) are needed to report
+// any sample, so they are kept regardless of time. They are much less than samples for most
+// workloads, but are still limited to [other_record_buffer_size] bytes, over which the oldest
+// ones are dropped. Records pinned by PinRecords() (like kernel symbols and maps dumped before
+// recording starts) are never dropped.
+class FlightRecorder {
+ public:
+  FlightRecorder(uint64_t window_in_ns, size_t sample_buffer_size,
+                 size_t other_record_buffer_size);
+
+  // Add a record. [data] starts with a perf_event_header. [time] is the timestamp of the record,
+  // or 0 if not available.
+  void AddRecord(const char* data, uint64_t time);
+  // Keep all non-sample records added so far, even when the buffer for non-sample records is full.
+  // Pinned records don't count in [other_record_buffer_size].
+  void PinRecords();
+
+  // Call [callback] for each kept record, in the order they are added.
+  bool ForEachRecord(const std::function<bool(const char*)>& callback) const;
+
+  size_t SampleCount() const { return samples_.size(); }
+  // Return count of samples dropped before leaving the window, because the buffer is full.
+  size_t DroppedSampleCount() const { return dropped_samples_; }
+  // Return count of non-sample records dropped because their buffer is full.
+  size_t DroppedOtherRecordCount() const { return dropped_other_records_; }
+
+ private:
+  struct SampleEntry {
+    uint64_t seq;
+    uint64_t time;
+    size_t pos;
+    size_t size;
+  };
+
+  void AddSample(const char* data, size_t size, uint64_t time);
+  void AddOtherRecord(const char* data, size_t size);
+
+  const uint64_t window_in_ns_;
+  // Sequence number of the next record, used to output records in the order they are added.
+  uint64_t next_seq_ = 0;
+
+  // Non-sample records stored one after another from other_records_start_, and their sequence
+  // numbers. Dropped records before other_records_start_ are erased when they take more than
+  // half of other_records_.
+  const size_t other_record_buffer_size_;
+  std::vector<char> pinned_records_;
+  std::vector<uint64_t> pinned_record_seqs_;
+  std::vector<char> other_records_;
+  size_t other_records_start_ = 0;
+  std::deque<uint64_t> other_record_seqs_;
+  size_t dropped_other_records_ = 0;
+
+  // Sample records in sample_buffer_, from the oldest to the latest. Live samples occupy a
+  // circular range ending at sample_write_pos_.
+  std::vector<char> sample_buffer_;
+  std::deque<SampleEntry> samples_;
+  size_t sample_write_pos_ = 0;
+  size_t dropped_samples_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(FlightRecorder);
+};
+
+}  // namespace simpleperf
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorder.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "perf_event.h"
+#include "record.h"
+
+using namespace simpleperf;
+
+// Build a record of [size] bytes, with [id] stored after the header.
+static std::vector<char> BuildRecord(uint32_t type, uint16_t size, uint32_t id) {
+  std::vector<char> data(size, 0);
+  perf_event_header header;
+  header.type = type;
+  header.misc = 0;
+  header.size = size;
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(data.data() + sizeof(header), &id, sizeof(id));
+  return data;
+}
+
+static std::vector<std::pair<uint32_t, uint32_t>> GetRecords(const FlightRecorder& recorder) {
+  std::vector<std::pair<uint32_t, uint32_t>> records;
+  recorder.ForEachRecord([&](const char* data) {
+    perf_event_header header;
+    memcpy(&header, data, sizeof(header));
+    uint32_t id;
+    memcpy(&id, data + sizeof(header), sizeof(id));
+    records.emplace_back(header.type, id);
+    return true;
+  });
+  return records;
+}
+
+TEST(FlightRecorder, keep_records_in_order) {
+  FlightRecorder recorder(1000, 1024, 1024);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, 1).data(), 0);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 2).data(), 100);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_COMM, 40, 3).data(), 0);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 4).data(), 200);
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {PERF_RECORD_MMAP, 1}, {PERF_RECORD_SAMPLE, 2}, {PERF_RECORD_COMM, 3},
+      {PERF_RECORD_SAMPLE, 4}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+}
+
+TEST(FlightRecorder, drop_samples_out_of_window) {
+  FlightRecorder recorder(1000, 1024, 1024);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, 1).data(), 0);
+  for (uint32_t i = 0; i < 5; ++i) {
+    recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 2 + i).data(), 400 * i + 1);
+  }
+  // Samples at time 1 and 401 are older than 1000ns before the last sample at time 1601.
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {PERF_RECORD_MMAP, 1}, {PERF_RECORD_SAMPLE, 4}, {PERF_RECORD_SAMPLE, 5},
+      {PERF_RECORD_SAMPLE, 6}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+  ASSERT_EQ(recorder.DroppedSampleCount(), 0u);
+}
+
+TEST(FlightRecorder, drop_oldest_samples_when_buffer_is_full) {
+  FlightRecorder recorder(1000000, 100, 1024);
+  for (uint32_t i = 0; i < 10; ++i) {
+    recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, i).data(), i + 1);
+  }
+  // At most 3 samples fit in the buffer.
+  ASSERT_EQ(recorder.SampleCount(), 3u);
+  ASSERT_EQ(recorder.DroppedSampleCount(), 7u);
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {PERF_RECORD_SAMPLE, 7}, {PERF_RECORD_SAMPLE, 8}, {PERF_RECORD_SAMPLE, 9}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+
+  // A sample bigger than the buffer is dropped.
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 128, 10).data(), 11);
+  ASSERT_EQ(recorder.SampleCount(), 3u);
+  ASSERT_EQ(recorder.DroppedSampleCount(), 8u);
+}
+
+TEST(FlightRecorder, keep_records_bigger_than_64k) {
+  FlightRecorder recorder(1000, 1024, 1024 * 1024);
+  // Records generated by simpleperf store sizes in 32 bits.
+  uint32_t size = 100000;
+  std::vector<char> data(size, 0);
+  RecordHeader header;
+  header.type = SIMPLE_PERF_RECORD_KERNEL_SYMBOL;
+  header.size = size;
+  char* p = data.data();
+  header.MoveToBinaryFormat(p);
+  uint32_t id = 1;
+  memcpy(p, &id, sizeof(id));
+  recorder.AddRecord(data.data(), 0);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, 2).data(), 0);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 3).data(), 100);
+  std::vector<uint32_t> sizes;
+  ASSERT_TRUE(recorder.ForEachRecord([&](const char* data) {
+    sizes.push_back(RecordHeader(data).size);
+    return true;
+  }));
+  std::vector<uint32_t> expected_sizes = {size, 64, 32};
+  ASSERT_EQ(sizes, expected_sizes);
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {SIMPLE_PERF_RECORD_KERNEL_SYMBOL, 1}, {PERF_RECORD_MMAP, 2}, {PERF_RECORD_SAMPLE, 3}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+}
+
+TEST(FlightRecorder, drop_oldest_other_records_when_buffer_is_full) {
+  FlightRecorder recorder(1000, 1024, 200);
+  for (uint32_t i = 0; i < 10; ++i) {
+    recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, i).data(), 0);
+  }
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 10).data(), 100);
+  // At most 3 non-sample records fit in the buffer.
+  ASSERT_EQ(recorder.DroppedOtherRecordCount(), 7u);
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {PERF_RECORD_MMAP, 7}, {PERF_RECORD_MMAP, 8}, {PERF_RECORD_MMAP, 9},
+      {PERF_RECORD_SAMPLE, 10}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+
+  // A record bigger than the buffer is dropped.
+  recorder.AddRecord(BuildRecord(PERF_RECORD_COMM, 256, 11).data(), 0);
+  ASSERT_EQ(recorder.DroppedOtherRecordCount(), 8u);
+  ASSERT_EQ(GetRecords(recorder), expected);
+}
+
+TEST(FlightRecorder, keep_pinned_records_when_buffer_is_full) {
+  FlightRecorder recorder(1000, 1024, 200);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, 0).data(), 0);
+  recorder.AddRecord(BuildRecord(PERF_RECORD_COMM, 64, 1).data(), 0);
+  recorder.PinRecords();
+  recorder.AddRecord(BuildRecord(PERF_RECORD_SAMPLE, 32, 2).data(), 100);
+  for (uint32_t i = 3; i < 10; ++i) {
+    recorder.AddRecord(BuildRecord(PERF_RECORD_MMAP, 64, i).data(), 0);
+  }
+  // Pinned records don't take space in the buffer, which fits at most 3 non-sample records.
+  ASSERT_EQ(recorder.DroppedOtherRecordCount(), 4u);
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {PERF_RECORD_MMAP, 0}, {PERF_RECORD_COMM, 1}, {PERF_RECORD_SAMPLE, 2},
+      {PERF_RECORD_MMAP, 7}, {PERF_RECORD_MMAP, 8}, {PERF_RECORD_MMAP, 9}};
+  ASSERT_EQ(GetRecords(recorder), expected);
+}
@@ -16,88 +16,81 @@
 
 #include "IOEventLoop.h"
 
-#include <event2/event.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <atomic>
 
 #include <android-base/logging.h>
 
+enum IOEventType {
+  IO_EVENT_READ,
+  IO_EVENT_WRITE,
+  IO_EVENT_SIGNAL,
+  IO_EVENT_PERIODIC,
+};
+
 struct IOEvent {
   IOEventLoop* loop;
-  event* e;
+  IOEventType type;
+  // The fd to read or write, or the timerfd of a periodic event, or -1 for a signal event.
+  int fd;
+  int sig;
   timeval timeout;
   std::function<bool()> callback;
   bool enabled;
 
-  IOEvent(IOEventLoop* loop, const std::function<bool()>& callback)
-      : loop(loop), e(nullptr), timeout({}), callback(callback), enabled(false) {
+  IOEvent(IOEventLoop* loop, IOEventType type, int fd, const std::function<bool()>& callback)
+      : loop(loop), type(type), fd(fd), sig(0), timeout({}), callback(callback), enabled(false) {
   }
 
   ~IOEvent() {
-    if (e != nullptr) {
-      event_free(e);
+    if (type == IO_EVENT_PERIODIC && fd != -1) {
+      close(fd);
     }
   }
 };
 
-IOEventLoop::IOEventLoop()
-    : ebase_(nullptr), has_error_(false), use_precise_timer_(false), in_loop_(false) {}
+// Write ends of signal pipes used by signal handlers, indexed by signal number. A value of 0
+// means no pipe, otherwise it is the fd plus 1. If more than one IOEventLoop monitor the same
+// signal, the latest one receives it.
+static std::atomic<int> signal_pipe_write_fds[NSIG];
 
-IOEventLoop::~IOEventLoop() {
-  events_.clear();
-  if (ebase_ != nullptr) {
-    event_base_free(ebase_);
+static void SignalHandler(int sig) {
+  int fd = signal_pipe_write_fds[sig] - 1;
+  if (fd != -1) {
+    int saved_errno = errno;
+    uint8_t value = static_cast<uint8_t>(sig);
+    TEMP_FAILURE_RETRY(write(fd, &value, 1));
+    errno = saved_errno;
   }
 }
 
-bool IOEventLoop::UsePreciseTimer() {
-  if (ebase_ != nullptr) {
-    return false;  // Too late to set the flag.
-  }
-  use_precise_timer_ = true;
-  return true;
-}
+IOEventLoop::IOEventLoop()
+    : pollfds_changed_(true), signal_pipe_{-1, -1}, has_error_(false), in_loop_(false),
+      dispatching_(false) {}
 
-bool IOEventLoop::EnsureInit() {
-  if (ebase_ == nullptr) {
-    event_config* cfg = event_config_new();
-    if (cfg != nullptr) {
-      if (use_precise_timer_) {
-        event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
-      }
-      if (event_config_avoid_method(cfg, "epoll") != 0) {
-        LOG(ERROR) << "event_config_avoid_method";
-        return false;
-      }
-      ebase_ = event_base_new_with_config(cfg);
-      // perf event files support reporting available data via poll methods. However, it doesn't
-      // work well with epoll. Because perf_poll() in kernel/events/core.c uses a report and reset
-      // way to report poll events. If perf_poll() is called twice, it may return POLLIN for the
-      // first time, and no events for the second time. And epoll may call perf_poll() more than
-      // once to confirm events. A failed situation is below:
-      // When profiling SimpleperfExampleOfKotlin on Pixel device with `-g --duration 10`, the
-      // kernel fills up the buffer before we call epoll_ctl(EPOLL_CTL_ADD). Then the POLLIN event
-      // is returned when calling epoll_ctl(), while no events are returned when calling
-      // epoll_wait(). As a result, simpleperf doesn't receive any poll wakeup events.
-      if (strcmp(event_base_get_method(ebase_), "poll") != 0) {
-        LOG(ERROR) << "event_base_get_method isn't poll: " << event_base_get_method(ebase_);
-        return false;
-      }
-      event_config_free(cfg);
+IOEventLoop::~IOEventLoop() {
+  for (auto& pair : old_signal_actions_) {
+    int sig = pair.first;
+    if (signal_pipe_write_fds[sig] == signal_pipe_[1] + 1) {
+      sigaction(sig, &pair.second, nullptr);
+      signal_pipe_write_fds[sig] = 0;
     }
-    if (ebase_ == nullptr) {
-      LOG(ERROR) << "failed to create event_base";
-      return false;
+  }
+  events_.clear();
+  deleted_events_.clear();
+  for (int fd : signal_pipe_) {
+    if (fd != -1) {
+      close(fd);
     }
   }
-  return true;
 }
 
-void IOEventLoop::EventCallbackFn(int, int16_t, void* arg) {
-  IOEvent* e = static_cast<IOEvent*>(arg);
-  if (!e->callback()) {
-    e->loop->has_error_ = true;
-    e->loop->ExitLoop();
-  }
+bool IOEventLoop::UsePreciseTimer() {
+  return true;
 }
 
 static bool MakeFdNonBlocking(int fd) {
@@ -114,7 +107,7 @@ IOEventRef IOEventLoop::AddReadEvent(int fd,
   if (!MakeFdNonBlocking(fd)) {
     return nullptr;
   }
-  return AddEvent(fd, EV_READ | EV_PERSIST, nullptr, callback);
+  return AddEvent(std::unique_ptr<IOEvent>(new IOEvent(this, IO_EVENT_READ, fd, callback)));
 }
 
 IOEventRef IOEventLoop::AddWriteEvent(int fd,
@@ -122,12 +115,45 @@ IOEventRef IOEventLoop::AddWriteEvent(int fd,
   if (!MakeFdNonBlocking(fd)) {
     return nullptr;
   }
-  return AddEvent(fd, EV_WRITE | EV_PERSIST, nullptr, callback);
+  return AddEvent(std::unique_ptr<IOEvent>(new IOEvent(this, IO_EVENT_WRITE, fd, callback)));
+}
+
+bool IOEventLoop::EnsureSignalPipe() {
+  if (signal_pipe_[0] == -1) {
+    if (pipe2(signal_pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+      PLOG(ERROR) << "pipe2() failed";
+      signal_pipe_[0] = signal_pipe_[1] = -1;
+      return false;
+    }
+  }
+  return true;
 }
 
 bool IOEventLoop::AddSignalEvent(int sig,
                                  const std::function<bool()>& callback) {
-  return AddEvent(sig, EV_SIGNAL | EV_PERSIST, nullptr, callback) != nullptr;
+  if (sig <= 0 || sig >= NSIG || !EnsureSignalPipe()) {
+    return false;
+  }
+  bool handled = false;
+  for (auto& pair : old_signal_actions_) {
+    handled |= pair.first == sig;
+  }
+  if (!handled) {
+    struct sigaction act = {};
+    act.sa_handler = SignalHandler;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    struct sigaction old_act;
+    if (sigaction(sig, &act, &old_act) != 0) {
+      PLOG(ERROR) << "sigaction() failed";
+      return false;
+    }
+    old_signal_actions_.emplace_back(sig, old_act);
+  }
+  signal_pipe_write_fds[sig] = signal_pipe_[1] + 1;
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IO_EVENT_SIGNAL, -1, callback));
+  e->sig = sig;
+  return AddEvent(std::move(e)) != nullptr;
 }
 
 bool IOEventLoop::AddSignalEvents(std::vector<int> sigs,
@@ -140,77 +166,192 @@ bool IOEventLoop::AddSignalEvents(std::vector<int> sigs,
   return true;
 }
 
-IOEventRef IOEventLoop::AddPeriodicEvent(timeval duration, const std::function<bool()>& callback) {
-  return AddEvent(-1, EV_PERSIST, &duration, callback);
+static bool SetTimer(int timer_fd, const timeval* duration) {
+  itimerspec spec = {};
+  if (duration != nullptr) {
+    spec.it_interval.tv_sec = duration->tv_sec;
+    spec.it_interval.tv_nsec = duration->tv_usec * 1000;
+    if (spec.it_interval.tv_sec == 0 && spec.it_interval.tv_nsec == 0) {
+      // A zero it_value disarms the timer.
+      spec.it_interval.tv_nsec = 1;
+    }
+    spec.it_value = spec.it_interval;
+  }
+  if (timerfd_settime(timer_fd, 0, &spec, nullptr) != 0) {
+    PLOG(ERROR) << "timerfd_settime() failed";
+    return false;
+  }
+  return true;
 }
 
-IOEventRef IOEventLoop::AddEvent(int fd_or_sig, int16_t events, timeval* timeout,
-                                 const std::function<bool()>& callback) {
-  if (!EnsureInit()) {
-    return nullptr;
-  }
-  std::unique_ptr<IOEvent> e(new IOEvent(this, callback));
-  e->e = event_new(ebase_, fd_or_sig, events, EventCallbackFn, e.get());
-  if (e->e == nullptr) {
-    LOG(ERROR) << "event_new() failed";
+IOEventRef IOEventLoop::AddPeriodicEvent(timeval duration, const std::function<bool()>& callback) {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (timer_fd == -1) {
+    PLOG(ERROR) << "timerfd_create() failed";
     return nullptr;
   }
-  if (event_add(e->e, timeout) != 0) {
-    LOG(ERROR) << "event_add() failed";
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IO_EVENT_PERIODIC, timer_fd, callback));
+  e->timeout = duration;
+  return AddEvent(std::move(e));
+}
+
+IOEventRef IOEventLoop::AddEvent(std::unique_ptr<IOEvent> e) {
+  if (e->type == IO_EVENT_PERIODIC && !SetTimer(e->fd, &e->timeout)) {
     return nullptr;
   }
-  if (timeout != nullptr) {
-    e->timeout = *timeout;
-  }
   e->enabled = true;
+  pollfds_changed_ = true;
   events_.push_back(std::move(e));
   return events_.back().get();
 }
 
-bool IOEventLoop::RunLoop() {
-  in_loop_ = true;
-  if (event_base_dispatch(ebase_) == -1) {
-    LOG(ERROR) << "event_base_dispatch() failed";
-    in_loop_ = false;
-    return false;
+void IOEventLoop::UpdatePollFds() {
+  pollfds_.clear();
+  poll_events_.clear();
+  bool has_signal_event = false;
+  for (auto& e : events_) {
+    if (!e->enabled) {
+      continue;
+    }
+    if (e->type == IO_EVENT_SIGNAL) {
+      has_signal_event = true;
+      continue;
+    }
+    pollfd pfd;
+    pfd.fd = e->fd;
+    pfd.events = (e->type == IO_EVENT_WRITE) ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    pollfds_.push_back(pfd);
+    poll_events_.push_back(e.get());
   }
-  if (has_error_) {
-    return false;
+  if (has_signal_event) {
+    pollfd pfd;
+    pfd.fd = signal_pipe_[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    pollfds_.push_back(pfd);
+    poll_events_.push_back(nullptr);
   }
-  return true;
+  pollfds_changed_ = false;
 }
 
-bool IOEventLoop::ExitLoop() {
-  if (in_loop_) {
-    if (event_base_loopbreak(ebase_) == -1) {
-      LOG(ERROR) << "event_base_loopbreak() failed";
+void IOEventLoop::CollectSignalEvents() {
+  uint8_t sigs[64];
+  ssize_t n;
+  while ((n = TEMP_FAILURE_RETRY(read(signal_pipe_[0], sigs, sizeof(sigs)))) > 0) {
+    for (ssize_t i = 0; i < n; ++i) {
+      for (auto& e : events_) {
+        if (e->type == IO_EVENT_SIGNAL && e->sig == sigs[i]) {
+          ready_events_.push_back(e.get());
+        }
+      }
+    }
+  }
+}
+
+bool IOEventLoop::RunLoop() {
+  in_loop_ = true;
+  while (in_loop_) {
+    if (pollfds_changed_) {
+      UpdatePollFds();
+    }
+    if (pollfds_.empty()) {
+      // Nothing to wait for.
+      break;
+    }
+    // perf event files support reporting available data via poll methods. However, it doesn't
+    // work well with epoll. Because perf_poll() in kernel/events/core.c uses a report and reset
+    // way to report poll events. If perf_poll() is called twice, it may return POLLIN for the
+    // first time, and no events for the second time. And epoll may call perf_poll() more than
+    // once to confirm events. A failed situation is below:
+    // When profiling SimpleperfExampleOfKotlin on Pixel device with `-g --duration 10`, the
+    // kernel fills up the buffer before we call epoll_ctl(EPOLL_CTL_ADD). Then the POLLIN event
+    // is returned when calling epoll_ctl(), while no events are returned when calling
+    // epoll_wait(). As a result, simpleperf doesn't receive any poll wakeup events.
+    int result = poll(pollfds_.data(), pollfds_.size(), -1);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "poll() failed";
+      in_loop_ = false;
       return false;
     }
-    in_loop_ = false;
+    // Collect all ready events before calling callbacks, which may change pollfds_.
+    ready_events_.clear();
+    for (size_t i = 0; i < pollfds_.size() && result > 0; ++i) {
+      int16_t revents = pollfds_[i].revents;
+      if (revents == 0) {
+        continue;
+      }
+      result--;
+      IOEvent* e = poll_events_[i];
+      if (e == nullptr) {
+        CollectSignalEvents();
+      } else if (e->type == IO_EVENT_PERIODIC) {
+        uint64_t expirations;
+        if (read(e->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+          ready_events_.push_back(e);
+        }
+      } else {
+        // Like libevent, report errors to both read and write events, so they can find them
+        // when reading or writing.
+        int16_t wanted = (e->type == IO_EVENT_READ ? POLLIN : POLLOUT) | POLLERR | POLLHUP |
+            POLLNVAL;
+        if (revents & wanted) {
+          ready_events_.push_back(e);
+        }
+      }
+    }
+    dispatching_ = true;
+    for (IOEvent* e : ready_events_) {
+      // Stop when ExitLoop() is called. Skip events disabled or deleted by previous callbacks.
+      if (!in_loop_) {
+        break;
+      }
+      if (e->enabled && !e->callback()) {
+        has_error_ = true;
+        in_loop_ = false;
+      }
+    }
+    dispatching_ = false;
+    deleted_events_.clear();
   }
+  in_loop_ = false;
+  return !has_error_;
+}
+
+bool IOEventLoop::ExitLoop() {
+  in_loop_ = false;
   return true;
 }
 
 bool IOEventLoop::DisableEvent(IOEventRef ref) {
   if (ref->enabled) {
-    if (event_del(ref->e) != 0) {
-      LOG(ERROR) << "event_del() failed";
+    if (ref->type == IO_EVENT_PERIODIC && !SetTimer(ref->fd, nullptr)) {
       return false;
     }
     ref->enabled = false;
+    ref->loop->pollfds_changed_ = true;
   }
   return true;
 }
 
 bool IOEventLoop::EnableEvent(IOEventRef ref) {
   if (!ref->enabled) {
-    timeval* timeout = (ref->timeout.tv_sec != 0 || ref->timeout.tv_usec != 0) ?
-                        &ref->timeout : nullptr;
-    if (event_add(ref->e, timeout) != 0) {
-      LOG(ERROR) << "event_add() failed";
+    if (ref->type == IO_EVENT_PERIODIC && !SetTimer(ref->fd, &ref->timeout)) {
       return false;
     }
     ref->enabled = true;
+    ref->loop->pollfds_changed_ = true;
+  }
+  return true;
+}
+
+bool IOEventLoop::SetPeriodicEventDuration(IOEventRef ref, timeval duration) {
+  ref->timeout = duration;
+  if (ref->enabled) {
+    return SetTimer(ref->fd, &ref->timeout);
   }
   return true;
 }
@@ -220,6 +361,10 @@ bool IOEventLoop::DelEvent(IOEventRef ref) {
   IOEventLoop* loop = ref->loop;
   for (auto it = loop->events_.begin(); it != loop->events_.end(); ++it) {
     if (it->get() == ref) {
+      if (loop->dispatching_) {
+        // The event may be in ready_events_, or be running its callback.
+        loop->deleted_events_.push_back(std::move(*it));
+      }
       loop->events_.erase(it);
       break;
     }
@@ -17,26 +17,30 @@
 #ifndef SIMPLE_PERF_IOEVENT_LOOP_H_
 #define SIMPLE_PERF_IOEVENT_LOOP_H_
 
+#include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <time.h>
 
 #include <functional>
 #include <memory>
+#include <utility>
 #include <vector>
 
 struct IOEvent;
 typedef IOEvent* IOEventRef;
-struct event_base;
 
-// IOEventLoop is a class wrapper of libevent, it monitors events happened,
-// and calls the corresponding callbacks. Possible events are: file ready to
-// read, file ready to write, signal happens, periodic timer timeout.
+// IOEventLoop monitors events happened, and calls the corresponding callbacks. Possible events
+// are: file ready to read, file ready to write, signal happens, periodic timer timeout.
+// All events are waited for by one poll() call: periodic timers are timerfds, and signals are
+// written to a pipe by signal handlers. epoll isn't used, see the comment in RunLoop().
 class IOEventLoop {
  public:
   IOEventLoop();
   ~IOEventLoop();
 
-  // Use precise timer for periodic events which want precision in ms.
+  // Periodic events always use timerfds, which are precise in us. So this is a no-op kept for
+  // periodic events which want precision in ms.
   bool UsePreciseTimer();
 
   // Register a read Event, so [callback] is called when [fd] can be read
@@ -61,7 +65,7 @@ class IOEventLoop {
   IOEventRef AddPeriodicEvent(timeval duration, const std::function<bool()>& callback);
 
   // Run a loop polling for Events. It only exits when ExitLoop() is called
-  // in a callback function of registered Events.
+  // in a callback function of registered Events, or when no Events are enabled.
   bool RunLoop();
 
   // Exit the loop started by RunLoop().
@@ -72,20 +76,35 @@ class IOEventLoop {
   // Enable a disabled Event.
   static bool EnableEvent(IOEventRef ref);
 
+  // Change the duration of a periodic Event. If the Event is enabled, the next callback is
+  // called [duration] after now.
+  static bool SetPeriodicEventDuration(IOEventRef ref, timeval duration);
+
   // Unregister an Event.
   static bool DelEvent(IOEventRef ref);
 
  private:
-  bool EnsureInit();
-  IOEventRef AddEvent(int fd_or_sig, int16_t events, timeval* timeout,
-                      const std::function<bool()>& callback);
-  static void EventCallbackFn(int, int16_t, void*);
+  IOEventRef AddEvent(std::unique_ptr<IOEvent> e);
+  bool EnsureSignalPipe();
+  void UpdatePollFds();
+  void CollectSignalEvents();
 
-  event_base* ebase_;
   std::vector<std::unique_ptr<IOEvent>> events_;
+  // Events deleted by callbacks while dispatching events. They are freed after dispatching.
+  std::vector<std::unique_ptr<IOEvent>> deleted_events_;
+  // Fds passed to poll(). poll_events_[i] is the event of pollfds_[i], or nullptr for the read
+  // end of signal_pipe_. They are rebuilt when pollfds_changed_ is set.
+  std::vector<pollfd> pollfds_;
+  std::vector<IOEvent*> poll_events_;
+  bool pollfds_changed_;
+  // Events ready to call callbacks, collected from one poll() call.
+  std::vector<IOEvent*> ready_events_;
+  // Signal handlers write signal numbers to the pipe.
+  int signal_pipe_[2];
+  std::vector<std::pair<int, struct sigaction>> old_signal_actions_;
   bool has_error_;
-  bool use_precise_timer_;
   bool in_loop_;
+  bool dispatching_;
 };
 
 #endif  // SIMPLE_PERF_IOEVENT_LOOP_H_
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <event2/event.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "environment.h"
+#include "IOEventLoop.h"
+#include "utils.h"
+
+// The implementation used before replacing libevent in IOEventLoop: a libevent loop using the
+// poll backend. It only supports what the benchmarks below need.
+class LibeventLoop {
+ public:
+  explicit LibeventLoop(bool precise_timer) {
+    event_config* cfg = event_config_new();
+    CHECK(cfg != nullptr);
+    if (precise_timer) {
+      event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+    }
+    CHECK_EQ(event_config_avoid_method(cfg, "epoll"), 0);
+    base_ = event_base_new_with_config(cfg);
+    CHECK(base_ != nullptr);
+    event_config_free(cfg);
+  }
+
+  ~LibeventLoop() {
+    if (e_ != nullptr) {
+      event_free(e_);
+    }
+    event_base_free(base_);
+  }
+
+  void AddReadEvent(int fd, const std::function<bool()>& callback) {
+    AddEvent(fd, EV_READ | EV_PERSIST, nullptr, callback);
+  }
+
+  void AddPeriodicEvent(timeval duration, const std::function<bool()>& callback) {
+    AddEvent(-1, EV_PERSIST, &duration, callback);
+  }
+
+  void RunLoop() {
+    CHECK_EQ(event_base_dispatch(base_), 0);
+  }
+
+  void ExitLoop() {
+    CHECK_EQ(event_base_loopbreak(base_), 0);
+  }
+
+ private:
+  void AddEvent(int fd, int16_t events, timeval* timeout, const std::function<bool()>& callback) {
+    callback_ = callback;
+    e_ = event_new(base_, fd, events, EventCallbackFn, this);
+    CHECK(e_ != nullptr);
+    CHECK_EQ(event_add(e_, timeout), 0);
+  }
+
+  static void EventCallbackFn(int, int16_t, void* arg) {
+    LibeventLoop* loop = static_cast<LibeventLoop*>(arg);
+    if (!loop->callback_()) {
+      loop->ExitLoop();
+    }
+  }
+
+  event_base* base_;
+  event* e_ = nullptr;
+  std::function<bool()> callback_;
+};
+
+// Measure the time from writing a pipe in one thread to calling the read callback in the thread
+// running the loop, like a kernel wakeup of a perf event file.
+template <typename Loop>
+static void MeasureWakeupLatency(benchmark::State& state, Loop& loop) {
+  int data_pipe[2];
+  int ack_pipe[2];
+  CHECK_EQ(pipe(data_pipe), 0);
+  CHECK_EQ(pipe(ack_pipe), 0);
+  int data_fd = data_pipe[0];
+  int ack_fd = ack_pipe[1];
+  loop.AddReadEvent(data_fd, [&]() {
+    double start_time;
+    if (read(data_fd, &start_time, sizeof(start_time)) != sizeof(start_time)) {
+      loop.ExitLoop();
+      return true;
+    }
+    double latency = GetSystemClock() / 1e9 - start_time;
+    CHECK_EQ(write(ack_fd, &latency, sizeof(latency)), static_cast<ssize_t>(sizeof(latency)));
+    return true;
+  });
+  std::thread loop_thread([&]() { loop.RunLoop(); });
+  while (state.KeepRunning()) {
+    double start_time = GetSystemClock() / 1e9;
+    CHECK_EQ(write(data_pipe[1], &start_time, sizeof(start_time)),
+             static_cast<ssize_t>(sizeof(start_time)));
+    double latency;
+    CHECK_EQ(read(ack_pipe[0], &latency, sizeof(latency)), static_cast<ssize_t>(sizeof(latency)));
+    state.SetIterationTime(latency);
+  }
+  // Closing the write end makes the read callback see EOF and exit the loop.
+  close(data_pipe[1]);
+  loop_thread.join();
+  close(data_pipe[0]);
+  close(ack_pipe[0]);
+  close(ack_pipe[1]);
+}
+
+static void BM_Libevent_WakeupLatency(benchmark::State& state) {
+  LibeventLoop loop(false);
+  MeasureWakeupLatency(state, loop);
+}
+BENCHMARK(BM_Libevent_WakeupLatency)->UseManualTime();
+
+static void BM_IOEventLoop_WakeupLatency(benchmark::State& state) {
+  IOEventLoop loop;
+  MeasureWakeupLatency(state, loop);
+}
+BENCHMARK(BM_IOEventLoop_WakeupLatency)->UseManualTime();
+
+// Measure intervals of a periodic event of 1ms, as used by `simpleperf stat --interval`. Each
+// iteration waits for one tick, and reports the interval since the previous tick. So the closer
+// to 1ms the time is, the more precise the timer is.
+template <typename Loop>
+static void MeasurePeriodicInterval(benchmark::State& state, Loop& loop) {
+  double tick_time = 0;
+  loop.AddPeriodicEvent(SecondToTimeval(1e-3), [&]() {
+    tick_time = GetSystemClock() / 1e9;
+    loop.ExitLoop();
+    return true;
+  });
+  loop.RunLoop();
+  while (state.KeepRunning()) {
+    double prev_tick_time = tick_time;
+    loop.RunLoop();
+    state.SetIterationTime(tick_time - prev_tick_time);
+  }
+}
+
+static void BM_Libevent_PeriodicInterval(benchmark::State& state) {
+  LibeventLoop loop(true);
+  MeasurePeriodicInterval(state, loop);
+}
+BENCHMARK(BM_Libevent_PeriodicInterval)->UseManualTime();
+
+static void BM_IOEventLoop_PeriodicInterval(benchmark::State& state) {
+  IOEventLoop loop;
+  CHECK(loop.UsePreciseTimer());
+  MeasurePeriodicInterval(state, loop);
+}
+BENCHMARK(BM_IOEventLoop_PeriodicInterval)->UseManualTime();
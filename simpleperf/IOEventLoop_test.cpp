@@ -242,6 +242,32 @@ TEST(IOEventLoop, disable_enable_periodic_event) {
   ASSERT_EQ(2u, periodic_count);
 }
 
+TEST(IOEventLoop, set_periodic_event_duration) {
+  timeval tv;
+  tv.tv_sec = 0;
+  tv.tv_usec = 1000;
+  IOEventLoop loop;
+  size_t periodic_count = 0;
+  IOEventRef ref = loop.AddPeriodicEvent(tv, [&]() {
+    periodic_count++;
+    if (periodic_count == 2u) {
+      return loop.ExitLoop();
+    }
+    timeval new_tv;
+    new_tv.tv_sec = 0;
+    new_tv.tv_usec = 200000;
+    return IOEventLoop::SetPeriodicEventDuration(ref, new_tv);
+  });
+  ASSERT_TRUE(ref != nullptr);
+  auto start_time = std::chrono::steady_clock::now();
+  ASSERT_TRUE(loop.RunLoop());
+  auto end_time = std::chrono::steady_clock::now();
+  ASSERT_EQ(2u, periodic_count);
+  double time_used = std::chrono::duration_cast<std::chrono::duration<double>>(
+                         end_time - start_time).count();
+  ASSERT_GE(time_used, 0.2);
+}
+
 TEST(IOEventLoop, exit_before_loop) {
   IOEventLoop loop;
   ASSERT_TRUE(loop.ExitLoop());
@@ -41,13 +41,24 @@ namespace simpleperf {
 // remotely.
 static constexpr size_t MAX_JIT_SYMFILE_SIZE = 1024 * 1024u;
 
+// JIT symfiles are usually several KB. Stop adding them to the JIT symfile container when it
+// reaches the size, and dump the rest to temporary files.
+static constexpr uint64_t MAX_JIT_SYMFILE_CONTAINER_SIZE = 256 * 1024 * 1024u;
+
 // It takes about 30us-130us on Pixel (depending on the cpu frequency) to check if the descriptors
 // have been updated (most time spent in process_vm_preadv). We want to know if the JIT debug info
-// changed as soon as possible, while not wasting too much time checking for updates. So use a
-// period of 100 ms.
+// changed as soon as possible, while not wasting too much time checking for updates. So start
+// with a period of 100 ms. When descriptors change, halve the period (to at least 20 ms), so new
+// JIT methods are read before they are removed. When nothing changes, double the period (to at
+// most 800 ms), so idle apps cost less.
 // In system wide profiling, we may need to check JIT debug info changes for many processes, to
-// avoid spending all time checking, wait 100 ms between any two checks.
-static constexpr size_t kUpdateJITDebugInfoIntervalInMs = 100;
+// avoid spending all time checking, wait the period between any two checks.
+static constexpr uint64_t kUpdateJITDebugInfoIntervalInMs = 100;
+static constexpr uint64_t kMinUpdateJITDebugInfoIntervalInMs = 20;
+static constexpr uint64_t kMaxUpdateJITDebugInfoIntervalInMs = 800;
+
+// The max count of iovecs passed to one process_vm_readv() call (UIO_MAXIOV in the kernel).
+static constexpr size_t MAX_IOVS_PER_READ = 1024;
 
 // Match the format of JITDescriptor in art/runtime/jit/debugger_itnerface.cc.
 template <typename ADDRT>
@@ -119,10 +130,14 @@ static_assert(sizeof(JITCodeEntry32) == 32, "");
 #endif
 static_assert(sizeof(JITCodeEntry64) == 40, "");
 
+JITDebugReader::JITDebugReader(bool keep_symfiles, bool sync_with_records)
+    : keep_symfiles_(keep_symfiles), sync_with_records_(sync_with_records),
+      read_interval_in_ms_(kUpdateJITDebugInfoIntervalInMs) {}
+
 bool JITDebugReader::RegisterDebugInfoCallback(IOEventLoop* loop,
                                              const debug_info_callback_t& callback) {
   debug_info_callback_ = callback;
-  read_event_ = loop->AddPeriodicEvent(SecondToTimeval(kUpdateJITDebugInfoIntervalInMs / 1000.0),
+  read_event_ = loop->AddPeriodicEvent(SecondToTimeval(read_interval_in_ms_ / 1000.0),
                                        [this]() { return ReadAllProcesses(); });
   return (read_event_ != nullptr && IOEventLoop::DisableEvent(read_event_));
 }
@@ -164,18 +179,23 @@ bool JITDebugReader::UpdateRecord(const Record* record) {
     }
   } else if (record->type() == PERF_RECORD_SAMPLE) {
     auto r = static_cast<const SampleRecord*>(record);
-    auto it = pids_with_art_lib_.find(r->tid_data.pid);
-    if (it != pids_with_art_lib_.end() && !it->second) {
-      it->second = true;
-      if (!MonitorProcess(r->tid_data.pid)) {
-        return false;
-      }
-      return ReadProcess(r->tid_data.pid);
-    }
+    return UpdateSample(r->tid_data.pid, r->Timestamp());
   }
   return FlushDebugInfo(record->Timestamp());
 }
 
+bool JITDebugReader::UpdateSample(pid_t pid, uint64_t timestamp) {
+  auto it = pids_with_art_lib_.find(pid);
+  if (it != pids_with_art_lib_.end() && !it->second) {
+    it->second = true;
+    if (!MonitorProcess(pid)) {
+      return false;
+    }
+    return ReadProcess(pid);
+  }
+  return FlushDebugInfo(timestamp);
+}
+
 bool JITDebugReader::FlushDebugInfo(uint64_t timestamp) {
   if (sync_with_records_) {
     if (!debug_info_q_.empty() && debug_info_q_.top().timestamp < timestamp) {
@@ -195,9 +215,10 @@ bool JITDebugReader::ReadAllProcesses() {
     return false;
   }
   std::vector<JITDebugInfo> debug_info;
+  bool descriptors_changed = false;
   for (auto it = processes_.begin(); it != processes_.end();) {
     Process& process = it->second;
-    ReadProcess(process, &debug_info);
+    ReadProcess(process, &debug_info, &descriptors_changed);
     if (process.died) {
       LOG(DEBUG) << "Stop monitoring process " << process.pid;
       it = processes_.erase(it);
@@ -209,6 +230,17 @@ bool JITDebugReader::ReadAllProcesses() {
     return false;
   }
   if (!processes_.empty()) {
+    uint64_t interval_in_ms =
+        descriptors_changed
+            ? std::max(read_interval_in_ms_ / 2, kMinUpdateJITDebugInfoIntervalInMs)
+            : std::min(read_interval_in_ms_ * 2, kMaxUpdateJITDebugInfoIntervalInMs);
+    if (interval_in_ms != read_interval_in_ms_) {
+      read_interval_in_ms_ = interval_in_ms;
+      if (!IOEventLoop::SetPeriodicEventDuration(read_event_,
+                                                 SecondToTimeval(interval_in_ms / 1000.0))) {
+        return false;
+      }
+    }
     return IOEventLoop::EnableEvent(read_event_);
   }
   return true;
@@ -224,7 +256,8 @@ bool JITDebugReader::ReadProcess(pid_t pid) {
   return true;
 }
 
-void JITDebugReader::ReadProcess(Process& process, std::vector<JITDebugInfo>* debug_info) {
+void JITDebugReader::ReadProcess(Process& process, std::vector<JITDebugInfo>* debug_info,
+                                 bool* descriptors_changed) {
   if (process.died || (!process.initialized && !InitializeProcess(process))) {
     return;
   }
@@ -239,12 +272,23 @@ void JITDebugReader::ReadProcess(Process& process, std::vector<JITDebugInfo>* de
       dex_descriptor.action_seqlock == process.last_dex_descriptor.action_seqlock) {
     return;
   }
+  if (descriptors_changed != nullptr) {
+    *descriptors_changed = true;
+  }
 
   // 3. Read new symfiles.
-  auto check_descriptor = [&](Descriptor& descriptor, bool is_jit) {
+  auto check_descriptor = [&](Descriptor& descriptor, bool is_jit,
+                              const std::vector<CodeEntry>& new_entries) {
       Descriptor tmp_jit_descriptor;
       Descriptor tmp_dex_descriptor;
-      if (!ReadDescriptors(process, &tmp_jit_descriptor, &tmp_dex_descriptor)) {
+      // Symfiles of new JIT code entries are read before the descriptors, in the same
+      // process_vm_readv() call. So they are valid if the descriptor isn't changed.
+      if (is_jit) {
+        if (!ReadJITSymfilesAndDescriptors(process, new_entries, &tmp_jit_descriptor,
+                                           &tmp_dex_descriptor)) {
+          return false;
+        }
+      } else if (!ReadDescriptors(process, &tmp_jit_descriptor, &tmp_dex_descriptor)) {
         return false;
       }
       if (is_jit) {
@@ -271,7 +315,7 @@ void JITDebugReader::ReadProcess(Process& process, std::vector<JITDebugInfo>* de
       return false;
     }
     // Check if the descriptor was changed while we were reading new entries.
-    if (!check_descriptor(new_descriptor, is_jit)) {
+    if (!check_descriptor(new_descriptor, is_jit, new_entries)) {
       return false;
     }
     LOG(DEBUG) << (is_jit ? "JIT" : "Dex") << " symfiles of pid " << process.pid
@@ -394,6 +438,29 @@ bool JITDebugReader::ReadRemoteMem(Process& process, uint64_t remote_addr, uint6
   return true;
 }
 
+// Read remote memory in [remote_iovs] to [local_iovs] in one process_vm_readv() call. Each
+// local iovec has the same size as the remote iovec at the same index. Reading stops at the first
+// remote iovec that can't be read, and the count of remote iovecs read completely is returned.
+size_t JITDebugReader::ReadRemoteMemBatch(Process& process, const std::vector<iovec>& local_iovs,
+                                          const std::vector<iovec>& remote_iovs) {
+  ssize_t result = process_vm_readv(process.pid, local_iovs.data(), local_iovs.size(),
+                                    remote_iovs.data(), remote_iovs.size(), 0);
+  if (result == -1) {
+    PLOG(DEBUG) << "ReadRemoteMemBatch(" << " pid " << process.pid << ", addr " << std::hex
+                << reinterpret_cast<uintptr_t>(remote_iovs[0].iov_base) << ") failed";
+    if (errno == ESRCH) {
+      process.died = true;
+    }
+    return 0;
+  }
+  size_t read_size = static_cast<size_t>(result);
+  size_t count = 0;
+  while (count < remote_iovs.size() && read_size >= remote_iovs[count].iov_len) {
+    read_size -= remote_iovs[count++].iov_len;
+  }
+  return count;
+}
+
 bool JITDebugReader::ReadDescriptors(Process& process, Descriptor* jit_descriptor,
                                      Descriptor* dex_descriptor) {
   if (!ReadRemoteMem(process, process.descriptors_addr, process.descriptors_size,
@@ -480,20 +547,88 @@ bool JITDebugReader::ReadNewCodeEntriesImpl(Process& process, const Descriptor&
   return true;
 }
 
-void JITDebugReader::ReadJITCodeDebugInfo(Process& process,
-                                          const std::vector<CodeEntry>& jit_entries,
-                                          std::vector<JITDebugInfo>* debug_info) {
-  std::vector<char> data;
+// Read symfiles of [jit_entries] into process.symfile_cache, and then read the descriptors.
+// Instead of reading each symfile in one process_vm_readv() call, symfiles and descriptors are read
+// in as few calls as possible. Symfiles already in the cache aren't read again. Symfiles that can't
+// be read are skipped. Return false if the descriptors can't be read.
+bool JITDebugReader::ReadJITSymfilesAndDescriptors(Process& process,
+                                                   const std::vector<CodeEntry>& jit_entries,
+                                                   Descriptor* jit_descriptor,
+                                                   Descriptor* dex_descriptor) {
+  // Remove cached symfiles not used by jit_entries, and find symfiles to read.
+  std::unordered_map<uint64_t, CachedSymfile> symfile_cache;
+  std::vector<const CodeEntry*> entries_to_read;
   for (auto& jit_entry : jit_entries) {
     if (jit_entry.symfile_size > MAX_JIT_SYMFILE_SIZE) {
       continue;
     }
-    if (data.size() < jit_entry.symfile_size) {
-      data.resize(jit_entry.symfile_size);
+    auto it = process.symfile_cache.find(jit_entry.addr);
+    if (it != process.symfile_cache.end() && it->second.timestamp == jit_entry.timestamp) {
+      symfile_cache[jit_entry.addr] = std::move(it->second);
+      continue;
+    }
+    CachedSymfile& symfile = symfile_cache[jit_entry.addr];
+    symfile.timestamp = jit_entry.timestamp;
+    symfile.data.resize(jit_entry.symfile_size);
+    entries_to_read.push_back(&jit_entry);
+  }
+  process.symfile_cache = std::move(symfile_cache);
+
+  std::vector<iovec> local_iovs;
+  std::vector<iovec> remote_iovs;
+  auto add_iov = [&](void* local_addr, uint64_t remote_addr, size_t size) {
+    local_iovs.push_back({local_addr, size});
+    remote_iovs.push_back({reinterpret_cast<void*>(static_cast<uintptr_t>(remote_addr)), size});
+  };
+  size_t i = 0;
+  while (true) {
+    local_iovs.clear();
+    remote_iovs.clear();
+    size_t batch_end = i;
+    while (batch_end < entries_to_read.size() && remote_iovs.size() + 1 < MAX_IOVS_PER_READ) {
+      const CodeEntry* entry = entries_to_read[batch_end++];
+      add_iov(process.symfile_cache[entry->addr].data.data(), entry->symfile_addr,
+              entry->symfile_size);
+    }
+    size_t symfile_count = batch_end - i;
+    bool read_descriptors = batch_end == entries_to_read.size();
+    if (read_descriptors) {
+      add_iov(descriptors_buf_.data(), process.descriptors_addr, process.descriptors_size);
+    }
+    size_t read_count = ReadRemoteMemBatch(process, local_iovs, remote_iovs);
+    if (process.died) {
+      return false;
+    }
+    if (read_count < symfile_count) {
+      // The symfile may have been freed. Skip it and read the following ones.
+      process.symfile_cache.erase(entries_to_read[i + read_count]->addr);
+      i += read_count + 1;
+      continue;
+    }
+    if (read_descriptors) {
+      if (read_count == symfile_count) {
+        process.died = true;
+        return false;
+      }
+      break;
     }
-    if (!ReadRemoteMem(process, jit_entry.symfile_addr, jit_entry.symfile_size, data.data())) {
+    i = batch_end;
+  }
+  return LoadDescriptor(process.is_64bit, &descriptors_buf_[process.jit_descriptor_offset],
+                        jit_descriptor) &&
+      LoadDescriptor(process.is_64bit, &descriptors_buf_[process.dex_descriptor_offset],
+                     dex_descriptor);
+}
+
+void JITDebugReader::ReadJITCodeDebugInfo(Process& process,
+                                          const std::vector<CodeEntry>& jit_entries,
+                                          std::vector<JITDebugInfo>* debug_info) {
+  for (auto& jit_entry : jit_entries) {
+    auto it = process.symfile_cache.find(jit_entry.addr);
+    if (it == process.symfile_cache.end() || it->second.timestamp != jit_entry.timestamp) {
       continue;
     }
+    const std::vector<char>& data = it->second.data;
     if (!IsValidElfFileMagic(data.data(), jit_entry.symfile_size)) {
       continue;
     }
@@ -509,17 +644,43 @@ void JITDebugReader::ReadJITCodeDebugInfo(Process& process,
         ElfStatus::NO_ERROR || min_addr >= max_addr) {
       continue;
     }
-    std::unique_ptr<TemporaryFile> tmp_file = ScopedTempFiles::CreateTempFile(!keep_symfiles_);
-    if (tmp_file == nullptr || !android::base::WriteFully(tmp_file->fd, data.data(),
-                                                          jit_entry.symfile_size)) {
+    std::string file_path;
+    uint64_t symfile_offset;
+    if (!DumpJITSymfile(data.data(), jit_entry.symfile_size, &file_path, &symfile_offset)) {
       continue;
     }
+    debug_info->emplace_back(process.pid, jit_entry.timestamp, min_addr, max_addr - min_addr,
+                             file_path, symfile_offset);
+  }
+  process.symfile_cache.clear();
+}
+
+bool JITDebugReader::DumpJITSymfile(const char* data, uint64_t size, std::string* file_path,
+                                    uint64_t* symfile_offset) {
+  if (!symfile_container_) {
+    std::unique_ptr<TemporaryFile> tmp_file = ScopedTempFiles::CreateTempFile(!keep_symfiles_);
     if (keep_symfiles_) {
       tmp_file->DoNotRemove();
     }
-    debug_info->emplace_back(process.pid, jit_entry.timestamp, min_addr, max_addr - min_addr,
-                             tmp_file->path);
+    symfile_container_.reset(
+        new JITSymfileContainerWriter(std::move(tmp_file), MAX_JIT_SYMFILE_CONTAINER_SIZE));
+  }
+  uint64_t offset = symfile_container_->AddSymfile(data, size);
+  if (offset != 0) {
+    *file_path = symfile_container_->Path();
+    *symfile_offset = offset;
+    return true;
   }
+  std::unique_ptr<TemporaryFile> tmp_file = ScopedTempFiles::CreateTempFile(!keep_symfiles_);
+  if (tmp_file == nullptr || !android::base::WriteFully(tmp_file->fd, data, size)) {
+    return false;
+  }
+  if (keep_symfiles_) {
+    tmp_file->DoNotRemove();
+  }
+  *file_path = tmp_file->path;
+  *symfile_offset = 0;
+  return true;
 }
 
 void JITDebugReader::ReadDexFileDebugInfo(Process& process,
@@ -17,6 +17,7 @@
 #ifndef SIMPLE_PERF_JIT_DEBUG_READER_H_
 #define SIMPLE_PERF_JIT_DEBUG_READER_H_
 
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <functional>
@@ -31,6 +32,7 @@
 #include <android-base/logging.h>
 
 #include "IOEventLoop.h"
+#include "JITSymfileContainer.h"
 #include "record.h"
 
 namespace simpleperf {
@@ -47,17 +49,20 @@ struct JITDebugInfo {
     struct {
       uint64_t jit_code_addr;  // The start addr of the JITed code
       uint64_t jit_code_len;   // The end addr of the JITed code
+      // The offset of the ELF file in a JIT symfile container, or 0 if file_path is the ELF file.
+      uint64_t symfile_offset;
     };
     uint64_t dex_file_offset;  // The offset of the dex file in the file containing it
   };
-  // For JITed code, it is the path of a temporary ELF file storing its debug info.
+  // For JITed code, it is the path of a temporary ELF file storing its debug info, or the path
+  // of a JIT symfile container storing the ELF file.
   // For dex file, it is the path of the file containing the dex file.
   std::string file_path;
 
   JITDebugInfo(pid_t pid, uint64_t timestamp, uint64_t jit_code_addr, uint64_t jit_code_len,
-               const std::string& file_path)
+               const std::string& file_path, uint64_t symfile_offset)
       : type(JIT_DEBUG_JIT_CODE), pid(pid), timestamp(timestamp), jit_code_addr(jit_code_addr),
-        jit_code_len(jit_code_len), file_path(file_path) {}
+        jit_code_len(jit_code_len), symfile_offset(symfile_offset), file_path(file_path) {}
 
   JITDebugInfo(pid_t pid, uint64_t timestamp, uint64_t dex_file_offset,
                const std::string& file_path)
@@ -77,8 +82,7 @@ class JITDebugReader {
   //                are only kept for debug unwinding.
   // sync_with_records: If true, sync debug info with records based on monotonic timestamp.
   //                    Otherwise, save debug info whenever they are added.
-  JITDebugReader(bool keep_symfiles, bool sync_with_records)
-      : keep_symfiles_(keep_symfiles), sync_with_records_(sync_with_records) {}
+  JITDebugReader(bool keep_symfiles, bool sync_with_records);
 
   bool SyncWithRecords() const {
     return sync_with_records_;
@@ -91,6 +95,8 @@ class JITDebugReader {
   // other is finding all processes having libart.so using records.
   bool MonitorProcess(pid_t pid);
   bool UpdateRecord(const Record* record);
+  // Same as UpdateRecord() for a sample record, but only needs its pid and timestamp.
+  bool UpdateSample(pid_t pid, uint64_t timestamp);
 
   // Read new debug info from all monitored processes.
   bool ReadAllProcesses();
@@ -117,6 +123,12 @@ class JITDebugReader {
     uint64_t timestamp;  // CLOCK_MONOTONIC time of last action
   };
 
+  // The symfile of a JIT code entry read from the remote process.
+  struct CachedSymfile {
+    uint64_t timestamp;  // timestamp of the code entry
+    std::vector<char> data;
+  };
+
   struct Process {
     pid_t pid = -1;
     bool initialized = false;
@@ -134,6 +146,12 @@ class JITDebugReader {
     Descriptor last_jit_descriptor;
     // The state we know about the remote dex debug descriptor.
     Descriptor last_dex_descriptor;
+
+    // Symfiles of new JIT code entries, keyed by code entry address. They are kept when the jit
+    // descriptor is changed while reading, so they don't need to be read again in the next try.
+    // ART doesn't change the symfile of a registered code entry, so a cached symfile is valid
+    // as long as the code entry at the same address has the same timestamp.
+    std::unordered_map<uint64_t, CachedSymfile> symfile_cache;
   };
 
   // The location of descriptors in libart.so.
@@ -144,11 +162,14 @@ class JITDebugReader {
     uint64_t dex_descriptor_offset = 0;
   };
 
-  void ReadProcess(Process& process, std::vector<JITDebugInfo>* debug_info);
+  void ReadProcess(Process& process, std::vector<JITDebugInfo>* debug_info,
+                   bool* descriptors_changed = nullptr);
   bool InitializeProcess(Process& process);
   const DescriptorsLocation* GetDescriptorsLocation(const std::string& art_lib_path,
                                                     bool is_64bit);
   bool ReadRemoteMem(Process& process, uint64_t remote_addr, uint64_t size, void* data);
+  size_t ReadRemoteMemBatch(Process& process, const std::vector<iovec>& local_iovs,
+                            const std::vector<iovec>& remote_iovs);
   bool ReadDescriptors(Process& process, Descriptor* jit_descriptor, Descriptor* dex_descriptor);
   bool LoadDescriptor(bool is_64bit, const char* data, Descriptor* descriptor);
   template <typename DescriptorT, typename CodeEntryT>
@@ -162,15 +183,21 @@ class JITDebugReader {
                               uint64_t last_action_timestamp, uint32_t read_entry_limit,
                               std::vector<CodeEntry>* new_code_entries);
 
+  bool ReadJITSymfilesAndDescriptors(Process& process, const std::vector<CodeEntry>& jit_entries,
+                                     Descriptor* jit_descriptor, Descriptor* dex_descriptor);
   void ReadJITCodeDebugInfo(Process& process, const std::vector<CodeEntry>& jit_entries,
                        std::vector<JITDebugInfo>* debug_info);
   void ReadDexFileDebugInfo(Process& process, const std::vector<CodeEntry>& dex_entries,
                        std::vector<JITDebugInfo>* debug_info);
+  bool DumpJITSymfile(const char* data, uint64_t size, std::string* file_path,
+                      uint64_t* symfile_offset);
   bool AddDebugInfo(const std::vector<JITDebugInfo>& jit_symfiles, bool sync_kernel_records);
 
   bool keep_symfiles_ = false;
   bool sync_with_records_ = false;
   IOEventRef read_event_ = nullptr;
+  // Interval between two reads of all processes, adjusted by how often descriptors change.
+  uint64_t read_interval_in_ms_;
   debug_info_callback_t debug_info_callback_;
 
   // Keys are pids of processes having libart.so, values show whether a process has been monitored.
@@ -180,6 +207,8 @@ class JITDebugReader {
   std::unordered_map<pid_t, Process> processes_;
   std::unordered_map<std::string, DescriptorsLocation> descriptors_location_cache_;
   std::vector<char> descriptors_buf_;
+  // JIT symfiles are dumped to the container, and to temporary files when it is full.
+  std::unique_ptr<JITSymfileContainerWriter> symfile_container_;
 
   std::priority_queue<JITDebugInfo, std::vector<JITDebugInfo>, std::greater<JITDebugInfo>>
       debug_info_q_;
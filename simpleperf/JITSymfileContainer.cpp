@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JITSymfileContainer.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include "utils.h"
+
+namespace simpleperf {
+
+static constexpr char JIT_SYMFILE_CONTAINER_MAGIC[8] = {'J', 'I', 'T', 'S', 'Y', 'M', 'F', 'S'};
+static const char* JIT_SYMFILE_URL_SEPARATOR = "!0x";
+
+JITSymfileContainerWriter::JITSymfileContainerWriter(std::unique_ptr<TemporaryFile> file,
+                                                     uint64_t max_size)
+    : file_(std::move(file)), path_(file_->path), max_size_(max_size) {}
+
+uint64_t JITSymfileContainerWriter::AddSymfile(const char* data, uint64_t size) {
+  if (write_failed_) {
+    return 0;
+  }
+  uint64_t entry_size = sizeof(uint64_t) + Align(size, 8);
+  uint64_t header_size = (file_size_ == 0) ? sizeof(JIT_SYMFILE_CONTAINER_MAGIC) : 0;
+  if (file_size_ + header_size + entry_size > max_size_) {
+    return 0;
+  }
+  static const char padding[8] = {};
+  size_t padding_size = entry_size - sizeof(uint64_t) - size;
+  if ((header_size != 0 &&
+       !android::base::WriteFully(file_->fd, JIT_SYMFILE_CONTAINER_MAGIC, header_size)) ||
+      !android::base::WriteFully(file_->fd, &size, sizeof(size)) ||
+      !android::base::WriteFully(file_->fd, data, size) ||
+      !android::base::WriteFully(file_->fd, padding, padding_size)) {
+    PLOG(ERROR) << "failed to write JIT symfile container " << path_;
+    write_failed_ = true;
+    return 0;
+  }
+  file_size_ += header_size;
+  uint64_t offset = file_size_ + sizeof(uint64_t);
+  file_size_ += entry_size;
+  return offset;
+}
+
+std::string GetJITSymfileUrl(const std::string& container_path, uint64_t offset) {
+  return android::base::StringPrintf("%s%s%" PRIx64, container_path.c_str(),
+                                     JIT_SYMFILE_URL_SEPARATOR, offset);
+}
+
+bool SplitJITSymfileUrl(const std::string& url, std::string* container_path, uint64_t* offset) {
+  size_t pos = url.rfind(JIT_SYMFILE_URL_SEPARATOR);
+  if (pos == std::string::npos || pos == 0) {
+    return false;
+  }
+  const char* offset_str = url.c_str() + pos + strlen(JIT_SYMFILE_URL_SEPARATOR);
+  char* end;
+  uint64_t value = strtoull(offset_str, &end, 16);
+  if (end == offset_str || *end != '\0') {
+    return false;
+  }
+  *container_path = url.substr(0, pos);
+  *offset = value;
+  return true;
+}
+
+bool ReadJITSymfileSize(const std::string& container_path, uint64_t offset, uint64_t* size) {
+  if (offset < sizeof(JIT_SYMFILE_CONTAINER_MAGIC) + sizeof(uint64_t) || offset % 8 != 0) {
+    return false;
+  }
+  std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(container_path.c_str(), "rb"), fclose);
+  if (!fp) {
+    return false;
+  }
+  char magic[sizeof(JIT_SYMFILE_CONTAINER_MAGIC)];
+  if (fread(magic, sizeof(magic), 1, fp.get()) != 1 ||
+      memcmp(magic, JIT_SYMFILE_CONTAINER_MAGIC, sizeof(magic)) != 0) {
+    LOG(WARNING) << container_path << " isn't a JIT symfile container";
+    return false;
+  }
+  uint64_t value;
+  if (fseek(fp.get(), offset - sizeof(uint64_t), SEEK_SET) != 0 ||
+      fread(&value, sizeof(value), 1, fp.get()) != 1) {
+    return false;
+  }
+  // The read above ensures offset <= file size.
+  if (value > GetFileSize(container_path) - offset) {
+    return false;
+  }
+  *size = value;
+  return true;
+}
+
+}  // namespace simpleperf
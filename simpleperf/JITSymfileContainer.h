@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/macros.h>
+
+namespace simpleperf {
+
+// A JIT symfile container stores symfiles of JITed Java methods (small ELF files read from ART)
+// one after another in a single file, so the record command doesn't create a file for each JITed
+// method. A symfile is referred to by its offset in the container, like an ELF file embedded in
+// an apk. The file format is as below:
+//   char magic[8] = "JITSYMFS";
+//   Entry entry_0;
+//   ...
+//   Entry entry_N;
+//
+// Each entry is:
+//   uint64_t size;
+//   char symfile[size];
+//   char padding[];  // To make the next entry 8 byte aligned.
+// The offset of a symfile is the file offset of its data. Since the size is stored just before
+// the data, a symfile can be read from the container with only its offset.
+class JITSymfileContainerWriter {
+ public:
+  // [file] is an empty file. Symfiles are added until the container reaches [max_size] bytes.
+  JITSymfileContainerWriter(std::unique_ptr<TemporaryFile> file, uint64_t max_size);
+
+  const std::string& Path() const { return path_; }
+
+  // Append a symfile, and return its offset in the container. Return 0 if the container is
+  // full or failed to write.
+  uint64_t AddSymfile(const char* data, uint64_t size);
+
+ private:
+  std::unique_ptr<TemporaryFile> file_;
+  const std::string path_;
+  const uint64_t max_size_;
+  uint64_t file_size_ = 0;
+  bool write_failed_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(JITSymfileContainerWriter);
+};
+
+// Return the path of a Dso for the symfile at [offset] in a container, in format
+// "container_path!0xoffset".
+std::string GetJITSymfileUrl(const std::string& container_path, uint64_t offset);
+// Return false if [url] isn't a path returned by GetJITSymfileUrl().
+bool SplitJITSymfileUrl(const std::string& url, std::string* container_path, uint64_t* offset);
+
+// Read the size of the symfile at [offset] in a container.
+bool ReadJITSymfileSize(const std::string& container_path, uint64_t offset, uint64_t* size);
+
+}  // namespace simpleperf
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JITSymfileContainer.h"
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+#include "dso.h"
+#include "get_test_data.h"
+#include "read_elf.h"
+
+using namespace simpleperf;
+
+TEST(JITSymfileContainer, add_and_read_symfiles) {
+  std::unique_ptr<TemporaryFile> tmp_file(new TemporaryFile);
+  std::string path = tmp_file->path;
+  JITSymfileContainerWriter writer(std::move(tmp_file), 64);
+  ASSERT_EQ(writer.Path(), path);
+  uint64_t offset1 = writer.AddSymfile("abc", 3);
+  uint64_t offset2 = writer.AddSymfile("0123456789", 10);
+  ASSERT_EQ(offset1, 16u);
+  ASSERT_EQ(offset2, 32u);
+  // The container is full.
+  ASSERT_EQ(writer.AddSymfile("0123456789abcdef", 16), 0u);
+
+  uint64_t size;
+  ASSERT_TRUE(ReadJITSymfileSize(path, offset1, &size));
+  ASSERT_EQ(size, 3u);
+  ASSERT_TRUE(ReadJITSymfileSize(path, offset2, &size));
+  ASSERT_EQ(size, 10u);
+  ASSERT_FALSE(ReadJITSymfileSize(path, 0, &size));
+  ASSERT_FALSE(ReadJITSymfileSize(path, 48, &size));
+}
+
+TEST(JITSymfileContainer, url) {
+  std::string url = GetJITSymfileUrl("/data/local/tmp/TemporaryFile-abc", 0x1f8);
+  ASSERT_EQ(url, "/data/local/tmp/TemporaryFile-abc!0x1f8");
+  std::string container_path;
+  uint64_t offset;
+  ASSERT_TRUE(SplitJITSymfileUrl(url, &container_path, &offset));
+  ASSERT_EQ(container_path, "/data/local/tmp/TemporaryFile-abc");
+  ASSERT_EQ(offset, 0x1f8u);
+  ASSERT_FALSE(SplitJITSymfileUrl("/data/app/base.apk!/lib/arm64/libfoo.so", &container_path,
+                                  &offset));
+  ASSERT_FALSE(SplitJITSymfileUrl("/data/local/tmp/TemporaryFile-abc!0x", &container_path,
+                                  &offset));
+}
+
+TEST(JITSymfileContainer, read_symbols_by_dso) {
+  std::string elf_data;
+  ASSERT_TRUE(android::base::ReadFileToString(GetTestData(ELF_FILE), &elf_data));
+  uint64_t func_addr = 0;
+  auto callback = [&](const ElfFileSymbol& symbol) {
+    if (symbol.name == "GlobalFunc") {
+      func_addr = symbol.vaddr;
+    }
+  };
+  ASSERT_EQ(ElfStatus::NO_ERROR, ParseSymbolsFromElfFile(GetTestData(ELF_FILE), BuildId(),
+                                                         callback));
+  ASSERT_NE(func_addr, 0u);
+
+  std::unique_ptr<TemporaryFile> tmp_file(new TemporaryFile);
+  std::string path = tmp_file->path;
+  JITSymfileContainerWriter writer(std::move(tmp_file), 1024 * 1024);
+  ASSERT_NE(writer.AddSymfile("abc", 3), 0u);
+  uint64_t offset = writer.AddSymfile(elf_data.data(), elf_data.size());
+  ASSERT_NE(offset, 0u);
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, GetJITSymfileUrl(path, offset));
+  ASSERT_TRUE(dso->IsForJavaMethod());
+  const Symbol* symbol = dso->FindSymbol(func_addr);
+  ASSERT_TRUE(symbol != nullptr);
+  ASSERT_STREQ(symbol->Name(), "GlobalFunc");
+}
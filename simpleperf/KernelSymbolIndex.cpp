@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KernelSymbolIndex.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+#include <android-base/logging.h>
+
+#include "utils.h"
+
+namespace simpleperf {
+
+namespace {
+
+constexpr uint32_t KERNEL_SYMBOL_INDEX_VERSION = 1;
+
+// Serialized format: SerializedHeader, addrs (uint64_t[symbol_count]), name offsets
+// (uint32_t[symbol_count]), name table (char[name_table_size]).
+struct SerializedHeader {
+  uint32_t version;
+  uint32_t symbol_count;
+  uint32_t name_table_size;
+  uint32_t reserved;
+};
+
+}  // namespace
+
+std::unique_ptr<KernelSymbolIndex> KernelSymbolIndex::BuildFromKallsyms(std::string& kallsyms) {
+  // Pairs of (addr, name offset in raw_names).
+  std::vector<std::pair<uint64_t, uint32_t>> symbols;
+  std::vector<char> raw_names;
+  auto callback = [&](const KernelSymbol& symbol) {
+    if (strchr("TtWw", symbol.type) && symbol.addr != 0u) {
+      symbols.emplace_back(symbol.addr, raw_names.size());
+      raw_names.insert(raw_names.end(), symbol.name, symbol.name + strlen(symbol.name) + 1);
+    }
+    return false;
+  };
+  ProcessKernelSymbols(kallsyms, callback);
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const auto& s1, const auto& s2) { return s1.first < s2.first; });
+
+  std::unique_ptr<KernelSymbolIndex> index(new KernelSymbolIndex);
+  index->addrs_.reserve(symbols.size());
+  index->name_offsets_.reserve(symbols.size());
+  // Intern names. Kernels have many static functions sharing the same name.
+  std::unordered_map<std::string_view, uint32_t> name_map;
+  for (auto& symbol : symbols) {
+    std::string_view name(&raw_names[symbol.second]);
+    auto it = name_map.find(name);
+    uint32_t offset;
+    if (it != name_map.end()) {
+      offset = it->second;
+    } else {
+      offset = index->names_.size();
+      index->names_.insert(index->names_.end(), name.begin(), name.end());
+      index->names_.push_back('\0');
+      name_map.emplace(name, offset);
+    }
+    index->addrs_.push_back(symbol.first);
+    index->name_offsets_.push_back(offset);
+  }
+  index->BuildEytzingerLayout();
+  return index;
+}
+
+std::unique_ptr<KernelSymbolIndex> KernelSymbolIndex::Deserialize(const char* data, size_t size) {
+  SerializedHeader header;
+  if (size < sizeof(header)) {
+    return nullptr;
+  }
+  const char* p = data;
+  MoveFromBinaryFormat(header, p);
+  if (header.version != KERNEL_SYMBOL_INDEX_VERSION) {
+    LOG(DEBUG) << "unsupported kernel symbol index version " << header.version;
+    return nullptr;
+  }
+  uint64_t count = header.symbol_count;
+  if (size != sizeof(header) + count * (sizeof(uint64_t) + sizeof(uint32_t)) +
+                  header.name_table_size) {
+    return nullptr;
+  }
+  std::unique_ptr<KernelSymbolIndex> index(new KernelSymbolIndex);
+  index->addrs_.resize(count);
+  MoveFromBinaryFormat(index->addrs_.data(), count, p);
+  index->name_offsets_.resize(count);
+  MoveFromBinaryFormat(index->name_offsets_.data(), count, p);
+  index->names_.assign(p, p + header.name_table_size);
+
+  // Check the index, so lookups don't need to.
+  if (!std::is_sorted(index->addrs_.begin(), index->addrs_.end())) {
+    return nullptr;
+  }
+  if (count > 0 && (index->names_.empty() || index->names_.back() != '\0')) {
+    return nullptr;
+  }
+  for (uint32_t offset : index->name_offsets_) {
+    if (offset >= index->names_.size()) {
+      return nullptr;
+    }
+  }
+  index->BuildEytzingerLayout();
+  return index;
+}
+
+std::vector<char> KernelSymbolIndex::Serialize() const {
+  SerializedHeader header;
+  header.version = KERNEL_SYMBOL_INDEX_VERSION;
+  header.symbol_count = addrs_.size();
+  header.name_table_size = names_.size();
+  header.reserved = 0;
+  std::vector<char> data(sizeof(header) + addrs_.size() * sizeof(uint64_t) +
+                         name_offsets_.size() * sizeof(uint32_t) + names_.size());
+  char* p = data.data();
+  MoveToBinaryFormat(header, p);
+  MoveToBinaryFormat(addrs_.data(), addrs_.size(), p);
+  MoveToBinaryFormat(name_offsets_.data(), name_offsets_.size(), p);
+  MoveToBinaryFormat(names_.data(), names_.size(), p);
+  return data;
+}
+
+bool KernelSymbolIndex::FindSymbol(uint64_t addr, size_t* index) const {
+  size_t n = addrs_.size();
+  size_t pos = 1;
+  while (pos <= n) {
+    pos = 2 * pos + (eytzinger_addrs_[pos] <= addr);
+  }
+  // Remove the right turns made after the last left turn, to get the position of the first
+  // address > [addr]. pos becomes 0 if there is no such address.
+  pos >>= __builtin_ffsll(~static_cast<unsigned long long>(pos));
+  size_t upper_bound = (pos == 0) ? n : eytzinger_indexes_[pos];
+  if (upper_bound == 0) {
+    return false;
+  }
+  *index = upper_bound - 1;
+  return true;
+}
+
+void KernelSymbolIndex::BuildEytzingerLayout() {
+  eytzinger_addrs_.resize(addrs_.size() + 1);
+  eytzinger_indexes_.resize(addrs_.size() + 1);
+  FillEytzingerLayout(0, 1);
+}
+
+// Fill the subtree at [pos] by an in-order traversal, starting from addrs_[sorted_index]. Return
+// the sorted index after the subtree.
+size_t KernelSymbolIndex::FillEytzingerLayout(size_t sorted_index, size_t pos) {
+  if (pos < eytzinger_addrs_.size()) {
+    sorted_index = FillEytzingerLayout(sorted_index, 2 * pos);
+    eytzinger_addrs_[pos] = addrs_[sorted_index];
+    eytzinger_indexes_[pos] = sorted_index++;
+    sorted_index = FillEytzingerLayout(sorted_index, 2 * pos + 1);
+  }
+  return sorted_index;
+}
+
+}  // namespace simpleperf
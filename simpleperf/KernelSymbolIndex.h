@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/macros.h>
+
+namespace simpleperf {
+
+// KernelSymbolIndex is a compact index of kernel text symbols in /proc/kallsyms. Addresses are
+// kept sorted, and symbol names are interned in one string table. It can be serialized into
+// perf.data, so readers don't need to parse kallsyms text again.
+// For lookup, addresses are also kept in Eytzinger order (the BFS order of a complete binary
+// search tree), which makes binary search more cache friendly than searching a sorted array.
+class KernelSymbolIndex {
+ public:
+  // Build an index from kallsyms text. Only symbols in text sections with non-zero addresses
+  // are kept. [kallsyms] is modified during parsing, but restored afterwards.
+  static std::unique_ptr<KernelSymbolIndex> BuildFromKallsyms(std::string& kallsyms);
+  // Read an index written by Serialize(). Return nullptr if the data is invalid.
+  static std::unique_ptr<KernelSymbolIndex> Deserialize(const char* data, size_t size);
+
+  std::vector<char> Serialize() const;
+
+  size_t SymbolCount() const { return addrs_.size(); }
+  // Symbols are indexed in address order.
+  uint64_t SymbolAddr(size_t index) const { return addrs_[index]; }
+  const char* SymbolName(size_t index) const { return &names_[name_offsets_[index]]; }
+
+  // Find the last symbol with address <= [addr]. Return false if not found.
+  bool FindSymbol(uint64_t addr, size_t* index) const;
+
+ private:
+  KernelSymbolIndex() {}
+  void BuildEytzingerLayout();
+  size_t FillEytzingerLayout(size_t sorted_index, size_t pos);
+
+  std::vector<uint64_t> addrs_;
+  std::vector<uint32_t> name_offsets_;
+  std::vector<char> names_;
+  // Position 0 is unused. Children of position k are at 2k and 2k + 1.
+  std::vector<uint64_t> eytzinger_addrs_;
+  // Index in addrs_ of each position in eytzinger_addrs_.
+  std::vector<uint32_t> eytzinger_indexes_;
+
+  DISALLOW_COPY_AND_ASSIGN(KernelSymbolIndex);
+};
+
+}  // namespace simpleperf
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KernelSymbolIndex.h"
+
+#include <inttypes.h>
+
+#include <gtest/gtest.h>
+
+#include <android-base/stringprintf.h>
+
+#include "dso.h"
+#include "thread_tree.h"
+
+using namespace simpleperf;
+
+TEST(KernelSymbolIndex, build_from_kallsyms) {
+  std::string kallsyms =
+      "ffffffffa0003000 t cleanup  [libsas]\n"
+      "ffffffffa0001000 T func1\n"
+      "ffffffffa005c4e4 d __warned.41698   [libsas]\n"
+      "0000000000000000 T zero_addr\n"
+      "ffffffffa0002000 t cleanup\n";
+  std::string old_kallsyms = kallsyms;
+  std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+  ASSERT_EQ(kallsyms, old_kallsyms);
+  ASSERT_TRUE(index);
+  ASSERT_EQ(index->SymbolCount(), 3u);
+  ASSERT_EQ(index->SymbolAddr(0), 0xffffffffa0001000ULL);
+  ASSERT_STREQ(index->SymbolName(0), "func1");
+  ASSERT_EQ(index->SymbolAddr(1), 0xffffffffa0002000ULL);
+  ASSERT_STREQ(index->SymbolName(1), "cleanup");
+  ASSERT_EQ(index->SymbolAddr(2), 0xffffffffa0003000ULL);
+  // Same names are interned.
+  ASSERT_EQ(index->SymbolName(1), index->SymbolName(2));
+}
+
+TEST(KernelSymbolIndex, find_symbol) {
+  // Use different symbol counts to test incomplete trees.
+  for (size_t count = 0; count < 40; ++count) {
+    std::string kallsyms;
+    for (size_t i = 0; i < count; ++i) {
+      kallsyms += android::base::StringPrintf("%" PRIx64 " T func%zu\n", 0x1000 + i * 0x10, i);
+    }
+    std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+    ASSERT_EQ(index->SymbolCount(), count);
+    size_t symbol_index;
+    ASSERT_FALSE(index->FindSymbol(0xfff, &symbol_index));
+    for (size_t i = 0; i < count; ++i) {
+      for (uint64_t offset : {0, 1, 0xf}) {
+        ASSERT_TRUE(index->FindSymbol(0x1000 + i * 0x10 + offset, &symbol_index));
+        ASSERT_EQ(symbol_index, i);
+      }
+    }
+    if (count > 0) {
+      ASSERT_TRUE(index->FindSymbol(UINT64_MAX, &symbol_index));
+      ASSERT_EQ(symbol_index, count - 1);
+    }
+  }
+}
+
+TEST(KernelSymbolIndex, find_symbol_with_same_addr) {
+  std::string kallsyms =
+      "1000 T func1\n"
+      "2000 T func2\n"
+      "2000 T func2_alias\n"
+      "3000 T func3\n";
+  std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+  size_t symbol_index;
+  ASSERT_TRUE(index->FindSymbol(0x2000, &symbol_index));
+  ASSERT_EQ(symbol_index, 2u);
+  ASSERT_TRUE(index->FindSymbol(0x1fff, &symbol_index));
+  ASSERT_EQ(symbol_index, 0u);
+}
+
+TEST(KernelSymbolIndex, serialize) {
+  std::string kallsyms =
+      "1000 T func1\n"
+      "2000 t func2\n"
+      "3000 W func3\n";
+  std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+  std::vector<char> data = index->Serialize();
+  std::unique_ptr<KernelSymbolIndex> index2 =
+      KernelSymbolIndex::Deserialize(data.data(), data.size());
+  ASSERT_TRUE(index2);
+  ASSERT_EQ(index2->SymbolCount(), index->SymbolCount());
+  for (size_t i = 0; i < index->SymbolCount(); ++i) {
+    ASSERT_EQ(index2->SymbolAddr(i), index->SymbolAddr(i));
+    ASSERT_STREQ(index2->SymbolName(i), index->SymbolName(i));
+  }
+  size_t symbol_index;
+  ASSERT_TRUE(index2->FindSymbol(0x2800, &symbol_index));
+  ASSERT_EQ(symbol_index, 1u);
+
+  // Reject truncated or corrupted data.
+  ASSERT_FALSE(KernelSymbolIndex::Deserialize(data.data(), data.size() - 1));
+  ASSERT_FALSE(KernelSymbolIndex::Deserialize(data.data(), 4));
+  std::vector<char> bad_data = data;
+  bad_data.back() = 'a';
+  ASSERT_FALSE(KernelSymbolIndex::Deserialize(bad_data.data(), bad_data.size()));
+}
+
+TEST(KernelSymbolIndex, kernel_dso) {
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_KERNEL, DEFAULT_KERNEL_MMAP_NAME);
+  std::string kallsyms =
+      "1000 T func1\n"
+      "2000 T func2\n";
+  std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+  std::vector<char> data = index->Serialize();
+  Dso::SetKernelSymbolIndex(KernelSymbolIndex::Deserialize(data.data(), data.size()));
+  ASSERT_EQ(dso->FindSymbol(0xfff), nullptr);
+  const Symbol* symbol = dso->FindSymbol(0x1800);
+  ASSERT_NE(symbol, nullptr);
+  ASSERT_STREQ(symbol->Name(), "func1");
+  ASSERT_EQ(symbol->len, 0x1000u);
+  symbol = dso->FindSymbol(0x123456);
+  ASSERT_NE(symbol, nullptr);
+  ASSERT_STREQ(symbol->Name(), "func2");
+}
@@ -36,9 +36,11 @@
 #include <unwindstack/UserX86_64.h>
 
 #include "environment.h"
+#include "JITSymfileContainer.h"
 #include "perf_regs.h"
 #include "read_apk.h"
 #include "thread_tree.h"
+#include "utils.h"
 
 static_assert(simpleperf::map_flags::PROT_JIT_SYMFILE_MAP ==
               unwindstack::MAPS_FLAGS_JIT_SYMFILE_MAP, "");
@@ -116,10 +118,81 @@ static unwindstack::Regs* GetBacktraceRegs(const RegSet& regs) {
   }
 }
 
-static unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry) {
+UnwindElfCache& UnwindElfCache::GetInstance() {
+  static UnwindElfCache cache;
+  return cache;
+}
+
+std::string UnwindElfCache::GetKey(const std::string& path, uint64_t offset,
+                                   const BuildId& build_id) {
+  return path + "@" + std::to_string(offset) + "@" + build_id.ToString();
+}
+
+void UnwindElfCache::SetMemoryLimit(uint64_t memory_limit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  memory_limit_ = memory_limit;
+  EvictEntries();
+}
+
+std::shared_ptr<unwindstack::Elf> UnwindElfCache::Get(const std::string& key,
+                                                      uint64_t* elf_offset) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entry_map_.find(key);
+  if (it == entry_map_.end()) {
+    return nullptr;
+  }
+  lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+  *elf_offset = it->second->elf_offset;
+  return it->second->elf;
+}
+
+void UnwindElfCache::Add(const std::string& key, const std::shared_ptr<unwindstack::Elf>& elf,
+                         uint64_t elf_offset, uint64_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entry_map_.find(key) != entry_map_.end()) {
+    // Added by another unwinder.
+    return;
+  }
+  lru_list_.push_front(CacheEntry{key, elf, elf_offset, size});
+  entry_map_[key] = lru_list_.begin();
+  memory_usage_ += size;
+  EvictEntries();
+}
+
+uint64_t UnwindElfCache::GetMemoryUsage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+void UnwindElfCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_list_.clear();
+  entry_map_.clear();
+  memory_usage_ = 0;
+}
+
+void UnwindElfCache::EvictEntries() {
+  // Evicted ELF files are still alive while used by MapInfos.
+  while (memory_usage_ > memory_limit_ && !lru_list_.empty()) {
+    CacheEntry& entry = lru_list_.back();
+    memory_usage_ -= entry.size;
+    entry_map_.erase(entry.key);
+    lru_list_.pop_back();
+  }
+}
+
+unwindstack::MapInfo* UnwindMaps::CreateMapInfo(const MapEntry* entry, bool* elf_cache_hit) {
   const char* name = entry->dso->GetDebugFilePath().c_str();
   uint64_t pgoff = entry->pgoff;
-  if (entry->pgoff == 0) {
+  uint64_t embedded_elf_size = 0;
+  std::string container_path;
+  uint64_t symfile_offset;
+  if ((entry->flags & map_flags::PROT_JIT_SYMFILE_MAP) &&
+      SplitJITSymfileUrl(entry->dso->GetDebugFilePath(), &container_path, &symfile_offset)) {
+    // The unwinder reads a JIT symfile in a container like an ELF file embedded in an apk.
+    name = container_path.c_str();
+    pgoff = symfile_offset;
+  } else if (entry->pgoff == 0) {
     auto tuple = SplitUrlInApk(entry->dso->GetDebugFilePath());
     if (std::get<0>(tuple)) {
       // The unwinder does not understand the ! format, so change back to
@@ -128,18 +201,42 @@ static unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry) {
       if (elf != nullptr) {
         name = elf->filepath().c_str();
         pgoff = elf->entry_offset();
+        embedded_elf_size = elf->entry_size();
       }
     }
   }
-  return new unwindstack::MapInfo(nullptr, entry->start_addr, entry->get_end_addr(), pgoff,
-                                  PROT_READ | PROT_EXEC | entry->flags, name);
+  auto map_info = new unwindstack::MapInfo(nullptr, entry->start_addr, entry->get_end_addr(),
+                                           pgoff, PROT_READ | PROT_EXEC | entry->flags, name);
+  *elf_cache_hit = false;
+  // Symfiles of JITed code are only used by one process, so not worth caching.
+  if (!(entry->flags & map_flags::PROT_JIT_SYMFILE_MAP)) {
+    std::string key = UnwindElfCache::GetKey(name, pgoff,
+                                             Dso::FindExpectedBuildIdForPath(entry->dso->Path()));
+    uint64_t elf_offset;
+    map_info->elf = UnwindElfCache::GetInstance().Get(key, &elf_offset);
+    if (map_info->elf) {
+      map_info->elf_offset = elf_offset;
+      *elf_cache_hit = true;
+    } else {
+      uncached_elfs_[map_info] = UncachedElf{std::move(key), embedded_elf_size};
+    }
+  }
+  return map_info;
 }
 
-void UnwindMaps::UpdateMaps(const MapSet& map_set) {
+void UnwindMaps::DeleteMapInfo(size_t index) {
+  entries_[index] = nullptr;
+  uncached_elfs_.erase(maps_[index]);
+  delete maps_[index];
+  maps_[index] = nullptr;
+}
+
+size_t UnwindMaps::UpdateMaps(const MapSet& map_set) {
   if (version_ == map_set.version) {
-    return;
+    return 0;
   }
   version_ = map_set.version;
+  size_t elf_cache_hits = 0;
   size_t i = 0;
   size_t old_size = entries_.size();
   for (auto it = map_set.maps.begin(); it != map_set.maps.end();) {
@@ -149,20 +246,20 @@ void UnwindMaps::UpdateMaps(const MapSet& map_set) {
       ++it;
     } else if (i == old_size || entry->start_addr <= entries_[i]->start_addr) {
       // Add an entry.
+      bool elf_cache_hit;
       entries_.push_back(entry);
-      maps_.push_back(CreateMapInfo(entry));
+      maps_.push_back(CreateMapInfo(entry, &elf_cache_hit));
+      if (elf_cache_hit) {
+        elf_cache_hits++;
+      }
       ++it;
     } else {
       // Remove an entry.
-      entries_[i] = nullptr;
-      delete maps_[i];
-      maps_[i++] = nullptr;
+      DeleteMapInfo(i++);
     }
   }
   while (i < old_size) {
-    entries_[i] = nullptr;
-    delete maps_[i];
-    maps_[i++] = nullptr;
+    DeleteMapInfo(i++);
   }
   std::sort(entries_.begin(), entries_.end(), [](const MapEntry* e1, const MapEntry* e2) {
     if (e1 == nullptr || e2 == nullptr) {
@@ -179,10 +276,42 @@ void UnwindMaps::UpdateMaps(const MapSet& map_set) {
   });
   entries_.resize(map_set.maps.size());
   maps_.resize(map_set.maps.size());
+  return elf_cache_hits;
+}
+
+size_t UnwindMaps::AddLoadedElfsToCache(const std::vector<unwindstack::FrameData>& frames) {
+  size_t added_count = 0;
+  uint64_t prev_map_start = 0;
+  for (auto& frame : frames) {
+    if (uncached_elfs_.empty()) {
+      break;
+    }
+    if (frame.map_start == 0 || frame.map_start == prev_map_start) {
+      continue;
+    }
+    prev_map_start = frame.map_start;
+    unwindstack::MapInfo* map_info = Find(frame.map_start);
+    if (map_info == nullptr || !map_info->elf) {
+      continue;
+    }
+    auto it = uncached_elfs_.find(map_info);
+    if (it != uncached_elfs_.end()) {
+      uint64_t size = it->second.embedded_elf_size;
+      if (size == 0) {
+        size = GetFileSize(map_info->name);
+      }
+      UnwindElfCache::GetInstance().Add(it->second.key, map_info->elf, map_info->elf_offset,
+                                        size);
+      uncached_elfs_.erase(it);
+      added_count++;
+    }
+  }
+  return added_count;
 }
 
 OfflineUnwinder::OfflineUnwinder(bool collect_stat) : collect_stat_(collect_stat) {
-  unwindstack::Elf::SetCachingEnabled(true);
+  // ELF files are cached in UnwindElfCache, which is bounded by memory and keyed by build id.
+  unwindstack::Elf::SetCachingEnabled(false);
 }
 
 bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& regs,
@@ -204,7 +333,7 @@ bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& r
   uint64_t stack_addr = sp_reg_value;
 
   UnwindMaps& cached_map = cached_maps_[thread.pid];
-  cached_map.UpdateMaps(*thread.maps);
+  size_t elf_cache_hits = cached_map.UpdateMaps(*thread.maps);
   std::shared_ptr<unwindstack::MemoryOfflineBuffer> stack_memory(
       new unwindstack::MemoryOfflineBuffer(reinterpret_cast<const uint8_t*>(stack),
                                            stack_addr, stack_addr + stack_size));
@@ -216,6 +345,7 @@ bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& r
                                  stack_memory);
   unwinder.SetResolveNames(false);
   unwinder.Unwind();
+  size_t elf_cache_misses = cached_map.AddLoadedElfsToCache(unwinder.frames());
   size_t last_jit_method_frame = UINT_MAX;
   for (auto& frame : unwinder.frames()) {
     // Unwinding in arm architecture can return 0 pc address.
@@ -281,6 +411,8 @@ bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& r
     }
     unwinding_result_.stack_start = stack_addr;
     unwinding_result_.stack_end = stack_addr + stack_size;
+    unwinding_result_.elf_cache_hits = elf_cache_hits;
+    unwinding_result_.elf_cache_misses = elf_cache_misses;
   }
   return true;
 }
@@ -17,15 +17,20 @@
 #ifndef SIMPLE_PERF_OFFLINE_UNWINDER_H_
 #define SIMPLE_PERF_OFFLINE_UNWINDER_H_
 
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
+#include "build_id.h"
 #include "perf_regs.h"
 #include "thread_tree.h"
 
 #if defined(__linux__)
 #include <unwindstack/Maps.h>
+#include <unwindstack/Unwinder.h>
 #endif
 
 namespace simpleperf {
@@ -53,16 +58,75 @@ struct UnwindingResult {
   } stop_info;
   uint64_t stack_start;
   uint64_t stack_end;
+  // ELF files got from UnwindElfCache, and ELF files loaded and added to UnwindElfCache while
+  // unwinding this sample.
+  uint64_t elf_cache_hits;
+  uint64_t elf_cache_misses;
 };
 
 #if defined(__linux__)
+// UnwindElfCache keeps ELF files parsed by libunwindstack, including their unwind tables, so
+// they are shared by all OfflineUnwinders and all processes mapping the same file. ELF files
+// are identified by path, offset in file and build id. The cache is bounded by memory, and
+// evicts least recently used ELF files when the limit is exceeded. It is thread safe.
+class UnwindElfCache {
+ public:
+  static constexpr uint64_t DEFAULT_MEMORY_LIMIT = 512 * 1024 * 1024;
+
+  static UnwindElfCache& GetInstance();
+  static std::string GetKey(const std::string& path, uint64_t offset, const BuildId& build_id);
+
+  UnwindElfCache(uint64_t memory_limit = DEFAULT_MEMORY_LIMIT) : memory_limit_(memory_limit) {}
+  void SetMemoryLimit(uint64_t memory_limit);
+  // Return the ELF file for [key], and set [elf_offset] to the offset of the ELF file in the
+  // mapped file. Return nullptr if not found.
+  std::shared_ptr<unwindstack::Elf> Get(const std::string& key, uint64_t* elf_offset);
+  // [size] is the estimated memory used by [elf], like the size of the ELF file.
+  void Add(const std::string& key, const std::shared_ptr<unwindstack::Elf>& elf,
+           uint64_t elf_offset, uint64_t size);
+  uint64_t GetMemoryUsage();
+  void Clear();
+
+ private:
+  struct CacheEntry {
+    std::string key;
+    std::shared_ptr<unwindstack::Elf> elf;
+    uint64_t elf_offset;
+    uint64_t size;
+  };
+
+  void EvictEntries();
+
+  std::mutex mutex_;
+  uint64_t memory_limit_;
+  uint64_t memory_usage_ = 0u;
+  // Entries ordered from the most recently used to the least recently used.
+  std::list<CacheEntry> lru_list_;
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator> entry_map_;
+};
+
 class UnwindMaps : public unwindstack::Maps {
  public:
-  void UpdateMaps(const MapSet& map_set);
+  // Return count of MapInfos getting ELF files from UnwindElfCache.
+  size_t UpdateMaps(const MapSet& map_set);
+  // Add ELF files loaded by libunwindstack for maps hit by [frames] to UnwindElfCache. Return
+  // count of ELF files added.
+  size_t AddLoadedElfsToCache(const std::vector<unwindstack::FrameData>& frames);
 
  private:
+  unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry, bool* elf_cache_hit);
+  void DeleteMapInfo(size_t index);
+
+  struct UncachedElf {
+    std::string key;
+    // Size of the ELF file if it is embedded in an apk, otherwise 0.
+    uint64_t embedded_elf_size;
+  };
+
   uint64_t version_ = 0u;
   std::vector<const MapEntry*> entries_;
+  // MapInfos whose ELF files should be added to UnwindElfCache after loaded by libunwindstack.
+  std::unordered_map<const unwindstack::MapInfo*, UncachedElf> uncached_elfs_;
 };
 
 class OfflineUnwinder {
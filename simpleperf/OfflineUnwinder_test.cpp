@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OfflineUnwinder.h"
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Elf.h>
+
+using namespace simpleperf;
+
+static std::shared_ptr<unwindstack::Elf> CreateElf() {
+  return std::shared_ptr<unwindstack::Elf>(new unwindstack::Elf(nullptr));
+}
+
+TEST(UnwindElfCache, get_and_add) {
+  UnwindElfCache cache(100);
+  BuildId build_id1("0102030405");
+  BuildId build_id2("0102030406");
+  std::string key1 = UnwindElfCache::GetKey("/system/lib/libc.so", 0, build_id1);
+  std::string key2 = UnwindElfCache::GetKey("/system/lib/libc.so", 0, build_id2);
+  std::string key3 = UnwindElfCache::GetKey("/data/app/base.apk", 4096, build_id1);
+  ASSERT_NE(key1, key2);
+  ASSERT_NE(key1, key3);
+  uint64_t elf_offset;
+  ASSERT_EQ(cache.Get(key1, &elf_offset), nullptr);
+  std::shared_ptr<unwindstack::Elf> elf1 = CreateElf();
+  cache.Add(key1, elf1, 0, 30);
+  std::shared_ptr<unwindstack::Elf> elf3 = CreateElf();
+  cache.Add(key3, elf3, 4096, 40);
+  ASSERT_EQ(cache.GetMemoryUsage(), 70u);
+  ASSERT_EQ(cache.Get(key1, &elf_offset), elf1);
+  ASSERT_EQ(elf_offset, 0u);
+  ASSERT_EQ(cache.Get(key3, &elf_offset), elf3);
+  ASSERT_EQ(elf_offset, 4096u);
+  ASSERT_EQ(cache.Get(key2, &elf_offset), nullptr);
+  // Adding an existing key doesn't replace the cached elf.
+  cache.Add(key1, CreateElf(), 0, 30);
+  ASSERT_EQ(cache.Get(key3, &elf_offset), elf3);
+  ASSERT_EQ(cache.GetMemoryUsage(), 70u);
+  cache.Clear();
+  ASSERT_EQ(cache.Get(key1, &elf_offset), nullptr);
+  ASSERT_EQ(cache.GetMemoryUsage(), 0u);
+}
+
+TEST(UnwindElfCache, evict_least_recently_used) {
+  UnwindElfCache cache(100);
+  std::shared_ptr<unwindstack::Elf> elf1 = CreateElf();
+  std::shared_ptr<unwindstack::Elf> elf2 = CreateElf();
+  std::shared_ptr<unwindstack::Elf> elf3 = CreateElf();
+  cache.Add("1", elf1, 0, 40);
+  cache.Add("2", elf2, 0, 40);
+  uint64_t elf_offset;
+  // Make "2" the least recently used.
+  ASSERT_EQ(cache.Get("1", &elf_offset), elf1);
+  cache.Add("3", elf3, 0, 40);
+  ASSERT_EQ(cache.GetMemoryUsage(), 80u);
+  ASSERT_EQ(cache.Get("1", &elf_offset), elf1);
+  ASSERT_EQ(cache.Get("2", &elf_offset), nullptr);
+  ASSERT_EQ(cache.Get("3", &elf_offset), elf3);
+  // Evicted elfs are still usable by their owners.
+  ASSERT_EQ(elf2.use_count(), 1);
+
+  cache.SetMemoryLimit(50);
+  ASSERT_EQ(cache.GetMemoryUsage(), 40u);
+  ASSERT_EQ(cache.Get("1", &elf_offset), nullptr);
+  ASSERT_EQ(cache.Get("3", &elf_offset), elf3);
+}
@@ -23,6 +23,7 @@
 #include <unordered_map>
 
 #include "environment.h"
+#include "perf_regs.h"
 #include "record.h"
 
 namespace simpleperf {
@@ -108,8 +109,12 @@ RecordParser::RecordParser(const perf_event_attr& attr)
     : sample_type_(attr.sample_type),
       sample_regs_count_(__builtin_popcountll(attr.sample_regs_user)) {
   size_t pos = sizeof(perf_event_header);
-  uint64_t mask = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID;
+  uint64_t mask = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP;
   pos += __builtin_popcountll(sample_type_ & mask) * sizeof(uint64_t);
+  if (sample_type_ & PERF_SAMPLE_TID) {
+    pid_pos_in_sample_records_ = pos;
+    pos += sizeof(uint64_t);
+  }
   if (sample_type_ & PERF_SAMPLE_TIME) {
     time_pos_in_sample_records_ = pos;
     pos += sizeof(uint64_t);
@@ -136,8 +141,12 @@ size_t RecordParser::GetTimePos(const perf_event_header& header) const {
   return 0;
 }
 
+size_t RecordParser::GetPidPos(const perf_event_header& header) const {
+  return header.type == PERF_RECORD_SAMPLE ? pid_pos_in_sample_records_ : 0;
+}
+
 size_t RecordParser::GetStackSizePos(
-    const std::function<void(size_t,size_t,void*)>& read_record_fn) const{
+    const std::function<void(size_t,size_t,void*)>& read_record_fn, size_t* user_regs_pos) const{
   size_t pos = callchain_pos_in_sample_records_;
   if (sample_type_ & PERF_SAMPLE_CALLCHAIN) {
     uint64_t ip_nr;
@@ -154,6 +163,9 @@ size_t RecordParser::GetStackSizePos(
     read_record_fn(pos, sizeof(stack_nr), &stack_nr);
     pos += sizeof(uint64_t) + stack_nr * sizeof(BranchStackItemType);
   }
+  if (user_regs_pos != nullptr) {
+    *user_regs_pos = (sample_type_ & PERF_SAMPLE_REGS_USER) ? pos : 0;
+  }
   if (sample_type_ & PERF_SAMPLE_REGS_USER) {
     uint64_t abi;
     read_record_fn(pos, sizeof(abi), &abi);
@@ -204,12 +216,18 @@ bool KernelRecordReader::MoveToNextRecord(const RecordParser& parser) {
 }
 
 RecordReadThread::RecordReadThread(size_t record_buffer_size, const perf_event_attr& attr,
-                                   size_t min_mmap_pages, size_t max_mmap_pages)
-    : record_buffer_(record_buffer_size), record_parser_(attr), attr_(attr),
-      min_mmap_pages_(min_mmap_pages), max_mmap_pages_(max_mmap_pages) {
+                                   size_t min_mmap_pages, size_t max_mmap_pages,
+                                   size_t reader_thread_count)
+    : record_parser_(attr), attr_(attr), min_mmap_pages_(min_mmap_pages),
+      max_mmap_pages_(max_mmap_pages) {
   if (attr.sample_type & PERF_SAMPLE_STACK_USER) {
     stack_size_in_sample_record_ = attr.sample_stack_user;
   }
+  reader_thread_count = std::max<size_t>(reader_thread_count, 1);
+  size_t shard_buffer_size = record_buffer_size / reader_thread_count;
+  for (size_t i = 0; i < reader_thread_count; ++i) {
+    shards_.emplace_back(new ReadShard(shard_buffer_size));
+  }
   record_buffer_low_level_ = std::min(record_buffer_size / 4, kDefaultLowBufferLevel);
   record_buffer_critical_level_ = std::min(record_buffer_size / 6, kDefaultCriticalBufferLevel);
 }
@@ -280,11 +298,50 @@ bool RecordReadThread::SendCmdToReadThread(Cmd cmd, void* cmd_arg) {
 }
 
 std::unique_ptr<Record> RecordReadThread::GetRecord() {
-  record_buffer_.MoveToNextRecord();
-  char* p = record_buffer_.GetCurrentRecord();
+  char* p = GetRecordData();
   if (p != nullptr) {
     return ReadRecordFromBuffer(attr_, p);
   }
+  return nullptr;
+}
+
+char* RecordReadThread::GetRecordData() {
+  ReadShard& last_shard = *shards_[last_read_shard_];
+  if (last_shard.current_record != nullptr) {
+    last_shard.record_buffer.MoveToNextRecord();
+    last_shard.current_record = nullptr;
+    last_shard.read_records++;
+  }
+  // Return the record with the smallest time among the current records of all shards. With
+  // multiple shards, records of an unfinished round aren't read, because other shards may still
+  // push records with smaller time in the round.
+  ReadShard* selected = nullptr;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    ReadShard& shard = *shards_[i];
+    if (shard.current_record == nullptr) {
+      if (shards_.size() > 1u && shard.read_records == shard.readable_records.load()) {
+        continue;
+      }
+      shard.current_record = shard.record_buffer.GetCurrentRecord();
+      if (shard.current_record == nullptr) {
+        continue;
+      }
+      perf_event_header header;
+      memcpy(&header, shard.current_record, sizeof(header));
+      size_t time_pos = record_parser_.GetTimePos(header);
+      shard.current_record_time = 0;
+      if (time_pos != 0) {
+        memcpy(&shard.current_record_time, shard.current_record + time_pos, sizeof(uint64_t));
+      }
+    }
+    if (selected == nullptr || shard.current_record_time < selected->current_record_time) {
+      selected = &shard;
+      last_read_shard_ = i;
+    }
+  }
+  if (selected != nullptr) {
+    return selected->current_record;
+  }
   if (has_data_notification_) {
     char dummy;
     TEMP_FAILURE_RETRY(read(read_data_fd_, &dummy, 1));
@@ -293,11 +350,63 @@ std::unique_ptr<Record> RecordReadThread::GetRecord() {
   return nullptr;
 }
 
+void RecordReadThread::GetLostRecords(size_t* lost_samples, size_t* lost_non_samples,
+                                      size_t* cut_stack_samples) {
+  *lost_samples = *lost_non_samples = *cut_stack_samples = 0;
+  for (auto& shard : shards_) {
+    *lost_samples += shard->lost_samples;
+    *lost_non_samples += shard->lost_non_samples;
+    *cut_stack_samples += shard->cut_stack_samples;
+  }
+}
+
 void RecordReadThread::RunReadThread() {
   IncreaseThreadPriority();
+  size_t start_round;
+  {
+    std::lock_guard<std::mutex> lock(shard_mutex_);
+    stop_shard_threads_ = false;
+    start_round = shard_round_;
+  }
+  // Shard threads wait for rounds after start_round. Reading shard_round_ in shard threads
+  // instead may miss a round started before they run.
+  for (size_t i = 1; i < shards_.size(); ++i) {
+    shard_threads_.emplace_back([this, i, start_round]() { RunShardThread(i, start_round); });
+  }
   IOEventLoop loop;
   CHECK(loop.AddReadEvent(read_cmd_fd_, [&]() { return HandleCmd(loop); }));
   loop.RunLoop();
+  {
+    std::lock_guard<std::mutex> lock(shard_mutex_);
+    stop_shard_threads_ = true;
+  }
+  shard_start_cond_.notify_all();
+  for (auto& thread : shard_threads_) {
+    thread.join();
+  }
+  shard_threads_.clear();
+}
+
+void RecordReadThread::RunShardThread(size_t shard_index, size_t finished_round) {
+  IncreaseThreadPriority();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(shard_mutex_);
+      shard_start_cond_.wait(lock, [&]() {
+        return stop_shard_threads_ || shard_round_ != finished_round;
+      });
+      if (stop_shard_threads_) {
+        break;
+      }
+      finished_round = shard_round_;
+    }
+    bool has_data = ReadRecordsFromShard(*shards_[shard_index]);
+    std::lock_guard<std::mutex> lock(shard_mutex_);
+    shard_has_data_ |= has_data;
+    if (--pending_shards_ == 0) {
+      shard_finish_cond_.notify_one();
+    }
+  }
 }
 
 void RecordReadThread::IncreaseThreadPriority() {
@@ -382,7 +491,13 @@ bool RecordReadThread::HandleAddEventFds(IOEventLoop& loop,
     if (!pair.second->StartPolling(loop, [this]() { return ReadRecordsFromKernelBuffer(); })) {
       return false;
     }
-    kernel_record_readers_.emplace_back(pair.second);
+    // Put the kernel buffer in the shard having the fewest kernel buffers.
+    auto shard = std::min_element(shards_.begin(), shards_.end(),
+                                  [](const std::unique_ptr<ReadShard>& s1,
+                                     const std::unique_ptr<ReadShard>& s2) {
+      return s1->kernel_record_readers.size() < s2->kernel_record_readers.size();
+    });
+    (*shard)->kernel_record_readers.emplace_back(pair.second);
   }
   return true;
 }
@@ -390,20 +505,61 @@ bool RecordReadThread::HandleAddEventFds(IOEventLoop& loop,
 bool RecordReadThread::HandleRemoveEventFds(const std::vector<EventFd*>& event_fds) {
   for (auto& event_fd : event_fds) {
     if (event_fd->HasMappedBuffer()) {
-      auto it = std::find_if(kernel_record_readers_.begin(), kernel_record_readers_.end(),
-                             [&](const KernelRecordReader& reader) {
-                               return reader.GetEventFd() == event_fd;
-      });
-      if (it != kernel_record_readers_.end()) {
-        kernel_record_readers_.erase(it);
-        event_fd->StopPolling();
-        event_fd->DestroyMappedBuffer();
+      for (auto& shard : shards_) {
+        auto& readers = shard->kernel_record_readers;
+        auto it = std::find_if(readers.begin(), readers.end(),
+                               [&](const KernelRecordReader& reader) {
+                                 return reader.GetEventFd() == event_fd;
+        });
+        if (it != readers.end()) {
+          readers.erase(it);
+          event_fd->StopPolling();
+          event_fd->DestroyMappedBuffer();
+          break;
+        }
       }
     }
   }
   return true;
 }
 
+bool RecordReadThread::ReadRecordsFromKernelBuffer() {
+  do {
+    if (!ReadRecordsFromShards()) {
+      break;
+    }
+    if (!SendDataNotificationToMainThread()) {
+      return false;
+    }
+    // If there are no commands, we can loop until there is no more data from the kernel.
+  } while (GetCmd() == NO_CMD);
+  return true;
+}
+
+// Read one round of records from all shards. Shard 0 is read in the current thread, while other
+// shards are read in parallel by shard threads. Return true if any shard has data.
+bool RecordReadThread::ReadRecordsFromShards() {
+  if (shards_.size() == 1u) {
+    return ReadRecordsFromShard(*shards_[0]);
+  }
+  {
+    std::lock_guard<std::mutex> lock(shard_mutex_);
+    shard_has_data_ = false;
+    pending_shards_ = shards_.size() - 1;
+    shard_round_++;
+  }
+  shard_start_cond_.notify_all();
+  bool has_data = ReadRecordsFromShard(*shards_[0]);
+  std::unique_lock<std::mutex> lock(shard_mutex_);
+  shard_finish_cond_.wait(lock, [&]() { return pending_shards_ == 0; });
+  // All shards have drained their kernel buffers in this round. So records pushed in the round
+  // can be merged by time in the main thread.
+  for (auto& shard : shards_) {
+    shard->readable_records.store(shard->pushed_records);
+  }
+  return has_data || shard_has_data_;
+}
+
 static bool CompareRecordTime(KernelRecordReader* r1, KernelRecordReader* r2) {
   return r1->RecordTime() > r2->RecordTime();
 }
@@ -411,58 +567,69 @@ static bool CompareRecordTime(KernelRecordReader* r1, KernelRecordReader* r2) {
 // When reading from mmap buffers, we prefer reading from all buffers at once rather than reading
 // one buffer at a time. Because by reading all buffers at once, we can merge records from
 // different buffers easily in memory. Otherwise, we have to sort records with greater effort.
-bool RecordReadThread::ReadRecordsFromKernelBuffer() {
-  do {
-    std::vector<KernelRecordReader*> readers;
-    for (auto& reader : kernel_record_readers_) {
-      if (reader.GetDataFromKernelBuffer()) {
-        readers.push_back(&reader);
-      }
+bool RecordReadThread::ReadRecordsFromShard(ReadShard& shard) {
+  std::vector<KernelRecordReader*> readers;
+  for (auto& reader : shard.kernel_record_readers) {
+    if (reader.GetDataFromKernelBuffer()) {
+      readers.push_back(&reader);
     }
-    if (readers.empty()) {
-      break;
+  }
+  if (readers.empty()) {
+    return false;
+  }
+  if (readers.size() == 1u) {
+    // Only one buffer has data, process it directly.
+    while (readers[0]->MoveToNextRecord(record_parser_)) {
+      PushRecordToRecordBuffer(shard, readers[0]);
     }
-    if (readers.size() == 1u) {
-      // Only one buffer has data, process it directly.
-      while (readers[0]->MoveToNextRecord(record_parser_)) {
-        PushRecordToRecordBuffer(readers[0]);
-      }
-    } else {
-      // Use a binary heap to merge records from different buffers. As records from the same buffer
-      // are already ordered by time, we only need to merge the first record from all buffers. And
-      // each time a record is popped from the heap, we put the next record from its buffer into
-      // the heap.
-      for (auto& reader : readers) {
-        reader->MoveToNextRecord(record_parser_);
-      }
-      std::make_heap(readers.begin(), readers.end(), CompareRecordTime);
-      size_t size = readers.size();
-      while (size > 0) {
-        std::pop_heap(readers.begin(), readers.begin() + size, CompareRecordTime);
-        PushRecordToRecordBuffer(readers[size - 1]);
-        if (readers[size - 1]->MoveToNextRecord(record_parser_)) {
-          std::push_heap(readers.begin(), readers.begin() + size, CompareRecordTime);
-        } else {
-          size--;
-        }
-      }
+  } else {
+    // Use a binary heap to merge records from different buffers. As records from the same buffer
+    // are already ordered by time, we only need to merge the first record from all buffers. And
+    // each time a record is popped from the heap, we put the next record from its buffer into
+    // the heap.
+    for (auto& reader : readers) {
+      reader->MoveToNextRecord(record_parser_);
     }
-    if (!SendDataNotificationToMainThread()) {
-      return false;
+    std::make_heap(readers.begin(), readers.end(), CompareRecordTime);
+    size_t size = readers.size();
+    while (size > 0) {
+      std::pop_heap(readers.begin(), readers.begin() + size, CompareRecordTime);
+      PushRecordToRecordBuffer(shard, readers[size - 1]);
+      if (readers[size - 1]->MoveToNextRecord(record_parser_)) {
+        std::push_heap(readers.begin(), readers.begin() + size, CompareRecordTime);
+      } else {
+        size--;
+      }
     }
-    // If there are no commands, we can loop until there is no more data from the kernel.
-  } while (GetCmd() == NO_CMD);
+  }
   return true;
 }
 
-void RecordReadThread::PushRecordToRecordBuffer(KernelRecordReader* kernel_record_reader) {
+// Buffer levels are for the total size of record buffers. Return the free size of all record
+// buffers, but not more than the free size of [shard] scaled to the total size. So a shard with
+// a nearly full record buffer can still save space for non-sample records.
+size_t RecordReadThread::GetFreeSizeOfRecordBuffers(const ReadShard& shard) const {
+  size_t shard_free_size = shard.record_buffer.GetFreeSize();
+  if (shards_.size() == 1u) {
+    return shard_free_size;
+  }
+  size_t total_free_size = 0;
+  for (auto& s : shards_) {
+    total_free_size += s->record_buffer.GetFreeSize();
+  }
+  return std::min(total_free_size, shard_free_size * shards_.size());
+}
+
+void RecordReadThread::PushRecordToRecordBuffer(ReadShard& shard,
+                                                KernelRecordReader* kernel_record_reader) {
+  RecordBuffer& record_buffer = shard.record_buffer;
   const perf_event_header& header = kernel_record_reader->RecordHeader();
   if (header.type == PERF_RECORD_SAMPLE && stack_size_in_sample_record_ > 1024) {
-    size_t free_size = record_buffer_.GetFreeSize();
+    size_t free_size = GetFreeSizeOfRecordBuffers(shard);
     if (free_size < record_buffer_critical_level_) {
       // When the free size in record buffer is below critical level, drop sample records to save
       // space for more important records (like mmap or fork records).
-      lost_samples_++;
+      shard.lost_samples++;
       return;
     }
     size_t stack_size_limit = stack_size_in_sample_record_;
@@ -472,10 +639,11 @@ void RecordReadThread::PushRecordToRecordBuffer(KernelRecordReader* kernel_recor
       // the call chain joiner can complete the callchains.
       stack_size_limit = 1024;
     }
+    size_t user_regs_pos;
     size_t stack_size_pos = record_parser_.GetStackSizePos(
         [&](size_t pos, size_t size, void* dest) {
           return kernel_record_reader->ReadRecord(pos, size, dest);
-    });
+    }, &user_regs_pos);
     uint64_t stack_size;
     kernel_record_reader->ReadRecord(stack_size_pos, sizeof(stack_size), &stack_size);
     if (stack_size > 0) {
@@ -489,6 +657,15 @@ void RecordReadThread::PushRecordToRecordBuffer(KernelRecordReader* kernel_recor
         // TODO: Add cts test.
         dyn_stack_size = stack_size;
       }
+      if (trim_stack_by_fp_ && user_regs_pos != 0) {
+        // Stack data above the outermost frame isn't used by unwinding.
+        uint64_t used_stack_size = GetStackSizeUsedByFrames(
+            kernel_record_reader, user_regs_pos, stack_size_pos + sizeof(stack_size),
+            dyn_stack_size);
+        if (used_stack_size != 0) {
+          dyn_stack_size = used_stack_size;
+        }
+      }
       // When simpleperf requests the kernel to dump 64K stack per sample, it will allocate 64K
       // space in each sample to store stack data. However, a thread may use less stack than 64K.
       // So not all the 64K stack data in a sample is valid, and we only need to keep valid stack
@@ -498,7 +675,7 @@ void RecordReadThread::PushRecordToRecordBuffer(KernelRecordReader* kernel_recor
         // Remove part of the stack data.
         perf_event_header new_header = header;
         new_header.size -= stack_size - new_stack_size;
-        char* p = record_buffer_.AllocWriteSpace(new_header.size);
+        char* p = record_buffer.AllocWriteSpace(new_header.size);
         if (p != nullptr) {
           memcpy(p, &new_header, sizeof(new_header));
           size_t pos = sizeof(new_header);
@@ -507,30 +684,84 @@ void RecordReadThread::PushRecordToRecordBuffer(KernelRecordReader* kernel_recor
           pos = stack_size_pos + sizeof(uint64_t);
           kernel_record_reader->ReadRecord(pos, new_stack_size, p + pos);
           memcpy(p + pos + new_stack_size, &new_stack_size, sizeof(uint64_t));
-          record_buffer_.FinishWrite();
+          record_buffer.FinishWrite();
+          shard.pushed_records++;
           if (new_stack_size < dyn_stack_size) {
-            cut_stack_samples_++;
+            shard.cut_stack_samples++;
           }
         } else {
-          lost_samples_++;
+          shard.lost_samples++;
         }
         return;
       }
     }
   }
-  char* p = record_buffer_.AllocWriteSpace(header.size);
+  char* p = record_buffer.AllocWriteSpace(header.size);
   if (p != nullptr) {
     kernel_record_reader->ReadRecord(0, header.size, p);
-    record_buffer_.FinishWrite();
+    record_buffer.FinishWrite();
+    shard.pushed_records++;
   } else {
     if (header.type == PERF_RECORD_SAMPLE) {
-      lost_samples_++;
+      shard.lost_samples++;
     } else {
-      lost_non_samples_++;
+      shard.lost_non_samples++;
     }
   }
 }
 
+// Walk the frame pointer chain in the stack data of the current sample record. Return the size of
+// stack data used by the found frames if the walk reaches the outermost frame, otherwise return 0.
+uint64_t RecordReadThread::GetStackSizeUsedByFrames(KernelRecordReader* kernel_record_reader,
+                                                    size_t user_regs_pos, size_t stack_pos,
+                                                    uint64_t stack_size) {
+  uint64_t abi;
+  kernel_record_reader->ReadRecord(user_regs_pos, sizeof(abi), &abi);
+  if (abi == 0) {
+    return 0;
+  }
+  uint64_t regs[64];
+  size_t reg_count = __builtin_popcountll(attr_.sample_regs_user);
+  kernel_record_reader->ReadRecord(user_regs_pos + sizeof(abi), reg_count * sizeof(uint64_t),
+                                   regs);
+  RegSet reg_set(abi, attr_.sample_regs_user, regs);
+  uint64_t sp;
+  uint64_t fp;
+  if (!reg_set.GetSpRegValue(&sp) || !reg_set.GetFpRegValue(&fp)) {
+    return 0;
+  }
+  // A frame record is {the caller's frame pointer, the return address}. Frame records of callers
+  // are at higher addresses, and the outermost frame has a zero caller's frame pointer.
+  // The frame pointer register can be used for other purposes, and a zero word is common in stack
+  // data. To avoid cutting stack data used by callers, only trust a chain of at least two frame
+  // records, each with a non-zero return address.
+  constexpr uint64_t frame_record_size = 2 * sizeof(uint64_t);
+  constexpr size_t min_frame_count = 2;
+  size_t frame_count = 0;
+  while (fp >= sp && fp % sizeof(uint64_t) == 0 && fp - sp < stack_size &&
+         stack_size - (fp - sp) >= frame_record_size) {
+    uint64_t frame_record[2];
+    kernel_record_reader->ReadRecord(stack_pos + (fp - sp), frame_record_size, frame_record);
+    uint64_t caller_fp = frame_record[0];
+    uint64_t return_addr = frame_record[1];
+    if (return_addr == 0) {
+      break;
+    }
+    frame_count++;
+    if (caller_fp == 0) {
+      if (frame_count < min_frame_count) {
+        break;
+      }
+      return fp - sp + frame_record_size;
+    }
+    if (caller_fp <= fp) {
+      break;
+    }
+    fp = caller_fp;
+  }
+  return 0;
+}
+
 bool RecordReadThread::SendDataNotificationToMainThread() {
   if (!has_data_notification_.load(std::memory_order_relaxed)) {
     has_data_notification_ = true;
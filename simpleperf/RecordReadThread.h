@@ -24,6 +24,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/macros.h>
 #include <android-base/unique_fd.h>
@@ -41,7 +42,8 @@ class RecordBuffer {
   RecordBuffer(size_t buffer_size);
   size_t size() const { return buffer_size_; }
 
-  // Return the size of writable space in the buffer.
+  // Return the size of writable space in the buffer. It can be called in threads other than the
+  // write thread, to get a recent size.
   size_t GetFreeSize() const;
   // Allocate a writable space for a record. Return nullptr if there isn't enough space.
   char* AllocWriteSpace(size_t record_size);
@@ -71,12 +73,18 @@ class RecordParser {
 
   // Return pos of the time field in the record. If not available, return 0.
   size_t GetTimePos(const perf_event_header& header) const;
+  // Return pos of the pid field in the sample record. If not available, return 0.
+  size_t GetPidPos(const perf_event_header& header) const;
   // Return pos of the user stack size field in the sample record. If not available, return 0.
-  size_t GetStackSizePos(const std::function<void(size_t,size_t,void*)>& read_record_fn) const;
+  // If [user_regs_pos] isn't nullptr, it is set to pos of the user regs abi field, or 0 if not
+  // available.
+  size_t GetStackSizePos(const std::function<void(size_t,size_t,void*)>& read_record_fn,
+                         size_t* user_regs_pos = nullptr) const;
 
  private:
   uint64_t sample_type_;
   uint64_t sample_regs_count_;
+  size_t pid_pos_in_sample_records_ = 0;
   size_t time_pos_in_sample_records_ = 0;
   size_t time_rpos_in_non_sample_records_ = 0;
   size_t callchain_pos_in_sample_records_ = 0;
@@ -112,15 +120,23 @@ class KernelRecordReader {
 
 // To reduce sample lost rate when recording dwarf based call graph, RecordReadThread uses a
 // separate high priority (nice -20) thread to read records from kernel buffers to a RecordBuffer.
+// When reader_thread_count > 1, kernel buffers are split into reader_thread_count shards. Each
+// shard is read by its own thread into its own RecordBuffer, and records from all shards are
+// merged by time when the main thread reads them. To merge records like reading all kernel buffers
+// in one thread, the main thread only reads records of finished rounds (in which all shards have
+// drained their kernel buffers).
 class RecordReadThread {
  public:
   RecordReadThread(size_t record_buffer_size, const perf_event_attr& attr, size_t min_mmap_pages,
-                   size_t max_mmap_pages);
+                   size_t max_mmap_pages, size_t reader_thread_count = 1);
   ~RecordReadThread();
   void SetBufferLevels(size_t record_buffer_low_level, size_t record_buffer_critical_level) {
     record_buffer_low_level_ = record_buffer_low_level;
     record_buffer_critical_level_ = record_buffer_critical_level;
   }
+  // If enabled, stack data in sample records is trimmed to the frames found by walking frame
+  // pointers, when the walk reaches the outermost frame.
+  void SetTrimStackByFramePointers(bool enable) { trim_stack_by_fp_ = enable; }
 
   // Below functions are called in the main thread:
 
@@ -137,13 +153,33 @@ class RecordReadThread {
 
   // If available, return the next record in the RecordBuffer, otherwise return nullptr.
   std::unique_ptr<Record> GetRecord();
-  void GetLostRecords(size_t* lost_samples, size_t* lost_non_samples, size_t* cut_stack_samples) {
-    *lost_samples = lost_samples_;
-    *lost_non_samples = lost_non_samples_;
-    *cut_stack_samples = cut_stack_samples_;
-  }
+  // If available, return data of the next record in the RecordBuffer, otherwise return nullptr.
+  // The data is only valid until the next call of GetRecord() or GetRecordData().
+  char* GetRecordData();
+  void GetLostRecords(size_t* lost_samples, size_t* lost_non_samples, size_t* cut_stack_samples);
 
  private:
+  // A shard contains a subset of kernel buffers, and the RecordBuffer they are read into.
+  struct ReadShard {
+    ReadShard(size_t record_buffer_size) : record_buffer(record_buffer_size) {}
+
+    RecordBuffer record_buffer;
+    std::vector<KernelRecordReader> kernel_record_readers;
+    // Count of records pushed to record_buffer, only used by the thread reading the shard.
+    uint64_t pushed_records = 0;
+    // Count of records pushed in finished rounds, which can be read by the main thread.
+    std::atomic<uint64_t> readable_records{0};
+    // Count of records read by the main thread.
+    uint64_t read_records = 0;
+    // The record got from record_buffer but not returned by GetRecord() yet.
+    char* current_record = nullptr;
+    uint64_t current_record_time = 0;
+
+    size_t lost_samples = 0;
+    size_t lost_non_samples = 0;
+    size_t cut_stack_samples = 0;
+  };
+
   enum Cmd {
     NO_CMD,
     CMD_ADD_EVENT_FDS,
@@ -163,10 +199,23 @@ class RecordReadThread {
   bool HandleAddEventFds(IOEventLoop& loop, const std::vector<EventFd*>& event_fds);
   bool HandleRemoveEventFds(const std::vector<EventFd*>& event_fds);
   bool ReadRecordsFromKernelBuffer();
-  void PushRecordToRecordBuffer(KernelRecordReader* kernel_record_reader);
+  bool ReadRecordsFromShards();
+  bool ReadRecordsFromShard(ReadShard& shard);
+  size_t GetFreeSizeOfRecordBuffers(const ReadShard& shard) const;
+  void PushRecordToRecordBuffer(ReadShard& shard, KernelRecordReader* kernel_record_reader);
+  uint64_t GetStackSizeUsedByFrames(KernelRecordReader* kernel_record_reader, size_t user_regs_pos,
+                                    size_t stack_pos, uint64_t stack_size);
   bool SendDataNotificationToMainThread();
 
-  RecordBuffer record_buffer_;
+  // Below functions are called in shard threads:
+
+  // [finished_round] is the value of shard_round_ when the thread is created.
+  void RunShardThread(size_t shard_index, size_t finished_round);
+
+  std::vector<std::unique_ptr<ReadShard>> shards_;
+  // Index of the shard containing the record last returned by GetRecord().
+  size_t last_read_shard_ = 0;
+  // Buffer levels are for the total size of record buffers of all shards.
   // When free size in record buffer is below low level, we cut stack data of sample records to 1K.
   size_t record_buffer_low_level_;
   // When free size in record buffer is below critical level, we drop sample records to avoid
@@ -175,6 +224,7 @@ class RecordReadThread {
   RecordParser record_parser_;
   perf_event_attr attr_;
   size_t stack_size_in_sample_record_ = 0;
+  bool trim_stack_by_fp_ = false;
   size_t min_mmap_pages_;
   size_t max_mmap_pages_;
 
@@ -193,11 +243,17 @@ class RecordReadThread {
   std::atomic_bool has_data_notification_;
 
   std::unique_ptr<std::thread> read_thread_;
-  std::vector<KernelRecordReader> kernel_record_readers_;
 
-  size_t lost_samples_ = 0;
-  size_t lost_non_samples_ = 0;
-  size_t cut_stack_samples_ = 0;
+  // Shard 0 is read by the read thread, other shards are read by shard threads. The read thread
+  // starts a round of reading by increasing shard_round_, and waits until pending_shards_ is 0.
+  std::vector<std::thread> shard_threads_;
+  std::mutex shard_mutex_;
+  std::condition_variable shard_start_cond_;
+  std::condition_variable shard_finish_cond_;
+  size_t shard_round_ = 0;
+  size_t pending_shards_ = 0;
+  bool shard_has_data_ = false;
+  bool stop_shard_threads_ = false;
 };
 
 }  // namespace simpleperf
@@ -19,13 +19,19 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <future>
+#include <thread>
+
 #include "event_type.h"
 #include "get_test_data.h"
 #include "record.h"
 #include "record_file.h"
+#include "utils.h"
 
 using ::testing::_;
 using ::testing::Eq;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::Truly;
 
@@ -91,6 +97,11 @@ TEST(RecordParser, smoke) {
       read_record_fn(pos, sizeof(time), &time);
       ASSERT_EQ(record->Timestamp(), time);
       if (record->type() == PERF_RECORD_SAMPLE) {
+        pos = parser.GetPidPos(header);
+        ASSERT_NE(0u, pos);
+        uint32_t pid;
+        read_record_fn(pos, sizeof(pid), &pid);
+        ASSERT_EQ(static_cast<SampleRecord*>(record.get())->tid_data.pid, pid);
         pos = parser.GetStackSizePos(read_record_fn);
         ASSERT_NE(0u, pos);
         uint64_t stack_size;
@@ -338,6 +349,115 @@ TEST_F(RecordReadThreadTest, process_sample_record) {
   ASSERT_EQ(cut_stack_samples, 1u);
 }
 
+TEST_F(RecordReadThreadTest, trim_stack_by_frame_pointers) {
+  ScopedCurrentArch scoped_arch(ARCH_ARM64);
+  perf_event_attr attr = CreateFakeEventAttr();
+  attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+  attr.sample_regs_user = (1ULL << PERF_REG_ARM64_X29) | (1ULL << PERF_REG_ARM64_SP);
+  attr.sample_stack_user = 64 * 1024;
+  RecordReadThread thread(128 * 1024, attr, 1, 1);
+  thread.SetBufferLevels(0, 0);
+  thread.SetTrimStackByFramePointers(true);
+  IOEventLoop loop;
+  ASSERT_TRUE(thread.RegisterDataCallback(loop, []() { return true; }));
+
+  // Build a sample record with 4K stack data starting at sp, and frame records at
+  // sp + 0x100 and sp + 0x400.
+  const uint64_t sp = 0x10000;
+  const uint64_t stack_size = 4096;
+  auto create_record = [&](uint64_t caller_fp_of_first_frame, std::vector<char>& data,
+                           uint64_t return_addr_of_second_frame = 0x1000) {
+    perf_event_header header;
+    header.type = PERF_RECORD_SAMPLE;
+    header.misc = PERF_RECORD_MISC_USER;
+    header.size = sizeof(header) + 5 * sizeof(uint64_t) + stack_size + sizeof(uint64_t);
+    std::vector<uint64_t> fields = {1, PERF_SAMPLE_REGS_ABI_64, sp + 0x100, sp, stack_size};
+    std::vector<char> stack(stack_size, 0);
+    uint64_t return_addr_of_first_frame = 0x2000;
+    memcpy(stack.data() + 0x100, &caller_fp_of_first_frame, sizeof(uint64_t));
+    memcpy(stack.data() + 0x108, &return_addr_of_first_frame, sizeof(uint64_t));
+    memcpy(stack.data() + 0x408, &return_addr_of_second_frame, sizeof(uint64_t));
+    data.resize(header.size);
+    char* p = data.data();
+    MoveToBinaryFormat(header, p);
+    MoveToBinaryFormat(fields.data(), fields.size(), p);
+    MoveToBinaryFormat(stack.data(), stack.size(), p);
+    MoveToBinaryFormat(stack_size, p);
+    records_.clear();
+    records_.push_back(ReadRecordFromBuffer(attr, data.data()));
+  };
+  auto read_record = [&](std::unique_ptr<Record>& r) {
+    std::vector<EventFd*> event_fds = CreateFakeEventFds(attr, 1);
+    ASSERT_TRUE(thread.AddEventFds(event_fds));
+    ASSERT_TRUE(thread.SyncKernelBuffer());
+    ASSERT_TRUE(thread.RemoveEventFds(event_fds));
+    r = thread.GetRecord();
+  };
+
+  // The walk reaches the outermost frame at sp + 0x400, so stack data after its frame record is
+  // removed.
+  std::vector<char> data;
+  create_record(sp + 0x400, data);
+  std::unique_ptr<Record> r;
+  read_record(r);
+  ASSERT_TRUE(r);
+  SampleRecord* sr = static_cast<SampleRecord*>(r.get());
+  ASSERT_EQ(sr->stack_user_data.size, 0x410u);
+  ASSERT_EQ(sr->stack_user_data.dyn_size, 0x410u);
+
+  // The frame pointer chain is broken, so the stack data is kept.
+  create_record(sp, data);
+  read_record(r);
+  ASSERT_TRUE(r);
+  sr = static_cast<SampleRecord*>(r.get());
+  ASSERT_EQ(sr->stack_user_data.size, stack_size);
+
+  // A zero word at the frame pointer isn't trusted as the outermost frame record, without a
+  // caller frame record.
+  create_record(0, data);
+  read_record(r);
+  ASSERT_TRUE(r);
+  sr = static_cast<SampleRecord*>(r.get());
+  ASSERT_EQ(sr->stack_user_data.size, stack_size);
+
+  // A frame record without a return address isn't trusted.
+  create_record(sp + 0x400, data, 0);
+  read_record(r);
+  ASSERT_TRUE(r);
+  sr = static_cast<SampleRecord*>(r.get());
+  ASSERT_EQ(sr->stack_user_data.size, stack_size);
+  size_t lost_samples;
+  size_t lost_non_samples;
+  size_t cut_stack_samples;
+  thread.GetLostRecords(&lost_samples, &lost_non_samples, &cut_stack_samples);
+  ASSERT_EQ(cut_stack_samples, 0u);
+}
+
+TEST_F(RecordReadThreadTest, get_record_data) {
+  perf_event_attr attr = CreateFakeEventAttr();
+  RecordReadThread thread(128 * 1024, attr, 1, 1);
+  IOEventLoop loop;
+  size_t record_index = 0;
+  auto callback = [&]() {
+    char* p;
+    while ((p = thread.GetRecordData()) != nullptr) {
+      std::unique_ptr<Record>& expected = records_[record_index++];
+      if (memcmp(p, expected->Binary(), expected->size()) != 0) {
+        return false;
+      }
+    }
+    return loop.ExitLoop();
+  };
+  ASSERT_TRUE(thread.RegisterDataCallback(loop, callback));
+  records_ = CreateFakeRecords(attr, 20, 0, 0);
+  std::vector<EventFd*> event_fds = CreateFakeEventFds(attr, 2);
+  ASSERT_TRUE(thread.AddEventFds(event_fds));
+  ASSERT_TRUE(thread.SyncKernelBuffer());
+  ASSERT_TRUE(loop.RunLoop());
+  ASSERT_EQ(record_index, records_.size());
+  ASSERT_TRUE(thread.RemoveEventFds(event_fds));
+}
+
 // Test that the data notification exists until the RecordBuffer is empty. So we can read all
 // records even if reading one record at a time.
 TEST_F(RecordReadThreadTest, has_data_notification_until_buffer_empty) {
@@ -365,3 +485,118 @@ TEST_F(RecordReadThreadTest, has_data_notification_until_buffer_empty) {
   ASSERT_EQ(record_index, records_.size());
   ASSERT_TRUE(thread.RemoveEventFds(event_fds));
 }
+
+TEST_F(RecordReadThreadTest, read_records_with_multiple_reader_threads) {
+  perf_event_attr attr = CreateFakeEventAttr();
+  for (size_t reader_thread_count = 2; reader_thread_count < 5; ++reader_thread_count) {
+    RecordReadThread thread(128 * 1024, attr, 1, 1, reader_thread_count);
+    IOEventLoop loop;
+    size_t record_index = 0;
+    auto callback = [&]() {
+      while (true) {
+        std::unique_ptr<Record> r = thread.GetRecord();
+        if (!r) {
+          break;
+        }
+        // Records from different shards should be merged by time.
+        std::unique_ptr<Record>& expected = records_[record_index++];
+        if (r->size() != expected->size() ||
+            memcmp(r->Binary(), expected->Binary(), r->size()) != 0) {
+          return false;
+        }
+      }
+      return loop.ExitLoop();
+    };
+    ASSERT_TRUE(thread.RegisterDataCallback(loop, callback));
+    records_ = CreateFakeRecords(attr, 80, 0, 0);
+    std::vector<EventFd*> event_fds = CreateFakeEventFds(attr, 8);
+    ASSERT_TRUE(thread.AddEventFds(event_fds));
+    ASSERT_TRUE(thread.SyncKernelBuffer());
+    ASSERT_TRUE(loop.RunLoop());
+    ASSERT_EQ(record_index, records_.size());
+    ASSERT_TRUE(thread.RemoveEventFds(event_fds));
+    ASSERT_TRUE(thread.StopReadThread());
+  }
+}
+
+// Without SyncKernelBuffer(), records are read by the read thread while the main thread reads
+// them. Records of a shard shouldn't be returned before other shards finish the round.
+TEST_F(RecordReadThreadTest, merge_records_of_shards_while_reading) {
+  perf_event_attr attr = CreateFakeEventAttr();
+  RecordReadThread thread(128 * 1024, attr, 1, 1, 2);
+  IOEventLoop loop;
+  ASSERT_TRUE(thread.RegisterDataCallback(loop, []() { return true; }));
+  // Times of records in the two kernel buffers are interleaved. The first kernel buffer is read
+  // in shard 0, and the second is read in shard 1.
+  records_ = CreateFakeRecords(attr, 20, 0, 0);
+  buffers_.clear();
+  buffers_.resize(2);
+  for (size_t i = 0; i < records_.size(); ++i) {
+    buffers_[i % 2].insert(buffers_[i % 2].end(), records_[i]->Binary(),
+                           records_[i]->Binary() + records_[i]->size());
+  }
+  size_t data_size = buffers_[0].size();
+  size_t buffer_size = AlignToPowerOfTwo(data_size);
+  int trigger_fd[2];
+  ASSERT_EQ(pipe(trigger_fd), 0);
+  std::promise<void> release_shard1;
+  std::shared_future<void> shard1_released = release_shard1.get_future().share();
+  event_fds_.resize(2);
+  for (size_t i = 0; i < 2; ++i) {
+    buffers_[i].resize(buffer_size);
+    event_fds_[i].reset(new MockEventFd(attr, i, buffers_[i].data(), buffer_size));
+    MockEventFd& event_fd = *event_fds_[i];
+    EXPECT_CALL(event_fd, CreateMappedBuffer(_, _)).Times(1).WillOnce(Return(true));
+    if (i == 0) {
+      // Read kernel buffers when the test writes to trigger_fd.
+      int read_fd = trigger_fd[0];
+      EXPECT_CALL(event_fd, StartPolling(_, _)).Times(1).WillOnce(
+          Invoke([read_fd](IOEventLoop& loop, const std::function<bool()>& callback) {
+            return loop.AddReadEvent(read_fd, [read_fd, callback]() {
+              char c;
+              return read(read_fd, &c, 1) == 1 && callback();
+            }) != nullptr;
+          }));
+    } else {
+      EXPECT_CALL(event_fd, StartPolling(_, _)).Times(1).WillOnce(Return(true));
+    }
+    EXPECT_CALL(event_fd, GetAvailableMmapDataSize(_))
+        .WillOnce(Invoke([i, data_size, shard1_released](size_t& data_pos) {
+          if (i == 1) {
+            // Shard 1 is slow.
+            shard1_released.wait();
+          }
+          data_pos = 0;
+          return data_size;
+        }))
+        .WillRepeatedly(Return(0));
+    EXPECT_CALL(event_fd, DiscardMmapData(Eq(data_size))).Times(1);
+    EXPECT_CALL(event_fd, StopPolling()).Times(1).WillOnce(Return(true));
+    EXPECT_CALL(event_fd, DestroyMappedBuffer()).Times(1);
+  }
+  std::vector<EventFd*> event_fds = {event_fds_[0].get(), event_fds_[1].get()};
+  ASSERT_TRUE(thread.AddEventFds(event_fds));
+
+  char c = 0;
+  ASSERT_EQ(write(trigger_fd[1], &c, 1), 1);
+  // Give shard 0 time to push its records. They can't be read while shard 1 is reading.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_TRUE(thread.GetRecord() == nullptr);
+  release_shard1.set_value();
+  size_t record_index = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (record_index < records_.size() && std::chrono::steady_clock::now() < deadline) {
+    std::unique_ptr<Record> r = thread.GetRecord();
+    if (!r) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    std::unique_ptr<Record>& expected = records_[record_index++];
+    ASSERT_EQ(r->Timestamp(), expected->Timestamp());
+  }
+  ASSERT_EQ(record_index, records_.size());
+  ASSERT_TRUE(thread.RemoveEventFds(event_fds));
+  ASSERT_TRUE(thread.StopReadThread());
+  close(trigger_fd[0]);
+  close(trigger_fd[1]);
+}
@@ -19,6 +19,9 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 // The compare functions below are used to compare two samples by their item
@@ -55,13 +58,63 @@ BUILD_COMPARE_VALUE_FUNCTION(CompareTid, thread->tid);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareSampleCount, sample_count);
 BUILD_COMPARE_STRING_FUNCTION(CompareComm, thread_comm);
 BUILD_COMPARE_STRING_FUNCTION(CompareDso, map->dso->Path().c_str());
+BUILD_COMPARE_STRING_FUNCTION(CompareDsoBuildId, map->dso->BuildIdString().c_str());
 BUILD_COMPARE_STRING_FUNCTION(CompareSymbol, symbol->DemangledName());
 BUILD_COMPARE_STRING_FUNCTION(CompareDsoFrom,
                               branch_from.map->dso->Path().c_str());
+BUILD_COMPARE_STRING_FUNCTION(CompareDsoFromBuildId,
+                              branch_from.map->dso->BuildIdString().c_str());
 BUILD_COMPARE_STRING_FUNCTION(CompareSymbolFrom,
                               branch_from.symbol->DemangledName());
 BUILD_COMPARE_VALUE_FUNCTION(CompareCallGraphDuplicated, callchain.duplicated);
 
+// StringIdMap gives each different string an id, so strings can be compared as integers. Ids are
+// cached by string address, so strings should stay alive and unchanged while the map is used.
+// Ids are given in order from 0, so a new string gets the id equal to the count of known strings.
+class StringIdMap {
+ public:
+  uint64_t GetId(const char* s) {
+    auto it = ids_by_address_.find(s);
+    if (it != ids_by_address_.end()) {
+      return it->second;
+    }
+    auto pair = ids_by_content_.emplace(std::string_view(s), ids_by_content_.size());
+    uint64_t id = pair.first->second;
+    ids_by_address_[s] = id;
+    return id;
+  }
+
+ private:
+  std::unordered_map<const char*, uint64_t> ids_by_address_;
+  std::unordered_map<std::string_view, uint64_t> ids_by_content_;
+};
+
+// The key functions below convert an item of a sample into an integer key. Two samples have
+// the same key if and only if the compare function of the item returns 0. It allows samples to
+// be aggregated in a hash table instead of being compared one by one.
+
+#define BUILD_KEY_VALUE_FUNCTION(function_name, key_part)      \
+  template <typename EntryT>                                   \
+  uint64_t function_name(const EntryT* sample, StringIdMap*) { \
+    return static_cast<uint64_t>(sample->key_part);            \
+  }
+
+#define BUILD_KEY_STRING_FUNCTION(function_name, key_part)                \
+  template <typename EntryT>                                              \
+  uint64_t function_name(const EntryT* sample, StringIdMap* string_ids) { \
+    return string_ids->GetId(sample->key_part);                           \
+  }
+
+BUILD_KEY_VALUE_FUNCTION(KeyPid, thread->pid);
+BUILD_KEY_VALUE_FUNCTION(KeyTid, thread->tid);
+BUILD_KEY_STRING_FUNCTION(KeyComm, thread_comm);
+BUILD_KEY_STRING_FUNCTION(KeyDso, map->dso->Path().c_str());
+BUILD_KEY_STRING_FUNCTION(KeyDsoBuildId, map->dso->BuildIdString().c_str());
+BUILD_KEY_STRING_FUNCTION(KeySymbol, symbol->DemangledName());
+BUILD_KEY_STRING_FUNCTION(KeyDsoFrom, branch_from.map->dso->Path().c_str());
+BUILD_KEY_STRING_FUNCTION(KeyDsoFromBuildId, branch_from.map->dso->BuildIdString().c_str());
+BUILD_KEY_STRING_FUNCTION(KeySymbolFrom, branch_from.symbol->DemangledName());
+
 template <typename EntryT>
 int CompareTotalPeriod(const EntryT* sample1, const EntryT* sample2) {
   uint64_t period1 = sample1->period + sample1->accumulated_period;
@@ -81,14 +134,33 @@ template <typename EntryT>
 class SampleComparator {
  public:
   typedef int (*compare_sample_func_t)(const EntryT*, const EntryT*);
+  typedef uint64_t (*sample_key_func_t)(const EntryT*, StringIdMap*);
 
-  void AddCompareFunction(compare_sample_func_t func) {
+  // [key_func] is optional. It should be the key function matching [func].
+  void AddCompareFunction(compare_sample_func_t func, sample_key_func_t key_func = nullptr) {
     compare_v_.push_back(func);
+    key_v_.push_back(key_func);
   }
 
   void AddComparator(const SampleComparator<EntryT>& other) {
     compare_v_.insert(compare_v_.end(), other.compare_v_.begin(),
                       other.compare_v_.end());
+    key_v_.insert(key_v_.end(), other.key_v_.begin(), other.key_v_.end());
+  }
+
+  // Return true if all compare functions have key functions. Then two samples are the same if
+  // and only if they have the same keys.
+  bool HasKeyFunctions() const {
+    return std::find(key_v_.begin(), key_v_.end(), nullptr) == key_v_.end();
+  }
+
+  size_t KeyCount() const { return key_v_.size(); }
+
+  // Write KeyCount() keys of [sample] to [keys]. Should only be called when HasKeyFunctions().
+  void GetKeys(const EntryT* sample, StringIdMap* string_ids, uint64_t* keys) const {
+    for (size_t i = 0; i < key_v_.size(); ++i) {
+      keys[i] = key_v_[i](sample, string_ids);
+    }
   }
 
   bool operator()(const EntryT* sample1, const EntryT* sample2) const {
@@ -114,6 +186,7 @@ class SampleComparator {
 
  private:
   std::vector<compare_sample_func_t> compare_v_;
+  std::vector<sample_key_func_t> key_v_;
 };
 
 #endif  // SIMPLE_PERF_SAMPLE_COMPARATOR_H_
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnwindingWorkerPool.h"
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "perf_regs.h"
+
+namespace simpleperf {
+
+// Max number of tasks waiting to be passed to the callback for each worker. It limits memory
+// used by samples waiting for unwinding.
+static constexpr size_t MAX_PENDING_TASKS_PER_WORKER = 64;
+
+bool UnwindingWorkerPool::CanUnwindSample(const SampleRecord& r) {
+  return (r.sample_type & PERF_SAMPLE_CALLCHAIN) && (r.sample_type & PERF_SAMPLE_REGS_USER) &&
+         (r.regs_user_data.reg_mask != 0) && (r.sample_type & PERF_SAMPLE_STACK_USER) &&
+         (r.GetValidStackSize() > 0);
+}
+
+UnwindingWorkerPool::UnwindingWorkerPool(size_t thread_count, bool collect_stat,
+                                         const Callback& callback)
+    : thread_count_(std::max<size_t>(thread_count, 1)),
+      collect_stat_(collect_stat),
+      callback_(callback),
+      stop_workers_(false) {
+  // Create unwinders in the current thread, because OfflineUnwinder() sets global states in
+  // libunwindstack.
+  for (size_t i = 0; i < thread_count_; ++i) {
+    unwinders_.emplace_back(new OfflineUnwinder(collect_stat_));
+  }
+  if (thread_count_ > 1) {
+    for (auto& unwinder : unwinders_) {
+      workers_.emplace_back(&UnwindingWorkerPool::RunWorker, this, unwinder.get());
+    }
+  }
+}
+
+UnwindingWorkerPool::~UnwindingWorkerPool() {
+  StopWorkers();
+}
+
+void UnwindingWorkerPool::StopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_workers_ = true;
+    // Drop tasks not started, which happens when processing stops on error.
+    unwinding_tasks_ = std::queue<Task*>();
+  }
+  unwinding_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+bool UnwindingWorkerPool::AddRecord(std::unique_ptr<Record> record, const ThreadEntry* thread) {
+  std::unique_ptr<Task> task(new Task);
+  Result& result = task->result;
+  result.record = std::move(record);
+  if (thread_count_ == 1) {
+    if (thread != nullptr) {
+      result.thread = *thread;
+      if (!UnwindSample(*unwinders_[0], result)) {
+        return false;
+      }
+    }
+    return callback_(result);
+  }
+  if (thread == nullptr) {
+    task->finished = true;
+    task->success = true;
+    tasks_.push_back(std::move(task));
+  } else {
+    // Workers unwind samples later, so use a snapshot of the maps. Snapshots are shared by
+    // samples of the same process until the maps change.
+    result.thread = *thread;
+    result.maps = GetMapSnapshot(*thread->maps);
+    result.thread.maps = result.maps.get();
+    Task* p = task.get();
+    tasks_.push_back(std::move(task));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      unwinding_tasks_.push(p);
+    }
+    unwinding_cond_.notify_one();
+  }
+  return OutputFinishedTasks(false);
+}
+
+bool UnwindingWorkerPool::Finish() {
+  return OutputFinishedTasks(true);
+}
+
+std::shared_ptr<MapSet> UnwindingWorkerPool::GetMapSnapshot(const MapSet& maps) {
+  std::shared_ptr<MapSet>& snapshot = map_snapshots_[&maps];
+  if (!snapshot || snapshot->version != maps.version) {
+    snapshot.reset(new MapSet(maps));
+  }
+  return snapshot;
+}
+
+bool UnwindingWorkerPool::UnwindSample(OfflineUnwinder& unwinder, Result& result) {
+  auto& r = *static_cast<SampleRecord*>(result.record.get());
+  RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
+  if (!unwinder.UnwindCallChain(result.thread, regs, r.stack_user_data.data,
+                                r.GetValidStackSize(), &result.ips, &result.sps)) {
+    return false;
+  }
+  result.unwound = true;
+  if (collect_stat_) {
+    result.unwinding_result = unwinder.GetUnwindingResult();
+  }
+  return true;
+}
+
+// Pass finished tasks to the callback in record order. If wait_all is true, wait until all tasks
+// finish. Otherwise, only wait when there are too many pending tasks.
+bool UnwindingWorkerPool::OutputFinishedTasks(bool wait_all) {
+  while (!tasks_.empty()) {
+    Task* task = tasks_.front().get();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (wait_all || tasks_.size() > MAX_PENDING_TASKS_PER_WORKER * thread_count_) {
+        finish_cond_.wait(lock, [&]() { return task->finished; });
+      } else if (!task->finished) {
+        break;
+      }
+    }
+    std::unique_ptr<Task> finished_task = std::move(tasks_.front());
+    tasks_.pop_front();
+    if (!task->success || !callback_(task->result)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void UnwindingWorkerPool::RunWorker(OfflineUnwinder* unwinder) {
+  while (true) {
+    Task* task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      unwinding_cond_.wait(lock, [&]() { return stop_workers_ || !unwinding_tasks_.empty(); });
+      if (unwinding_tasks_.empty()) {
+        return;
+      }
+      task = unwinding_tasks_.front();
+      unwinding_tasks_.pop();
+    }
+    bool success = UnwindSample(*unwinder, task->result);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task->success = success;
+      task->finished = true;
+    }
+    finish_cond_.notify_one();
+  }
+}
+
+}  // namespace simpleperf
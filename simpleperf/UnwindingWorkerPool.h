@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMPLE_PERF_UNWINDING_WORKER_POOL_H_
+#define SIMPLE_PERF_UNWINDING_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/macros.h>
+
+#include "OfflineUnwinder.h"
+#include "record.h"
+#include "thread_tree.h"
+
+namespace simpleperf {
+
+// UnwindingWorkerPool unwinds user stacks of samples in multiple worker threads, each owning an
+// OfflineUnwinder. Records are added in order by AddRecord(), and passed to the callback in the
+// same order, in the thread calling AddRecord() and Finish().
+class UnwindingWorkerPool {
+ public:
+  struct Result {
+    std::unique_ptr<Record> record;
+    // Below fields are only valid for samples added with a thread.
+    bool unwound = false;
+    // Thread of the sample, with maps at the time the sample is added.
+    ThreadEntry thread;
+    std::vector<uint64_t> ips;
+    std::vector<uint64_t> sps;
+    UnwindingResult unwinding_result;
+    // Keep the maps referred by thread alive.
+    std::shared_ptr<MapSet> maps;
+  };
+
+  // Return false to stop processing records.
+  using Callback = std::function<bool(Result&)>;
+
+  // Return true if the sample has regs and stack data needed for unwinding.
+  static bool CanUnwindSample(const SampleRecord& r);
+
+  // If thread_count <= 1, samples are unwound in the thread calling AddRecord().
+  UnwindingWorkerPool(size_t thread_count, bool collect_stat, const Callback& callback);
+  ~UnwindingWorkerPool();
+
+  // Add a record. If [thread] isn't nullptr, [record] is a sample, and is unwound with the maps
+  // of [thread] at the time AddRecord() is called.
+  bool AddRecord(std::unique_ptr<Record> record, const ThreadEntry* thread);
+  // Wait until all added records are passed to the callback.
+  bool Finish();
+
+ private:
+  struct Task {
+    Result result;
+    bool finished = false;
+    bool success = false;
+  };
+
+  std::shared_ptr<MapSet> GetMapSnapshot(const MapSet& maps);
+  bool UnwindSample(OfflineUnwinder& unwinder, Result& result);
+  bool OutputFinishedTasks(bool wait_all);
+  void RunWorker(OfflineUnwinder* unwinder);
+  void StopWorkers();
+
+  const size_t thread_count_;
+  const bool collect_stat_;
+  Callback callback_;
+  std::vector<std::unique_ptr<OfflineUnwinder>> unwinders_;
+  // Latest map snapshot of each process.
+  std::unordered_map<const MapSet*, std::shared_ptr<MapSet>> map_snapshots_;
+
+  // Tasks in record order, only accessed by the thread adding records.
+  std::deque<std::unique_ptr<Task>> tasks_;
+  std::mutex mutex_;
+  // Below fields are protected by mutex_.
+  std::queue<Task*> unwinding_tasks_;
+  bool stop_workers_;
+  std::condition_variable unwinding_cond_;
+  std::condition_variable finish_cond_;
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(UnwindingWorkerPool);
+};
+
+}  // namespace simpleperf
+
+#endif  // SIMPLE_PERF_UNWINDING_WORKER_POOL_H_
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnwindingWorkerPool.h"
+
+#include <gtest/gtest.h>
+
+#include "get_test_data.h"
+#include "perf_regs.h"
+#include "record_file.h"
+
+using namespace simpleperf;
+
+struct UnwoundRecordInfo {
+  uint32_t type;
+  uint64_t time;
+  bool unwound;
+  std::vector<uint64_t> ips;
+};
+
+static std::vector<UnwoundRecordInfo> UnwindRecordFile(const std::string& filename,
+                                                       size_t thread_count) {
+  std::vector<UnwoundRecordInfo> infos;
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(filename);
+  if (!reader) {
+    return infos;
+  }
+  ThreadTree thread_tree;
+  reader->LoadBuildIdAndFileFeatures(thread_tree);
+  ScopedCurrentArch scoped_arch(GetArchType(reader->ReadFeatureString(PerfFileFormat::FEAT_ARCH)));
+  UnwindingWorkerPool pool(thread_count, false, [&](UnwindingWorkerPool::Result& result) {
+    infos.push_back(UnwoundRecordInfo{result.record->type(), result.record->Timestamp(),
+                                      result.unwound, result.ips});
+    return true;
+  });
+  auto callback = [&](std::unique_ptr<Record> record) {
+    const ThreadEntry* thread = nullptr;
+    if (record->type() == PERF_RECORD_SAMPLE) {
+      auto& r = *static_cast<SampleRecord*>(record.get());
+      if (UnwindingWorkerPool::CanUnwindSample(r)) {
+        thread = thread_tree.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      }
+    } else {
+      thread_tree.Update(*record);
+    }
+    return pool.AddRecord(std::move(record), thread);
+  };
+  if (!reader->ReadDataSection(callback) || !pool.Finish()) {
+    infos.clear();
+  }
+  return infos;
+}
+
+TEST(UnwindingWorkerPool, keep_record_order_and_results) {
+  std::string filename = GetTestData(PERF_DATA_NO_UNWIND);
+  std::vector<UnwoundRecordInfo> expected = UnwindRecordFile(filename, 1);
+  ASSERT_FALSE(expected.empty());
+  size_t unwound_count = 0;
+  for (auto& info : expected) {
+    if (info.unwound) {
+      unwound_count++;
+      ASSERT_FALSE(info.ips.empty());
+    }
+  }
+  ASSERT_EQ(unwound_count, 8u);
+  for (size_t thread_count : {2, 4}) {
+    std::vector<UnwoundRecordInfo> infos = UnwindRecordFile(filename, thread_count);
+    ASSERT_EQ(infos.size(), expected.size());
+    for (size_t i = 0; i < infos.size(); ++i) {
+      ASSERT_EQ(infos[i].type, expected[i].type);
+      ASSERT_EQ(infos[i].time, expected[i].time);
+      ASSERT_EQ(infos[i].unwound, expected[i].unwound);
+      ASSERT_EQ(infos[i].ips, expected[i].ips);
+    }
+  }
+}
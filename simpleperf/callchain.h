@@ -21,18 +21,20 @@
 
 #include <algorithm>
 #include <functional>
-#include <memory>
 #include <queue>
 #include <vector>
 
 #include <android-base/logging.h>
 
+#include "utils.h"
+
 template <typename EntryT>
 struct CallChainNode {
   uint64_t period;
   uint64_t children_period;
   std::vector<EntryT*> chain;
-  std::vector<std::unique_ptr<CallChainNode>> children;
+  // Nodes are allocated in an ObjectArena owned by the SampleTreeBuilder.
+  std::vector<CallChainNode*> children;
 };
 
 template <typename EntryT>
@@ -42,18 +44,18 @@ struct CallChainRoot {
   // And we don't need to show it in brief callgraph report mode.
   bool duplicated;
   uint64_t children_period;
-  std::vector<std::unique_ptr<NodeT>> children;
+  std::vector<NodeT*> children;
 
   CallChainRoot() : duplicated(false), children_period(0) {}
 
+  // New nodes are allocated in [node_arena], which should live longer than the root.
   void AddCallChain(
-      const std::vector<EntryT*>& callchain, uint64_t period,
+      const std::vector<EntryT*>& callchain, uint64_t period, ObjectArena<NodeT>* node_arena,
       std::function<bool(const EntryT*, const EntryT*)> is_same_sample) {
     children_period += period;
     NodeT* p = FindMatchingNode(children, callchain[0], is_same_sample);
     if (p == nullptr) {
-      std::unique_ptr<NodeT> new_node = AllocateNode(callchain, 0, period, 0);
-      children.push_back(std::move(new_node));
+      children.push_back(AllocateNode(node_arena, callchain, 0, period, 0));
       return;
     }
     size_t callchain_pos = 0;
@@ -64,7 +66,7 @@ struct CallChainRoot {
       callchain_pos += match_length;
       bool find_child = true;
       if (match_length < p->chain.size()) {
-        SplitNode(p, match_length);
+        SplitNode(node_arena, p, match_length);
         find_child = false;  // No need to find matching node in p->children.
       }
       if (callchain_pos == callchain.size()) {
@@ -80,20 +82,28 @@ struct CallChainRoot {
           continue;
         }
       }
-      std::unique_ptr<NodeT> new_node =
-          AllocateNode(callchain, callchain_pos, period, 0);
-      p->children.push_back(std::move(new_node));
+      p->children.push_back(AllocateNode(node_arena, callchain, callchain_pos, period, 0));
       break;
     }
   }
 
-  void SortByPeriod() {
-    std::queue<std::vector<std::unique_ptr<NodeT>>*> queue;
+  // Sort children of each node by period. If [compare] isn't empty, children with the same period
+  // are sorted by comparing their first samples, so the order doesn't depend on the order of
+  // adding callchains.
+  void SortByPeriod(std::function<bool(const EntryT*, const EntryT*)> compare = nullptr) {
+    std::queue<std::vector<NodeT*>*> queue;
     queue.push(&children);
     while (!queue.empty()) {
-      std::vector<std::unique_ptr<NodeT>>* v = queue.front();
+      std::vector<NodeT*>* v = queue.front();
       queue.pop();
-      std::sort(v->begin(), v->end(), CallChainRoot::CompareNodeByPeriod);
+      std::sort(v->begin(), v->end(), [&](const NodeT* n1, const NodeT* n2) {
+        uint64_t period1 = n1->period + n1->children_period;
+        uint64_t period2 = n2->period + n2->children_period;
+        if (period1 != period2) {
+          return period1 > period2;
+        }
+        return compare && compare(n1->chain.front(), n2->chain.front());
+      });
       for (auto& node : *v) {
         if (!node->children.empty()) {
           queue.push(&node->children);
@@ -104,11 +114,11 @@ struct CallChainRoot {
 
  private:
   NodeT* FindMatchingNode(
-      const std::vector<std::unique_ptr<NodeT>>& nodes, const EntryT* sample,
+      const std::vector<NodeT*>& nodes, const EntryT* sample,
       std::function<bool(const EntryT*, const EntryT*)> is_same_sample) {
-    for (auto& node : nodes) {
+    for (NodeT* node : nodes) {
       if (is_same_sample(node->chain.front(), sample)) {
-        return node.get();
+        return node;
       }
     }
     return nullptr;
@@ -127,21 +137,20 @@ struct CallChainRoot {
     return i;
   }
 
-  void SplitNode(NodeT* parent, size_t parent_length) {
-    std::unique_ptr<NodeT> child = AllocateNode(
-        parent->chain, parent_length, parent->period, parent->children_period);
+  void SplitNode(ObjectArena<NodeT>* node_arena, NodeT* parent, size_t parent_length) {
+    NodeT* child = AllocateNode(node_arena, parent->chain, parent_length, parent->period,
+                                parent->children_period);
     child->children = std::move(parent->children);
     parent->period = 0;
     parent->children_period = child->period + child->children_period;
     parent->chain.resize(parent_length);
     parent->children.clear();
-    parent->children.push_back(std::move(child));
+    parent->children.push_back(child);
   }
 
-  std::unique_ptr<NodeT> AllocateNode(const std::vector<EntryT*>& chain,
-                                      size_t chain_start, uint64_t period,
-                                      uint64_t children_period) {
-    std::unique_ptr<NodeT> node(new NodeT);
+  NodeT* AllocateNode(ObjectArena<NodeT>* node_arena, const std::vector<EntryT*>& chain,
+                      size_t chain_start, uint64_t period, uint64_t children_period) {
+    NodeT* node = node_arena->New();
     for (size_t i = chain_start; i < chain.size(); ++i) {
       node->chain.push_back(chain[i]);
     }
@@ -149,13 +158,6 @@ struct CallChainRoot {
     node->children_period = children_period;
     return node;
   }
-
-  static bool CompareNodeByPeriod(const std::unique_ptr<NodeT>& n1,
-                                  const std::unique_ptr<NodeT>& n2) {
-    uint64_t period1 = n1->period + n1->children_period;
-    uint64_t period2 = n2->period + n2->children_period;
-    return period1 > period2;
-  }
 };
 
 #endif  // SIMPLE_PERF_CALLCHAIN_H_
@@ -33,6 +33,7 @@
 #include "perf_regs.h"
 #include "record_file.h"
 #include "thread_tree.h"
+#include "UnwindingWorkerPool.h"
 #include "utils.h"
 #include "workload.h"
 
@@ -40,6 +41,9 @@ using namespace simpleperf;
 
 // Cache size used by CallChainJoiner to cache call chains in memory.
 constexpr size_t DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE = 8 * 1024 * 1024;
+// Memory used by CallChainJoiner to keep call chains. Past it, call chains are kept in temporary
+// files.
+constexpr size_t DEFAULT_CALL_CHAIN_JOINER_MEMORY_BUDGET = 64 * 1024 * 1024;
 
 struct MemStat {
   std::string vm_peak;
@@ -90,13 +94,16 @@ class DebugUnwindCommand : public Command {
 "-o <file>  The path ot write new perf.data. Default is perf.data.debug.\n"
 "--symfs <dir>  Look for files with symbols relative to this directory.\n"
 "--time time    Only unwind samples recorded at selected time.\n"
+"--unwind-threads count  Set the number of threads used to unwind samples.\n"
+"                        Default is the number of online cpus.\n"
                 // clang-format on
                ),
           input_filename_("perf.data"),
           output_filename_("perf.data.debug"),
-          offline_unwinder_(true),
-          callchain_joiner_(DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE, 1, true),
-          selected_time_(0) {
+          callchain_joiner_(DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE, 1, true,
+                            DEFAULT_CALL_CHAIN_JOINER_MEMORY_BUDGET),
+          selected_time_(0),
+          unwinding_thread_count_(GetOnlineCpus().size()) {
   }
 
   bool Run(const std::vector<std::string>& args);
@@ -104,8 +111,9 @@ class DebugUnwindCommand : public Command {
  private:
   bool ParseOptions(const std::vector<std::string>& args);
   bool UnwindRecordFile();
-  bool ProcessRecord(Record* record);
-  void CollectHitFileInfo(const SampleRecord& r, const std::vector<uint64_t>& ips);
+  bool ProcessRecord(std::unique_ptr<Record> record);
+  bool WriteUnwoundRecord(UnwindingWorkerPool::Result& result);
+  void CollectHitFileInfo(const ThreadEntry& thread, const std::vector<uint64_t>& ips);
   bool JoinCallChains();
   bool WriteFeatureSections();
   void PrintStat();
@@ -115,6 +123,9 @@ class DebugUnwindCommand : public Command {
     uint64_t unwinding_sample_count = 0u;
     uint64_t total_unwinding_time_in_ns = 0u;
     uint64_t max_unwinding_time_in_ns = 0u;
+    uint64_t unwinding_wall_time_in_ns = 0u;
+    uint64_t elf_cache_hits = 0u;
+    uint64_t elf_cache_misses = 0u;
 
     // For memory consumption.
     MemStat mem_before_unwinding;
@@ -126,10 +137,11 @@ class DebugUnwindCommand : public Command {
   std::unique_ptr<RecordFileReader> reader_;
   std::unique_ptr<RecordFileWriter> writer_;
   ThreadTree thread_tree_;
-  OfflineUnwinder offline_unwinder_;
+  std::unique_ptr<UnwindingWorkerPool> unwinding_pool_;
   CallChainJoiner callchain_joiner_;
   Stat stat_;
   uint64_t selected_time_;
+  size_t unwinding_thread_count_;
 };
 
 bool DebugUnwindCommand::Run(const std::vector<std::string>& args) {
@@ -172,6 +184,10 @@ bool DebugUnwindCommand::ParseOptions(const std::vector<std::string>& args) {
       if (!GetUintOption(args, &i, &selected_time_)) {
         return false;
       }
+    } else if (args[i] == "--unwind-threads") {
+      if (!GetUintOption(args, &i, &unwinding_thread_count_, 1, sysconf(_SC_NPROCESSORS_CONF))) {
+        return false;
+      }
     } else {
       ReportUnknownOption(args, i);
       return false;
@@ -206,12 +222,18 @@ bool DebugUnwindCommand::UnwindRecordFile() {
   if (!GetMemStat(&stat_.mem_before_unwinding)) {
     return false;
   }
+  unwinding_pool_.reset(new UnwindingWorkerPool(
+      unwinding_thread_count_, true,
+      [this](UnwindingWorkerPool::Result& result) { return WriteUnwoundRecord(result); }));
+  uint64_t start_time = GetSystemClock();
   auto callback = [this](std::unique_ptr<Record> record) {
-    return ProcessRecord(record.get());
+    return ProcessRecord(std::move(record));
   };
-  if (!reader_->ReadDataSection(callback)) {
+  if (!reader_->ReadDataSection(callback) || !unwinding_pool_->Finish()) {
     return false;
   }
+  stat_.unwinding_wall_time_in_ns = GetSystemClock() - start_time;
+  unwinding_pool_.reset();
   if (!JoinCallChains()) {
     return false;
   }
@@ -223,56 +245,58 @@ bool DebugUnwindCommand::UnwindRecordFile() {
   return WriteFeatureSections();
 }
 
-bool DebugUnwindCommand::ProcessRecord(Record* record) {
+bool DebugUnwindCommand::ProcessRecord(std::unique_ptr<Record> record) {
+  const ThreadEntry* thread = nullptr;
   if (record->type() == PERF_RECORD_SAMPLE) {
-    auto& r = *static_cast<SampleRecord*>(record);
+    auto& r = *static_cast<SampleRecord*>(record.get());
     if (selected_time_ != 0u && r.Timestamp() != selected_time_) {
       return true;
     }
-    uint64_t need_type = PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
-    if ((r.sample_type & need_type) == need_type && r.regs_user_data.reg_mask != 0 &&
-        r.GetValidStackSize() > 0) {
-      ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
-      RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
-      std::vector<uint64_t> ips;
-      std::vector<uint64_t> sps;
-      if (!offline_unwinder_.UnwindCallChain(*thread, regs, r.stack_user_data.data,
-                                             r.GetValidStackSize(), &ips, &sps)) {
-        return false;
-      }
-
-      const UnwindingResult& unwinding_result = offline_unwinder_.GetUnwindingResult();
-      stat_.unwinding_sample_count++;
-      stat_.total_unwinding_time_in_ns += unwinding_result.used_time;
-      stat_.max_unwinding_time_in_ns = std::max(stat_.max_unwinding_time_in_ns,
-                                                unwinding_result.used_time);
-      if (!writer_->WriteRecord(UnwindingResultRecord(r.time_data.time, unwinding_result))) {
-        return false;
-      }
-      // We want to keep both reg/stack data and callchain of a sample. However, storing both
-      // can exceed the size limit of a SampleRecord. So instead we store one sample with reg/stack
-      // data and one sample with callchain.
-      if (!writer_->WriteRecord(r)) {
-        return false;
-      }
-      r.ReplaceRegAndStackWithCallChain(ips);
-      if (!callchain_joiner_.AddCallChain(r.tid_data.pid, r.tid_data.tid,
-                                          CallChainJoiner::ORIGINAL_OFFLINE, ips, sps)) {
-        return false;
-      }
-      CollectHitFileInfo(r, ips);
+    if (UnwindingWorkerPool::CanUnwindSample(r)) {
+      thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
     }
   } else {
     thread_tree_.Update(*record);
   }
-  return writer_->WriteRecord(*record);
+  return unwinding_pool_->AddRecord(std::move(record), thread);
+}
+
+// Called in record order after samples are unwound.
+bool DebugUnwindCommand::WriteUnwoundRecord(UnwindingWorkerPool::Result& result) {
+  if (result.unwound) {
+    auto& r = *static_cast<SampleRecord*>(result.record.get());
+    const UnwindingResult& unwinding_result = result.unwinding_result;
+    stat_.unwinding_sample_count++;
+    stat_.total_unwinding_time_in_ns += unwinding_result.used_time;
+    stat_.max_unwinding_time_in_ns = std::max(stat_.max_unwinding_time_in_ns,
+                                              unwinding_result.used_time);
+    stat_.elf_cache_hits += unwinding_result.elf_cache_hits;
+    stat_.elf_cache_misses += unwinding_result.elf_cache_misses;
+    if (!writer_->WriteRecord(UnwindingResultRecord(r.time_data.time, unwinding_result))) {
+      return false;
+    }
+    // We want to keep both reg/stack data and callchain of a sample. However, storing both
+    // can exceed the size limit of a SampleRecord. So instead we store one sample with reg/stack
+    // data and one sample with callchain.
+    if (!writer_->WriteRecord(r)) {
+      return false;
+    }
+    r.ReplaceRegAndStackWithCallChain(result.ips);
+    if (!callchain_joiner_.AddCallChain(r.tid_data.pid, r.tid_data.tid,
+                                        CallChainJoiner::ORIGINAL_OFFLINE, result.ips,
+                                        result.sps)) {
+      return false;
+    }
+    CollectHitFileInfo(result.thread, result.ips);
+  }
+  return writer_->WriteRecord(*result.record);
 }
 
-void DebugUnwindCommand::CollectHitFileInfo(const SampleRecord& r,
+// [thread] has maps at the time of the sample.
+void DebugUnwindCommand::CollectHitFileInfo(const ThreadEntry& thread,
                                             const std::vector<uint64_t>& ips) {
-  const ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
   for (auto ip : ips) {
-    const MapEntry* map = thread_tree_.FindMap(thread, ip, false);
+    const MapEntry* map = thread_tree_.FindMap(&thread, ip, false);
     Dso* dso = map->dso;
     if (!dso->HasDumpId() && dso->type() != DSO_UNKNOWN_FILE) {
       dso->CreateDumpId();
@@ -341,8 +365,12 @@ bool DebugUnwindCommand::JoinCallChains() {
 
 bool DebugUnwindCommand::WriteFeatureSections() {
   // Add debug_unwind info in META_INFO section, and add symbol info in FILE section.
+  // RECORD_INDEX section isn't kept, because the data section is rewritten.
   const std::map<int, PerfFileFormat::SectionDesc>& features = reader_->FeatureSectionDescriptors();
   size_t new_feature_count = features.size();
+  if (features.find(PerfFileFormat::FEAT_RECORD_INDEX) != features.end()) {
+    new_feature_count--;
+  }
   for (int feature : {PerfFileFormat::FEAT_FILE, PerfFileFormat::FEAT_META_INFO}) {
     if (features.find(feature) == features.end()) {
       new_feature_count++;
@@ -376,6 +404,9 @@ bool DebugUnwindCommand::WriteFeatureSections() {
     }
     ++it;
   }
+  if (it != features.end() && it->first == PerfFileFormat::FEAT_RECORD_INDEX) {
+    ++it;
+  }
   info_map["debug_unwind"] = "true";
   info_map["debug_unwind_mem_before"] = stat_.mem_before_unwinding.ToString();
   info_map["debug_unwind_mem_after"] = stat_.mem_after_unwinding.ToString();
@@ -394,6 +425,14 @@ void DebugUnwindCommand::PrintStat() {
     printf("Max unwinding time: %f us\n", static_cast<double>(stat_.max_unwinding_time_in_ns)
            / 1000);
   }
+  if (stat_.unwinding_wall_time_in_ns > 0u) {
+    printf("Unwinding throughput: %f samples/s with %zu threads\n",
+           stat_.unwinding_sample_count * 1e9 / stat_.unwinding_wall_time_in_ns,
+           unwinding_thread_count_);
+  }
+  printf("Elf cache hits: %" PRIu64 ", misses: %" PRIu64 ", memory usage: %" PRIu64 " bytes\n",
+         stat_.elf_cache_hits, stat_.elf_cache_misses,
+         UnwindElfCache::GetInstance().GetMemoryUsage());
   printf("Memory change:\n");
   PrintIndented(1, "VmPeak: %s -> %s\n", stat_.mem_before_unwinding.vm_peak.c_str(),
                 stat_.mem_after_unwinding.vm_peak.c_str());
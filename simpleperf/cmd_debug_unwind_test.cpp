@@ -39,7 +39,9 @@ TEST(cmd_debug_unwind, smoke) {
   TemporaryFile tmp_file;
   ASSERT_TRUE(capture.Start());
   ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "-o", tmp_file.path}));
-  ASSERT_NE(capture.Finish().find("Unwinding sample count: 8"), std::string::npos);
+  std::string output = capture.Finish();
+  ASSERT_NE(output.find("Unwinding sample count: 8"), std::string::npos);
+  ASSERT_NE(output.find("Elf cache hits:"), std::string::npos);
 
   ASSERT_TRUE(capture.Start());
   ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "-o", tmp_file.path, "--time",
@@ -39,8 +39,17 @@ class DumpRecordCommand : public Command {
   DumpRecordCommand()
       : Command("dump", "dump perf record file",
                 "Usage: simpleperf dumprecord [options] [perf_record_file]\n"
-                "    Dump different parts of a perf record file. Default file is perf.data.\n"),
-        record_filename_("perf.data"), record_file_arch_(GetBuildArch()) {
+                "    Dump different parts of a perf record file. Default file is perf.data.\n"
+                "--start-record <record_id>  Dump records in the data section from the record with\n"
+                "                            <record_id>. The first record has id 0.\n"
+                "--start-time <time_in_ns>   Dump records in the data section from the first record\n"
+                "                            with time >= <time_in_ns>. Records after it aren't\n"
+                "                            strictly sorted by time.\n"
+                "    When using --start-record or --start-time, the record index in the record file\n"
+                "    is used to skip reading records before the start. So maps in skipped records\n"
+                "    aren't known, and callchain ips may not be symbolized.\n"),
+        record_filename_("perf.data"), record_file_arch_(GetBuildArch()),
+        start_record_id_(0), start_time_(0) {
   }
 
   bool Run(const std::vector<std::string>& args);
@@ -55,6 +64,8 @@ class DumpRecordCommand : public Command {
   std::string record_filename_;
   std::unique_ptr<RecordFileReader> record_file_reader_;
   ArchType record_file_arch_;
+  uint64_t start_record_id_;
+  uint64_t start_time_;
 };
 
 bool DumpRecordCommand::Run(const std::vector<std::string>& args) {
@@ -93,10 +104,29 @@ bool DumpRecordCommand::Run(const std::vector<std::string>& args) {
 }
 
 bool DumpRecordCommand::ParseOptions(const std::vector<std::string>& args) {
-  if (args.size() == 1) {
-    record_filename_ = args[0];
-  } else if (args.size() > 1) {
-    ReportUnknownOption(args, 1);
+  size_t i;
+  for (i = 0; i < args.size() && !args[i].empty() && args[i][0] == '-'; ++i) {
+    if (args[i] == "--start-record") {
+      if (!GetUintOption(args, &i, &start_record_id_)) {
+        return false;
+      }
+    } else if (args[i] == "--start-time") {
+      if (!GetUintOption(args, &i, &start_time_)) {
+        return false;
+      }
+    } else {
+      ReportUnknownOption(args, i);
+      return false;
+    }
+  }
+  if (start_record_id_ != 0 && start_time_ != 0) {
+    LOG(ERROR) << "--start-record and --start-time can't be used together.";
+    return false;
+  }
+  if (i + 1 == args.size()) {
+    record_filename_ = args[i];
+  } else if (i + 1 < args.size()) {
+    ReportUnknownOption(args, i + 1);
     return false;
   }
   return true;
@@ -176,7 +206,17 @@ bool DumpRecordCommand::DumpDataSection() {
     symbol_name = symbol->DemangledName();
   };
 
+  // With --start-time, records read before the first record with time >= start_time_ are only
+  // used to update the thread tree.
+  bool reach_start_time = start_time_ == 0;
   auto record_callback = [&](std::unique_ptr<Record> r) {
+    if (!reach_start_time) {
+      if (r->Timestamp() < start_time_) {
+        thread_tree.Update(*r);
+        return true;
+      }
+      reach_start_time = true;
+    }
     r->Dump();
     thread_tree.Update(*r);
     if (r->type() == PERF_RECORD_SAMPLE) {
@@ -215,6 +255,12 @@ bool DumpRecordCommand::DumpDataSection() {
     }
     return true;
   };
+  if (start_record_id_ != 0 && !record_file_reader_->SeekToRecord(start_record_id_)) {
+    return false;
+  }
+  if (start_time_ != 0 && !record_file_reader_->SeekToTime(start_time_)) {
+    return false;
+  }
   return record_file_reader_->ReadDataSection(record_callback);
 }
 
@@ -236,6 +282,9 @@ bool DumpRecordCommand::DumpFeatureSection() {
     } else if (feature == FEAT_ARCH) {
       std::string s = record_file_reader_->ReadFeatureString(feature);
       PrintIndented(1, "arch: %s\n", s.c_str());
+    } else if (feature == FEAT_JIT_SYMFILE_CONTAINER) {
+      std::string s = record_file_reader_->ReadFeatureString(feature);
+      PrintIndented(1, "jit_symfile_container: %s\n", s.c_str());
     } else if (feature == FEAT_CMDLINE) {
       std::vector<std::string> cmdline = record_file_reader_->ReadCmdlineFeature();
       PrintIndented(1, "cmdline: %s\n", android::base::Join(cmdline, ' ').c_str());
@@ -274,6 +323,16 @@ bool DumpRecordCommand::DumpFeatureSection() {
       for (auto& pair : info_map) {
         PrintIndented(2, "%s = %s\n", pair.first.c_str(), pair.second.c_str());
       }
+    } else if (feature == FEAT_RECORD_INDEX) {
+      std::vector<RecordIndexEntry> entries;
+      if (!record_file_reader_->ReadRecordIndexFeature(&entries)) {
+        return false;
+      }
+      PrintIndented(1, "record_index:\n");
+      for (auto& entry : entries) {
+        PrintIndented(2, "record_id %" PRIu64 ", offset %" PRIu64 ", max_time_before %" PRIu64
+                      "\n", entry.record_id, entry.offset, entry.max_time_before);
+      }
     }
   }
   return true;
@@ -16,6 +16,8 @@
 
 #include <gtest/gtest.h>
 
+#include <android-base/strings.h>
+
 #include "command.h"
 #include "get_test_data.h"
 #include "test_util.h"
@@ -44,3 +46,38 @@ TEST(cmd_dump, dump_callchain_of_sample_records) {
   ASSERT_NE(data.find("[kernel.kallsyms][+ffffffc000086b4a]"), std::string::npos);
   ASSERT_NE(data.find("__ioctl (/system/lib64/libc.so[+70b6c])"), std::string::npos);
 }
+
+static size_t DumpDataSectionRecords(const std::vector<std::string>& args) {
+  CaptureStdout capture;
+  if (!capture.Start() || !DumpCmd()->Run(args)) {
+    return 0;
+  }
+  size_t count = 0;
+  for (const auto& line : android::base::Split(capture.Finish(), "\n")) {
+    // Records in feature sections are dumped with indentation.
+    if (android::base::StartsWith(line, "record ")) {
+      count++;
+    }
+  }
+  return count;
+}
+
+TEST(cmd_dump, start_record_option) {
+  std::string file = GetTestData("perf.data");
+  size_t total = DumpDataSectionRecords({file});
+  ASSERT_GT(total, 2u);
+  ASSERT_EQ(DumpDataSectionRecords({"--start-record", "2", file}), total - 2);
+  ASSERT_EQ(DumpDataSectionRecords({"--start-record", std::to_string(total), file}), 0u);
+  ASSERT_FALSE(DumpCmd()->Run({"--start-record", "1", "--start-time", "1", file}));
+}
+
+TEST(cmd_dump, start_time_option) {
+  std::string file = GetTestData("perf.data");
+  size_t total = DumpDataSectionRecords({file});
+  ASSERT_GT(total, 0u);
+  // Records without time before the first sample are skipped.
+  size_t count = DumpDataSectionRecords({"--start-time", "1", file});
+  ASSERT_GT(count, 0u);
+  ASSERT_LE(count, total);
+  ASSERT_EQ(DumpDataSectionRecords({"--start-time", std::to_string(UINT64_MAX), file}), 0u);
+}
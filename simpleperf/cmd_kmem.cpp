@@ -64,9 +64,11 @@ struct SlabAccumulateInfo {
 };
 
 BUILD_COMPARE_VALUE_FUNCTION(ComparePtr, ptr);
+BUILD_KEY_VALUE_FUNCTION(KeyPtr, ptr);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareBytesReq, bytes_req);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareBytesAlloc, bytes_alloc);
 BUILD_COMPARE_VALUE_FUNCTION(CompareGfpFlags, gfp_flags);
+BUILD_KEY_VALUE_FUNCTION(KeyGfpFlags, gfp_flags);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareCrossCpuAllocations,
                                      cross_cpu_allocations);
 
@@ -182,9 +184,8 @@ class SlabSampleTreeBuilder
       uint64_t bytes_req = format->bytes_req.ReadFromData(raw_data);
       uint64_t bytes_alloc = format->bytes_alloc.ReadFromData(raw_data);
       uint64_t gfp_flags = format->gfp_flags.ReadFromData(raw_data);
-      SlabSample* sample =
-          InsertSample(std::unique_ptr<SlabSample>(new SlabSample(
-              symbol, ptr, bytes_req, bytes_alloc, 1, gfp_flags, 0)));
+      SlabSample* sample = InsertSample(
+          SlabSample(symbol, ptr, bytes_req, bytes_alloc, 1, gfp_flags, 0));
       alloc_cpu_record_map_.insert(
           std::make_pair(ptr, std::make_pair(r.cpu_data.cpu, sample)));
       acc_info->bytes_req = bytes_req;
@@ -220,9 +221,8 @@ class SlabSampleTreeBuilder
     }
     const Symbol* symbol = thread_tree_->FindKernelSymbol(ip);
     return InsertCallChainSample(
-        std::unique_ptr<SlabSample>(
-            new SlabSample(symbol, sample->ptr, acc_info.bytes_req,
-                           acc_info.bytes_alloc, 1, sample->gfp_flags, 0)),
+        SlabSample(symbol, sample->ptr, acc_info.bytes_req, acc_info.bytes_alloc, 1,
+                   sample->gfp_flags, 0),
         callchain);
   }
 
@@ -515,10 +515,10 @@ bool KmemCommand::PrepareToBuildSampleTree() {
         displayer.AddDisplayFunction(accumulated_name + "Hit",
                                      DisplaySampleCount);
       } else if (key == "caller") {
-        comparator.AddCompareFunction(CompareSymbol);
+        comparator.AddCompareFunction(CompareSymbol, KeySymbol);
         displayer.AddDisplayFunction("Caller", DisplaySymbol);
       } else if (key == "ptr") {
-        comparator.AddCompareFunction(ComparePtr);
+        comparator.AddCompareFunction(ComparePtr, KeyPtr);
         displayer.AddDisplayFunction("Ptr", DisplayPtr);
       } else if (key == "bytes_req") {
         sort_comparator.AddCompareFunction(CompareBytesReq);
@@ -533,7 +533,7 @@ bool KmemCommand::PrepareToBuildSampleTree() {
         displayer.AddDisplayFunction(accumulated_name + "Fragment",
                                      DisplayFragment);
       } else if (key == "gfp_flags") {
-        comparator.AddCompareFunction(CompareGfpFlags);
+        comparator.AddCompareFunction(CompareGfpFlags, KeyGfpFlags);
         displayer.AddDisplayFunction("GfpFlags", DisplayGfpFlags);
       } else if (key == "pingpong") {
         sort_comparator.AddCompareFunction(CompareCrossCpuAllocations);
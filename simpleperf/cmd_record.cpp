@@ -41,15 +41,19 @@
 #include "environment.h"
 #include "event_selection_set.h"
 #include "event_type.h"
+#include "FlightRecorder.h"
 #include "IOEventLoop.h"
 #include "JITDebugReader.h"
+#include "KernelSymbolIndex.h"
 #include "OfflineUnwinder.h"
 #include "read_apk.h"
 #include "read_elf.h"
+#include "RecordReadThread.h"
 #include "record.h"
 #include "record_file.h"
 #include "thread_tree.h"
 #include "tracing.h"
+#include "UnwindingWorkerPool.h"
 #include "utils.h"
 #include "workload.h"
 
@@ -82,8 +86,14 @@ constexpr uint32_t MAX_DUMP_STACK_SIZE = 65528;
 // successfully, the buffer size = 1024 * 4K (page size) = 4M.
 constexpr size_t DESIRED_PAGES_IN_MAPPED_BUFFER = 1024;
 
+// Default size of the buffer keeping samples in flight recorder mode.
+constexpr size_t DEFAULT_FLIGHT_RECORDER_BUFFER_SIZE_IN_MB = 32;
+
 // Cache size used by CallChainJoiner to cache call chains in memory.
 constexpr size_t DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE = 8 * 1024 * 1024;
+// Memory used by CallChainJoiner to keep call chains. Past it, call chains are kept in temporary
+// files.
+constexpr size_t DEFAULT_CALL_CHAIN_JOINER_MEMORY_BUDGET = 64 * 1024 * 1024;
 
 // Currently, the record buffer size in user-space is set to match the kernel buffer size on a
 // 8 core system. For system-wide recording, it is 8K pages * 4K page_size * 8 cores = 256MB.
@@ -179,6 +189,11 @@ class RecordCommand : public Command {
 "                the kernel. It should be a power of 2. If not set, the max\n"
 "                possible value <= 1024 will be used.\n"
 "--no-inherit  Don't record created child threads/processes.\n"
+"--record-read-threads count  Set the number of threads reading records from\n"
+"                             kernel buffers. Kernel buffers of different cpus\n"
+"                             are split between the threads. Using more threads\n"
+"                             can reduce lost samples when recording at a high\n"
+"                             frequency on many cpus. Default is 1.\n"
 "--cpu-percent <percent>  Set the max percent of cpu time used for recording.\n"
 "                         percent is in range [1-100], default is 25.\n"
 "\n"
@@ -187,6 +202,9 @@ class RecordCommand : public Command {
 "                       stack will be recorded in perf.data and unwound while\n"
 "                       recording by default. Use --post-unwind=yes to switch\n"
 "                       to unwind after recording.\n"
+"--post-unwind-threads count  Set the number of threads used to unwind samples\n"
+"                             with --post-unwind=yes. Default is the number of\n"
+"                             online cpus.\n"
 "--no-unwind   If `--call-graph dwarf` option is used, then the user's stack\n"
 "              will be unwound by default. Use this option to disable the\n"
 "              unwinding of the user's stack.\n"
@@ -197,8 +215,21 @@ class RecordCommand : public Command {
 "--callchain-joiner-min-matching-nodes count\n"
 "               When callchain joiner is used, set the matched nodes needed to join\n"
 "               callchains. The count should be >= 1. By default it is 1.\n"
+"--trim-stack   If `--call-graph dwarf` option is used, trim the user stack data in\n"
+"               each sample to the frames found by walking frame pointers, when the\n"
+"               walk reaches the outermost frame. It reduces the size of perf.data and\n"
+"               the record buffer, but may lose callers of code that uses the frame\n"
+"               pointer register for other purposes. Only supported on arm64 and x86_64.\n"
 "\n"
 "Recording file options:\n"
+"--compress    Compress records in the data section of perf.data. It can reduce\n"
+"              the file size a lot when recording with `--call-graph dwarf`.\n"
+"              The records are compressed in a background thread. Compressed files\n"
+"              can't be read by simpleperf versions before --compress was added.\n"
+"--kernel-symbol-index  Dump kernel symbols as a prebuilt index instead of\n"
+"                       kallsyms text. Reports load kernel symbols faster,\n"
+"                       but simpleperf versions without the index support\n"
+"                       can't read kernel symbols in the recording file.\n"
 "--no-dump-kernel-symbols  Don't dump kernel symbols in perf.data. By default\n"
 "                          kernel symbols will be dumped when needed.\n"
 "--no-dump-symbols       Don't dump symbols in perf.data. By default symbols are\n"
@@ -214,6 +245,22 @@ class RecordCommand : public Command {
 "--symfs <dir>    Look for files with symbols relative to this directory.\n"
 "                 This option is used to provide files with symbol table and\n"
 "                 debug information, which are used for unwinding and dumping symbols.\n"
+"--sync-interval <sec>  Make records written so far readable every <sec> seconds, so\n"
+"                       `simpleperf report --follow` can report while recording. It\n"
+"                       can't be used with --post-unwind=yes, and disables the callchain\n"
+"                       joiner, because they rewrite the record file after recording.\n"
+"--flight-recorder <sec>  Keep records of the last <sec> seconds in memory instead of\n"
+"                         writing them to the record file. Each time simpleperf\n"
+"                         receives SIGUSR2, the kept records are dumped to\n"
+"                         <record_file_name>.<n>, where n counts dumps from 1. It can't\n"
+"                         be used with --post-unwind=yes, --size-limit or\n"
+"                         --sync-interval, and disables the callchain joiner.\n"
+"--flight-recorder-buffer-size <MB>  Set the size of the buffer keeping samples in\n"
+"                                    flight recorder mode. When it is full, the oldest\n"
+"                                    samples are dropped. Other records (like mmap\n"
+"                                    records) are kept in another buffer of the same\n"
+"                                    size, except those dumped before recording starts,\n"
+"                                    which are always kept. Default is 32.\n"
 #if 0
 // Below options are only used internally and shouldn't be visible to the public.
 "--in-app         We are already running in the app's context.\n"
@@ -230,8 +277,11 @@ class RecordCommand : public Command {
         post_unwind_(false),
         child_inherit_(true),
         duration_in_sec_(0),
+        sync_interval_in_sec_(0),
         can_dump_kernel_symbols_(true),
+        dump_kernel_symbol_index_(false),
         dump_symbols_(true),
+        compress_data_(false),
         event_selection_set_(false),
         mmap_page_range_(std::make_pair(1, DESIRED_PAGES_IN_MAPPED_BUFFER)),
         record_filename_("perf.data"),
@@ -260,7 +310,7 @@ class RecordCommand : public Command {
   bool AdjustPerfEventLimit();
   bool PrepareRecording(Workload* workload);
   bool DoRecording(Workload* workload);
-  bool PostProcessRecording(const std::vector<std::string>& args);
+  bool PostProcessRecording();
   bool TraceOffCpu();
   bool SetEventSelectionFlags();
   bool CreateAndInitRecordFile();
@@ -272,22 +322,30 @@ class RecordCommand : public Command {
   bool DumpUserSpaceMaps();
   bool DumpProcessMaps(pid_t pid, const std::unordered_set<pid_t>& tids);
   bool ProcessRecord(Record* record);
+  bool ProcessRecordData(char* data);
   bool ShouldOmitRecord(Record* record);
   bool DumpMapsForRecord(Record* record);
+  bool DumpMapsForProcess(pid_t pid);
   bool SaveRecordForPostUnwinding(Record* record);
   bool SaveRecordAfterUnwinding(Record* record);
   bool SaveRecordWithoutUnwinding(Record* record);
+  bool SaveUnwoundSample(SampleRecord& r);
+  bool WriteRecord(const Record& record);
+  bool WriteRecordData(const char* data);
+  bool DumpFlightRecords();
   bool ProcessJITDebugInfo(const std::vector<JITDebugInfo>& debug_info, bool sync_kernel_records);
 
   void UpdateRecord(Record* record);
   bool UnwindRecord(SampleRecord& r);
+  bool SetUnwoundCallChain(SampleRecord& r, const std::vector<uint64_t>& ips,
+                           const std::vector<uint64_t>& sps);
   bool PostUnwindRecords();
   bool JoinCallChains();
-  bool DumpAdditionalFeatures(const std::vector<std::string>& args);
-  bool DumpBuildIdFeature();
-  bool DumpFileFeature();
+  bool DumpAdditionalFeatures(ThreadTree& thread_tree);
+  bool DumpBuildIdFeature(ThreadTree& thread_tree);
+  bool DumpFileFeature(ThreadTree& thread_tree);
   bool DumpMetaInfoFeature(bool kernel_symbols_available);
-  void CollectHitFileInfo(const SampleRecord& r);
+  void CollectHitFileInfo(ThreadTree& thread_tree, const SampleRecord& r);
 
   std::unique_ptr<SampleSpeed> sample_speed_;
   bool system_wide_collection_;
@@ -297,11 +355,15 @@ class RecordCommand : public Command {
   uint32_t dump_stack_size_in_dwarf_sampling_;
   bool unwind_dwarf_callchain_;
   bool post_unwind_;
+  bool trim_stack_ = false;
   std::unique_ptr<OfflineUnwinder> offline_unwinder_;
   bool child_inherit_;
   double duration_in_sec_;
+  double sync_interval_in_sec_;
   bool can_dump_kernel_symbols_;
+  bool dump_kernel_symbol_index_;
   bool dump_symbols_;
+  bool compress_data_;
   std::string clockid_;
   std::vector<int> cpus_;
   EventSelectionSet event_selection_set_;
@@ -311,6 +373,8 @@ class RecordCommand : public Command {
   ThreadTree thread_tree_;
   std::string record_filename_;
   std::unique_ptr<RecordFileWriter> record_file_writer_;
+  // Options of the record command, written in the cmdline feature.
+  std::vector<std::string> record_args_;
 
   uint64_t sample_record_count_;
   uint64_t lost_record_count_;
@@ -322,16 +386,37 @@ class RecordCommand : public Command {
   uint64_t size_limit_in_bytes_ = 0;
   uint64_t max_sample_freq_ = DEFAULT_SAMPLE_FREQ_FOR_NONTRACEPOINT_EVENT;
   size_t cpu_time_max_percent_ = 25;
+  size_t record_read_thread_count_ = 1;
+  size_t post_unwind_thread_count_ = GetOnlineCpus().size();
+  // Stat of PostUnwindRecords(), shown with the record result.
+  uint64_t post_unwind_sample_count_ = 0;
+  double post_unwind_time_in_sec_ = 0;
 
   // For CallChainJoiner
   bool allow_callchain_joiner_;
   size_t callchain_joiner_min_matching_nodes_;
   std::unique_ptr<CallChainJoiner> callchain_joiner_;
 
+  // For flight recorder mode
+  double flight_recorder_window_in_sec_ = 0;
+  size_t flight_recorder_buffer_size_in_mb_ = DEFAULT_FLIGHT_RECORDER_BUFFER_SIZE_IN_MB;
+  std::unique_ptr<FlightRecorder> flight_recorder_;
+  size_t flight_dump_count_ = 0;
+  // Dex file offsets reported by JITDebugReader. They are added to the thread tree used by each
+  // dump.
+  std::vector<std::pair<std::string, uint64_t>> dex_file_offsets_;
+
   std::unique_ptr<JITDebugReader> jit_debug_reader_;
+  // Set when JIT maps refer to symfiles in a JIT symfile container.
+  std::string jit_symfile_container_path_;
   uint64_t last_record_timestamp_;  // used to insert Mmap2Records for JIT debug info
   TimeStat time_stat_;
   EventAttrWithId dumping_attr_id_;
+  // Used to parse fields of sample records read from kernel buffers without parsing the whole
+  // record.
+  std::unique_ptr<RecordParser> record_parser_;
+  // Whether sample records read from kernel buffers can be saved without being parsed.
+  bool save_samples_without_parsing_ = false;
   // In system wide recording, record if we have dumped map info for a process.
   std::unordered_set<pid_t> dumped_processes_;
 };
@@ -347,6 +432,7 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
   if (!ParseOptions(args, &workload_args)) {
     return false;
   }
+  record_args_ = args;
   if (!AdjustPerfEventLimit()) {
     return false;
   }
@@ -375,7 +461,7 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
   if (!DoRecording(workload.get())) {
     return false;
   }
-  return PostProcessRecording(args);
+  return PostProcessRecording();
 }
 
 bool RecordCommand::PrepareRecording(Workload* workload) {
@@ -407,7 +493,7 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
   if (unwind_dwarf_callchain_ && allow_callchain_joiner_) {
     callchain_joiner_.reset(new CallChainJoiner(DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE,
                                                 callchain_joiner_min_matching_nodes_,
-                                                false));
+                                                false, DEFAULT_CALL_CHAIN_JOINER_MEMORY_BUDGET));
   }
 
   // 4. Add monitored targets.
@@ -452,18 +538,30 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
   }
 
   // 5. Open perf event files and create mapped buffers.
+  event_selection_set_.SetTrimStackByFramePointers(trim_stack_);
   if (!event_selection_set_.OpenEventFiles(cpus_)) {
     return false;
   }
   size_t record_buffer_size = system_wide_collection_ ? kSystemWideRecordBufferSize
                                                       : kRecordBufferSize;
   if (!event_selection_set_.MmapEventFiles(mmap_page_range_.first, mmap_page_range_.second,
-                                           record_buffer_size)) {
+                                           record_buffer_size, record_read_thread_count_)) {
     return false;
   }
   auto callback =
       std::bind(&RecordCommand::ProcessRecord, this, std::placeholders::_1);
-  if (!event_selection_set_.PrepareToReadMmapEventData(callback)) {
+  auto raw_callback =
+      std::bind(&RecordCommand::ProcessRecordData, this, std::placeholders::_1);
+  record_parser_.reset(new RecordParser(*event_selection_set_.GetEventAttrWithId()[0].attr));
+  // Sample records need to be modified before saving when unwinding while recording, or when
+  // adjusting callchains generated by the kernel.
+  if (unwind_dwarf_callchain_) {
+    save_samples_without_parsing_ = post_unwind_;
+  } else {
+    save_samples_without_parsing_ = !fp_callchain_sampling_ && !dwarf_callchain_sampling_ &&
+        !exclude_kernel_callchain_;
+  }
+  if (!event_selection_set_.PrepareToReadMmapEventData(callback, raw_callback)) {
     return false;
   }
 
@@ -495,6 +593,17 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
       return false;
     }
   }
+  if (sync_interval_in_sec_ != 0) {
+    auto sync = [this]() { return record_file_writer_->SyncDataSection(); };
+    if (!sync() || !loop->AddPeriodicEvent(SecondToTimeval(sync_interval_in_sec_), sync)) {
+      return false;
+    }
+  }
+  if (flight_recorder_) {
+    if (!loop->AddSignalEvent(SIGUSR2, [this]() { return DumpFlightRecords(); })) {
+      return false;
+    }
+  }
   if (jit_debug_reader_) {
     auto callback = [this](const std::vector<JITDebugInfo>& debug_info, bool sync_kernel_records) {
       return ProcessJITDebugInfo(debug_info, sync_kernel_records);
@@ -545,25 +654,37 @@ bool RecordCommand::DoRecording(Workload* workload) {
   return true;
 }
 
-bool RecordCommand::PostProcessRecording(const std::vector<std::string>& args) {
-  // 1. Post unwind dwarf callchain.
-  if (unwind_dwarf_callchain_ && post_unwind_) {
-    if (!PostUnwindRecords()) {
-      return false;
+bool RecordCommand::PostProcessRecording() {
+  if (flight_recorder_) {
+    // In flight recorder mode, records are only written when dumping.
+    LOG(INFO) << "Dumped flight records " << flight_dump_count_ << " times. Samples kept: "
+              << flight_recorder_->SampleCount() << ", dropped because the buffer is full: "
+              << flight_recorder_->DroppedSampleCount() << ".";
+    if (flight_recorder_->DroppedOtherRecordCount() != 0) {
+      LOG(WARNING) << flight_recorder_->DroppedOtherRecordCount()
+                   << " non-sample records are dropped because the buffer is full. Samples "
+                   << "may not be reported correctly. Try a bigger --flight-recorder-buffer-size.";
+    }
+  } else {
+    // 1. Post unwind dwarf callchain.
+    if (unwind_dwarf_callchain_ && post_unwind_) {
+      if (!PostUnwindRecords()) {
+        return false;
+      }
     }
-  }
 
-  // 2. Optionally join Callchains.
-  if (callchain_joiner_) {
-    JoinCallChains();
-  }
+    // 2. Optionally join Callchains.
+    if (callchain_joiner_) {
+      JoinCallChains();
+    }
 
-  // 3. Dump additional features, and close record file.
-  if (!DumpAdditionalFeatures(args)) {
-    return false;
-  }
-  if (!record_file_writer_->Close()) {
-    return false;
+    // 3. Dump additional features, and close record file.
+    if (!DumpAdditionalFeatures(thread_tree_)) {
+      return false;
+    }
+    if (!record_file_writer_->Close()) {
+      return false;
+    }
   }
   time_stat_.post_process_time = GetSystemClock();
 
@@ -579,6 +700,14 @@ bool RecordCommand::PostProcessRecording(const std::vector<std::string>& args) {
   lost_record_count_ += lost_samples + lost_non_samples;
   LOG(INFO) << "Samples recorded: " << sample_record_count_ << cut_samples
             << ". Samples lost: " << lost_record_count_ << ".";
+  if (post_unwind_sample_count_ > 0) {
+    double samples_per_sec =
+        post_unwind_time_in_sec_ > 0 ? post_unwind_sample_count_ / post_unwind_time_in_sec_ : 0;
+    LOG(INFO) << android::base::StringPrintf(
+        "Post unwinding: %" PRIu64 " samples with %zu threads in %.3f s (%.0f samples/s).",
+        post_unwind_sample_count_, post_unwind_thread_count_, post_unwind_time_in_sec_,
+        samples_per_sec);
+  }
   LOG(DEBUG) << "In user space, dropped " << lost_samples << " samples, " << lost_non_samples
              << " non samples, cut stack of " << cut_stack_samples << " samples.";
   if (sample_record_count_ + lost_record_count_ != 0) {
@@ -690,6 +819,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         }
       }
       clockid_ = args[i];
+    } else if (args[i] == "--compress") {
+      compress_data_ = true;
     } else if (args[i] == "--cpu") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -721,6 +852,15 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       }
     } else if (args[i] == "--exit-with-parent") {
       prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
+    } else if (args[i] == "--flight-recorder") {
+      if (!GetDoubleOption(args, &i, &flight_recorder_window_in_sec_, 1e-9)) {
+        return false;
+      }
+    } else if (args[i] == "--flight-recorder-buffer-size") {
+      if (!GetUintOption(args, &i, &flight_recorder_buffer_size_in_mb_, 1,
+                         std::numeric_limits<size_t>::max() >> 20)) {
+        return false;
+      }
     } else if (args[i] == "-g") {
       fp_callchain_sampling_ = false;
       dwarf_callchain_sampling_ = true;
@@ -754,6 +894,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         }
         branch_sampling_ |= it->second;
       }
+    } else if (args[i] == "--kernel-symbol-index") {
+      dump_kernel_symbol_index_ = true;
     } else if (args[i] == "-m") {
       uint64_t pages;
       if (!GetUintOption(args, &i, &pages)) {
@@ -792,6 +934,11 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         return false;
       }
       event_selection_set_.AddMonitoredProcesses(pids);
+    } else if (args[i] == "--post-unwind-threads") {
+      if (!GetUintOption(args, &i, &post_unwind_thread_count_, 1,
+                         sysconf(_SC_NPROCESSORS_CONF))) {
+        return false;
+      }
     } else if (android::base::StartsWith(args[i], "--post-unwind")) {
       if (args[i] == "--post-unwind" || args[i] == "--post-unwind=yes") {
         post_unwind_ = true;
@@ -801,6 +948,11 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         LOG(ERROR) << "unexpected option " << args[i];
         return false;
       }
+    } else if (args[i] == "--record-read-threads") {
+      if (!GetUintOption(args, &i, &record_read_thread_count_, 1,
+                         sysconf(_SC_NPROCESSORS_CONF))) {
+        return false;
+      }
     } else if (args[i] == "--size-limit") {
       if (!GetUintOption(args, &i, &size_limit_in_bytes_, 1, std::numeric_limits<uint64_t>::max(),
                          true)) {
@@ -817,6 +969,10 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       if (!Dso::SetSymFsDir(args[i])) {
         return false;
       }
+    } else if (args[i] == "--sync-interval") {
+      if (!GetDoubleOption(args, &i, &sync_interval_in_sec_, 1e-9)) {
+        return false;
+      }
     } else if (args[i] == "-t") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -835,6 +991,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       if (!SetTracepointEventsFilePath(args[i])) {
         return false;
       }
+    } else if (args[i] == "--trim-stack") {
+      trim_stack_ = true;
     } else if (args[i] == "--") {
       i++;
       break;
@@ -851,12 +1009,33 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       return false;
     }
     unwind_dwarf_callchain_ = false;
+    if (trim_stack_) {
+      LOG(ERROR) << "--trim-stack is only used with `--call-graph dwarf` option.";
+      return false;
+    }
   }
   if (post_unwind_) {
     if (!dwarf_callchain_sampling_ || !unwind_dwarf_callchain_) {
       post_unwind_ = false;
     }
   }
+  if (sync_interval_in_sec_ != 0) {
+    if (post_unwind_) {
+      LOG(ERROR) << "--sync-interval can't be used with --post-unwind=yes.";
+      return false;
+    }
+    allow_callchain_joiner_ = false;
+  }
+  if (flight_recorder_window_in_sec_ != 0) {
+    if (post_unwind_ || size_limit_in_bytes_ != 0 || sync_interval_in_sec_ != 0) {
+      LOG(ERROR) << "--flight-recorder can't be used with --post-unwind=yes, --size-limit or "
+                 << "--sync-interval.";
+      return false;
+    }
+    // Callchains are joined by rewriting the record file after recording, which doesn't apply
+    // to dumped records.
+    allow_callchain_joiner_ = false;
+  }
 
   if (fp_callchain_sampling_) {
     if (GetBuildArch() == ARCH_ARM) {
@@ -959,13 +1138,27 @@ bool RecordCommand::SetEventSelectionFlags() {
 }
 
 bool RecordCommand::CreateAndInitRecordFile() {
-  record_file_writer_ = CreateRecordFile(record_filename_);
-  if (record_file_writer_ == nullptr) {
-    return false;
+  if (flight_recorder_window_in_sec_ != 0) {
+    // Records are kept in memory until dumped.
+    flight_recorder_.reset(new FlightRecorder(
+        static_cast<uint64_t>(flight_recorder_window_in_sec_ * 1e9),
+        flight_recorder_buffer_size_in_mb_ << 20, flight_recorder_buffer_size_in_mb_ << 20));
+  } else {
+    record_file_writer_ = CreateRecordFile(record_filename_);
+    if (record_file_writer_ == nullptr) {
+      return false;
+    }
   }
   // Use first perf_event_attr and first event id to dump mmap and comm records.
   dumping_attr_id_ = event_selection_set_.GetEventAttrWithId()[0];
-  return DumpKernelSymbol() && DumpTracingData() && DumpKernelMaps() && DumpUserSpaceMaps();
+  if (!DumpKernelSymbol() || !DumpTracingData() || !DumpKernelMaps() || !DumpUserSpaceMaps()) {
+    return false;
+  }
+  if (flight_recorder_) {
+    // Records dumped before recording starts are needed to report samples in every dump.
+    flight_recorder_->PinRecords();
+  }
+  return true;
 }
 
 std::unique_ptr<RecordFileWriter> RecordCommand::CreateRecordFile(
@@ -979,6 +1172,9 @@ std::unique_ptr<RecordFileWriter> RecordCommand::CreateRecordFile(
   if (!writer->WriteAttrSection(event_selection_set_.GetEventAttrWithId())) {
     return nullptr;
   }
+  if (compress_data_ && !writer->EnableDataCompression()) {
+    return nullptr;
+  }
   return writer;
 }
 
@@ -991,9 +1187,18 @@ bool RecordCommand::DumpKernelSymbol() {
         PLOG(ERROR) << "failed to read /proc/kallsyms";
         return false;
       }
-      KernelSymbolRecord r(kallsyms);
-      if (!ProcessRecord(&r)) {
-        return false;
+      if (dump_kernel_symbol_index_) {
+        // A prebuilt index doesn't need to be parsed by readers, but old readers can't use it.
+        std::unique_ptr<KernelSymbolIndex> index = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+        KernelSymbolIndexRecord r(index->Serialize(), index->SymbolCount());
+        if (!ProcessRecord(&r)) {
+          return false;
+        }
+      } else {
+        KernelSymbolRecord r(kallsyms);
+        if (!ProcessRecord(&r)) {
+          return false;
+        }
       }
     }
   }
@@ -1131,6 +1336,50 @@ bool RecordCommand::ProcessRecord(Record* record) {
   return SaveRecordWithoutUnwinding(record);
 }
 
+// Process a record read from kernel buffers. To reduce overhead, sample records are written to
+// the record file directly from the RecordBuffer when they don't need to be modified.
+bool RecordCommand::ProcessRecordData(char* data) {
+  perf_event_header header;
+  memcpy(&header, data, sizeof(header));
+  if (header.type != PERF_RECORD_SAMPLE || !save_samples_without_parsing_) {
+    std::unique_ptr<Record> r = ReadRecordFromBuffer(*dumping_attr_id_.attr, data);
+    return ProcessRecord(r.get());
+  }
+  uint32_t pid = 0;
+  uint64_t timestamp = 0;
+  size_t pos = record_parser_->GetPidPos(header);
+  if (pos != 0) {
+    memcpy(&pid, data + pos, sizeof(pid));
+  }
+  pos = record_parser_->GetTimePos(header);
+  if (pos != 0) {
+    memcpy(&timestamp, data + pos, sizeof(timestamp));
+  }
+  if (size_limit_in_bytes_ > 0u) {
+    if (size_limit_in_bytes_ < record_file_writer_->GetDataSectionSize()) {
+      return event_selection_set_.GetIOEventLoop()->ExitLoop();
+    }
+  }
+  if (jit_debug_reader_ && !jit_debug_reader_->UpdateSample(pid, timestamp)) {
+    return false;
+  }
+  last_record_timestamp_ = std::max(last_record_timestamp_, timestamp);
+  if (system_wide_collection_ && !DumpMapsForProcess(pid)) {
+    return false;
+  }
+  if (!WriteRecordData(data)) {
+    if (post_unwind_) {
+      LOG(ERROR) << "If there isn't enough space for storing profiling data, consider using "
+                 << "--no-post-unwind option.";
+    }
+    return false;
+  }
+  if (!post_unwind_) {
+    sample_record_count_++;
+  }
+  return true;
+}
+
 template <typename MmapRecordType>
 bool MapOnlyExistInMemory(MmapRecordType* record) {
   return !record->InKernel() && MappedFileOnlyExistInMemory(record->filename);
@@ -1155,16 +1404,20 @@ bool RecordCommand::ShouldOmitRecord(Record* record) {
 
 bool RecordCommand::DumpMapsForRecord(Record* record) {
   if (record->type() == PERF_RECORD_SAMPLE) {
-    pid_t pid = static_cast<SampleRecord*>(record)->tid_data.pid;
-    if (dumped_processes_.find(pid) == dumped_processes_.end()) {
-      // Dump map info and all thread names for that process.
-      std::vector<pid_t> tids = GetThreadsInProcess(pid);
-      if (!tids.empty() &&
-          !DumpProcessMaps(pid, std::unordered_set<pid_t>(tids.begin(), tids.end()))) {
-        return false;
-      }
-      dumped_processes_.insert(pid);
+    return DumpMapsForProcess(static_cast<SampleRecord*>(record)->tid_data.pid);
+  }
+  return true;
+}
+
+bool RecordCommand::DumpMapsForProcess(pid_t pid) {
+  if (dumped_processes_.find(pid) == dumped_processes_.end()) {
+    // Dump map info and all thread names for that process.
+    std::vector<pid_t> tids = GetThreadsInProcess(pid);
+    if (!tids.empty() &&
+        !DumpProcessMaps(pid, std::unordered_set<pid_t>(tids.begin(), tids.end()))) {
+      return false;
     }
+    dumped_processes_.insert(pid);
   }
   return true;
 }
@@ -1187,19 +1440,24 @@ bool RecordCommand::SaveRecordAfterUnwinding(Record* record) {
     if (!UnwindRecord(r)) {
       return false;
     }
-    // ExcludeKernelCallChain() should go after UnwindRecord() to notice the generated user call
-    // chain.
-    if (r.InKernel() && exclude_kernel_callchain_ && !r.ExcludeKernelCallChain()) {
-      // If current record contains no user callchain, skip it.
-      return true;
-    }
-    sample_record_count_++;
+    return SaveUnwoundSample(r);
   } else if (record->type() == PERF_RECORD_LOST) {
     lost_record_count_ += static_cast<LostRecord*>(record)->lost;
   } else {
     thread_tree_.Update(*record);
   }
-  return record_file_writer_->WriteRecord(*record);
+  return WriteRecord(*record);
+}
+
+bool RecordCommand::SaveUnwoundSample(SampleRecord& r) {
+  // ExcludeKernelCallChain() should go after UnwindRecord() to notice the generated user call
+  // chain.
+  if (r.InKernel() && exclude_kernel_callchain_ && !r.ExcludeKernelCallChain()) {
+    // If current record contains no user callchain, skip it.
+    return true;
+  }
+  sample_record_count_++;
+  return WriteRecord(r);
 }
 
 bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
@@ -1216,7 +1474,59 @@ bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
   } else if (record->type() == PERF_RECORD_LOST) {
     lost_record_count_ += static_cast<LostRecord*>(record)->lost;
   }
-  return record_file_writer_->WriteRecord(*record);
+  return WriteRecord(*record);
+}
+
+bool RecordCommand::WriteRecord(const Record& record) {
+  if (flight_recorder_) {
+    flight_recorder_->AddRecord(record.Binary(), record.Timestamp());
+    return true;
+  }
+  return record_file_writer_->WriteRecord(record);
+}
+
+bool RecordCommand::WriteRecordData(const char* data) {
+  if (flight_recorder_) {
+    perf_event_header header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t timestamp = 0;
+    size_t pos = record_parser_->GetTimePos(header);
+    if (pos != 0) {
+      memcpy(&timestamp, data + pos, sizeof(timestamp));
+    }
+    flight_recorder_->AddRecord(data, timestamp);
+    return true;
+  }
+  return record_file_writer_->WriteRecordData(data);
+}
+
+bool RecordCommand::DumpFlightRecords() {
+  // Read records left in kernel buffers, so the dump includes the latest samples.
+  if (!event_selection_set_.SyncKernelBuffer()) {
+    return false;
+  }
+  std::string filename = record_filename_ + "." + std::to_string(++flight_dump_count_);
+  record_file_writer_ = CreateRecordFile(filename);
+  if (!record_file_writer_) {
+    return false;
+  }
+  auto write_record = [this](const char* data) {
+    return record_file_writer_->WriteRecordData(data);
+  };
+  if (!flight_recorder_->ForEachRecord(write_record)) {
+    return false;
+  }
+  // thread_tree_ is still used for unwinding, so build hit file info in a separate thread tree.
+  ThreadTree thread_tree;
+  for (auto& pair : dex_file_offsets_) {
+    thread_tree.AddDexFileOffset(pair.first, pair.second);
+  }
+  if (!DumpAdditionalFeatures(thread_tree) || !record_file_writer_->Close()) {
+    return false;
+  }
+  record_file_writer_.reset();
+  LOG(INFO) << "Dump flight records to " << filename;
+  return true;
 }
 
 bool RecordCommand::ProcessJITDebugInfo(const std::vector<JITDebugInfo>& debug_info,
@@ -1227,13 +1537,20 @@ bool RecordCommand::ProcessJITDebugInfo(const std::vector<JITDebugInfo>& debug_i
       uint64_t timestamp = jit_debug_reader_->SyncWithRecords() ? info.timestamp
                                                                 : last_record_timestamp_;
       Mmap2Record record(*attr_id.attr, false, info.pid, info.pid,
-                         info.jit_code_addr, info.jit_code_len, 0, map_flags::PROT_JIT_SYMFILE_MAP,
-                         info.file_path, attr_id.ids[0], timestamp);
+                         info.jit_code_addr, info.jit_code_len, info.symfile_offset,
+                         map_flags::PROT_JIT_SYMFILE_MAP, info.file_path, attr_id.ids[0],
+                         timestamp);
+      if (info.symfile_offset != 0) {
+        jit_symfile_container_path_ = info.file_path;
+      }
       if (!ProcessRecord(&record)) {
         return false;
       }
     } else {
       thread_tree_.AddDexFileOffset(info.file_path, info.dex_file_offset);
+      if (flight_recorder_) {
+        dex_file_offsets_.emplace_back(info.file_path, info.dex_file_offset);
+      }
     }
   }
   // We want to let samples see the most recent JIT maps generated before them, but no JIT maps
@@ -1309,11 +1626,7 @@ void RecordCommand::UpdateRecord(Record* record) {
 }
 
 bool RecordCommand::UnwindRecord(SampleRecord& r) {
-  if ((r.sample_type & PERF_SAMPLE_CALLCHAIN) &&
-      (r.sample_type & PERF_SAMPLE_REGS_USER) &&
-      (r.regs_user_data.reg_mask != 0) &&
-      (r.sample_type & PERF_SAMPLE_STACK_USER) &&
-      (r.GetValidStackSize() > 0)) {
+  if (UnwindingWorkerPool::CanUnwindSample(r)) {
     ThreadEntry* thread =
         thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
     RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
@@ -1334,11 +1647,17 @@ bool RecordCommand::UnwindRecord(SampleRecord& r) {
         return false;
       }
     }
-    r.ReplaceRegAndStackWithCallChain(ips);
-    if (callchain_joiner_) {
-      return callchain_joiner_->AddCallChain(r.tid_data.pid, r.tid_data.tid,
-                                             CallChainJoiner::ORIGINAL_OFFLINE, ips, sps);
-    }
+    return SetUnwoundCallChain(r, ips, sps);
+  }
+  return true;
+}
+
+bool RecordCommand::SetUnwoundCallChain(SampleRecord& r, const std::vector<uint64_t>& ips,
+                                        const std::vector<uint64_t>& sps) {
+  r.ReplaceRegAndStackWithCallChain(ips);
+  if (callchain_joiner_) {
+    return callchain_joiner_->AddCallChain(r.tid_data.pid, r.tid_data.tid,
+                                           CallChainJoiner::ORIGINAL_OFFLINE, ips, sps);
   }
   return true;
 }
@@ -1365,10 +1684,45 @@ bool RecordCommand::PostUnwindRecords() {
   }
   sample_record_count_ = 0;
   lost_record_count_ = 0;
-  auto callback = [this](std::unique_ptr<Record> record) {
-    return SaveRecordAfterUnwinding(record.get());
+
+  // Samples are unwound in worker threads. Other steps are done in this thread in record order.
+  auto save_record = [this](UnwindingWorkerPool::Result& result) {
+    Record* record = result.record.get();
+    if (record->type() != PERF_RECORD_SAMPLE) {
+      return record_file_writer_->WriteRecord(*record);
+    }
+    auto& r = *static_cast<SampleRecord*>(record);
+    if (result.unwound && !SetUnwoundCallChain(r, result.ips, result.sps)) {
+      return false;
+    }
+    return SaveUnwoundSample(r);
+  };
+  UnwindingWorkerPool unwinding_pool(post_unwind_thread_count_, false, save_record);
+  uint64_t start_time = GetSystemClock();
+  post_unwind_sample_count_ = 0;
+  auto callback = [&](std::unique_ptr<Record> record) {
+    const ThreadEntry* thread = nullptr;
+    if (record->type() == PERF_RECORD_SAMPLE) {
+      auto& r = *static_cast<SampleRecord*>(record.get());
+      // AdjustCallChainGeneratedByKernel() should go before unwinding. Because we don't want
+      // to adjust callchains generated by dwarf unwinder.
+      r.AdjustCallChainGeneratedByKernel();
+      if (UnwindingWorkerPool::CanUnwindSample(r)) {
+        thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+        post_unwind_sample_count_++;
+      }
+    } else if (record->type() == PERF_RECORD_LOST) {
+      lost_record_count_ += static_cast<LostRecord*>(record.get())->lost;
+    } else {
+      thread_tree_.Update(*record);
+    }
+    return unwinding_pool.AddRecord(std::move(record), thread);
   };
-  return reader->ReadDataSection(callback);
+  if (!reader->ReadDataSection(callback) || !unwinding_pool.Finish()) {
+    return false;
+  }
+  post_unwind_time_in_sec_ = (GetSystemClock() - start_time) / 1e9;
+  return true;
 }
 
 bool RecordCommand::JoinCallChains() {
@@ -1419,36 +1773,41 @@ bool RecordCommand::JoinCallChains() {
   return reader->ReadDataSection(record_callback);
 }
 
-bool RecordCommand::DumpAdditionalFeatures(
-    const std::vector<std::string>& args) {
+bool RecordCommand::DumpAdditionalFeatures(ThreadTree& thread_tree) {
   // Read data section of perf.data to collect hit file information.
-  thread_tree_.ClearThreadAndMap();
+  thread_tree.ClearThreadAndMap();
   bool kernel_symbols_available = false;
   if (CheckKernelSymbolAddresses()) {
     Dso::ReadKernelSymbolsFromProc();
     kernel_symbols_available = true;
   }
   auto callback = [&](const Record* r) {
-    thread_tree_.Update(*r);
+    thread_tree.Update(*r);
     if (r->type() == PERF_RECORD_SAMPLE) {
-      CollectHitFileInfo(*reinterpret_cast<const SampleRecord*>(r));
+      CollectHitFileInfo(thread_tree, *reinterpret_cast<const SampleRecord*>(r));
     }
   };
   if (!record_file_writer_->ReadDataSection(callback)) {
     return false;
   }
 
-  size_t feature_count = 6;
+  size_t feature_count = 7;
   if (branch_sampling_) {
     feature_count++;
   }
+  if (compress_data_) {
+    feature_count++;
+  }
+  if (!jit_symfile_container_path_.empty()) {
+    feature_count++;
+  }
   if (!record_file_writer_->BeginWriteFeatures(feature_count)) {
     return false;
   }
-  if (!DumpBuildIdFeature()) {
+  if (!DumpBuildIdFeature(thread_tree)) {
     return false;
   }
-  if (!DumpFileFeature()) {
+  if (!DumpFileFeature(thread_tree)) {
     return false;
   }
   utsname uname_buf;
@@ -1470,7 +1829,7 @@ bool RecordCommand::DumpAdditionalFeatures(
   std::vector<std::string> cmdline;
   cmdline.push_back(exec_path);
   cmdline.push_back("record");
-  cmdline.insert(cmdline.end(), args.begin(), args.end());
+  cmdline.insert(cmdline.end(), record_args_.begin(), record_args_.end());
   if (!record_file_writer_->WriteCmdlineFeature(cmdline)) {
     return false;
   }
@@ -1478,9 +1837,21 @@ bool RecordCommand::DumpAdditionalFeatures(
       !record_file_writer_->WriteBranchStackFeature()) {
     return false;
   }
+  if (compress_data_ &&
+      !record_file_writer_->WriteFeatureString(PerfFileFormat::FEAT_DATA_COMPRESSION, "zlib")) {
+    return false;
+  }
+  if (!jit_symfile_container_path_.empty() &&
+      !record_file_writer_->WriteFeatureString(PerfFileFormat::FEAT_JIT_SYMFILE_CONTAINER,
+                                               jit_symfile_container_path_)) {
+    return false;
+  }
   if (!DumpMetaInfoFeature(kernel_symbols_available)) {
     return false;
   }
+  if (!record_file_writer_->WriteRecordIndexFeature()) {
+    return false;
+  }
 
   if (!record_file_writer_->EndWriteFeatures()) {
     return false;
@@ -1488,10 +1859,10 @@ bool RecordCommand::DumpAdditionalFeatures(
   return true;
 }
 
-bool RecordCommand::DumpBuildIdFeature() {
+bool RecordCommand::DumpBuildIdFeature(ThreadTree& thread_tree) {
   std::vector<BuildIdRecord> build_id_records;
   BuildId build_id;
-  std::vector<Dso*> dso_v = thread_tree_.GetAllDsos();
+  std::vector<Dso*> dso_v = thread_tree.GetAllDsos();
   for (Dso* dso : dso_v) {
     if (!dso->HasDumpId()) {
       continue;
@@ -1531,9 +1902,9 @@ bool RecordCommand::DumpBuildIdFeature() {
   return true;
 }
 
-bool RecordCommand::DumpFileFeature() {
-  std::vector<Dso*> dso_v = thread_tree_.GetAllDsos();
-  return record_file_writer_->WriteFileFeatures(thread_tree_.GetAllDsos());
+bool RecordCommand::DumpFileFeature(ThreadTree& thread_tree) {
+  std::vector<Dso*> dso_v = thread_tree.GetAllDsos();
+  return record_file_writer_->WriteFileFeatures(thread_tree.GetAllDsos());
 }
 
 bool RecordCommand::DumpMetaInfoFeature(bool kernel_symbols_available) {
@@ -1560,15 +1931,15 @@ bool RecordCommand::DumpMetaInfoFeature(bool kernel_symbols_available) {
   return record_file_writer_->WriteMetaInfoFeature(info_map);
 }
 
-void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
+void RecordCommand::CollectHitFileInfo(ThreadTree& thread_tree, const SampleRecord& r) {
   const ThreadEntry* thread =
-      thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      thread_tree.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
   const MapEntry* map =
-      thread_tree_.FindMap(thread, r.ip_data.ip, r.InKernel());
+      thread_tree.FindMap(thread, r.ip_data.ip, r.InKernel());
   Dso* dso = map->dso;
   const Symbol* symbol;
   if (dump_symbols_) {
-    symbol = thread_tree_.FindSymbol(map, r.ip_data.ip, nullptr, &dso);
+    symbol = thread_tree.FindSymbol(map, r.ip_data.ip, nullptr, &dso);
     if (!symbol->HasDumpId()) {
       dso->CreateSymbolDumpId(symbol);
     }
@@ -1601,10 +1972,10 @@ void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
             continue;
           }
         }
-        map = thread_tree_.FindMap(thread, ip, in_kernel);
+        map = thread_tree.FindMap(thread, ip, in_kernel);
         dso = map->dso;
         if (dump_symbols_) {
-          symbol = thread_tree_.FindSymbol(map, ip, nullptr, &dso);
+          symbol = thread_tree.FindSymbol(map, ip, nullptr, &dso);
           if (!symbol->HasDumpId()) {
             dso->CreateSymbolDumpId(symbol);
           }
@@ -356,7 +356,7 @@ TEST(record_cmd, mmap_page_option) {
 }
 
 static void CheckKernelSymbol(const std::string& path, bool need_kallsyms,
-                              bool* success) {
+                              bool* success, int record_type = SIMPLE_PERF_RECORD_KERNEL_SYMBOL) {
   *success = false;
   std::unique_ptr<RecordFileReader> reader =
       RecordFileReader::CreateInstance(path);
@@ -364,7 +364,7 @@ static void CheckKernelSymbol(const std::string& path, bool need_kallsyms,
   std::vector<std::unique_ptr<Record>> records = reader->DataSection();
   bool has_kernel_symbol_records = false;
   for (const auto& record : records) {
-    if (record->type() == SIMPLE_PERF_RECORD_KERNEL_SYMBOL) {
+    if (record->type() == record_type) {
       has_kernel_symbol_records = true;
     }
   }
@@ -383,6 +383,9 @@ TEST(record_cmd, kernel_symbol) {
   ASSERT_TRUE(RunRecordCmd({"--no-dump-symbols", "--no-dump-kernel-symbols"}, tmpfile.path));
   CheckKernelSymbol(tmpfile.path, false, &success);
   ASSERT_TRUE(success);
+  ASSERT_TRUE(RunRecordCmd({"--no-dump-symbols", "--kernel-symbol-index"}, tmpfile.path));
+  CheckKernelSymbol(tmpfile.path, true, &success, SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX);
+  ASSERT_TRUE(success);
 }
 
 // Check if the dso/symbol records in perf.data matches our expectation.
@@ -728,3 +731,66 @@ TEST(record_cmd, cpu_percent_option) {
   ASSERT_FALSE(RunRecordCmd({"--cpu-percent", "0"}));
   ASSERT_FALSE(RunRecordCmd({"--cpu-percent", "101"}));
 }
+
+TEST(record_cmd, record_read_threads_option) {
+  ASSERT_TRUE(RunRecordCmd({"-e", "cpu-clock", "--record-read-threads", "1"}));
+  ASSERT_TRUE(RunRecordCmd({"-e", "cpu-clock", "--record-read-threads", "2"}));
+  ASSERT_FALSE(RunRecordCmd({"-e", "cpu-clock", "--record-read-threads", "0"}));
+}
+
+TEST(record_cmd, compress_option) {
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(RunRecordCmd({"-e", "cpu-clock", "--compress"}, tmpfile.path));
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile.path);
+  ASSERT_TRUE(reader != nullptr);
+  ASSERT_EQ(reader->ReadFeatureString(FEAT_DATA_COMPRESSION), "zlib");
+  bool has_sample = false;
+  ASSERT_TRUE(reader->ReadDataSection([&](std::unique_ptr<Record> r) {
+    if (r->type() == PERF_RECORD_SAMPLE) {
+      has_sample = true;
+    }
+    return true;
+  }));
+  ASSERT_TRUE(has_sample);
+}
+
+TEST(record_cmd, sync_interval_option) {
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(RunRecordCmd({"-e", "cpu-clock", "--sync-interval", "0.1"}, tmpfile.path));
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile.path);
+  ASSERT_TRUE(reader != nullptr);
+  // The file is finished after recording.
+  bool finished;
+  ASSERT_TRUE(reader->RefreshDataSection(&finished));
+  ASSERT_TRUE(finished);
+}
+
+TEST(record_cmd, flight_recorder_option) {
+  TemporaryFile tmpfile;
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  int read_fd = pipefd[0];
+  int write_fd = pipefd[1];
+  char data[8] = {};
+  std::thread thread([&]() {
+    android::base::ReadFully(read_fd, data, 7);
+    usleep(100000);
+    kill(getpid(), SIGUSR2);
+  });
+  ASSERT_TRUE(RecordCmd()->Run({"-e", "cpu-clock", "-o", tmpfile.path, "--flight-recorder", "10",
+                                "--start_profiling_fd", std::to_string(write_fd), "--duration",
+                                "1"}));
+  thread.join();
+  close(write_fd);
+  close(read_fd);
+  // Records are only written when dumping.
+  std::string dump_file = std::string(tmpfile.path) + ".1";
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(dump_file);
+  ASSERT_TRUE(reader != nullptr);
+  ASSERT_FALSE(reader->ReadCmdlineFeature().empty());
+  reader.reset();
+  remove(dump_file.c_str());
+
+  ASSERT_FALSE(RunRecordCmd({"--flight-recorder", "10", "--size-limit", "1M"}));
+  ASSERT_FALSE(RunRecordCmd({"--flight-recorder", "10", "--sync-interval", "1"}));
+}
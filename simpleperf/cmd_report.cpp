@@ -16,10 +16,15 @@
 
 #include <inttypes.h>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <map>
+#include <mutex>
+#include <queue>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -72,19 +77,19 @@ struct SampleEntry {
   CallChainRoot<SampleEntry> callchain;
 
   SampleEntry(uint64_t time, uint64_t period, uint64_t accumulated_period,
-              uint64_t sample_count, const ThreadEntry* thread,
+              uint64_t sample_count, const ThreadEntry* thread, const char* thread_comm,
               const MapEntry* map, const Symbol* symbol, uint64_t vaddr_in_file)
       : time(time),
         period(period),
         accumulated_period(accumulated_period),
         sample_count(sample_count),
         thread(thread),
-        thread_comm(thread->comm),
+        thread_comm(thread_comm),
         map(map),
         symbol(symbol),
         vaddr_in_file(vaddr_in_file) {}
 
-  // The data member 'callchain' can only move, not copy.
+  // Samples are moved into the arena of SampleTreeBuilder, not copied.
   SampleEntry(SampleEntry&&) = default;
   SampleEntry(SampleEntry&) = delete;
 
@@ -101,8 +106,63 @@ struct SampleTree {
 };
 
 BUILD_COMPARE_VALUE_FUNCTION(CompareVaddrInFile, vaddr_in_file);
+BUILD_KEY_VALUE_FUNCTION(KeyVaddrInFile, vaddr_in_file);
 BUILD_DISPLAY_HEX64_FUNCTION(DisplayVaddrInFile, vaddr_in_file);
 
+enum IpType {
+  USER_IP,
+  KERNEL_IP,
+  // Not known whether in user space or kernel, like addresses in branch stacks.
+  UNKNOWN_IP,
+};
+
+struct ResolvedIp {
+  uint64_t ip;
+  IpType type;
+  const MapEntry* map;
+  // Null for ips in callchains hitting unknown dsos, which are invalid.
+  const Symbol* symbol;
+  uint64_t vaddr_in_file;
+};
+
+// Thread and symbols of a sample, resolved in the thread updating ThreadTree. It allows other
+// threads to build sample trees without accessing ThreadTree, which keeps changing.
+struct ResolvedSample {
+  const ThreadEntry* thread;
+  const char* thread_comm;
+  // Ips in the order used by SampleTreeBuilder::ProcessSampleRecord().
+  std::vector<ResolvedIp> ips;
+};
+
+static void ResolveIp(ThreadTree* thread_tree, const ThreadEntry* thread, uint64_t ip,
+                      IpType type, bool in_callchain, ResolvedIp* result) {
+  result->ip = ip;
+  result->type = type;
+  if (type == UNKNOWN_IP) {
+    result->map = thread_tree->FindMap(thread, ip);
+  } else {
+    result->map = thread_tree->FindMap(thread, ip, type == KERNEL_IP);
+  }
+  if (in_callchain && thread_tree->IsUnknownDso(result->map->dso)) {
+    result->symbol = nullptr;
+    result->vaddr_in_file = 0;
+  } else {
+    result->symbol = thread_tree->FindSymbol(result->map, ip, &result->vaddr_in_file);
+  }
+}
+
+static void AddResolvedIp(ThreadTree* thread_tree, const ThreadEntry* thread, uint64_t ip,
+                          IpType type, bool in_callchain, ResolvedSample* resolved) {
+  resolved->ips.resize(resolved->ips.size() + 1);
+  ResolvedIp& result = resolved->ips.back();
+  ResolveIp(thread_tree, thread, ip, type, in_callchain, &result);
+  // Symbol names are demangled lazily. Do it here, so other threads only read them when
+  // comparing samples.
+  if (result.symbol != nullptr) {
+    result.symbol->DemangledName();
+  }
+}
+
 class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_t> {
  public:
   ReportCmdSampleTreeBuilder(const SampleComparator<SampleEntry>& sample_comparator,
@@ -111,7 +171,9 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
         thread_tree_(thread_tree),
         total_samples_(0),
         total_period_(0),
-        total_error_callchains_(0) {}
+        total_error_callchains_(0),
+        resolved_sample_(nullptr),
+        resolved_ip_pos_(0) {}
 
   void SetFilters(const std::unordered_set<int>& pid_filter,
                   const std::unordered_set<int>& tid_filter,
@@ -125,6 +187,8 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
     symbol_filter_ = symbol_filter;
   }
 
+  uint64_t GetTotalSamples() const { return total_samples_; }
+
   SampleTree GetSampleTree() {
     AddCallChainDuplicateInfo();
     SampleTree sample_tree;
@@ -143,43 +207,48 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
     return ProcessSampleRecord(r);
   }
 
+  // Process a sample resolved by SampleTreeBuilderOptions::ResolveSample(). It doesn't access
+  // thread_tree_, so can run in a thread other than the one updating thread_tree_.
+  void ProcessResolvedSampleRecord(const SampleRecord& r, const ResolvedSample& resolved) {
+    resolved_sample_ = &resolved;
+    resolved_ip_pos_ = 0;
+    ProcessSampleRecord(r);
+    resolved_sample_ = nullptr;
+  }
+
+  void MergeSampleTreeFrom(ReportCmdSampleTreeBuilder& other) {
+    MergeSamplesFrom(other);
+    total_samples_ += other.total_samples_;
+    total_period_ += other.total_period_;
+    total_error_callchains_ += other.total_error_callchains_;
+  }
+
  protected:
   virtual uint64_t GetPeriod(const SampleRecord& r) = 0;
 
   SampleEntry* CreateSample(const SampleRecord& r, bool in_kernel,
                             uint64_t* acc_info) override {
-    const ThreadEntry* thread =
-        thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
-    const MapEntry* map =
-        thread_tree_->FindMap(thread, r.ip_data.ip, in_kernel);
-    uint64_t vaddr_in_file;
-    const Symbol* symbol =
-        thread_tree_->FindSymbol(map, r.ip_data.ip, &vaddr_in_file);
+    const char* thread_comm;
+    const ThreadEntry* thread = GetThread(r, &thread_comm);
+    const ResolvedIp& ip = GetIp(thread, r.ip_data.ip, in_kernel ? KERNEL_IP : USER_IP, false);
     uint64_t period = GetPeriod(r);
     *acc_info = period;
-    return InsertSample(std::unique_ptr<SampleEntry>(
-        new SampleEntry(r.time_data.time, period, 0, 1, thread, map, symbol, vaddr_in_file)));
+    return InsertSample(SampleEntry(r.time_data.time, period, 0, 1, thread, thread_comm, ip.map,
+                                    ip.symbol, ip.vaddr_in_file));
   }
 
   SampleEntry* CreateBranchSample(const SampleRecord& r,
                                   const BranchStackItemType& item) override {
-    const ThreadEntry* thread =
-        thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
-    const MapEntry* from_map = thread_tree_->FindMap(thread, item.from);
-    uint64_t from_vaddr_in_file;
-    const Symbol* from_symbol =
-        thread_tree_->FindSymbol(from_map, item.from, &from_vaddr_in_file);
-    const MapEntry* to_map = thread_tree_->FindMap(thread, item.to);
-    uint64_t to_vaddr_in_file;
-    const Symbol* to_symbol =
-        thread_tree_->FindSymbol(to_map, item.to, &to_vaddr_in_file);
-    std::unique_ptr<SampleEntry> sample(
-        new SampleEntry(r.time_data.time, r.period_data.period, 0, 1, thread,
-                        to_map, to_symbol, to_vaddr_in_file));
-    sample->branch_from.map = from_map;
-    sample->branch_from.symbol = from_symbol;
-    sample->branch_from.vaddr_in_file = from_vaddr_in_file;
-    sample->branch_from.flags = item.flags;
+    const char* thread_comm;
+    const ThreadEntry* thread = GetThread(r, &thread_comm);
+    ResolvedIp from = GetIp(thread, item.from, UNKNOWN_IP, false);
+    const ResolvedIp& to = GetIp(thread, item.to, UNKNOWN_IP, false);
+    SampleEntry sample(r.time_data.time, r.period_data.period, 0, 1, thread, thread_comm, to.map,
+                       to.symbol, to.vaddr_in_file);
+    sample.branch_from.map = from.map;
+    sample.branch_from.symbol = from.symbol;
+    sample.branch_from.vaddr_in_file = from.vaddr_in_file;
+    sample.branch_from.flags = item.flags;
     return InsertSample(std::move(sample));
   }
 
@@ -188,18 +257,16 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
                                      const std::vector<SampleEntry*>& callchain,
                                      const uint64_t& acc_info) override {
     const ThreadEntry* thread = sample->thread;
-    const MapEntry* map = thread_tree_->FindMap(thread, ip, in_kernel);
-    if (thread_tree_->IsUnknownDso(map->dso)) {
+    const ResolvedIp& resolved = GetIp(thread, ip, in_kernel ? KERNEL_IP : USER_IP, true);
+    if (resolved.symbol == nullptr) {
       // The unwinders can give wrong ip addresses, which can't map to a valid dso. Skip them.
       total_error_callchains_++;
       return nullptr;
     }
-    uint64_t vaddr_in_file;
-    const Symbol* symbol = thread_tree_->FindSymbol(map, ip, &vaddr_in_file);
-    std::unique_ptr<SampleEntry> callchain_sample(new SampleEntry(
-        sample->time, 0, acc_info, 0, thread, map, symbol, vaddr_in_file));
-    callchain_sample->thread_comm = sample->thread_comm;
-    return InsertCallChainSample(std::move(callchain_sample), callchain);
+    return InsertCallChainSample(
+        SampleEntry(sample->time, 0, acc_info, 0, thread, sample->thread_comm, resolved.map,
+                    resolved.symbol, resolved.vaddr_in_file),
+        callchain);
   }
 
   const ThreadEntry* GetThreadOfSample(SampleEntry* sample) override {
@@ -247,6 +314,32 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
   }
 
  private:
+  const ThreadEntry* GetThread(const SampleRecord& r, const char** thread_comm) {
+    if (resolved_sample_ != nullptr) {
+      *thread_comm = resolved_sample_->thread_comm;
+      return resolved_sample_->thread;
+    }
+    const ThreadEntry* thread = thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+    *thread_comm = thread->comm;
+    return thread;
+  }
+
+  const ResolvedIp& GetIp(const ThreadEntry* thread, uint64_t ip, IpType type,
+                          bool in_callchain) {
+    if (resolved_sample_ != nullptr) {
+      // Ips are requested in the order they are resolved, since ResolveSample() uses the same
+      // ForEachBranchItem() and ForEachCallChainIp() iterations as ProcessSampleRecord().
+      // Resolved ips after a filtered sample aren't requested.
+      const std::vector<ResolvedIp>& ips = resolved_sample_->ips;
+      CHECK_LT(resolved_ip_pos_, ips.size());
+      const ResolvedIp& resolved = ips[resolved_ip_pos_++];
+      CHECK(resolved.ip == ip && resolved.type == type);
+      return resolved;
+    }
+    ResolveIp(thread_tree_, thread, ip, type, in_callchain, &resolved_ip_);
+    return resolved_ip_;
+  }
+
   ThreadTree* thread_tree_;
 
   std::unordered_set<int> pid_filter_;
@@ -258,6 +351,10 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
   uint64_t total_samples_;
   uint64_t total_period_;
   uint64_t total_error_callchains_;
+
+  const ResolvedSample* resolved_sample_;
+  size_t resolved_ip_pos_;
+  ResolvedIp resolved_ip_;
 };
 
 // Build sample tree based on event count in each sample.
@@ -334,6 +431,39 @@ struct SampleTreeBuilderOptions {
                                        use_caller_as_callchain_root);
     return builder;
   }
+
+  // Resolve thread and ips used by ReportCmdSampleTreeBuilder::ProcessResolvedSampleRecord(). It
+  // should be called in the thread updating thread_tree, right after thread_tree is updated by
+  // records before [r]. Offline unwinding isn't supported.
+  void ResolveSample(const SampleRecord& r, ResolvedSample* resolved) const {
+    const ThreadEntry* thread = thread_tree->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+    resolved->thread = thread;
+    resolved->thread_comm = thread->comm;
+    resolved->ips.clear();
+    if (use_branch_address && (r.sample_type & PERF_SAMPLE_BRANCH_STACK)) {
+      ReportCmdSampleTreeBuilder::ForEachBranchItem(r, [&](const BranchStackItemType& item) {
+        AddResolvedIp(thread_tree, thread, item.from, UNKNOWN_IP, false, resolved);
+        AddResolvedIp(thread_tree, thread, item.to, UNKNOWN_IP, false, resolved);
+      });
+      return;
+    }
+    bool in_kernel = r.InKernel();
+    AddResolvedIp(thread_tree, thread, r.ip_data.ip, in_kernel ? KERNEL_IP : USER_IP, false,
+                  resolved);
+    // Use the same iteration as SampleTreeBuilder::ProcessSampleRecord(), so ips are resolved in
+    // the order they are requested.
+    if (accumulate_callchain && (r.sample_type & PERF_SAMPLE_CALLCHAIN)) {
+      std::vector<uint64_t> ips(r.callchain_data.ips,
+                                r.callchain_data.ips + r.callchain_data.ip_nr);
+      ReportCmdSampleTreeBuilder::ForEachCallChainIp(
+          r, ips, in_kernel, [&](uint64_t ip, bool ip_in_kernel) {
+            AddResolvedIp(thread_tree, thread, ip, ip_in_kernel ? KERNEL_IP : USER_IP, true,
+                          resolved);
+            // SampleTreeBuilder stops at the first invalid ip in a callchain.
+            return resolved->ips.back().symbol != nullptr;
+          });
+    }
+  }
 };
 
 using ReportCmdSampleTreeSorter = SampleTreeSorter<SampleEntry>;
@@ -358,6 +488,130 @@ struct EventAttrWithName {
   std::string name;
 };
 
+// A bounded queue passing data between threads of the report pipeline.
+template <typename T>
+class BlockingQueue {
+ public:
+  explicit BlockingQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+  // Wait until there is room for [value]. Return false if the queue is closed.
+  bool Push(T&& value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_cond_.wait(lock, [&]() { return closed_ || queue_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    queue_.push(std::move(value));
+    not_empty_cond_.notify_one();
+    return true;
+  }
+
+  // Wait until there is data. Return false if the queue is closed and empty.
+  bool Pop(T* value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_cond_.wait(lock, [&]() { return closed_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return false;
+    }
+    *value = std::move(queue_.front());
+    queue_.pop();
+    not_full_cond_.notify_one();
+    return true;
+  }
+
+  // Stop accepting data. Data already in the queue can still be popped.
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_cond_.notify_all();
+    not_full_cond_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_cond_;
+  std::condition_variable not_full_cond_;
+  std::queue<T> queue_;
+  bool closed_;
+};
+
+// Max number of records in a batch passed between threads of the report pipeline.
+static constexpr size_t RECORD_BATCH_SIZE = 1024;
+// Max number of batches waiting in each queue of the report pipeline. It limits memory used by
+// records read but not processed.
+static constexpr size_t MAX_PENDING_RECORD_BATCHES = 16;
+
+// A record read by RecordReaderThread. For a sample, attr_id is the index of its event attr. It
+// is found in the reader thread, because EventIdRecords update the map from event ids to attrs
+// while reading records.
+struct RecordWithAttrId {
+  std::unique_ptr<Record> record;
+  size_t attr_id;
+};
+
+// Reads records of a record file in its own thread, and passes them in batches. Other threads
+// shouldn't use [reader] until the thread is destroyed.
+class RecordReaderThread {
+ public:
+  explicit RecordReaderThread(RecordFileReader* reader)
+      : queue_(MAX_PENDING_RECORD_BATCHES),
+        success_(true),
+        thread_(&RecordReaderThread::Run, this, reader) {}
+
+  ~RecordReaderThread() {
+    // Stop the thread if records are not all read.
+    queue_.Close();
+    thread_.join();
+  }
+
+  // Return false if there are no more records.
+  bool Pop(std::vector<RecordWithAttrId>* batch) { return queue_.Pop(batch); }
+  // Return false if reading records failed. Only valid after Pop() returns false.
+  bool Success() const { return success_; }
+
+ private:
+  void Run(RecordFileReader* reader) {
+    std::vector<RecordWithAttrId> batch;
+    while (true) {
+      std::unique_ptr<Record> record;
+      if (!reader->ReadRecord(record)) {
+        success_ = false;
+        break;
+      }
+      if (record == nullptr) {
+        break;
+      }
+      size_t attr_id = 0;
+      if (record->type() == PERF_RECORD_SAMPLE) {
+        attr_id = reader->GetAttrIndexOfRecord(record.get());
+      }
+      batch.push_back(RecordWithAttrId{std::move(record), attr_id});
+      if (batch.size() == RECORD_BATCH_SIZE) {
+        if (!queue_.Push(std::move(batch))) {
+          // Stopped by the consumer.
+          return;
+        }
+        batch.clear();
+      }
+    }
+    if (!batch.empty()) {
+      queue_.Push(std::move(batch));
+    }
+    queue_.Close();
+  }
+
+  BlockingQueue<std::vector<RecordWithAttrId>> queue_;
+  bool success_;
+  std::thread thread_;
+};
+
+struct ResolvedSampleTask {
+  std::unique_ptr<Record> record;
+  size_t attr_id;
+  ResolvedSample resolved;
+};
+
 class ReportCommand : public Command {
  public:
   ReportCommand()
@@ -372,13 +626,28 @@ class ReportCommand : public Command {
 "--children    Print the overhead accumulated by appearing in the callchain.\n"
 "--comms comm1,comm2,...   Report only for selected comms.\n"
 "--dsos dso1,dso2,...      Report only for selected dsos.\n"
+"--follow   Report a record file while it is being written by\n"
+"           `simpleperf record --sync-interval`. A new report is printed each\n"
+"           time new samples are read, until recording finishes. Symbols are\n"
+"           read from files on the current device.\n"
+"--follow-interval <sec>  Check for new records every <sec> seconds in --follow\n"
+"                         mode. Default is 1.\n"
+"--follow-timeout <sec>   Stop following if the record file doesn't grow in <sec>\n"
+"                         seconds, like when the recording process was killed.\n"
+"                         Default is 60.\n"
 "--full-callgraph  Print full call graph. Used with -g option. By default,\n"
 "                  brief call graph is printed.\n"
 "-g [callee|caller]    Print call graph. If callee mode is used, the graph\n"
 "                      shows how functions are called from others. Otherwise,\n"
 "                      the graph shows how functions call others.\n"
 "                      Default is caller mode.\n"
-"-i <file>  Specify path of record file, default is perf.data.\n"
+"-i <file>  Specify path of record file, default is perf.data. It can be used\n"
+"           multiple times to merge samples of record files recorded with the same\n"
+"           events, like files recorded on different devices. The files are read in\n"
+"           parallel, and samples are merged by sort keys, with shared libraries\n"
+"           told apart by build id. The default sort keys are dso,symbol. All files\n"
+"           should be recorded on the same arch. Meta info like the record command\n"
+"           line is only read from the first file.\n"
 "--kallsyms <file>     Set the file to read kernel symbols.\n"
 "--max-stack <frames>  Set max stack frames shown when printing call graph.\n"
 "-n         Print the sample count for each item.\n"
@@ -388,6 +657,8 @@ class ReportCommand : public Command {
 "--percent-limit <percent>  Set min percentage shown when printing call graph.\n"
 "--pids pid1,pid2,...  Report only for selected pids.\n"
 "--raw-period          Report period count instead of period percentage.\n"
+"--show-stats          Print memory used to build the report, including the peak rss and\n"
+"                      bytes per sample.\n"
 "--sort key1,key2,...  Select keys used to sort and print the report. The\n"
 "                      appearance order of keys decides the order of keys used\n"
 "                      to sort and print the report.\n"
@@ -407,13 +678,17 @@ class ReportCommand : public Command {
 "                        symbol_to       -- name of function branched to\n"
 "                      The default sort keys are:\n"
 "                        comm,pid,tid,dso,symbol\n"
+"--symbol-cache-dir <dir>  Cache symbols of elf files in <dir>. Later reports read cached\n"
+"                          symbols instead of parsing elf files again.\n"
 "--symbols symbol1;symbol2;...    Report only for selected symbols.\n"
 "--symfs <dir>         Look for files with symbols relative to this directory.\n"
+"--threads <count>     Set the number of threads used to load symbols and build the report.\n"
+"                      Default is the number of cpus.\n"
 "--tids tid1,tid2,...  Report only for selected tids.\n"
+"--top <n>             Only print the first <n> entries of each event.\n"
 "--vmlinux <file>      Parse kernel symbols from <file>.\n"
             // clang-format on
             ),
-        record_filename_("perf.data"),
         record_file_arch_(GetBuildArch()),
         use_branch_address_(false),
         system_wide_collection_(false),
@@ -425,7 +700,14 @@ class ReportCommand : public Command {
         raw_period_(false),
         brief_callgraph_(true),
         trace_offcpu_(false),
-        sched_switch_attr_id_(0u) {}
+        show_stats_(false),
+        show_ip_for_unknown_symbol_(true),
+        follow_(false),
+        follow_interval_in_sec_(1),
+        follow_timeout_in_sec_(60),
+        max_printed_entries_(SIZE_MAX),
+        sched_switch_attr_id_(0u),
+        report_thread_count_(std::max(std::thread::hardware_concurrency(), 1u)) {}
 
   bool Run(const std::vector<std::string>& args);
 
@@ -434,16 +716,28 @@ class ReportCommand : public Command {
   bool ReadMetaInfoFromRecordFile();
   bool ReadEventAttrFromRecordFile();
   bool ReadFeaturesFromRecordFile();
+  void CreateSampleTreeBuilders();
   bool ReadSampleTreeFromRecordFile();
+  void LoadBuildIdAndFileFeatures(RecordFileReader& reader, ThreadTree& thread_tree);
+  bool ReadSampleTreeFromMergedRecordFiles();
+  void BuildSampleTrees();
+  bool FollowRecordFile();
+  bool CanProcessRecordsInParallel();
+  bool ProcessRecordsInParallel();
   bool ProcessRecord(std::unique_ptr<Record> record);
   void ProcessSampleRecordInTraceOffCpuMode(std::unique_ptr<Record> record, size_t attr_id);
   bool ProcessTracingData(const std::vector<char>& data);
   bool PrintReport();
   void PrintReportContext(FILE* fp);
+  void PrintMemoryStats(FILE* fp);
 
-  std::string record_filename_;
+  std::vector<std::string> record_filenames_;
   ArchType record_file_arch_;
   std::unique_ptr<RecordFileReader> record_file_reader_;
+  // Readers of record files other than the first one, when merging samples of multiple files.
+  std::vector<std::unique_ptr<RecordFileReader>> merged_file_readers_;
+  // Thread trees of merged record files, kept alive because samples refer to them.
+  std::vector<std::unique_ptr<ThreadTree>> merged_thread_trees_;
   std::vector<EventAttrWithName> event_attrs_;
   ThreadTree thread_tree_;
   // Create a SampleTreeBuilder and SampleTree for each event_attr.
@@ -464,7 +758,14 @@ class ReportCommand : public Command {
   bool raw_period_;
   bool brief_callgraph_;
   bool trace_offcpu_;
+  bool show_stats_;
+  bool show_ip_for_unknown_symbol_;
+  bool follow_;
+  double follow_interval_in_sec_;
+  double follow_timeout_in_sec_;
+  size_t max_printed_entries_;
   size_t sched_switch_attr_id_;
+  size_t report_thread_count_;
 
   std::string report_filename_;
   std::unordered_map<std::string, std::string> meta_info_;
@@ -478,10 +779,16 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
   }
 
   // 2. Read record file and build SampleTree.
-  record_file_reader_ = RecordFileReader::CreateInstance(record_filename_);
+  record_file_reader_ = RecordFileReader::CreateInstance(record_filenames_[0]);
   if (record_file_reader_ == nullptr) {
     return false;
   }
+  for (size_t i = 1; i < record_filenames_.size(); ++i) {
+    merged_file_readers_.push_back(RecordFileReader::CreateInstance(record_filenames_[i]));
+    if (merged_file_readers_.back() == nullptr) {
+      return false;
+    }
+  }
   if (!ReadMetaInfoFromRecordFile()) {
     return false;
   }
@@ -493,7 +800,14 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
     return false;
   }
   ScopedCurrentArch scoped_arch(record_file_arch_);
-  if (!ReadSampleTreeFromRecordFile()) {
+  if (follow_) {
+    return FollowRecordFile();
+  }
+  if (!merged_file_readers_.empty()) {
+    if (!ReadSampleTreeFromMergedRecordFiles()) {
+      return false;
+    }
+  } else if (!ReadSampleTreeFromRecordFile()) {
     return false;
   }
 
@@ -510,7 +824,7 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
   bool show_ip_for_unknown_symbol = true;
   std::string vmlinux;
   bool print_sample_count = false;
-  std::vector<std::string> sort_keys = {"comm", "pid", "tid", "dso", "symbol"};
+  std::vector<std::string> sort_keys;
 
   for (size_t i = 0; i < args.size(); ++i) {
     if (args[i] == "-b") {
@@ -526,6 +840,16 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       }
       std::vector<std::string> strs = android::base::Split(args[i], ",");
       filter.insert(strs.begin(), strs.end());
+    } else if (args[i] == "--follow") {
+      follow_ = true;
+    } else if (args[i] == "--follow-interval") {
+      if (!GetDoubleOption(args, &i, &follow_interval_in_sec_, 1e-9)) {
+        return false;
+      }
+    } else if (args[i] == "--follow-timeout") {
+      if (!GetDoubleOption(args, &i, &follow_timeout_in_sec_, 1e-9)) {
+        return false;
+      }
     } else if (args[i] == "--full-callgraph") {
       brief_callgraph_ = false;
     } else if (args[i] == "-g") {
@@ -546,7 +870,7 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       if (!NextArgumentOrError(args, &i)) {
         return false;
       }
-      record_filename_ = args[i];
+      record_filenames_.push_back(args[i]);
 
     } else if (args[i] == "--kallsyms") {
       if (!NextArgumentOrError(args, &i)) {
@@ -608,6 +932,13 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       }
       std::vector<std::string> strs = android::base::Split(args[i], ";");
       sample_tree_builder_options_.symbol_filter.insert(strs.begin(), strs.end());
+    } else if (args[i] == "--symbol-cache-dir") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!Dso::SetSymbolCacheDir(args[i])) {
+        return false;
+      }
     } else if (args[i] == "--symfs") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -615,6 +946,16 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       if (!Dso::SetSymFsDir(args[i])) {
         return false;
       }
+    } else if (args[i] == "--show-stats") {
+      show_stats_ = true;
+    } else if (args[i] == "--threads") {
+      if (!GetUintOption(args, &i, &report_thread_count_, 1)) {
+        return false;
+      }
+    } else if (args[i] == "--top") {
+      if (!GetUintOption(args, &i, &max_printed_entries_, 1)) {
+        return false;
+      }
     } else if (args[i] == "--vmlinux") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -626,11 +967,29 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     }
   }
 
+  if (record_filenames_.empty()) {
+    record_filenames_.push_back("perf.data");
+  }
+  bool merge_files = record_filenames_.size() > 1;
+  if (merge_files && follow_) {
+    LOG(ERROR) << "--follow can't be used with multiple record files.";
+    return false;
+  }
+  if (sort_keys.empty()) {
+    // Pids and tids of different record files are unrelated.
+    if (merge_files) {
+      sort_keys = {"dso", "symbol"};
+    } else {
+      sort_keys = {"comm", "pid", "tid", "dso", "symbol"};
+    }
+  }
+
   Dso::SetDemangle(demangle);
   if (!vmlinux.empty()) {
     Dso::SetVmlinux(vmlinux);
   }
 
+  show_ip_for_unknown_symbol_ = show_ip_for_unknown_symbol;
   if (show_ip_for_unknown_symbol) {
     thread_tree_.ShowIpForUnknownSymbol();
   }
@@ -664,34 +1023,43 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       return false;
     }
     if (key == "pid") {
-      comparator.AddCompareFunction(ComparePid);
+      comparator.AddCompareFunction(ComparePid, KeyPid);
       displayer.AddDisplayFunction("Pid", DisplayPid);
     } else if (key == "tid") {
-      comparator.AddCompareFunction(CompareTid);
+      comparator.AddCompareFunction(CompareTid, KeyTid);
       displayer.AddDisplayFunction("Tid", DisplayTid);
     } else if (key == "comm") {
-      comparator.AddCompareFunction(CompareComm);
+      comparator.AddCompareFunction(CompareComm, KeyComm);
       displayer.AddDisplayFunction("Command", DisplayComm);
     } else if (key == "dso") {
-      comparator.AddCompareFunction(CompareDso);
+      comparator.AddCompareFunction(CompareDso, KeyDso);
+      if (merge_files) {
+        comparator.AddCompareFunction(CompareDsoBuildId, KeyDsoBuildId);
+      }
       displayer.AddDisplayFunction("Shared Object", DisplayDso);
     } else if (key == "symbol") {
-      comparator.AddCompareFunction(CompareSymbol);
+      comparator.AddCompareFunction(CompareSymbol, KeySymbol);
       displayer.AddDisplayFunction("Symbol", DisplaySymbol);
     } else if (key == "vaddr_in_file") {
-      comparator.AddCompareFunction(CompareVaddrInFile);
+      comparator.AddCompareFunction(CompareVaddrInFile, KeyVaddrInFile);
       displayer.AddDisplayFunction("VaddrInFile", DisplayVaddrInFile);
     } else if (key == "dso_from") {
-      comparator.AddCompareFunction(CompareDsoFrom);
+      comparator.AddCompareFunction(CompareDsoFrom, KeyDsoFrom);
+      if (merge_files) {
+        comparator.AddCompareFunction(CompareDsoFromBuildId, KeyDsoFromBuildId);
+      }
       displayer.AddDisplayFunction("Source Shared Object", DisplayDsoFrom);
     } else if (key == "dso_to") {
-      comparator.AddCompareFunction(CompareDso);
+      comparator.AddCompareFunction(CompareDso, KeyDso);
+      if (merge_files) {
+        comparator.AddCompareFunction(CompareDsoBuildId, KeyDsoBuildId);
+      }
       displayer.AddDisplayFunction("Target Shared Object", DisplayDso);
     } else if (key == "symbol_from") {
-      comparator.AddCompareFunction(CompareSymbolFrom);
+      comparator.AddCompareFunction(CompareSymbolFrom, KeySymbolFrom);
       displayer.AddDisplayFunction("Source Symbol", DisplaySymbolFrom);
     } else if (key == "symbol_to") {
-      comparator.AddCompareFunction(CompareSymbol);
+      comparator.AddCompareFunction(CompareSymbol, KeySymbol);
       displayer.AddDisplayFunction("Target Symbol", DisplaySymbol);
     } else {
       LOG(ERROR) << "Unknown sort key: " << key;
@@ -772,7 +1140,7 @@ bool ReportCommand::ReadEventAttrFromRecordFile() {
       }
     }
     if (!has_branch_stack) {
-      LOG(ERROR) << record_filename_
+      LOG(ERROR) << record_filenames_[0]
                  << " is not recorded with branch stack sampling option.";
       return false;
     }
@@ -791,7 +1159,9 @@ bool ReportCommand::ReadEventAttrFromRecordFile() {
 }
 
 bool ReportCommand::ReadFeaturesFromRecordFile() {
-  record_file_reader_->LoadBuildIdAndFileFeatures(thread_tree_);
+  if (merged_file_readers_.empty()) {
+    LoadBuildIdAndFileFeatures(*record_file_reader_, thread_tree_);
+  }
 
   std::string arch =
       record_file_reader_->ReadFeatureString(PerfFileFormat::FEAT_ARCH);
@@ -836,7 +1206,20 @@ bool ReportCommand::ReadFeaturesFromRecordFile() {
   return true;
 }
 
-bool ReportCommand::ReadSampleTreeFromRecordFile() {
+// Load build ids and symbols of hit files recorded in [reader] into [thread_tree].
+void ReportCommand::LoadBuildIdAndFileFeatures(RecordFileReader& reader, ThreadTree& thread_tree) {
+  std::vector<Dso*> hit_dsos;
+  reader.LoadBuildIdAndFileFeatures(thread_tree, &hit_dsos);
+  // Load symbols of all hit dsos in parallel, instead of one by one when processing samples.
+  // The kernel dso is skipped, because kernel symbols can come from a record in the data
+  // section.
+  hit_dsos.erase(std::remove_if(hit_dsos.begin(), hit_dsos.end(),
+                                [](Dso* dso) { return dso->type() == DSO_KERNEL; }),
+                 hit_dsos.end());
+  Dso::PrefetchSymbols(hit_dsos, report_thread_count_);
+}
+
+void ReportCommand::CreateSampleTreeBuilders() {
   sample_tree_builder_options_.use_branch_address = use_branch_address_;
   sample_tree_builder_options_.accumulate_callchain = accumulate_callchain_;
   sample_tree_builder_options_.build_callchain = print_callgraph_;
@@ -846,17 +1229,288 @@ bool ReportCommand::ReadSampleTreeFromRecordFile() {
   for (size_t i = 0; i < event_attrs_.size(); ++i) {
     sample_tree_builder_.push_back(sample_tree_builder_options_.CreateSampleTreeBuilder());
   }
+}
 
-  if (!record_file_reader_->ReadDataSection(
-          [this](std::unique_ptr<Record> record) {
-            return ProcessRecord(std::move(record));
-          })) {
+bool ReportCommand::ReadSampleTreeFromRecordFile() {
+  CreateSampleTreeBuilders();
+  if (CanProcessRecordsInParallel()) {
+    if (!ProcessRecordsInParallel()) {
+      return false;
+    }
+  } else if (!record_file_reader_->ReadDataSection(
+                 [this](std::unique_ptr<Record> record) {
+                   return ProcessRecord(std::move(record));
+                 })) {
+    return false;
+  }
+  BuildSampleTrees();
+  return true;
+}
+
+// Samples of multiple record files are merged in a pipeline:
+// 1. Each file has a reader thread reading its records, so all files are read in parallel.
+// 2. The current thread processes files in order. Build ids are global states of Dso, so they
+//    are switched to those of each file before creating its thread tree. Symbols of hit dsos of
+//    each file are loaded in parallel.
+// 3. Samples of each file are added to its own sample tree builders, which are then merged into
+//    sample_tree_builder_. Samples are merged by sort keys, and dsos are also compared by build
+//    id, so different builds of a library aren't merged.
+bool ReportCommand::ReadSampleTreeFromMergedRecordFiles() {
+  if (trace_offcpu_) {
+    LOG(ERROR) << "Merging record files recorded with --trace-offcpu isn't supported.";
     return false;
   }
+  std::vector<RecordFileReader*> readers = {record_file_reader_.get()};
+  std::string arch = record_file_reader_->ReadFeatureString(PerfFileFormat::FEAT_ARCH);
+  for (auto& reader : merged_file_readers_) {
+    if (reader->ReadFeatureString(PerfFileFormat::FEAT_ARCH) != arch) {
+      LOG(ERROR) << record_filenames_[readers.size()] << " isn't recorded on the same arch as "
+                 << record_filenames_[0];
+      return false;
+    }
+    std::vector<EventAttrWithId> attrs = reader->AttrSection();
+    bool same_events = attrs.size() == event_attrs_.size();
+    for (size_t i = 0; same_events && i < attrs.size(); ++i) {
+      const perf_event_attr& attr = event_attrs_[i].attr;
+      same_events = attrs[i].attr->type == attr.type && attrs[i].attr->config == attr.config &&
+                    attrs[i].attr->sample_type == attr.sample_type;
+    }
+    if (!same_events) {
+      LOG(ERROR) << record_filenames_[readers.size()] << " isn't recorded with the same events as "
+                 << record_filenames_[0];
+      return false;
+    }
+    readers.push_back(reader.get());
+  }
+  // Reader threads read records with their own readers, while the current thread reads features
+  // with readers in [readers].
+  std::vector<std::unique_ptr<RecordFileReader>> record_readers;
+  std::vector<std::unique_ptr<RecordReaderThread>> reader_threads;
+  for (const std::string& filename : record_filenames_) {
+    record_readers.push_back(RecordFileReader::CreateInstance(filename));
+    if (record_readers.back() == nullptr) {
+      return false;
+    }
+    reader_threads.emplace_back(new RecordReaderThread(record_readers.back().get()));
+  }
+
+  CreateSampleTreeBuilders();
+  // Kernel symbol records in a file replace the kernel symbols set by --kallsyms. So restore them
+  // before reading each file, to not use kernel symbols of a previous file.
+  std::shared_ptr<const simpleperf::KernelSymbolIndex> kernel_symbol_index =
+      Dso::GetKernelSymbolIndex();
+  for (size_t i = 0; i < readers.size(); ++i) {
+    RecordFileReader& reader = *readers[i];
+    Dso::SetKernelSymbolIndex(kernel_symbol_index);
+    std::vector<std::pair<std::string, BuildId>> build_ids;
+    for (auto& r : reader.ReadBuildIdFeature()) {
+      build_ids.emplace_back(r.filename, r.build_id);
+    }
+    Dso::SetBuildIds(build_ids);
+    merged_thread_trees_.emplace_back(new ThreadTree);
+    ThreadTree& thread_tree = *merged_thread_trees_.back();
+    if (show_ip_for_unknown_symbol_) {
+      thread_tree.ShowIpForUnknownSymbol();
+    }
+    LoadBuildIdAndFileFeatures(reader, thread_tree);
+
+    SampleTreeBuilderOptions options = sample_tree_builder_options_;
+    options.thread_tree = &thread_tree;
+    std::vector<std::unique_ptr<ReportCmdSampleTreeBuilder>> builders;
+    for (size_t j = 0; j < event_attrs_.size(); ++j) {
+      builders.push_back(options.CreateSampleTreeBuilder());
+    }
+    std::vector<RecordWithAttrId> batch;
+    while (reader_threads[i]->Pop(&batch)) {
+      for (auto& item : batch) {
+        std::unique_ptr<Record>& record = item.record;
+        thread_tree.Update(*record);
+        if (record->type() == PERF_RECORD_SAMPLE) {
+          builders[item.attr_id]->ReportCmdProcessSampleRecord(
+              *static_cast<SampleRecord*>(record.get()));
+        } else if (record->type() == PERF_RECORD_TRACING_DATA ||
+                   record->type() == SIMPLE_PERF_RECORD_TRACING_DATA) {
+          const auto& r = *static_cast<TracingDataRecord*>(record.get());
+          if (!ProcessTracingData(std::vector<char>(r.data, r.data + r.data_size))) {
+            return false;
+          }
+        }
+      }
+    }
+    if (!reader_threads[i]->Success()) {
+      return false;
+    }
+    reader_threads[i].reset();
+    for (size_t j = 0; j < event_attrs_.size(); ++j) {
+      sample_tree_builder_[j]->MergeSampleTreeFrom(*builders[j]);
+    }
+  }
+  BuildSampleTrees();
+  return true;
+}
+
+void ReportCommand::BuildSampleTrees() {
+  sample_tree_.clear();
   for (size_t i = 0; i < sample_tree_builder_.size(); ++i) {
     sample_tree_.push_back(sample_tree_builder_[i]->GetSampleTree());
     sample_tree_sorter_->Sort(sample_tree_.back().samples, print_callgraph_);
   }
+}
+
+// Report a record file while it is being written. The thread tree and sample tree builders keep
+// their states between reads, so each read only processes records appended since the last one.
+// A report is printed after reading new samples, and after the writer closes the file.
+bool ReportCommand::FollowRecordFile() {
+  CreateSampleTreeBuilders();
+  uint64_t reported_samples = 0;
+  uint64_t data_size = 0;
+  auto grow_time = std::chrono::steady_clock::now();
+  while (true) {
+    bool finished;
+    if (!record_file_reader_->RefreshDataSection(&finished)) {
+      return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (record_file_reader_->FileHeader().data.size != data_size) {
+      data_size = record_file_reader_->FileHeader().data.size;
+      grow_time = now;
+    } else if (!finished &&
+               std::chrono::duration<double>(now - grow_time).count() >= follow_timeout_in_sec_) {
+      // The recording process may be killed without closing the file.
+      LOG(WARNING) << record_filenames_[0] << " doesn't grow in " << follow_timeout_in_sec_
+                   << " seconds, stop following it";
+      finished = true;
+    }
+    if (!record_file_reader_->ReadDataSection([this](std::unique_ptr<Record> record) {
+          return ProcessRecord(std::move(record));
+        })) {
+      return false;
+    }
+    uint64_t total_samples = 0;
+    for (auto& builder : sample_tree_builder_) {
+      total_samples += builder->GetTotalSamples();
+    }
+    if (total_samples != reported_samples || finished) {
+      BuildSampleTrees();
+      if (!PrintReport()) {
+        return false;
+      }
+      reported_samples = total_samples;
+    }
+    if (finished) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(follow_interval_in_sec_));
+  }
+}
+
+bool ReportCommand::CanProcessRecordsInParallel() {
+  if (report_thread_count_ <= 1 || trace_offcpu_) {
+    // In trace-offcpu mode, a sample is processed after the next sample of the same thread, and
+    // sched_switch samples are passed to builders of all events. Keep it simple.
+    return false;
+  }
+  if (accumulate_callchain_) {
+    // Offline unwinding needs maps at the time of each sample, so it isn't supported.
+    for (auto& attr : event_attrs_) {
+      if (attr.attr.sample_type & PERF_SAMPLE_STACK_USER) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Records are processed in a pipeline:
+// 1. A reader thread reads records from the record file.
+// 2. The current thread updates thread_tree_ with records in order, and resolves threads and
+//    symbols of samples.
+// 3. Builder threads each build partial sample trees for samples of a subset of threads.
+// 4. After all records are processed, partial sample trees are merged into sample_tree_builder_.
+bool ReportCommand::ProcessRecordsInParallel() {
+  std::unique_ptr<RecordReaderThread> reader_thread(
+      new RecordReaderThread(record_file_reader_.get()));
+
+  using TaskQueue = BlockingQueue<std::vector<ResolvedSampleTask>>;
+  size_t shard_count = report_thread_count_;
+  std::vector<std::vector<std::unique_ptr<ReportCmdSampleTreeBuilder>>> shard_builders(
+      shard_count);
+  std::vector<std::unique_ptr<TaskQueue>> task_queues;
+  std::vector<std::thread> builder_threads;
+  for (size_t i = 0; i < shard_count; ++i) {
+    // The first shard uses sample_tree_builder_, to which other shards are merged.
+    std::vector<ReportCmdSampleTreeBuilder*> builders;
+    for (size_t j = 0; j < event_attrs_.size(); ++j) {
+      if (i == 0) {
+        builders.push_back(sample_tree_builder_[j].get());
+      } else {
+        shard_builders[i].push_back(sample_tree_builder_options_.CreateSampleTreeBuilder());
+        builders.push_back(shard_builders[i].back().get());
+      }
+    }
+    task_queues.emplace_back(new TaskQueue(MAX_PENDING_RECORD_BATCHES));
+    TaskQueue* queue = task_queues.back().get();
+    builder_threads.emplace_back([queue, builders]() {
+      std::vector<ResolvedSampleTask> batch;
+      while (queue->Pop(&batch)) {
+        for (auto& task : batch) {
+          builders[task.attr_id]->ProcessResolvedSampleRecord(
+              *static_cast<SampleRecord*>(task.record.get()), task.resolved);
+        }
+      }
+    });
+  }
+
+  bool result = true;
+  std::vector<std::vector<ResolvedSampleTask>> pending_tasks(shard_count);
+  std::vector<RecordWithAttrId> batch;
+  while (result && reader_thread->Pop(&batch)) {
+    for (auto& item : batch) {
+      std::unique_ptr<Record>& record = item.record;
+      thread_tree_.Update(*record);
+      if (record->type() == PERF_RECORD_SAMPLE) {
+        auto& r = *static_cast<SampleRecord*>(record.get());
+        // Samples of the same thread go to the same shard, so they are processed in order.
+        size_t shard = r.tid_data.tid % shard_count;
+        std::vector<ResolvedSampleTask>& tasks = pending_tasks[shard];
+        tasks.resize(tasks.size() + 1);
+        ResolvedSampleTask& task = tasks.back();
+        task.attr_id = item.attr_id;
+        sample_tree_builder_options_.ResolveSample(r, &task.resolved);
+        task.record = std::move(record);
+        if (tasks.size() == RECORD_BATCH_SIZE) {
+          task_queues[shard]->Push(std::move(tasks));
+          tasks.clear();
+        }
+      } else if (record->type() == PERF_RECORD_TRACING_DATA ||
+                 record->type() == SIMPLE_PERF_RECORD_TRACING_DATA) {
+        const auto& r = *static_cast<TracingDataRecord*>(record.get());
+        if (!ProcessTracingData(std::vector<char>(r.data, r.data + r.data_size))) {
+          result = false;
+          break;
+        }
+      }
+    }
+  }
+  bool read_success = result && reader_thread->Success();
+  reader_thread.reset();
+  for (size_t i = 0; i < shard_count; ++i) {
+    if (!pending_tasks[i].empty()) {
+      task_queues[i]->Push(std::move(pending_tasks[i]));
+    }
+    task_queues[i]->Close();
+  }
+  for (auto& thread : builder_threads) {
+    thread.join();
+  }
+  if (!result || !read_success) {
+    return false;
+  }
+  for (size_t i = 1; i < shard_count; ++i) {
+    for (size_t j = 0; j < event_attrs_.size(); ++j) {
+      sample_tree_builder_[j]->MergeSampleTreeFrom(*shard_builders[i][j]);
+    }
+  }
   return true;
 }
 
@@ -940,7 +1594,11 @@ bool ReportCommand::PrintReport() {
     }
     const char* period_prefix = trace_offcpu_ ? "Time in ns" : "Event count";
     fprintf(report_fp, "%s: %" PRIu64 "\n\n", period_prefix, sample_tree.total_period);
-    sample_tree_displayer_->DisplaySamples(report_fp, sample_tree.samples, &sample_tree);
+    sample_tree_displayer_->DisplaySamples(report_fp, sample_tree.samples, &sample_tree,
+                                           max_printed_entries_);
+  }
+  if (show_stats_) {
+    PrintMemoryStats(report_fp);
   }
   fflush(report_fp);
   if (ferror(report_fp) != 0) {
@@ -951,12 +1609,41 @@ bool ReportCommand::PrintReport() {
 }
 
 void ReportCommand::PrintReportContext(FILE* report_fp) {
+  if (record_filenames_.size() > 1) {
+    fprintf(report_fp, "Merged record files: %s\n",
+            android::base::Join(record_filenames_, ' ').c_str());
+  }
   if (!record_cmdline_.empty()) {
     fprintf(report_fp, "Cmdline: %s\n", record_cmdline_.c_str());
   }
   fprintf(report_fp, "Arch: %s\n", GetArchString(record_file_arch_).c_str());
 }
 
+void ReportCommand::PrintMemoryStats(FILE* report_fp) {
+  uint64_t total_samples = 0;
+  size_t sample_entries = 0;
+  size_t callchain_nodes = 0;
+  size_t sample_memory = 0;
+  for (size_t i = 0; i < sample_tree_builder_.size(); ++i) {
+    total_samples += sample_tree_[i].total_samples;
+    sample_entries += sample_tree_builder_[i]->GetSampleEntryCount();
+    callchain_nodes += sample_tree_builder_[i]->GetCallChainNodeCount();
+    sample_memory += sample_tree_builder_[i]->GetSampleMemoryUsage();
+  }
+  fprintf(report_fp, "\nMemory stats:\n");
+  fprintf(report_fp, "Samples: %" PRIu64 ", sample entries: %zu, callchain nodes: %zu\n",
+          total_samples, sample_entries, callchain_nodes);
+  fprintf(report_fp, "Sample tree memory: %zu bytes\n", sample_memory);
+  Dso::DemangleStats demangle_stats = Dso::GetDemangleStats();
+  fprintf(report_fp, "Demangled names: %" PRIu64 ", demangles avoided by cache: %" PRIu64 "\n",
+          demangle_stats.demangled_names, demangle_stats.cache_hits);
+  uint64_t peak_rss;
+  if (GetPeakRss(&peak_rss)) {
+    fprintf(report_fp, "Peak rss: %" PRIu64 " bytes, %" PRIu64 " bytes per sample\n", peak_rss,
+            total_samples == 0 ? 0 : peak_rss / total_samples);
+  }
+}
+
 }  // namespace
 
 void RegisterReportCommand() {
@@ -25,6 +25,7 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
+#include "ColumnarSampleFile.h"
 #include "command.h"
 #include "event_attr.h"
 #include "event_type.h"
@@ -34,6 +35,8 @@
 
 namespace proto = simpleperf_report_proto;
 
+using namespace simpleperf;
+
 namespace {
 
 static const char PROT_FILE_MAGIC[] = "SIMPLEPERF";
@@ -69,6 +72,17 @@ struct CallEntry {
   uint64_t vaddr_in_file;
 };
 
+// Android studio wants a clear call chain end to notify whether a call chain is complete.
+// For the main thread, the call chain ends at __libc_init in libc.so. For other threads,
+// the call chain ends at __start_thread in libc.so.
+// The call chain of the main thread can go beyond __libc_init, to _start (<= android O) or
+// _start_main (> android O).
+static bool IsCallChainEnd(const CallEntry& node) {
+  return node.dso->FileName() == "libc.so" &&
+         (strcmp(node.symbol->Name(), "__libc_init") == 0 ||
+          strcmp(node.symbol->Name(), "__start_thread") == 0);
+}
+
 class ReportSampleCommand : public Command {
  public:
   ReportSampleCommand()
@@ -76,12 +90,19 @@ class ReportSampleCommand : public Command {
             "report-sample", "report raw sample information in perf.data",
             // clang-format off
 "Usage: simpleperf report-sample [options]\n"
+"--columnar  Use the binary columnar format in ColumnarSampleFile.h to output\n"
+"            samples. It is faster to generate and read than protobuf format\n"
+"            when exporting many samples.\n"
+"--dump-columnar-report <file>\n"
+"           Dump report file generated by\n"
+"           `simpleperf report-sample --columnar -o <file>`.\n"
 "--dump-protobuf-report  <file>\n"
 "           Dump report file generated by\n"
 "           `simpleperf report-sample --protobuf -o <file>`.\n"
 "-i <file>  Specify path of record file, default is perf.data.\n"
 "-o report_file_name  Set report file name. Default report file name is\n"
-"                     report_sample.trace if --protobuf is used, otherwise\n"
+"                     report_sample.trace if --protobuf is used,\n"
+"                     report_sample.columnar if --columnar is used, otherwise\n"
 "                     the report is written to stdout.\n"
 "--protobuf  Use protobuf format in report_sample.proto to output samples.\n"
 "            Need to set a report_file_name when using this option.\n"
@@ -89,12 +110,15 @@ class ReportSampleCommand : public Command {
 "--remove-unknown-kernel-symbols  Remove kernel callchains when kernel symbols\n"
 "                                 are not available in perf.data.\n"
 "--show-art-frames  Show frames of internal methods in the ART Java interpreter.\n"
+"--symbol-cache-dir <dir>  Cache symbols of elf files in <dir>. Later reports read\n"
+"                          cached symbols instead of parsing elf files again.\n"
 "--symdir <dir>     Look for files with symbols in a directory recursively.\n"
             // clang-format on
             ),
         record_filename_("perf.data"),
         show_callchain_(false),
         use_protobuf_(false),
+        use_columnar_(false),
         report_fp_(nullptr),
         coded_os_(nullptr),
         sample_count_(0),
@@ -109,6 +133,7 @@ class ReportSampleCommand : public Command {
  private:
   bool ParseOptions(const std::vector<std::string>& args);
   bool DumpProtobufReport(const std::string& filename);
+  bool DumpColumnarReport(const std::string& filename);
   bool OpenRecordFile();
   bool PrintMetaInfo();
   bool ProcessRecord(std::unique_ptr<Record> record);
@@ -117,7 +142,11 @@ class ReportSampleCommand : public Command {
                                    const std::vector<CallEntry>& entries);
   bool GetCallEntry(const ThreadEntry* thread, bool in_kernel, uint64_t ip, bool omit_unknown_dso,
                     CallEntry* entry);
+  void GetDumpIds(const CallEntry& node, uint32_t* file_id, int32_t* symbol_id);
   bool WriteRecordInProtobuf(proto::Record& proto_record);
+  bool PrintSampleRecordInColumnar(const SampleRecord& record,
+                                   const std::vector<CallEntry>& entries);
+  bool PrintInfoInColumnar();
   bool PrintLostSituationInProtobuf();
   bool PrintFileInfoInProtobuf();
   bool PrintThreadInfoInProtobuf();
@@ -127,12 +156,15 @@ class ReportSampleCommand : public Command {
   std::string record_filename_;
   std::unique_ptr<RecordFileReader> record_file_reader_;
   std::string dump_protobuf_report_file_;
+  std::string dump_columnar_report_file_;
   bool show_callchain_;
   bool use_protobuf_;
+  bool use_columnar_;
   ThreadTree thread_tree_;
   std::string report_filename_;
   FILE* report_fp_;
   google::protobuf::io::CodedOutputStream* coded_os_;
+  std::unique_ptr<ColumnarSampleWriter> columnar_writer_;
   size_t sample_count_;
   size_t lost_count_;
   bool trace_offcpu_;
@@ -153,7 +185,7 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
   report_fp_ = stdout;
   std::unique_ptr<FILE, decltype(&fclose)> fp(nullptr, fclose);
   if (!report_filename_.empty()) {
-    const char* open_mode = use_protobuf_ ? "wb" : "w";
+    const char* open_mode = (use_protobuf_ || use_columnar_) ? "wb" : "w";
     fp.reset(fopen(report_filename_.c_str(), open_mode));
     if (fp == nullptr) {
       PLOG(ERROR) << "failed to open " << report_filename_;
@@ -162,10 +194,13 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
     report_fp_ = fp.get();
   }
 
-  // 3. Dump protobuf report.
+  // 3. Dump protobuf or columnar report.
   if (!dump_protobuf_report_file_.empty()) {
     return DumpProtobufReport(dump_protobuf_report_file_);
   }
+  if (!dump_columnar_report_file_.empty()) {
+    return DumpColumnarReport(dump_columnar_report_file_);
+  }
 
   // 4. Open record file.
   if (!OpenRecordFile()) {
@@ -173,7 +208,7 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
   }
   if (use_protobuf_) {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
-  } else {
+  } else if (!use_columnar_) {
     thread_tree_.ShowMarkForUnknownSymbol();
     thread_tree_.ShowIpForUnknownSymbol();
   }
@@ -194,6 +229,8 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
     protobuf_coded_os.reset(
         new google::protobuf::io::CodedOutputStream(protobuf_os.get()));
     coded_os_ = protobuf_coded_os.get();
+  } else if (use_columnar_) {
+    columnar_writer_.reset(new ColumnarSampleWriter(report_fp_));
   }
 
   // 6. Read record file, and print samples online.
@@ -223,6 +260,10 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
       return false;
     }
     protobuf_coded_os.reset(nullptr);
+  } else if (use_columnar_) {
+    if (!PrintInfoInColumnar()) {
+      return false;
+    }
   } else {
     PrintLostSituation();
     fflush(report_fp_);
@@ -241,6 +282,11 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
         return false;
       }
       dump_protobuf_report_file_ = args[i];
+    } else if (args[i] == "--dump-columnar-report") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      dump_columnar_report_file_ = args[i];
     } else if (args[i] == "-i") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -253,12 +299,21 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
       report_filename_ = args[i];
     } else if (args[i] == "--protobuf") {
       use_protobuf_ = true;
+    } else if (args[i] == "--columnar") {
+      use_columnar_ = true;
     } else if (args[i] == "--show-callchain") {
       show_callchain_ = true;
     } else if (args[i] == "--remove-unknown-kernel-symbols") {
       remove_unknown_kernel_symbols_ = true;
     } else if (args[i] == "--show-art-frames") {
       show_art_frames_ = true;
+    } else if (args[i] == "--symbol-cache-dir") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!Dso::SetSymbolCacheDir(args[i])) {
+        return false;
+      }
     } else if (args[i] == "--symdir") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -272,8 +327,16 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
     }
   }
 
-  if (use_protobuf_ && report_filename_.empty()) {
-    report_filename_ = "report_sample.trace";
+  if (use_protobuf_ && use_columnar_) {
+    LOG(ERROR) << "--protobuf and --columnar can't be used together";
+    return false;
+  }
+  if (report_filename_.empty()) {
+    if (use_protobuf_) {
+      report_filename_ = "report_sample.trace";
+    } else if (use_columnar_) {
+      report_filename_ = "report_sample.columnar";
+    }
   }
   return true;
 }
@@ -415,6 +478,131 @@ bool ReportSampleCommand::DumpProtobufReport(const std::string& filename) {
   return true;
 }
 
+bool ReportSampleCommand::DumpColumnarReport(const std::string& filename) {
+  std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(filename.c_str(), "rb"), fclose);
+  if (fp == nullptr) {
+    PLOG(ERROR) << "failed to open " << filename;
+    return false;
+  }
+  ColumnarSampleReader reader(fp.get());
+  if (!reader.ReadHeader()) {
+    return false;
+  }
+  std::vector<ColumnarFrame> frames;
+  // files[file_id] is the number of symbols in the file.
+  std::vector<uint32_t> files;
+  size_t sample_count = 0;
+  ColumnarSampleReader::Chunk chunk;
+  std::vector<const char*> strings;
+  std::vector<ColumnarFrame> new_frames;
+  ColumnarSampleReader::MetaInfo meta_info;
+  ColumnarSampleReader::File file;
+  while (true) {
+    if (!reader.ReadChunk(&chunk)) {
+      return false;
+    }
+    if (chunk.type == COLUMNAR_CHUNK_END) {
+      break;
+    }
+    const char* data = chunk.payload.data();
+    size_t size = chunk.payload.size();
+    bool valid = true;
+    if (chunk.type == COLUMNAR_CHUNK_META) {
+      valid = ColumnarSampleReader::ParseMetaInfo(chunk, &meta_info);
+      if (valid) {
+        FprintIndented(report_fp_, 0, "meta_info:\n");
+        FprintIndented(report_fp_, 1, "trace_offcpu: %s\n",
+                       (meta_info.flags & COLUMNAR_META_TRACE_OFFCPU) ? "true" : "false");
+        for (const char* event_type : meta_info.event_types) {
+          FprintIndented(report_fp_, 1, "event_type: %s\n", event_type);
+        }
+        if (meta_info.app_package_name[0] != '\0') {
+          FprintIndented(report_fp_, 1, "app_package_name: %s\n", meta_info.app_package_name);
+        }
+      }
+    } else if (chunk.type == COLUMNAR_CHUNK_FRAMES) {
+      valid = ColumnarSampleReader::ParseFrames(chunk, &new_frames);
+      frames.insert(frames.end(), new_frames.begin(), new_frames.end());
+    } else if (chunk.type == COLUMNAR_CHUNK_SAMPLES) {
+      ColumnarSampleReader::Samples samples;
+      valid = ColumnarSampleReader::ParseSamples(chunk, &samples);
+      for (uint32_t i = 0; valid && i < chunk.count; ++i) {
+        FprintIndented(report_fp_, 0, "sample %zu:\n", ++sample_count);
+        FprintIndented(report_fp_, 1, "event_type_id: %u\n", samples.event_type_id[i]);
+        FprintIndented(report_fp_, 1, "time: %" PRIu64 "\n", samples.time[i]);
+        FprintIndented(report_fp_, 1, "event_count: %" PRIu64 "\n", samples.event_count[i]);
+        FprintIndented(report_fp_, 1, "thread_id: %u\n", samples.tid[i]);
+        FprintIndented(report_fp_, 1, "callchain:\n");
+        for (uint32_t j = samples.callchain_offset[i]; j < samples.callchain_offset[i + 1]; ++j) {
+          uint32_t frame_id = samples.frames[j];
+          if (frame_id >= frames.size()) {
+            LOG(ERROR) << "unexpected frame_id " << frame_id;
+            return false;
+          }
+          const ColumnarFrame& frame = frames[frame_id];
+          FprintIndented(report_fp_, 2, "vaddr_in_file: %" PRIx64 "\n", frame.vaddr_in_file);
+          FprintIndented(report_fp_, 2, "file_id: %u\n", frame.file_id);
+          FprintIndented(report_fp_, 2, "symbol_id: %d\n", frame.symbol_id);
+        }
+      }
+    } else if (chunk.type == COLUMNAR_CHUNK_FILE) {
+      valid = ColumnarSampleReader::ParseFile(chunk, &file);
+      if (valid) {
+        FprintIndented(report_fp_, 0, "file:\n");
+        FprintIndented(report_fp_, 1, "id: %zu\n", files.size());
+        FprintIndented(report_fp_, 1, "path: %s\n", file.path);
+        for (const char* symbol : file.symbols) {
+          FprintIndented(report_fp_, 1, "symbol: %s\n", symbol);
+        }
+        for (const char* mangled_symbol : file.mangled_symbols) {
+          FprintIndented(report_fp_, 1, "mangled_symbol: %s\n", mangled_symbol);
+        }
+        files.push_back(file.symbols.size());
+      }
+    } else if (chunk.type == COLUMNAR_CHUNK_THREADS) {
+      size_t ids_size = chunk.count * 2 * sizeof(uint32_t);
+      valid = size >= ids_size && ColumnarSampleReader::ParseStringTable(
+                                      data + ids_size, size - ids_size, chunk.count, &strings);
+      const uint32_t* tids = reinterpret_cast<const uint32_t*>(data);
+      const uint32_t* pids = tids + chunk.count;
+      for (uint32_t i = 0; valid && i < chunk.count; ++i) {
+        FprintIndented(report_fp_, 0, "thread:\n");
+        FprintIndented(report_fp_, 1, "thread_id: %u\n", tids[i]);
+        FprintIndented(report_fp_, 1, "process_id: %u\n", pids[i]);
+        FprintIndented(report_fp_, 1, "thread_name: %s\n", strings[i]);
+      }
+    } else if (chunk.type == COLUMNAR_CHUNK_LOST) {
+      valid = size >= 2 * sizeof(uint64_t);
+      if (valid) {
+        const uint64_t* counts = reinterpret_cast<const uint64_t*>(data);
+        FprintIndented(report_fp_, 0, "lost_situation:\n");
+        FprintIndented(report_fp_, 1, "sample_count: %" PRIu64 "\n", counts[0]);
+        FprintIndented(report_fp_, 1, "lost_count: %" PRIu64 "\n", counts[1]);
+      }
+    } else {
+      LOG(ERROR) << "unexpected chunk type " << chunk.type;
+      return false;
+    }
+    if (!valid) {
+      LOG(ERROR) << "invalid chunk of type " << chunk.type << " in " << filename;
+      return false;
+    }
+  }
+  for (const ColumnarFrame& frame : frames) {
+    if (frame.file_id >= files.size()) {
+      LOG(ERROR) << "file_id(" << frame.file_id << ") >= file count (" << files.size() << ")";
+      return false;
+    }
+    if (frame.symbol_id < -1 ||
+        (frame.symbol_id != -1 && static_cast<uint32_t>(frame.symbol_id) >= files[frame.file_id])) {
+      LOG(ERROR) << "unexpected symbol_id(" << frame.symbol_id << ") in file_id("
+                 << frame.file_id << ")";
+      return false;
+    }
+  }
+  return true;
+}
+
 bool ReportSampleCommand::OpenRecordFile() {
   record_file_reader_ = RecordFileReader::CreateInstance(record_filename_);
   if (record_file_reader_ == nullptr) {
@@ -458,6 +646,13 @@ bool ReportSampleCommand::PrintMetaInfo() {
     }
     return WriteRecordInProtobuf(proto_record);
   }
+  if (use_columnar_) {
+    ColumnarMetaInfo meta_info;
+    meta_info.event_types = event_types_;
+    meta_info.app_package_name = app_package_name;
+    meta_info.trace_offcpu = trace_offcpu_;
+    return columnar_writer_->WriteHeader(meta_info);
+  }
   FprintIndented(report_fp_, 0, "meta_info:\n");
   FprintIndented(report_fp_, 1, "trace_offcpu: %s\n", trace_offcpu_ ? "true" : "false");
   for (auto& event_type : event_types_) {
@@ -527,6 +722,9 @@ bool ReportSampleCommand::ProcessSampleRecord(const SampleRecord& r) {
   if (use_protobuf_) {
     return PrintSampleRecordInProtobuf(r, entries);
   }
+  if (use_columnar_) {
+    return PrintSampleRecordInColumnar(r, entries);
+  }
   return PrintSampleRecord(r, entries);
 }
 
@@ -542,33 +740,31 @@ bool ReportSampleCommand::PrintSampleRecordInProtobuf(const SampleRecord& r,
   for (const CallEntry& node : entries) {
     proto::Sample_CallChainEntry* callchain = sample->add_callchain();
     uint32_t file_id;
-    if (!node.dso->GetDumpId(&file_id)) {
-      file_id = node.dso->CreateDumpId();
-    }
-    int32_t symbol_id = -1;
-    if (node.symbol != thread_tree_.UnknownSymbol()) {
-      if (!node.symbol->GetDumpId(reinterpret_cast<uint32_t*>(&symbol_id))) {
-        symbol_id = node.dso->CreateSymbolDumpId(node.symbol);
-      }
-    }
+    int32_t symbol_id;
+    GetDumpIds(node, &file_id, &symbol_id);
     callchain->set_vaddr_in_file(node.vaddr_in_file);
     callchain->set_file_id(file_id);
     callchain->set_symbol_id(symbol_id);
-
-    // Android studio wants a clear call chain end to notify whether a call chain is complete.
-    // For the main thread, the call chain ends at __libc_init in libc.so. For other threads,
-    // the call chain ends at __start_thread in libc.so.
-    // The call chain of the main thread can go beyond __libc_init, to _start (<= android O) or
-    // _start_main (> android O).
-    if (node.dso->FileName() == "libc.so" &&
-        (strcmp(node.symbol->Name(), "__libc_init") == 0 ||
-            strcmp(node.symbol->Name(), "__start_thread") == 0)) {
+    if (IsCallChainEnd(node)) {
       break;
     }
   }
   return WriteRecordInProtobuf(proto_record);
 }
 
+void ReportSampleCommand::GetDumpIds(const CallEntry& node, uint32_t* file_id,
+                                     int32_t* symbol_id) {
+  if (!node.dso->GetDumpId(file_id)) {
+    *file_id = node.dso->CreateDumpId();
+  }
+  *symbol_id = -1;
+  if (node.symbol != thread_tree_.UnknownSymbol()) {
+    if (!node.symbol->GetDumpId(reinterpret_cast<uint32_t*>(symbol_id))) {
+      *symbol_id = node.dso->CreateSymbolDumpId(node.symbol);
+    }
+  }
+}
+
 bool ReportSampleCommand::WriteRecordInProtobuf(proto::Record& proto_record) {
   coded_os_->WriteLittleEndian32(proto_record.ByteSize());
   if (!proto_record.SerializeToCodedStream(coded_os_)) {
@@ -610,6 +806,18 @@ static bool CompareDsoByDumpId(Dso* d1, Dso* d2) {
   return id1 < id2;
 }
 
+// Return symbols having dump ids in dump id order.
+static std::vector<const Symbol*> GetDumpSymbols(Dso* dso) {
+  std::vector<const Symbol*> dump_symbols;
+  for (const auto& sym : dso->GetSymbols()) {
+    if (sym.HasDumpId()) {
+      dump_symbols.push_back(&sym);
+    }
+  }
+  std::sort(dump_symbols.begin(), dump_symbols.end(), Symbol::CompareByDumpId);
+  return dump_symbols;
+}
+
 bool ReportSampleCommand::PrintFileInfoInProtobuf() {
   std::vector<Dso*> dsos = thread_tree_.GetAllDsos();
   std::sort(dsos.begin(), dsos.end(), CompareDsoByDumpId);
@@ -622,17 +830,7 @@ bool ReportSampleCommand::PrintFileInfoInProtobuf() {
     proto::File* file = proto_record.mutable_file();
     file->set_id(file_id);
     file->set_path(dso->Path());
-    const std::vector<Symbol>& symbols = dso->GetSymbols();
-    std::vector<const Symbol*> dump_symbols;
-    for (const auto& sym : symbols) {
-      if (sym.HasDumpId()) {
-        dump_symbols.push_back(&sym);
-      }
-    }
-    std::sort(dump_symbols.begin(), dump_symbols.end(),
-              Symbol::CompareByDumpId);
-
-    for (const auto& sym : dump_symbols) {
+    for (const auto& sym : GetDumpSymbols(dso)) {
       std::string* symbol = file->add_symbol();
       *symbol = sym->DemangledName();
       std::string* mangled_symbol = file->add_mangled_symbol();
@@ -664,6 +862,49 @@ bool ReportSampleCommand::PrintThreadInfoInProtobuf() {
   return true;
 }
 
+bool ReportSampleCommand::PrintSampleRecordInColumnar(const SampleRecord& r,
+                                                      const std::vector<CallEntry>& entries) {
+  std::vector<ColumnarFrame> callchain;
+  for (const CallEntry& node : entries) {
+    ColumnarFrame frame;
+    GetDumpIds(node, &frame.file_id, &frame.symbol_id);
+    frame.vaddr_in_file = node.vaddr_in_file;
+    callchain.push_back(frame);
+    if (IsCallChainEnd(node)) {
+      break;
+    }
+  }
+  return columnar_writer_->AddSample(r.time_data.time, r.period_data.period, r.tid_data.tid,
+                                     record_file_reader_->GetAttrIndexOfRecord(&r), callchain);
+}
+
+bool ReportSampleCommand::PrintInfoInColumnar() {
+  std::vector<Dso*> dsos = thread_tree_.GetAllDsos();
+  std::sort(dsos.begin(), dsos.end(), CompareDsoByDumpId);
+  for (Dso* dso : dsos) {
+    if (!dso->HasDumpId()) {
+      continue;
+    }
+    std::vector<ColumnarSymbol> symbols;
+    for (const auto& sym : GetDumpSymbols(dso)) {
+      symbols.push_back(ColumnarSymbol{sym->DemangledName(), sym->Name()});
+    }
+    if (!columnar_writer_->WriteFile(dso->Path(), symbols)) {
+      return false;
+    }
+  }
+  std::vector<ColumnarThread> threads;
+  for (const ThreadEntry* thread : thread_tree_.GetAllThreads()) {
+    threads.push_back(ColumnarThread{static_cast<uint32_t>(thread->tid),
+                                     static_cast<uint32_t>(thread->pid), thread->comm});
+  }
+  std::sort(threads.begin(), threads.end(),
+            [](const ColumnarThread& t1, const ColumnarThread& t2) { return t1.tid < t2.tid; });
+  return columnar_writer_->WriteThreads(threads) &&
+         columnar_writer_->WriteLostSituation(sample_count_, lost_count_) &&
+         columnar_writer_->Finish();
+}
+
 bool ReportSampleCommand::PrintSampleRecord(const SampleRecord& r,
                                             const std::vector<CallEntry>& entries) {
   FprintIndented(report_fp_, 0, "sample:\n");
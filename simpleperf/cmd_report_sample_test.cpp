@@ -17,6 +17,7 @@
 #include <gtest/gtest.h>
 
 #include <android-base/file.h>
+#include <android-base/strings.h>
 
 #include "command.h"
 #include "get_test_data.h"
@@ -160,3 +161,66 @@ TEST(cmd_report_sample, symdir_option) {
                     {"--symdir", GetTestDataDir() + CORRECT_SYMFS_FOR_BUILD_ID_CHECK});
   ASSERT_NE(data.find("symbol: main"), std::string::npos);
 }
+
+static void GetColumnarReport(const std::string& test_data_file, std::string* columnar_report,
+                              const std::vector<std::string>& extra_args = {}) {
+  TemporaryFile tmpfile;
+  TemporaryFile tmpfile2;
+  std::vector<std::string> args = {"-i", GetTestData(test_data_file), "-o", tmpfile.path,
+                                   "--columnar"};
+  args.insert(args.end(), extra_args.begin(), extra_args.end());
+  ASSERT_TRUE(ReportSampleCmd()->Run(args));
+  ASSERT_TRUE(ReportSampleCmd()->Run({"--dump-columnar-report", tmpfile.path,
+                                      "-o", tmpfile2.path}));
+  ASSERT_TRUE(android::base::ReadFileToString(tmpfile2.path, columnar_report));
+}
+
+TEST(cmd_report_sample, columnar_option) {
+  std::string data;
+  GetColumnarReport(PERF_DATA_WITH_TRACE_OFFCPU, &data, {"--show-callchain"});
+  ASSERT_NE(data.find("event_type: sched:sched_switch"), std::string::npos);
+  ASSERT_NE(data.find("trace_offcpu: true"), std::string::npos);
+  ASSERT_NE(data.find("sample 1:"), std::string::npos);
+  ASSERT_NE(data.find("file:"), std::string::npos);
+  ASSERT_NE(data.find("thread:"), std::string::npos);
+  ASSERT_NE(data.find("lost_situation:"), std::string::npos);
+  // Callchains end at __libc_init, like in protobuf output.
+  ASSERT_NE(data.find("__libc_init"), std::string::npos);
+  ASSERT_EQ(data.find("_start_main"), std::string::npos);
+
+  // Samples are the same as in protobuf output.
+  std::string protobuf_data;
+  GetProtobufReport(PERF_DATA_WITH_TRACE_OFFCPU, &protobuf_data, {"--show-callchain"});
+  auto get_samples = [](const std::string& s) {
+    std::vector<std::string> lines;
+    bool in_sample = false;
+    for (auto& line : android::base::Split(s, "\n")) {
+      if (android::base::StartsWith(line, "sample ")) {
+        in_sample = true;
+      } else if (!android::base::StartsWith(line, " ")) {
+        in_sample = false;
+      } else if (in_sample) {
+        lines.push_back(line);
+      }
+    }
+    return lines;
+  };
+  ASSERT_EQ(get_samples(data), get_samples(protobuf_data));
+}
+
+TEST(cmd_report_sample, columnar_option_keeps_meta_info_and_mangled_symbols) {
+  std::string data;
+  GetColumnarReport(PERF_DATA_WITH_APP_PACKAGE_NAME, &data);
+  ASSERT_NE(data.find("app_package_name: com.google.sample.tunnel"), std::string::npos);
+  ASSERT_NE(data.find("trace_offcpu: false"), std::string::npos);
+  GetColumnarReport(PERF_DATA_WITH_INTERPRETER_FRAMES, &data, {"--show-callchain"});
+  ASSERT_NE(data.find("symbol: android::hardware::IPCThreadState::talkWithDriver(bool)"),
+            std::string::npos);
+  ASSERT_NE(data.find("mangled_symbol: _ZN7android8hardware14IPCThreadState14talkWithDriverEb"),
+            std::string::npos);
+}
+
+TEST(cmd_report_sample, columnar_and_protobuf_options_conflict) {
+  ASSERT_FALSE(ReportSampleCmd()->Run(
+      {"-i", GetTestData(PERF_DATA_WITH_SYMBOLS), "--protobuf", "--columnar"}));
+}
@@ -16,6 +16,7 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <set>
 #include <unordered_map>
 
@@ -23,9 +24,13 @@
 #include <android-base/strings.h>
 
 #include "command.h"
+#include "event_attr.h"
+#include "event_type.h"
 #include "get_test_data.h"
 #include "perf_regs.h"
 #include "read_apk.h"
+#include "record.h"
+#include "record_file.h"
 #include "test_util.h"
 
 static std::unique_ptr<Command> ReportCmd() {
@@ -495,6 +500,172 @@ TEST_F(ReportCommandTest, report_big_trace_data) {
   ASSERT_TRUE(success);
 }
 
+TEST_F(ReportCommandTest, threads_option) {
+  auto check = [&](const std::string& perf_data, const std::vector<std::string>& args) {
+    std::vector<std::string> serial_args = args;
+    serial_args.insert(serial_args.end(), {"--threads", "1"});
+    Report(perf_data, serial_args);
+    ASSERT_TRUE(success);
+    std::vector<std::string> serial_lines = lines;
+    std::vector<std::string> parallel_args = args;
+    parallel_args.insert(parallel_args.end(), {"--threads", "4"});
+    Report(perf_data, parallel_args);
+    ASSERT_TRUE(success);
+    ASSERT_EQ(serial_lines, lines);
+  };
+  check(PERF_DATA_WITH_MULTIPLE_PIDS_AND_TIDS, {"-n"});
+  check(CALLGRAPH_FP_PERF_DATA, {"--children", "-n"});
+  check(CALLGRAPH_FP_PERF_DATA, {"-g", "--sort", "symbol"});
+  check(CALLGRAPH_FP_PERF_DATA, {"-g", "callee", "--full-callgraph"});
+  check(PERF_DATA_WITH_WRONG_IP_IN_CALLCHAIN, {"-g", "--children"});
+  check(BRANCH_PERF_DATA, {"-b", "--sort", "symbol_from,symbol_to"});
+  check(PERF_DATA_WITH_TWO_EVENT_TYPES, {"--children", "--sort", "comm,symbol"});
+}
+
+TEST_F(ReportCommandTest, threads_option_with_invalid_ips_in_callchain) {
+  std::unique_ptr<EventTypeAndModifier> event_type = ParseEventType("cpu-clock");
+  ASSERT_TRUE(event_type != nullptr);
+  perf_event_attr attr = CreateDefaultPerfEventAttr(event_type->event_type);
+  attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+  attr.sample_id_all = 1;
+  std::vector<EventAttrWithId> attrs(1);
+  attrs[0].attr = &attr;
+  attrs[0].ids.push_back(1);
+  TemporaryFile tmp_file;
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmp_file.path);
+  ASSERT_TRUE(writer != nullptr);
+  ASSERT_TRUE(writer->WriteAttrSection(attrs));
+  ASSERT_TRUE(writer->WriteRecord(CommRecord(attr, 1, 1, "app", 1, 0)));
+  ASSERT_TRUE(writer->WriteRecord(
+      MmapRecord(attr, false, 1, 1, 0x1000, 0x1000, 0, "/system/lib/libapp.so", 1, 0)));
+  // The sampled ip hits an unknown dso, and is also the first ip in the callchain.
+  std::vector<uint64_t> ips = {PERF_CONTEXT_USER, 0x100000, 0x1010, 0x1020};
+  ASSERT_TRUE(writer->WriteRecord(SampleRecord(attr, 1, 0x100000, 1, 1, 1, 0, 1, ips, {}, 0)));
+  // An ip in the middle of the callchain hits an unknown dso.
+  ips = {PERF_CONTEXT_USER, 0x1030, 0x1040, 0x200000, 0x1050};
+  ASSERT_TRUE(writer->WriteRecord(SampleRecord(attr, 1, 0x1030, 1, 1, 2, 0, 1, ips, {}, 0)));
+  ASSERT_TRUE(writer->Close());
+
+  ReportRaw(tmp_file.path, {"-g", "--children", "--threads", "1"});
+  ASSERT_TRUE(success);
+  std::vector<std::string> serial_lines = lines;
+  ReportRaw(tmp_file.path, {"-g", "--children", "--threads", "4"});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(serial_lines, lines);
+}
+
+TEST_F(ReportCommandTest, show_stats_option) {
+  Report(CALLGRAPH_FP_PERF_DATA, {"-g", "--show-stats"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("Memory stats:"), std::string::npos);
+  ASSERT_NE(content.find("Sample tree memory:"), std::string::npos);
+  ASSERT_NE(content.find("demangles avoided by cache:"), std::string::npos);
+  ASSERT_NE(content.find("bytes per sample"), std::string::npos);
+}
+
+TEST_F(ReportCommandTest, top_option) {
+  Report(PERF_DATA);
+  ASSERT_TRUE(success);
+  size_t line_count = lines.size();
+  Report(PERF_DATA, {"--top", "1"});
+  ASSERT_TRUE(success);
+  ASSERT_LT(lines.size(), line_count);
+  // Only one entry follows the column names.
+  ASSERT_NE(lines[lines.size() - 2].find("Overhead"), std::string::npos);
+}
+
+TEST_F(ReportCommandTest, merge_record_files) {
+  auto get_event_count = [&]() {
+    size_t pos = content.find("Event count: ");
+    return std::stoull(content.substr(pos + strlen("Event count: ")));
+  };
+  auto get_entries = [&]() {
+    auto it = std::find_if(lines.begin(), lines.end(), [](const std::string& line) {
+      return android::base::StartsWith(line, "Overhead");
+    });
+    return std::vector<std::string>(it, lines.end());
+  };
+  Report(PERF_DATA, {"--sort", "dso,symbol"});
+  ASSERT_TRUE(success);
+  uint64_t event_count = get_event_count();
+  std::vector<std::string> entries = get_entries();
+  // Merging a file with itself doubles event counts, but doesn't change percentages.
+  Report(PERF_DATA, {"-i", GetTestData(PERF_DATA)});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("Merged record files:"), std::string::npos);
+  ASSERT_EQ(get_event_count(), event_count * 2);
+  ASSERT_EQ(get_entries(), entries);
+  // Files with different events can't be merged.
+  ASSERT_FALSE(ReportCmd()->Run({"-i", GetTestData(PERF_DATA), "-i",
+                                 GetTestData(CALLGRAPH_FP_PERF_DATA)}));
+  // Files recorded on different arches can't be merged.
+  ASSERT_FALSE(ReportCmd()->Run({"-i", GetTestData(PERF_DATA_WITH_SYMBOLS), "-i",
+                                 GetTestData(PERF_DATA_WITH_APP_PACKAGE_NAME)}));
+}
+
+TEST_F(ReportCommandTest, merge_record_files_with_different_kernel_symbols) {
+  auto get_kernel_symbols = [&]() {
+    std::set<std::string> symbols;
+    auto it = std::find_if(lines.begin(), lines.end(), [](const std::string& line) {
+      return android::base::StartsWith(line, "Overhead");
+    });
+    for (++it; it != lines.end(); ++it) {
+      std::vector<std::string> items = android::base::Split(*it, " ");
+      if (!items.empty()) {
+        symbols.insert(items.back());
+      }
+    }
+    return symbols;
+  };
+  std::vector<std::string> options = {"--dsos", "[kernel.kallsyms]", "--sort", "symbol"};
+  // perf_with_kernel_symbol.data has a kernel symbol record, while perf_with_symbols.data doesn't.
+  Report(PERF_DATA_WITH_KERNEL_SYMBOL, options);
+  ASSERT_TRUE(success);
+  std::set<std::string> expected = get_kernel_symbols();
+  Report(PERF_DATA_WITH_SYMBOLS, options);
+  ASSERT_TRUE(success);
+  std::set<std::string> symbols = get_kernel_symbols();
+  expected.insert(symbols.begin(), symbols.end());
+  // Kernel samples in perf_with_symbols.data shouldn't be symbolized with kernel symbols of
+  // perf_with_kernel_symbol.data.
+  options.push_back("-i");
+  options.push_back(GetTestData(PERF_DATA_WITH_SYMBOLS));
+  Report(PERF_DATA_WITH_KERNEL_SYMBOL, options);
+  ASSERT_TRUE(success);
+  ASSERT_EQ(get_kernel_symbols(), expected);
+}
+
+TEST_F(ReportCommandTest, follow_option) {
+  // A record file not being written is reported once.
+  Report(PERF_DATA);
+  ASSERT_TRUE(success);
+  std::string expected = content;
+  Report(PERF_DATA, {"--follow", "--follow-interval", "0.1"});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(content, expected);
+
+  // A record file left unclosed (like when the recording process is killed) is followed until
+  // it doesn't grow for the timeout.
+  std::unique_ptr<EventTypeAndModifier> event_type = ParseEventType("cpu-clock");
+  ASSERT_TRUE(event_type != nullptr);
+  perf_event_attr attr = CreateDefaultPerfEventAttr(event_type->event_type);
+  attr.sample_id_all = 1;
+  std::vector<EventAttrWithId> attrs(1);
+  attrs[0].attr = &attr;
+  attrs[0].ids.push_back(1);
+  TemporaryFile tmp_file;
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmp_file.path);
+  ASSERT_TRUE(writer != nullptr);
+  ASSERT_TRUE(writer->WriteAttrSection(attrs));
+  ASSERT_TRUE(writer->WriteRecord(CommRecord(attr, 1, 1, "unclosed_app", 1, 0)));
+  ASSERT_TRUE(writer->WriteRecord(SampleRecord(attr, 1, 0x1000, 1, 1, 1, 0, 1, {}, {}, 0)));
+  ASSERT_TRUE(writer->SyncDataSection());
+  ReportRaw(tmp_file.path, {"--follow", "--follow-interval", "0.1", "--follow-timeout", "0.5",
+                            "--sort", "comm"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("unclosed_app"), std::string::npos);
+}
+
 #if defined(__linux__)
 #include "event_selection_set.h"
 
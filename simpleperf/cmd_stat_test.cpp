@@ -231,6 +231,34 @@ TEST(stat_cmd, sample_speed_should_be_zero) {
   }
 }
 
+TEST(stat_cmd, read_group_counters) {
+  EventSelectionSet set(true);
+  ASSERT_TRUE(set.AddEventGroup({"cpu-clock", "task-clock", "page-faults"}));
+  ASSERT_TRUE(set.AddEventType("context-switches"));
+  set.AddMonitoredThreads({gettid()});
+  ASSERT_TRUE(set.OpenEventFiles({-1}));
+  std::vector<CountersInfo> counters;
+  for (size_t round = 0; round < 2; ++round) {
+    // Do some work to increase counters.
+    std::vector<char> buf(1024 * 1024, 1);
+    ASSERT_TRUE(set.ReadCounters(&counters));
+    ASSERT_EQ(counters.size(), 4u);
+    for (size_t i = 0; i < 3; ++i) {
+      ASSERT_EQ(counters[i].group_id, 0u);
+      ASSERT_EQ(counters[i].counters.size(), 1u);
+      ASSERT_EQ(counters[i].counters[0].tid, gettid());
+    }
+    ASSERT_EQ(counters[0].event_name, "cpu-clock");
+    ASSERT_EQ(counters[2].event_name, "page-faults");
+    ASSERT_EQ(counters[3].group_id, 1u);
+    ASSERT_EQ(counters[3].counters.size(), 1u);
+    // Members of a group are scheduled together.
+    ASSERT_EQ(counters[0].counters[0].counter.time_running,
+              counters[2].counters[0].counter.time_running);
+    ASSERT_GT(counters[0].counters[0].counter.value, 0u);
+  }
+}
+
 TEST(stat_cmd, calculating_cpu_frequency) {
   TEST_REQUIRE_HW_COUNTER();
   CaptureStdout capture;
@@ -16,24 +16,38 @@
 
 #include "dso.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
 #include "environment.h"
+#include "JITSymfileContainer.h"
 #include "read_apk.h"
 #include "read_dex_file.h"
 #include "read_elf.h"
 #include "utils.h"
 
+using simpleperf::KernelSymbolIndex;
+using simpleperf::ReadJITSymfileSize;
+using simpleperf::SplitJITSymfileUrl;
+
 namespace simpleperf_dso_impl {
 
 std::string RemovePathSeparatorSuffix(const std::string& path) {
@@ -170,25 +184,323 @@ std::string DebugElfFileFinder::GetPathInSymFsDir(const std::string& path) {
   std::replace(elf_path.begin(), elf_path.end(), '/', OS_PATH_SEPARATOR);
   return add_symfs_prefix(elf_path);
 }
+
+static constexpr char SYMBOL_CACHE_MAGIC[8] = {'S', 'Y', 'M', 'C', 'A', 'C', 'H', 'E'};
+static constexpr uint32_t SYMBOL_CACHE_VERSION = 1;
+static constexpr uint32_t NO_DEMANGLED_NAME = UINT32_MAX;
+
+// A symbol cache file contains a header, an array of SymbolCacheEntry sorted by address, and a
+// string table. Names are stored as offsets in the string table.
+struct SymbolCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t symbol_count;
+  // Size and modification time of the file containing the symbols, used to detect changes.
+  uint64_t file_size;
+  uint64_t file_mtime;
+  uint64_t min_vaddr;
+  uint32_t file_path_offset;
+  uint32_t string_table_size;
+};
+
+struct SymbolCacheEntry {
+  uint64_t addr;
+  uint64_t len;
+  uint32_t name_offset;
+  uint32_t demangled_name_offset;
+};
+
+static bool GetFileStamp(const std::string& file_path, uint64_t* size, uint64_t* mtime) {
+  // For elf files in apks, use the apk file.
+  auto tuple = SplitUrlInApk(file_path);
+  const std::string& path = std::get<0>(tuple) ? std::get<1>(tuple) : file_path;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  return true;
+}
+
+SymbolCache::~SymbolCache() {
+  Reset();
+}
+
+void SymbolCache::Reset() {
+  cache_dir_.clear();
+  for (auto& file : mapped_files_) {
+    UnmapCacheFile(file);
+  }
+  mapped_files_.clear();
+}
+
+bool SymbolCache::SetCacheDir(const std::string& cache_dir) {
+  std::string dir = RemovePathSeparatorSuffix(cache_dir);
+  if (!IsDir(dir) && !MkdirWithParents(dir + OS_PATH_SEPARATOR)) {
+    return false;
+  }
+  if (!IsDir(dir)) {
+    LOG(ERROR) << "Invalid symbol cache dir '" << dir << "'";
+    return false;
+  }
+  cache_dir_ = dir;
+  return true;
+}
+
+std::string SymbolCache::GetCacheFilePath(const BuildId& build_id) {
+  // Remove the "0x" prefix.
+  return cache_dir_ + OS_PATH_SEPARATOR + build_id.ToString().substr(2) + ".symcache";
+}
+
+bool SymbolCache::ReadCacheHeader(const BuildId& build_id, const std::string& file_path,
+                                  const char* data, size_t size) {
+  if (size < sizeof(SymbolCacheHeader)) {
+    return false;
+  }
+  const SymbolCacheHeader* header = reinterpret_cast<const SymbolCacheHeader*>(data);
+  if (memcmp(header->magic, SYMBOL_CACHE_MAGIC, sizeof(SYMBOL_CACHE_MAGIC)) != 0 ||
+      header->version != SYMBOL_CACHE_VERSION) {
+    LOG(DEBUG) << "Unsupported symbol cache file for " << build_id.ToString();
+    return false;
+  }
+  uint64_t file_size;
+  uint64_t file_mtime;
+  if (!GetFileStamp(file_path, &file_size, &file_mtime) || file_size != header->file_size ||
+      file_mtime != header->file_mtime) {
+    LOG(DEBUG) << "Symbol cache for " << file_path << " is out of date";
+    return false;
+  }
+  return true;
+}
+
+bool SymbolCache::ReadSymbols(const BuildId& build_id, const std::string& file_path,
+                              bool use_demangled_names, std::vector<Symbol>* symbols,
+                              uint64_t* min_vaddr) {
+  MappedFile file;
+  if (!MapCacheFile(GetCacheFilePath(build_id), &file)) {
+    return false;
+  }
+  bool result = false;
+  if (ReadCacheHeader(build_id, file_path, file.data, file.size)) {
+    const SymbolCacheHeader* header = reinterpret_cast<const SymbolCacheHeader*>(file.data);
+    const SymbolCacheEntry* entries =
+        reinterpret_cast<const SymbolCacheEntry*>(file.data + sizeof(SymbolCacheHeader));
+    uint64_t string_table_offset =
+        sizeof(SymbolCacheHeader) + uint64_t(header->symbol_count) * sizeof(SymbolCacheEntry);
+    const char* strings = file.data + string_table_offset;
+    uint32_t strings_size = header->string_table_size;
+    auto valid_offset = [&](uint32_t offset) { return offset < strings_size; };
+    if (string_table_offset + strings_size == file.size && strings_size > 0 &&
+        strings[strings_size - 1] == '\0' && valid_offset(header->file_path_offset) &&
+        file_path == strings + header->file_path_offset) {
+      result = true;
+      symbols->clear();
+      symbols->reserve(header->symbol_count);
+      for (uint32_t i = 0; i < header->symbol_count; ++i) {
+        const SymbolCacheEntry& entry = entries[i];
+        if (!valid_offset(entry.name_offset) ||
+            (entry.demangled_name_offset != NO_DEMANGLED_NAME &&
+             !valid_offset(entry.demangled_name_offset))) {
+          result = false;
+          break;
+        }
+        const char* demangled_name = nullptr;
+        if (use_demangled_names && entry.demangled_name_offset != NO_DEMANGLED_NAME) {
+          demangled_name = strings + entry.demangled_name_offset;
+        }
+        symbols->push_back(
+            Symbol(strings + entry.name_offset, demangled_name, entry.addr, entry.len));
+      }
+      *min_vaddr = header->min_vaddr;
+    }
+  }
+  if (!result) {
+    LOG(DEBUG) << "Failed to read symbol cache for " << file_path;
+    symbols->clear();
+    UnmapCacheFile(file);
+    return false;
+  }
+  LOG(VERBOSE) << "Read symbols of " << file_path << " from symbol cache";
+  std::lock_guard<std::mutex> lock(mapped_files_mutex_);
+  mapped_files_.push_back(file);
+  return true;
+}
+
+bool SymbolCache::ReadMinVirtualAddress(const BuildId& build_id, const std::string& file_path,
+                                        uint64_t* min_vaddr) {
+  std::unique_ptr<FILE, decltype(&fclose)> fp(
+      fopen(GetCacheFilePath(build_id).c_str(), "rb"), fclose);
+  if (!fp) {
+    return false;
+  }
+  SymbolCacheHeader header;
+  if (fread(&header, sizeof(header), 1, fp.get()) != 1 ||
+      !ReadCacheHeader(build_id, file_path, reinterpret_cast<const char*>(&header),
+                       sizeof(header))) {
+    return false;
+  }
+  *min_vaddr = header.min_vaddr;
+  return true;
+}
+
+bool SymbolCache::WriteSymbols(const BuildId& build_id, const std::string& file_path,
+                               const std::vector<Symbol>& symbols, bool save_demangled_names,
+                               uint64_t min_vaddr) {
+  SymbolCacheHeader header;
+  memcpy(header.magic, SYMBOL_CACHE_MAGIC, sizeof(SYMBOL_CACHE_MAGIC));
+  header.version = SYMBOL_CACHE_VERSION;
+  header.symbol_count = symbols.size();
+  if (!GetFileStamp(file_path, &header.file_size, &header.file_mtime)) {
+    return false;
+  }
+  header.min_vaddr = min_vaddr;
+  std::vector<char> strings;
+  auto add_string = [&](const char* s) {
+    uint32_t offset = strings.size();
+    strings.insert(strings.end(), s, s + strlen(s) + 1);
+    return offset;
+  };
+  header.file_path_offset = add_string(file_path.c_str());
+  std::vector<SymbolCacheEntry> entries(symbols.size());
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    const Symbol& symbol = symbols[i];
+    SymbolCacheEntry& entry = entries[i];
+    entry.addr = symbol.addr;
+    entry.len = symbol.len;
+    entry.name_offset = add_string(symbol.Name());
+    entry.demangled_name_offset = NO_DEMANGLED_NAME;
+    if (save_demangled_names) {
+      // Call Dso::Demangle() instead of Symbol::DemangledName(), which isn't thread safe.
+      std::string demangled_name = Dso::Demangle(symbol.Name());
+      entry.demangled_name_offset = (demangled_name == symbol.Name())
+                                        ? entry.name_offset
+                                        : add_string(demangled_name.c_str());
+    }
+  }
+  if (strings.size() >= NO_DEMANGLED_NAME) {
+    return false;
+  }
+  header.string_table_size = strings.size();
+
+  // Write to a temporary file first, so readers never see a partially written cache file.
+  std::string path = GetCacheFilePath(build_id);
+  // Symbols can be written by multiple threads and processes, so use a unique temporary file.
+  static std::atomic<uint32_t> tmp_file_count(0);
+  std::string tmp_path = android::base::StringPrintf("%s.%d_%u.tmp", path.c_str(), getpid(),
+                                                    tmp_file_count++);
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (fp == nullptr) {
+    PLOG(DEBUG) << "failed to open " << tmp_path;
+    return false;
+  }
+  bool result = fwrite(&header, sizeof(header), 1, fp) == 1;
+  if (result && !entries.empty()) {
+    result = fwrite(entries.data(), sizeof(SymbolCacheEntry), entries.size(), fp) ==
+             entries.size();
+  }
+  result = result && fwrite(strings.data(), strings.size(), 1, fp) == 1;
+  result = (fclose(fp) == 0) && result;
+#if defined(_WIN32)
+  // rename() doesn't replace existing files on Windows.
+  unlink(path.c_str());
+#endif
+  if (!result || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PLOG(DEBUG) << "failed to write symbol cache file " << path;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  LOG(VERBOSE) << "Write symbols of " << file_path << " to symbol cache";
+  return true;
+}
+
+bool SymbolCache::MapCacheFile(const std::string& path, MappedFile* file) {
+  if (!IsRegularFile(path)) {
+    return false;
+  }
+  uint64_t file_size = GetFileSize(path);
+  if (file_size == 0 || file_size > SIZE_MAX) {
+    return false;
+  }
+  android::base::unique_fd fd = FileHelper::OpenReadOnly(path);
+  if (fd == -1) {
+    return false;
+  }
+  file->size = file_size;
+#if defined(_WIN32)
+  file->data = new char[file->size];
+  if (!android::base::ReadFully(fd, file->data, file->size)) {
+    delete[] file->data;
+    return false;
+  }
+#else
+  void* p = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    PLOG(DEBUG) << "failed to mmap " << path;
+    return false;
+  }
+  file->data = static_cast<char*>(p);
+#endif
+  return true;
+}
+
+void SymbolCache::UnmapCacheFile(MappedFile& file) {
+#if defined(_WIN32)
+  delete[] file.data;
+#else
+  munmap(file.data, file.size);
+#endif
+}
 }  // namespace simpleperf_dso_imp
 
 static OneTimeFreeAllocator symbol_name_allocator;
+// Set in threads loading symbols in Dso::PrefetchSymbols(), to avoid sharing
+// symbol_name_allocator between threads.
+static thread_local OneTimeFreeAllocator* thread_symbol_name_allocator = nullptr;
+
+static const char* AllocateSymbolName(std::string_view name) {
+  if (thread_symbol_name_allocator != nullptr) {
+    return thread_symbol_name_allocator->AllocateString(name);
+  }
+  return symbol_name_allocator.AllocateString(name);
+}
 
 Symbol::Symbol(std::string_view name, uint64_t addr, uint64_t len)
     : addr(addr),
       len(len),
-      name_(symbol_name_allocator.AllocateString(name)),
+      name_(AllocateSymbolName(name)),
       demangled_name_(nullptr),
       dump_id_(UINT_MAX) {
 }
 
+Symbol::Symbol(const char* name, const char* demangled_name, uint64_t addr, uint64_t len)
+    : addr(addr), len(len), name_(name), demangled_name_(demangled_name), dump_id_(UINT_MAX) {}
+
+// Demangled names shared by symbols of all dsos. The same mangled name often appears in many
+// dsos (like template and inline functions from common headers), and is only demangled once.
+// Names are demangled lazily, when DemangledName() is called for a symbol hit by samples.
+// Keys and values are owned by symbol_name_allocator, so the map is cleared with it. Names of
+// symbols can't be used directly, because some are owned by others with a shorter lifetime, like
+// the KernelSymbolIndex of a KernelDso.
+static std::unordered_map<std::string_view, const char*> demangled_name_cache;
+static Dso::DemangleStats demangle_stats;
+
 const char* Symbol::DemangledName() const {
   if (demangled_name_ == nullptr) {
-    const std::string s = Dso::Demangle(name_);
-    if (s == name_) {
-      demangled_name_ = name_;
+    auto it = demangled_name_cache.find(name_);
+    if (it != demangled_name_cache.end()) {
+      demangle_stats.cache_hits++;
+      demangled_name_ = it->second;
     } else {
-      demangled_name_ = symbol_name_allocator.AllocateString(s);
+      demangle_stats.demangled_names++;
+      const char* name = symbol_name_allocator.AllocateString(name_);
+      const std::string s = Dso::Demangle(name_);
+      if (s == name_) {
+        demangled_name_ = name;
+      } else {
+        demangled_name_ = symbol_name_allocator.AllocateString(s);
+      }
+      demangled_name_cache.emplace(name, demangled_name_);
     }
   }
   return demangled_name_;
@@ -196,14 +508,22 @@ const char* Symbol::DemangledName() const {
 
 bool Dso::demangle_ = true;
 std::string Dso::vmlinux_;
-std::string Dso::kallsyms_;
+std::shared_ptr<const KernelSymbolIndex> Dso::kernel_symbol_index_;
 bool Dso::read_kernel_symbols_from_proc_;
 std::unordered_map<std::string, BuildId> Dso::build_id_map_;
 size_t Dso::dso_count_;
 uint32_t Dso::g_dump_id_;
 simpleperf_dso_impl::DebugElfFileFinder Dso::debug_elf_file_finder_;
+simpleperf_dso_impl::SymbolCache Dso::symbol_cache_;
 
-void Dso::SetDemangle(bool demangle) { demangle_ = demangle; }
+void Dso::SetDemangle(bool demangle) {
+  if (demangle != demangle_) {
+    demangled_name_cache.clear();
+  }
+  demangle_ = demangle;
+}
+
+Dso::DemangleStats Dso::GetDemangleStats() { return demangle_stats; }
 
 extern "C" char* __cxa_demangle(const char* mangled_name, char* buf, size_t* n,
                                 int* status);
@@ -241,8 +561,22 @@ bool Dso::AddSymbolDir(const std::string& symbol_dir) {
   return debug_elf_file_finder_.AddSymbolDir(symbol_dir);
 }
 
+bool Dso::SetSymbolCacheDir(const std::string& cache_dir) {
+  return symbol_cache_.SetCacheDir(cache_dir);
+}
+
 void Dso::SetVmlinux(const std::string& vmlinux) { vmlinux_ = vmlinux; }
 
+void Dso::SetKallsyms(std::string kallsyms) {
+  if (!kallsyms.empty()) {
+    kernel_symbol_index_ = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
+  }
+}
+
+void Dso::SetKernelSymbolIndex(std::shared_ptr<const KernelSymbolIndex> index) {
+  kernel_symbol_index_ = std::move(index);
+}
+
 void Dso::SetBuildIds(
     const std::vector<std::pair<std::string, BuildId>>& build_ids) {
   std::unordered_map<std::string, BuildId> map;
@@ -284,20 +618,27 @@ Dso::Dso(DsoType type, const std::string& path, const std::string& debug_file_pa
   } else {
     file_name_ = path;
   }
+  BuildId build_id = FindExpectedBuildIdForPath(path_);
+  if (!build_id.IsEmpty()) {
+    build_id_string_ = build_id.ToString();
+  }
   dso_count_++;
 }
 
 Dso::~Dso() {
   if (--dso_count_ == 0) {
     // Clean up global variables when no longer used.
+    demangled_name_cache.clear();
+    demangle_stats = DemangleStats();
     symbol_name_allocator.Clear();
     demangle_ = true;
     vmlinux_.clear();
-    kallsyms_.clear();
+    kernel_symbol_index_.reset();
     read_kernel_symbols_from_proc_ = false;
     build_id_map_.clear();
     g_dump_id_ = 0;
     debug_elf_file_finder_.Reset();
+    symbol_cache_.Reset();
   }
 }
 
@@ -312,6 +653,45 @@ uint32_t Dso::CreateSymbolDumpId(const Symbol* symbol) {
   return symbol->dump_id_;
 }
 
+void Dso::PrefetchSymbols(const std::vector<Dso*>& dsos, size_t thread_count) {
+  std::vector<Dso*> dsos_to_load;
+  for (Dso* dso : dsos) {
+    if (!dso->is_loaded_) {
+      dsos_to_load.push_back(dso);
+    }
+  }
+  thread_count = std::min(thread_count, dsos_to_load.size());
+  if (thread_count <= 1) {
+    for (Dso* dso : dsos_to_load) {
+      dso->Load();
+    }
+    return;
+  }
+  // Each dso is loaded by one thread. Symbol names allocated by a thread are moved to
+  // symbol_name_allocator after all threads finish.
+  std::vector<std::unique_ptr<OneTimeFreeAllocator>> allocators;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next_dso(0);
+  auto load_dsos = [&](OneTimeFreeAllocator* allocator) {
+    thread_symbol_name_allocator = allocator;
+    size_t i;
+    while ((i = next_dso++) < dsos_to_load.size()) {
+      dsos_to_load[i]->Load();
+    }
+    thread_symbol_name_allocator = nullptr;
+  };
+  for (size_t i = 0; i < thread_count; ++i) {
+    allocators.emplace_back(new OneTimeFreeAllocator);
+    threads.emplace_back(load_dsos, allocators.back().get());
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads[i].join();
+    symbol_name_allocator.Merge(*allocators[i]);
+  }
+  LOG(VERBOSE) << "Prefetched symbols of " << dsos_to_load.size() << " dsos in " << thread_count
+               << " threads";
+}
+
 const Symbol* Dso::FindSymbol(uint64_t vaddr_in_dso) {
   if (!is_loaded_) {
     Load();
@@ -466,7 +846,12 @@ class ElfDso : public Dso {
         uint64_t addr;
         ElfStatus result;
         auto tuple = SplitUrlInApk(debug_file_path_);
-        if (std::get<0>(tuple)) {
+        std::string container_path;
+        uint64_t symfile_offset;
+        if (UseSymbolCache(build_id) &&
+            symbol_cache_.ReadMinVirtualAddress(build_id, debug_file_path_, &addr)) {
+          result = ElfStatus::NO_ERROR;
+        } else if (std::get<0>(tuple)) {
           EmbeddedElf* elf = ApkInspector::FindElfInApkByName(std::get<1>(tuple),
                                                               std::get<2>(tuple));
           if (elf == nullptr) {
@@ -475,6 +860,14 @@ class ElfDso : public Dso {
             result = ReadMinExecutableVirtualAddressFromEmbeddedElfFile(
                 elf->filepath(), elf->entry_offset(), elf->entry_size(), build_id, &addr);
           }
+        } else if (SplitJITSymfileUrl(debug_file_path_, &container_path, &symfile_offset)) {
+          uint64_t symfile_size;
+          if (!ReadJITSymfileSize(container_path, symfile_offset, &symfile_size)) {
+            result = ElfStatus::FILE_NOT_FOUND;
+          } else {
+            result = ReadMinExecutableVirtualAddressFromEmbeddedElfFile(
+                container_path, symfile_offset, symfile_size, build_id, &addr);
+          }
         } else {
           result = ReadMinExecutableVirtualAddressFromElfFile(debug_file_path_, build_id, &addr);
         }
@@ -517,6 +910,17 @@ class ElfDso : public Dso {
     }
     std::vector<Symbol> symbols;
     BuildId build_id = GetExpectedBuildId();
+    bool use_symbol_cache = UseSymbolCache(build_id);
+    if (use_symbol_cache) {
+      uint64_t min_vaddr;
+      if (symbol_cache_.ReadSymbols(build_id, debug_file_path_, demangle_, &symbols,
+                                    &min_vaddr)) {
+        if (min_vaddr_ == std::numeric_limits<uint64_t>::max()) {
+          min_vaddr_ = min_vaddr;
+        }
+        return symbols;
+      }
+    }
     auto symbol_callback = [&](const ElfFileSymbol& symbol) {
       if (symbol.is_func || (symbol.is_label && symbol.is_in_text_section)) {
         symbols.emplace_back(symbol.name, symbol.vaddr, symbol.len);
@@ -524,6 +928,8 @@ class ElfDso : public Dso {
     };
     ElfStatus status;
     std::tuple<bool, std::string, std::string> tuple = SplitUrlInApk(debug_file_path_);
+    std::string container_path;
+    uint64_t symfile_offset;
     if (std::get<0>(tuple)) {
       EmbeddedElf* elf = ApkInspector::FindElfInApkByName(std::get<1>(tuple), std::get<2>(tuple));
       if (elf == nullptr) {
@@ -532,16 +938,34 @@ class ElfDso : public Dso {
         status = ParseSymbolsFromEmbeddedElfFile(elf->filepath(), elf->entry_offset(),
                                                  elf->entry_size(), build_id, symbol_callback);
       }
+    } else if (SplitJITSymfileUrl(debug_file_path_, &container_path, &symfile_offset)) {
+      // Read the JIT symfile in place, without extracting it from the container.
+      uint64_t symfile_size;
+      if (!ReadJITSymfileSize(container_path, symfile_offset, &symfile_size)) {
+        status = ElfStatus::FILE_NOT_FOUND;
+      } else {
+        status = ParseSymbolsFromEmbeddedElfFile(container_path, symfile_offset, symfile_size,
+                                                 build_id, symbol_callback);
+      }
     } else {
       status = ParseSymbolsFromElfFile(debug_file_path_, build_id, symbol_callback);
     }
     ReportReadElfSymbolResult(status, path_, debug_file_path_,
                               symbols_.empty() ? android::base::WARNING : android::base::DEBUG);
     SortAndFixSymbols(symbols);
+    if (use_symbol_cache && status == ElfStatus::NO_ERROR) {
+      symbol_cache_.WriteSymbols(build_id, debug_file_path_, symbols, demangle_,
+                                 MinVirtualAddress());
+    }
     return symbols;
   }
 
  private:
+  // JIT symfiles don't have build ids, so they are never cached.
+  bool UseSymbolCache(const BuildId& build_id) {
+    return symbol_cache_.IsEnabled() && !build_id.IsEmpty();
+  }
+
   uint64_t min_vaddr_;
   std::unique_ptr<DexFileDso> dex_file_dso_;
 };
@@ -551,6 +975,24 @@ class KernelDso : public Dso {
   KernelDso(const std::string& path, const std::string& debug_file_path)
       : Dso(DSO_KERNEL, path, debug_file_path) {}
 
+  const Symbol* FindSymbol(uint64_t vaddr_in_dso) override {
+    if (!is_loaded_) {
+      Load();
+    }
+    // The index can only be used when symbols_ has the same addresses as the index, which isn't
+    // true after merging with symbols not in the index (like symbols from the file feature).
+    if (symbol_index_ && symbols_.size() == symbol_index_->SymbolCount()) {
+      size_t index;
+      if (symbol_index_->FindSymbol(vaddr_in_dso, &index)) {
+        const Symbol& symbol = symbols_[index];
+        if (symbol.addr + symbol.len > vaddr_in_dso) {
+          return &symbol;
+        }
+      }
+    }
+    return Dso::FindSymbol(vaddr_in_dso);
+  }
+
  protected:
   std::vector<Symbol> LoadSymbols() override {
     std::vector<Symbol> symbols;
@@ -563,8 +1005,9 @@ class KernelDso : public Dso {
       };
       ElfStatus status = ParseSymbolsFromElfFile(vmlinux_, build_id, symbol_callback);
       ReportReadElfSymbolResult(status, path_, vmlinux_);
-    } else if (!kallsyms_.empty()) {
-      symbols = ReadSymbolsFromKallsyms(kallsyms_);
+      SortAndFixSymbols(symbols);
+    } else if (kernel_symbol_index_) {
+      symbol_index_ = kernel_symbol_index_;
     } else if (read_kernel_symbols_from_proc_ || !build_id.IsEmpty()) {
       // Try /proc/kallsyms only when asked to do so, or when build id matches.
       // Otherwise, it is likely to use /proc/kallsyms on host for perf.data recorded on device.
@@ -581,11 +1024,18 @@ class KernelDso : public Dso {
         if (!android::base::ReadFileToString("/proc/kallsyms", &kallsyms)) {
           LOG(DEBUG) << "failed to read /proc/kallsyms";
         } else {
-          symbols = ReadSymbolsFromKallsyms(kallsyms);
+          symbol_index_ = KernelSymbolIndex::BuildFromKallsyms(kallsyms);
         }
       }
     }
-    SortAndFixSymbols(symbols);
+    if (symbol_index_) {
+      // The index may come from kallsyms text or a kernel symbol index record.
+      if (symbol_index_->SymbolCount() == 0) {
+        LOG(WARNING) << "Symbol addresses in /proc/kallsyms on device are all zero. "
+                        "`echo 0 >/proc/sys/kernel/kptr_restrict` if possible.";
+      }
+      symbols = GetSymbolsFromIndex(*symbol_index_);
+    }
     if (!symbols.empty()) {
       symbols.back().len = std::numeric_limits<uint64_t>::max() - symbols.back().addr;
     }
@@ -593,21 +1043,21 @@ class KernelDso : public Dso {
   }
 
  private:
-  std::vector<Symbol> ReadSymbolsFromKallsyms(std::string& kallsyms) {
+  // Symbols are sorted in the index, and use names owned by the index.
+  std::vector<Symbol> GetSymbolsFromIndex(const KernelSymbolIndex& index) {
     std::vector<Symbol> symbols;
-    auto symbol_callback = [&](const KernelSymbol& symbol) {
-      if (strchr("TtWw", symbol.type) && symbol.addr != 0u) {
-        symbols.emplace_back(symbol.name, symbol.addr, 0);
-      }
-      return false;
-    };
-    ProcessKernelSymbols(kallsyms, symbol_callback);
-    if (symbols.empty()) {
-      LOG(WARNING) << "Symbol addresses in /proc/kallsyms on device are all zero. "
-                      "`echo 0 >/proc/sys/kernel/kptr_restrict` if possible.";
+    size_t count = index.SymbolCount();
+    symbols.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      uint64_t addr = index.SymbolAddr(i);
+      uint64_t len = (i + 1 < count) ? index.SymbolAddr(i + 1) - addr : 0;
+      symbols.push_back(Symbol(index.SymbolName(i), nullptr, addr, len));
     }
     return symbols;
   }
+
+  // Kernel symbols are loaded from symbol_index_ unless vmlinux is used.
+  std::shared_ptr<const KernelSymbolIndex> symbol_index_;
 };
 
 class KernelModuleDso : public Dso {
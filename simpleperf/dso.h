@@ -18,6 +18,7 @@
 #define SIMPLE_PERF_DSO_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -26,8 +27,10 @@
 #include <android-base/logging.h>
 
 #include "build_id.h"
+#include "KernelSymbolIndex.h"
 #include "read_elf.h"
 
+struct Symbol;
 
 namespace simpleperf_dso_impl {
 
@@ -52,6 +55,48 @@ class DebugElfFileFinder {
   std::unordered_map<std::string, std::string> build_id_to_file_map_;
 };
 
+// Save symbol tables of elf files in a cache dir, so later reports can read symbols without
+// parsing elf files. Each cache file is named by the build id of an elf file, and contains
+// symbols sorted by address with their demangled names. Symbols read from a cache file refer to
+// names in the mapped file, so cache files stay mapped until Reset().
+class SymbolCache {
+ public:
+  ~SymbolCache();
+  void Reset();
+  bool SetCacheDir(const std::string& cache_dir);
+  bool IsEnabled() const { return !cache_dir_.empty(); }
+  // Read symbols cached for [file_path] with [build_id]. Return false if they aren't cached, or
+  // [file_path] has been modified after being cached. If [use_demangled_names] is false, cached
+  // demangled names are ignored.
+  bool ReadSymbols(const BuildId& build_id, const std::string& file_path,
+                   bool use_demangled_names, std::vector<Symbol>* symbols, uint64_t* min_vaddr);
+  bool ReadMinVirtualAddress(const BuildId& build_id, const std::string& file_path,
+                             uint64_t* min_vaddr);
+  // [symbols] should be sorted by address. If [save_demangled_names] is true, demangled names of
+  // symbols are also saved.
+  bool WriteSymbols(const BuildId& build_id, const std::string& file_path,
+                    const std::vector<Symbol>& symbols, bool save_demangled_names,
+                    uint64_t min_vaddr);
+  // Only for testing
+  std::string GetCacheFilePath(const BuildId& build_id);
+
+ private:
+  struct MappedFile {
+    char* data;
+    size_t size;
+  };
+
+  bool ReadCacheHeader(const BuildId& build_id, const std::string& file_path, const char* data,
+                       size_t size);
+  bool MapCacheFile(const std::string& path, MappedFile* file);
+  void UnmapCacheFile(MappedFile& file);
+
+  std::string cache_dir_;
+  // Symbols can be read in multiple threads in Dso::PrefetchSymbols().
+  std::mutex mapped_files_mutex_;
+  std::vector<MappedFile> mapped_files_;
+};
+
 }  // namespace simpleperf_dso_impl
 
 struct Symbol {
@@ -93,11 +138,16 @@ struct Symbol {
   }
 
  private:
+  // Create a symbol using names owned by others.
+  Symbol(const char* name, const char* demangled_name, uint64_t addr, uint64_t len);
+
   const char* name_;
   mutable const char* demangled_name_;
   mutable uint32_t dump_id_;
 
   friend class Dso;
+  friend class KernelDso;
+  friend class simpleperf_dso_impl::SymbolCache;
 };
 
 enum DsoType {
@@ -113,8 +163,16 @@ struct ElfFileSymbol;
 
 class Dso {
  public:
+  struct DemangleStats {
+    // Number of names passed to Demangle() for symbols.
+    uint64_t demangled_names = 0;
+    // Number of symbols reusing a name demangled for another symbol.
+    uint64_t cache_hits = 0;
+  };
+
   static void SetDemangle(bool demangle);
   static std::string Demangle(const std::string& name);
+  static DemangleStats GetDemangleStats();
   // SymFsDir is used to provide an alternative root directory looking for files with symbols.
   // For example, if we are searching symbols for /system/lib/libc.so and SymFsDir is /data/symbols,
   // then we will also search file /data/symbols/system/lib/libc.so.
@@ -122,11 +180,15 @@ class Dso {
   // SymbolDir is used to add a directory containing files with symbols. Each file under it will
   // be searched recursively to build a build_id_map.
   static bool AddSymbolDir(const std::string& symbol_dir);
+  // SymbolCacheDir is used to cache symbols of elf files. Reading symbols of an elf file from
+  // the cache avoids parsing the elf file.
+  static bool SetSymbolCacheDir(const std::string& cache_dir);
   static void SetVmlinux(const std::string& vmlinux);
-  static void SetKallsyms(std::string kallsyms) {
-    if (!kallsyms.empty()) {
-      kallsyms_ = std::move(kallsyms);
-    }
+  // Set kernel symbols from kallsyms text. It is parsed into a KernelSymbolIndex.
+  static void SetKallsyms(std::string kallsyms);
+  static void SetKernelSymbolIndex(std::shared_ptr<const simpleperf::KernelSymbolIndex> index);
+  static std::shared_ptr<const simpleperf::KernelSymbolIndex> GetKernelSymbolIndex() {
+    return kernel_symbol_index_;
   }
   static void ReadKernelSymbolsFromProc() {
     read_kernel_symbols_from_proc_ = true;
@@ -138,6 +200,9 @@ class Dso {
 
   static std::unique_ptr<Dso> CreateDso(DsoType dso_type, const std::string& dso_path,
                                         bool force_64bit = false);
+  // Load symbols of [dsos] in [thread_count] threads, instead of loading them lazily in
+  // FindSymbol(). No other Dso functions should be called while it is running.
+  static void PrefetchSymbols(const std::vector<Dso*>& dsos, size_t thread_count);
 
   virtual ~Dso();
 
@@ -149,6 +214,10 @@ class Dso {
   const std::string& GetDebugFilePath() const { return debug_file_path_; }
   // Return the file name without directory info.
   const std::string& FileName() const { return file_name_; }
+  // Return the build id set by SetBuildIds() for the path when the dso was created, or an empty
+  // string if there is none. It tells apart dsos with the same path in record files of
+  // different builds.
+  const std::string& BuildIdString() const { return build_id_string_; }
 
   bool HasDumpId() {
     return dump_id_ != UINT_MAX;
@@ -171,7 +240,7 @@ class Dso {
   virtual void AddDexFileOffset(uint64_t) {}
   virtual const std::vector<uint64_t>* DexFileOffsets() { return nullptr; }
 
-  const Symbol* FindSymbol(uint64_t vaddr_in_dso);
+  virtual const Symbol* FindSymbol(uint64_t vaddr_in_dso);
 
   const std::vector<Symbol>& GetSymbols() { return symbols_; }
   void SetSymbols(std::vector<Symbol>* symbols);
@@ -184,12 +253,13 @@ class Dso {
  protected:
   static bool demangle_;
   static std::string vmlinux_;
-  static std::string kallsyms_;
+  static std::shared_ptr<const simpleperf::KernelSymbolIndex> kernel_symbol_index_;
   static bool read_kernel_symbols_from_proc_;
   static std::unordered_map<std::string, BuildId> build_id_map_;
   static size_t dso_count_;
   static uint32_t g_dump_id_;
   static simpleperf_dso_impl::DebugElfFileFinder debug_elf_file_finder_;
+  static simpleperf_dso_impl::SymbolCache symbol_cache_;
 
   Dso(DsoType type, const std::string& path, const std::string& debug_file_path);
   BuildId GetExpectedBuildId();
@@ -205,6 +275,7 @@ class Dso {
   std::string debug_file_path_;
   // File name of the shared library, got by removing directories in path_.
   std::string file_name_;
+  std::string build_id_string_;
   std::vector<Symbol> symbols_;
   // unknown symbols are like [libc.so+0x1234].
   std::unordered_map<uint64_t, Symbol> unknown_symbols_;
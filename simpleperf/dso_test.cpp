@@ -22,6 +22,7 @@
 #include <android-base/stringprintf.h>
 
 #include "get_test_data.h"
+#include "KernelSymbolIndex.h"
 #include "read_apk.h"
 #include "utils.h"
 
@@ -133,3 +134,116 @@ TEST(dso, embedded_elf) {
   ASSERT_TRUE(GetBuildIdFromDsoPath(file_path, &build_id));
   ASSERT_EQ(build_id, native_lib_build_id);
 }
+
+TEST(SymbolCache, read_and_write_symbols) {
+  TemporaryDir tmpdir;
+  TemporaryFile elf_file;
+  ASSERT_TRUE(android::base::WriteStringToFile("elf data", elf_file.path));
+  SymbolCache cache;
+  ASSERT_TRUE(cache.SetCacheDir(std::string(tmpdir.path) + "/symbol_cache"));
+  BuildId build_id(ELF_FILE_BUILD_ID);
+  std::vector<Symbol> symbols;
+  symbols.emplace_back("_ZN4test3fooEv", 0x100, 0x10);
+  symbols.emplace_back("bar", 0x200, 0x20);
+  ASSERT_TRUE(cache.WriteSymbols(build_id, elf_file.path, symbols, true, 0x1000));
+
+  std::vector<Symbol> cached_symbols;
+  uint64_t min_vaddr;
+  ASSERT_TRUE(cache.ReadSymbols(build_id, elf_file.path, true, &cached_symbols, &min_vaddr));
+  ASSERT_EQ(min_vaddr, 0x1000u);
+  ASSERT_EQ(cached_symbols.size(), symbols.size());
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    ASSERT_EQ(cached_symbols[i].addr, symbols[i].addr);
+    ASSERT_EQ(cached_symbols[i].len, symbols[i].len);
+    ASSERT_STREQ(cached_symbols[i].Name(), symbols[i].Name());
+    ASSERT_STREQ(cached_symbols[i].DemangledName(), symbols[i].DemangledName());
+  }
+  ASSERT_STREQ(cached_symbols[0].DemangledName(), "test::foo()");
+  min_vaddr = 0;
+  ASSERT_TRUE(cache.ReadMinVirtualAddress(build_id, elf_file.path, &min_vaddr));
+  ASSERT_EQ(min_vaddr, 0x1000u);
+
+  // Cached symbols can't be used for a different path or build id.
+  TemporaryFile other_file;
+  ASSERT_FALSE(cache.ReadSymbols(build_id, other_file.path, true, &cached_symbols, &min_vaddr));
+  ASSERT_FALSE(cache.ReadSymbols(native_lib_build_id, elf_file.path, true, &cached_symbols,
+                                 &min_vaddr));
+  // Cached symbols are out of date after the file is modified.
+  ASSERT_TRUE(android::base::WriteStringToFile("modified elf data", elf_file.path));
+  ASSERT_FALSE(cache.ReadSymbols(build_id, elf_file.path, true, &cached_symbols, &min_vaddr));
+  ASSERT_FALSE(cache.ReadMinVirtualAddress(build_id, elf_file.path, &min_vaddr));
+}
+
+TEST(dso, symbol_cache) {
+  TemporaryDir tmpdir;
+  const std::string file_path = GetUrlInApk(GetTestData(APK_FILE), NATIVELIB_IN_APK);
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, file_path);
+  ASSERT_TRUE(Dso::SetSymbolCacheDir(tmpdir.path));
+  Dso::SetBuildIds({std::make_pair(file_path, native_lib_build_id)});
+  const Symbol* symbol = dso->FindSymbol(0x9a4);
+  ASSERT_TRUE(symbol != nullptr);
+  SymbolCache cache;
+  ASSERT_TRUE(cache.SetCacheDir(tmpdir.path));
+  ASSERT_TRUE(IsRegularFile(cache.GetCacheFilePath(native_lib_build_id)));
+
+  // The second dso reads symbols from the cache.
+  std::unique_ptr<Dso> dso2 = Dso::CreateDso(DSO_ELF_FILE, file_path);
+  const Symbol* cached_symbol = dso2->FindSymbol(0x9a4);
+  ASSERT_TRUE(cached_symbol != nullptr);
+  ASSERT_STREQ(cached_symbol->Name(), symbol->Name());
+  ASSERT_EQ(cached_symbol->addr, symbol->addr);
+  ASSERT_EQ(cached_symbol->len, symbol->len);
+  ASSERT_EQ(dso2->GetSymbols().size(), dso->GetSymbols().size());
+  ASSERT_EQ(dso2->MinVirtualAddress(), dso->MinVirtualAddress());
+}
+
+TEST(dso, demangle_cache) {
+  // Keep a dso alive, so the demangle cache isn't cleared.
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, "/nonexist/libtest.so");
+  Dso::DemangleStats old_stats = Dso::GetDemangleStats();
+  Symbol symbol1("_ZN4test3fooEv", 0x100, 0x10);
+  Symbol symbol2("_ZN4test3fooEv", 0x200, 0x10);
+  Symbol symbol3("_ZN4test3barEv", 0x300, 0x10);
+  ASSERT_STREQ(symbol1.DemangledName(), "test::foo()");
+  // The second symbol with the same name reuses the demangled name.
+  ASSERT_EQ(symbol2.DemangledName(), symbol1.DemangledName());
+  ASSERT_STREQ(symbol3.DemangledName(), "test::bar()");
+  Dso::DemangleStats stats = Dso::GetDemangleStats();
+  ASSERT_EQ(stats.demangled_names, old_stats.demangled_names + 2);
+  ASSERT_EQ(stats.cache_hits, old_stats.cache_hits + 1);
+}
+
+TEST(dso, demangle_cache_outlives_kernel_dso) {
+  // Keep a dso alive, so the demangle cache isn't cleared.
+  std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, "/nonexist/libtest.so");
+  std::string kallsyms = "ffffffc000080000 T _ZN4test6kernelEv\n";
+  Dso::SetKernelSymbolIndex(simpleperf::KernelSymbolIndex::BuildFromKallsyms(kallsyms));
+  std::unique_ptr<Dso> kernel_dso = Dso::CreateDso(DSO_KERNEL, "[kernel.kallsyms]");
+  const Symbol* symbol = kernel_dso->FindSymbol(0xffffffc000080010);
+  ASSERT_TRUE(symbol != nullptr);
+  ASSERT_STREQ(symbol->DemangledName(), "test::kernel()");
+  // The symbol name is owned by the kernel symbol index, which is freed with the kernel dso.
+  Dso::SetKernelSymbolIndex(nullptr);
+  kernel_dso.reset();
+  Symbol symbol2("_ZN4test6kernelEv", 0x100, 0x10);
+  ASSERT_STREQ(symbol2.DemangledName(), "test::kernel()");
+}
+
+TEST(dso, prefetch_symbols) {
+  std::vector<std::unique_ptr<Dso>> dsos;
+  dsos.push_back(Dso::CreateDso(DSO_ELF_FILE, GetTestData(ELF_FILE)));
+  dsos.push_back(Dso::CreateDso(DSO_ELF_FILE, GetTestData(ELF_FILE_WITH_MINI_DEBUG_INFO)));
+  dsos.push_back(
+      Dso::CreateDso(DSO_ELF_FILE, GetUrlInApk(GetTestData(APK_FILE), NATIVELIB_IN_APK)));
+  std::vector<Dso*> dso_pointers;
+  for (auto& dso : dsos) {
+    dso_pointers.push_back(dso.get());
+  }
+  Dso::PrefetchSymbols(dso_pointers, 2);
+  for (auto& dso : dsos) {
+    ASSERT_FALSE(dso->GetSymbols().empty()) << dso->Path();
+  }
+  const Symbol* symbol = dsos[2]->FindSymbol(0x9a4);
+  ASSERT_TRUE(symbol != nullptr);
+  ASSERT_STREQ(symbol->Name(), "Java_com_example_hellojni_HelloJni_callFunc1");
+}
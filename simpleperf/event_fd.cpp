@@ -125,6 +125,21 @@ bool EventFd::EnableEvent() {
 
 bool EventFd::InnerReadCounter(PerfCounter* counter) const {
   CHECK(counter != nullptr);
+  if (attr_.read_format & PERF_FORMAT_GROUP) {
+    // The data read from a group leader has values of all group members. Only keep the value
+    // of the leader, which comes first. The read fails if the buffer can't hold all members.
+    uint64_t data[256];
+    ssize_t size = TEMP_FAILURE_RETRY(read(perf_event_fd_, data, sizeof(data)));
+    if (size < static_cast<ssize_t>(5 * sizeof(uint64_t))) {
+      PLOG(ERROR) << "ReadCounter from " << Name() << " failed";
+      return false;
+    }
+    counter->time_enabled = data[1];
+    counter->time_running = data[2];
+    counter->value = data[3];
+    counter->id = data[4];
+    return true;
+  }
   if (!android::base::ReadFully(perf_event_fd_, counter, sizeof(*counter))) {
     PLOG(ERROR) << "ReadCounter from " << Name() << " failed";
     return false;
@@ -136,20 +151,51 @@ bool EventFd::ReadCounter(PerfCounter* counter) {
   if (!InnerReadCounter(counter)) {
     return false;
   }
-  // Trace is always available to systrace if enabled
-  if (tid_ > 0) {
-    ATRACE_INT64(android::base::StringPrintf(
-                   "%s_tid%d_cpu%d", event_name_.c_str(), tid_,
-                   cpu_).c_str(), counter->value - last_counter_value_);
-  } else {
-    ATRACE_INT64(android::base::StringPrintf(
-                   "%s_cpu%d", event_name_.c_str(),
-                   cpu_).c_str(), counter->value - last_counter_value_);
+  TraceCounter(*counter);
+  return true;
+}
+
+bool EventFd::ReadGroupCounters(size_t group_size, PerfCounter* counters) {
+  CHECK(attr_.read_format & PERF_FORMAT_GROUP);
+  // Data layout: nr, time_enabled, time_running, {value, id}[nr].
+  group_read_buffer_.resize(3 + 2 * group_size);
+  size_t size = group_read_buffer_.size() * sizeof(uint64_t);
+  if (!android::base::ReadFully(perf_event_fd_, group_read_buffer_.data(), size)) {
+    PLOG(ERROR) << "ReadGroupCounters from " << Name() << " failed";
+    return false;
   }
-  last_counter_value_ = counter->value;
+  const uint64_t* p = group_read_buffer_.data();
+  if (p[0] != group_size) {
+    LOG(ERROR) << "ReadGroupCounters from " << Name() << " got " << p[0]
+               << " counters, expected " << group_size;
+    return false;
+  }
+  for (size_t i = 0; i < group_size; ++i) {
+    counters[i].time_enabled = p[1];
+    counters[i].time_running = p[2];
+    counters[i].value = p[3 + 2 * i];
+    counters[i].id = p[4 + 2 * i];
+  }
+  TraceCounter(counters[0]);
   return true;
 }
 
+void EventFd::TraceCounter(const PerfCounter& counter) {
+  // Trace is always available to systrace if enabled
+  if (ATRACE_ENABLED()) {
+    if (trace_name_.empty()) {
+      if (tid_ > 0) {
+        trace_name_ = android::base::StringPrintf("%s_tid%d_cpu%d", event_name_.c_str(), tid_,
+                                                  cpu_);
+      } else {
+        trace_name_ = android::base::StringPrintf("%s_cpu%d", event_name_.c_str(), cpu_);
+      }
+    }
+    ATRACE_INT64(trace_name_.c_str(), counter.value - last_counter_value_);
+  }
+  last_counter_value_ = counter.value;
+}
+
 bool EventFd::CreateMappedBuffer(size_t mmap_pages, bool report_error) {
   CHECK(IsPowerOfTwo(mmap_pages));
   size_t page_size = sysconf(_SC_PAGE_SIZE);
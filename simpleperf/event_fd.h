@@ -62,6 +62,14 @@ class EventFd {
 
   bool ReadCounter(PerfCounter* counter);
 
+  // Read counters of all events in the group led by this event in one read(). The event should
+  // be a group leader opened with PERF_FORMAT_GROUP. counters[0] is for this event, and others
+  // are for group members in the order they are opened.
+  bool ReadGroupCounters(size_t group_size, PerfCounter* counters);
+
+  // Report the counter value difference since the last call to systrace, if it is enabled.
+  void TraceCounter(const PerfCounter& counter);
+
   // Create mapped buffer used to receive records sent by the kernel.
   // mmap_pages should be power of 2.
   virtual bool CreateMappedBuffer(size_t mmap_pages, bool report_error);
@@ -127,6 +135,10 @@ class EventFd {
 
   // Used by atrace to generate value difference between two ReadCounter() calls.
   uint64_t last_counter_value_;
+  std::string trace_name_;
+
+  // Buffer used by ReadGroupCounters(), kept to avoid allocating for each read.
+  std::vector<uint64_t> group_read_buffer_;
 
   DISALLOW_COPY_AND_ASSIGN(EventFd);
 };
@@ -512,6 +512,16 @@ bool EventSelectionSet::OpenEventFiles(const std::vector<int>& on_cpus) {
   } else {
     cpus = GetOnlineCpus();
   }
+  if (for_stat_cmd_) {
+    // Read counters of a group in one read() from the group leader. Old kernels don't support
+    // PERF_FORMAT_GROUP on inherited events.
+    for (auto& group : groups_) {
+      perf_event_attr& leader_attr = group[0].event_attr;
+      if (group.size() > 1 && !leader_attr.inherit) {
+        leader_attr.read_format |= PERF_FORMAT_GROUP;
+      }
+    }
+  }
   std::map<pid_t, std::set<pid_t>> process_map = PrepareThreads(processes_, threads_);
   for (auto& group : groups_) {
     if (IsUserSpaceSamplerGroup(group)) {
@@ -579,37 +589,76 @@ static bool ReadCounter(EventFd* event_fd, CounterInfo* counter) {
 }
 
 bool EventSelectionSet::ReadCounters(std::vector<CountersInfo>* counters) {
-  counters->clear();
+  // Reuse buffers in [counters] from the last call, to avoid allocations when reading counters
+  // periodically.
+  size_t selection_count = 0;
+  for (auto& group : groups_) {
+    selection_count += group.size();
+  }
+  counters->resize(selection_count);
+  CountersInfo* counters_info = counters->data();
   for (size_t i = 0; i < groups_.size(); ++i) {
-    for (auto& selection : groups_[i]) {
-      CountersInfo counters_info;
-      counters_info.group_id = i;
-      counters_info.event_name = selection.event_type_modifier.event_type.name;
-      counters_info.event_modifier = selection.event_type_modifier.modifier;
-      counters_info.counters = selection.hotplugged_counters;
-      for (auto& event_fd : selection.event_fds) {
-        CounterInfo counter;
-        if (!ReadCounter(event_fd.get(), &counter)) {
+    EventSelectionGroup& group = groups_[i];
+    for (size_t j = 0; j < group.size(); ++j) {
+      EventSelection& selection = group[j];
+      CountersInfo& info = counters_info[j];
+      info.group_id = i;
+      info.event_name = selection.event_type_modifier.event_type.name;
+      info.event_modifier = selection.event_type_modifier.modifier;
+      info.counters.assign(selection.hotplugged_counters.begin(),
+                           selection.hotplugged_counters.end());
+    }
+    if (group[0].event_attr.read_format & PERF_FORMAT_GROUP) {
+      // Event files at the same position of each selection belong to the same group, because
+      // they are opened and closed together.
+      group_counters_.resize(group.size());
+      for (size_t k = 0; k < group[0].event_fds.size(); ++k) {
+        if (!group[0].event_fds[k]->ReadGroupCounters(group.size(), group_counters_.data())) {
           return false;
         }
-        counters_info.counters.push_back(counter);
+        for (size_t j = 0; j < group.size(); ++j) {
+          EventFd* event_fd = group[j].event_fds[k].get();
+          if (j > 0) {
+            event_fd->TraceCounter(group_counters_[j]);
+          }
+          counters_info[j].counters.push_back(
+              CounterInfo{event_fd->ThreadId(), event_fd->Cpu(), group_counters_[j]});
+        }
+      }
+    } else {
+      for (size_t j = 0; j < group.size(); ++j) {
+        for (auto& event_fd : group[j].event_fds) {
+          CounterInfo counter;
+          if (!ReadCounter(event_fd.get(), &counter)) {
+            return false;
+          }
+          counters_info[j].counters.push_back(counter);
+        }
       }
-      counters->push_back(counters_info);
     }
+    counters_info += group.size();
   }
   return true;
 }
 
 bool EventSelectionSet::MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pages,
-                                       size_t record_buffer_size) {
+                                       size_t record_buffer_size, size_t reader_thread_count) {
   record_read_thread_.reset(new simpleperf::RecordReadThread(
-      record_buffer_size, groups_[0][0].event_attr, min_mmap_pages, max_mmap_pages));
+      record_buffer_size, groups_[0][0].event_attr, min_mmap_pages, max_mmap_pages,
+      reader_thread_count));
+  record_read_thread_->SetTrimStackByFramePointers(trim_stack_by_fp_);
   return true;
 }
 
 bool EventSelectionSet::PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback) {
+  return PrepareToReadMmapEventData(callback, nullptr);
+}
+
+bool EventSelectionSet::PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback,
+                                                   const std::function<bool(char*)>& raw_callback) {
   // Prepare record callback function.
   record_callback_ = callback;
+  raw_record_callback_ = raw_callback;
   if (!record_read_thread_->RegisterDataCallback(*loop_,
                                                  [this]() { return ReadMmapEventData(true); })) {
     return false;
@@ -636,6 +685,18 @@ bool EventSelectionSet::ReadMmapEventData(bool with_time_limit) {
   if (with_time_limit) {
     start_time_in_ns = GetSystemClock();
   }
+  if (raw_record_callback_) {
+    char* data;
+    while ((data = record_read_thread_->GetRecordData()) != nullptr) {
+      if (!raw_record_callback_(data)) {
+        return false;
+      }
+      if (with_time_limit && (GetSystemClock() - start_time_in_ns) >= 1e8) {
+        break;
+      }
+    }
+    return true;
+  }
   std::unique_ptr<Record> r;
   while ((r = record_read_thread_->GetRecord()) != nullptr) {
     if (!record_callback_(r.get())) {
@@ -111,6 +111,9 @@ class EventSelectionSet {
   bool NeedKernelSymbol() const;
   void SetRecordNotExecutableMaps(bool record);
   bool RecordNotExecutableMaps() const;
+  // Trim user stack data in sample records by walking frame pointers. Should be called before
+  // MmapEventFiles().
+  void SetTrimStackByFramePointers(bool enable) { trim_stack_by_fp_ = enable; }
 
   void AddMonitoredProcesses(const std::set<pid_t>& processes) {
     processes_.insert(processes.begin(), processes.end());
@@ -134,8 +137,14 @@ class EventSelectionSet {
 
   bool OpenEventFiles(const std::vector<int>& on_cpus);
   bool ReadCounters(std::vector<CountersInfo>* counters);
-  bool MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pages, size_t record_buffer_size);
+  bool MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pages, size_t record_buffer_size,
+                      size_t reader_thread_count = 1);
   bool PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback);
+  // Like above, but records read from kernel buffers are passed to raw_callback without being
+  // parsed. The record data passed to raw_callback is only valid until raw_callback returns.
+  // Records not from kernel buffers are still passed to callback.
+  bool PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback,
+                                  const std::function<bool(char*)>& raw_callback);
   bool SyncKernelBuffer();
   bool FinishReadMmapEventData();
   void GetLostRecords(size_t* lost_samples, size_t* lost_non_samples, size_t* cut_stack_samples);
@@ -185,11 +194,16 @@ class EventSelectionSet {
 
   std::unique_ptr<IOEventLoop> loop_;
   std::function<bool(Record*)> record_callback_;
+  std::function<bool(char*)> raw_record_callback_;
 
   std::set<int> monitored_cpus_;
   std::vector<int> online_cpus_;
 
   std::unique_ptr<simpleperf::RecordReadThread> record_read_thread_;
+  bool trim_stack_by_fp_ = false;
+
+  // Buffer used by ReadCounters() to read counters of a group.
+  std::vector<PerfCounter> group_counters_;
 
   DISALLOW_COPY_AND_ASSIGN(EventSelectionSet);
 };
@@ -215,3 +215,18 @@ bool RegSet::GetIpRegValue(uint64_t* value) const {
   }
   return GetRegValue(regno, value);
 }
+
+bool RegSet::GetFpRegValue(uint64_t* value) const {
+  size_t regno;
+  switch (arch) {
+    case ARCH_X86_64:
+      regno = PERF_REG_X86_BP;
+      break;
+    case ARCH_ARM64:
+      regno = PERF_REG_ARM64_X29;
+      break;
+    default:
+      return false;
+  }
+  return GetRegValue(regno, value);
+}
@@ -98,6 +98,9 @@ struct RegSet {
   bool GetRegValue(size_t regno, uint64_t* value) const;
   bool GetSpRegValue(uint64_t* value) const;
   bool GetIpRegValue(uint64_t* value) const;
+  // Get the frame pointer. Only supported on 64-bit arches, where each frame record pointed by the
+  // frame pointer is {the caller's frame pointer, the return address}.
+  bool GetFpRegValue(uint64_t* value) const;
 };
 
 #endif  // SIMPLE_PERF_PERF_REGS_H_
@@ -52,6 +52,8 @@ static std::string RecordTypeToString(int record_type) {
       {SIMPLE_PERF_RECORD_CALLCHAIN, "callchain"},
       {SIMPLE_PERF_RECORD_UNWINDING_RESULT, "unwinding_result"},
       {SIMPLE_PERF_RECORD_TRACING_DATA, "tracing_data"},
+      {SIMPLE_PERF_RECORD_COMPRESSED_DATA, "compressed_data"},
+      {SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX, "kernel_symbol_index"},
   };
 
   auto it = record_type_names.find(record_type);
@@ -1037,6 +1039,83 @@ void TracingDataRecord::DumpData(size_t indent) const {
   tracing.Dump(indent);
 }
 
+CompressedDataRecord::CompressedDataRecord(char* p) : Record(p) {
+  const char* end = p + size();
+  p += header_size();
+  MoveFromBinaryFormat(uncompressed_size, p);
+  MoveFromBinaryFormat(compressed_size, p);
+  compressed_data = p;
+  p += Align(compressed_size, 8);
+  CHECK_EQ(p, end);
+}
+
+CompressedDataRecord::CompressedDataRecord(const std::vector<char>& compressed_data,
+                                           uint32_t uncompressed_size) {
+  SetTypeAndMisc(SIMPLE_PERF_RECORD_COMPRESSED_DATA, 0);
+  this->uncompressed_size = uncompressed_size;
+  compressed_size = compressed_data.size();
+  SetSize(header_size() + 2 * sizeof(uint32_t) + Align(compressed_size, 8));
+  char* new_binary = new char[size()];
+  char* p = new_binary;
+  MoveToBinaryFormat(header, p);
+  MoveToBinaryFormat(this->uncompressed_size, p);
+  MoveToBinaryFormat(compressed_size, p);
+  this->compressed_data = p;
+  memcpy(p, compressed_data.data(), compressed_size);
+  memset(p + compressed_size, 0, Align(compressed_size, 8) - compressed_size);
+  UpdateBinary(new_binary);
+}
+
+bool CompressedDataRecord::IsValid(const char* p, uint32_t size) {
+  if (size < header_size() + 2 * sizeof(uint32_t)) {
+    return false;
+  }
+  uint32_t compressed_size;
+  memcpy(&compressed_size, p + header_size() + sizeof(uint32_t), sizeof(compressed_size));
+  return size == header_size() + 2 * sizeof(uint32_t) + Align(compressed_size, 8);
+}
+
+bool CompressedDataRecord::Decompress(std::vector<char>* data) const {
+  return ZlibDecompress(compressed_data, compressed_size, uncompressed_size, data);
+}
+
+void CompressedDataRecord::DumpData(size_t indent) const {
+  PrintIndented(indent, "uncompressed_size %u\n", uncompressed_size);
+  PrintIndented(indent, "compressed_size %u\n", compressed_size);
+}
+
+KernelSymbolIndexRecord::KernelSymbolIndexRecord(char* p) : Record(p) {
+  const char* end = p + size();
+  p += header_size();
+  MoveFromBinaryFormat(symbol_count, p);
+  MoveFromBinaryFormat(data_size, p);
+  data = p;
+  p += Align(data_size, 8);
+  CHECK_EQ(p, end);
+}
+
+KernelSymbolIndexRecord::KernelSymbolIndexRecord(const std::vector<char>& data,
+                                                 uint32_t symbol_count) {
+  SetTypeAndMisc(SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX, 0);
+  this->symbol_count = symbol_count;
+  data_size = data.size();
+  SetSize(header_size() + 2 * sizeof(uint32_t) + Align(data_size, 8));
+  char* new_binary = new char[size()];
+  char* p = new_binary;
+  MoveToBinaryFormat(header, p);
+  MoveToBinaryFormat(this->symbol_count, p);
+  MoveToBinaryFormat(data_size, p);
+  this->data = p;
+  memcpy(p, data.data(), data_size);
+  memset(p + data_size, 0, Align(data_size, 8) - data_size);
+  UpdateBinary(new_binary);
+}
+
+void KernelSymbolIndexRecord::DumpData(size_t indent) const {
+  PrintIndented(indent, "symbol_count %u\n", symbol_count);
+  PrintIndented(indent, "data_size %u\n", data_size);
+}
+
 EventIdRecord::EventIdRecord(char* p) : Record(p) {
   const char* end = p + size();
   p += header_size();
@@ -1225,6 +1304,10 @@ std::unique_ptr<Record> ReadRecordFromBuffer(const perf_event_attr& attr, uint32
       return std::unique_ptr<Record>(new UnwindingResultRecord(p));
     case SIMPLE_PERF_RECORD_TRACING_DATA:
       return std::unique_ptr<Record>(new TracingDataRecord(p));
+    case SIMPLE_PERF_RECORD_COMPRESSED_DATA:
+      return std::unique_ptr<Record>(new CompressedDataRecord(p));
+    case SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX:
+      return std::unique_ptr<Record>(new KernelSymbolIndexRecord(p));
     default:
       return std::unique_ptr<Record>(new UnknownRecord(p));
   }
@@ -51,6 +51,8 @@ enum user_record_type {
   SIMPLE_PERF_RECORD_CALLCHAIN,
   SIMPLE_PERF_RECORD_UNWINDING_RESULT,
   SIMPLE_PERF_RECORD_TRACING_DATA,
+  SIMPLE_PERF_RECORD_COMPRESSED_DATA,
+  SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX,
 };
 
 // perf_event_header uses u16 to store record size. However, that is not
@@ -492,6 +494,43 @@ struct TracingDataRecord : public Record {
   void DumpData(size_t indent) const override;
 };
 
+// CompressedDataRecord stores a frame of consecutive records compressed by zlib. Each frame only
+// contains whole records, so it can be decompressed independently.
+struct CompressedDataRecord : public Record {
+  uint32_t uncompressed_size;
+  uint32_t compressed_size;
+  const char* compressed_data;
+
+  explicit CompressedDataRecord(char* p);
+
+  CompressedDataRecord(const std::vector<char>& compressed_data, uint32_t uncompressed_size);
+
+  // Return true if [p] of [size] bytes can be parsed as a CompressedDataRecord. The constructor
+  // aborts on invalid data, so check data read from files first.
+  static bool IsValid(const char* p, uint32_t size);
+
+  bool Decompress(std::vector<char>* data) const;
+
+ protected:
+  void DumpData(size_t indent) const override;
+};
+
+// KernelSymbolIndexRecord stores a serialized KernelSymbolIndex. It is written instead of
+// KernelSymbolRecord by `simpleperf record --kernel-symbol-index`, so readers don't need to parse
+// kallsyms text.
+struct KernelSymbolIndexRecord : public Record {
+  uint32_t symbol_count;
+  uint32_t data_size;
+  const char* data;
+
+  explicit KernelSymbolIndexRecord(char* p);
+
+  KernelSymbolIndexRecord(const std::vector<char>& data, uint32_t symbol_count);
+
+ protected:
+  void DumpData(size_t indent) const override;
+};
+
 struct EventIdRecord : public Record {
   uint64_t count;
   struct EventIdData {
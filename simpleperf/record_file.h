@@ -19,10 +19,15 @@
 
 #include <stdio.h>
 
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -45,9 +50,23 @@ class RecordFileWriter {
   ~RecordFileWriter();
 
   bool WriteAttrSection(const std::vector<EventAttrWithId>& attr_ids);
+  // Compress records written afterwards. Records are collected into frames of about
+  // [frame_size] bytes. Each frame is compressed in a background thread, and written to the
+  // data section as a CompressedDataRecord.
+  bool EnableDataCompression(size_t frame_size = DEFAULT_COMPRESSION_FRAME_SIZE);
   bool WriteRecord(const Record& record);
+  // Write a record in binary format, like a record read from kernel buffers. The record size
+  // should be <= 65535.
+  bool WriteRecordData(const char* data);
 
   uint64_t GetDataSectionSize() const { return data_section_size_; }
+  // Make records written so far readable while the file is still being written: flush pending
+  // records, and write a file header with the current data section size. Readers following the
+  // file can see the new size by RecordFileReader::RefreshDataSection(). The header only has
+  // the FEAT_BEING_WRITTEN bit until Close().
+  bool SyncDataSection();
+  // Read all records in the data section. It also builds the record index, which can be written
+  // by WriteRecordIndexFeature().
   bool ReadDataSection(const std::function<void(const Record*)>& callback);
 
   bool BeginWriteFeatures(size_t feature_count);
@@ -57,6 +76,7 @@ class RecordFileWriter {
   bool WriteBranchStackFeature();
   bool WriteFileFeatures(const std::vector<Dso*>& files);
   bool WriteMetaInfoFeature(const std::unordered_map<std::string, std::string>& info_map);
+  bool WriteRecordIndexFeature();
   bool WriteFeature(int feature, const std::vector<char>& data);
   bool EndWriteFeatures();
 
@@ -67,7 +87,12 @@ class RecordFileWriter {
   void GetHitModulesInBuffer(const char* p, const char* end,
                              std::vector<std::string>* hit_kernel_modules,
                              std::vector<std::string>* hit_user_files);
-  bool WriteFileHeader();
+  bool WriteFileHeader(bool being_written);
+  bool WriteRecordToDataSection(const Record& record);
+  bool AddToCompressionFrame(const char* data, size_t size);
+  bool WriteCompressedFrames(bool wait_all);
+  void RunCompressionThread();
+  void StopCompressionThread();
   bool WriteData(const void* buf, size_t len);
   bool Write(const void* buf, size_t len);
   bool Read(void* buf, size_t len);
@@ -93,6 +118,31 @@ class RecordFileWriter {
 
   std::map<int, PerfFileFormat::SectionDesc> features_;
   size_t feature_count_;
+  std::vector<PerfFileFormat::RecordIndexEntry> record_index_;
+
+  static constexpr size_t DEFAULT_COMPRESSION_FRAME_SIZE = 1024 * 1024;
+  // Max number of frames waiting to be compressed or written. It limits memory usage when
+  // compression is slower than recording.
+  static constexpr size_t MAX_PENDING_COMPRESSION_FRAMES = 4;
+
+  struct CompressionFrame {
+    std::vector<char> data;
+    std::vector<char> compressed_data;
+    bool finished = false;
+    bool result = false;
+  };
+
+  bool compress_data_;
+  size_t compression_frame_size_;
+  std::unique_ptr<CompressionFrame> current_frame_;
+  // Frames are written to the file in the order they are added to pending_frames_.
+  std::deque<std::unique_ptr<CompressionFrame>> pending_frames_;
+  std::queue<CompressionFrame*> frames_to_compress_;
+  std::mutex compression_mutex_;
+  std::condition_variable compression_start_cond_;
+  std::condition_variable compression_finish_cond_;
+  bool stop_compression_thread_;
+  std::thread compression_thread_;
 
   DISALLOW_COPY_AND_ASSIGN(RecordFileWriter);
 };
@@ -135,8 +185,25 @@ class RecordFileReader {
   // Read next record. If read successfully, set [record] and return true.
   // If there is no more records, set [record] to nullptr and return true.
   // Otherwise return false.
+  // If the file is memory mapped, records may point to data in the mapped file instead of owning
+  // a copy. So they should not be used after the reader is destroyed.
   bool ReadRecord(std::unique_ptr<Record>& record);
 
+  // Seek to the record with [record_id], so it is returned by the next ReadRecord() call. The
+  // first record in the data section has id 0. The record index feature section is used to
+  // avoid reading all records before it.
+  bool SeekToRecord(uint64_t record_id);
+  // Seek to a position before the first record with time >= [timestamp], using the record index
+  // feature section. Records in the data section aren't strictly sorted by time, so records read
+  // afterwards can still have time < [timestamp].
+  bool SeekToTime(uint64_t timestamp);
+
+  // Used to read a file still being written. Read the file header again, so records synced by
+  // RecordFileWriter::SyncDataSection() since the last call can be read by following
+  // ReadRecord() calls. [finished] is set to true if the writer has closed the file, which means
+  // the data section won't grow any more.
+  bool RefreshDataSection(bool* finished);
+
   size_t GetAttrIndexOfRecord(const Record* record);
 
   std::vector<std::string> ReadCmdlineFeature();
@@ -152,8 +219,12 @@ class RecordFileReader {
                        uint32_t* file_type, uint64_t* min_vaddr,
                        std::vector<Symbol>* symbols, std::vector<uint64_t>* dex_file_offsets);
   bool ReadMetaInfoFeature(std::unordered_map<std::string, std::string>* info_map);
+  bool ReadRecordIndexFeature(std::vector<PerfFileFormat::RecordIndexEntry>* entries);
 
-  void LoadBuildIdAndFileFeatures(ThreadTree& thread_tree);
+  // If [hit_dsos] isn't nullptr, it is set to dsos of files in the file feature, which are
+  // files hit by samples.
+  void LoadBuildIdAndFileFeatures(ThreadTree& thread_tree,
+                                  std::vector<Dso*>* hit_dsos = nullptr);
 
   bool Close();
 
@@ -166,7 +237,15 @@ class RecordFileReader {
   bool ReadAttrSection();
   bool ReadIdsForAttr(const PerfFileFormat::FileAttr& attr, std::vector<uint64_t>* ids);
   bool ReadFeatureSectionDescriptors();
+  bool CheckDataCompression();
+  bool IsBeingWritten() const;
+  void MapFile();
   std::unique_ptr<Record> ReadRecord(uint64_t* nbytes_read);
+  std::unique_ptr<Record> ReadRecordFromMappedFile(uint64_t* nbytes_read);
+  std::unique_ptr<Record> ReadRecordFromFrame();
+  std::unique_ptr<Record> CreateRecord(const RecordHeader& header, char* p, bool own_binary);
+  bool ReadRecordIndex();
+  bool SetReadPos(uint64_t record_id, uint64_t offset);
   bool Read(void* buf, size_t len);
   void ProcessEventIdRecord(const EventIdRecord& r);
 
@@ -183,6 +262,19 @@ class RecordFileReader {
   size_t event_id_reverse_pos_in_non_sample_records_;
 
   uint64_t read_record_size_;
+  // Id of the next record returned by ReadRecord().
+  uint64_t read_record_id_;
+
+  // If not null, the whole file is mapped, and records are read from the mapped data.
+  char* mapped_file_;
+  uint64_t mapped_file_size_;
+
+  bool record_index_loaded_;
+  std::vector<PerfFileFormat::RecordIndexEntry> record_index_;
+
+  // Decompressed data of the CompressedDataRecord being read.
+  std::vector<char> frame_data_;
+  size_t frame_read_pos_;
 
   DISALLOW_COPY_AND_ASSIGN(RecordFileReader);
 };
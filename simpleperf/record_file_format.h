@@ -29,6 +29,33 @@ The file structure of perf.data:
     data section
     feature section
 
+The data section can optionally be compressed (enabled by `simpleperf record --compress`). In
+that case, records are grouped into frames. Each frame is compressed by zlib and stored as a
+SIMPLE_PERF_RECORD_COMPRESSED_DATA record, which can be decompressed independently:
+  struct compressed_data_record {
+    simpleperf_record_header header;
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+    char compressed_data[compressed_size];  // padded to 8-byte boundary
+  };
+Like other simpleperf records, compressed_data records larger than 65535 bytes are stored as
+SIMPLE_PERF_RECORD_SPLIT records followed by a SIMPLE_PERF_RECORD_SPLIT_END record.
+A file with a compressed data section has the data_compression feature, which is a string
+naming the compression method (currently only "zlib"). Readers should refuse a file compressed
+by a method they don't support, instead of skipping unknown records.
+
+While a file is being written with the data section synced periodically (like by
+`simpleperf record --sync-interval`), its file header has only the being_written feature bit set.
+The bit has no feature section descriptor or data. When the writer closes the file, the header is
+rewritten with the real features, and without the bit.
+
+Symfiles of JITed Java methods can be stored in a JIT symfile container (see
+JITSymfileContainer.h). Then the mmap2 record of JITed code has the container path as filename,
+and the offset of the symfile in the container as pgoff, which is 0 for other JIT maps. A file
+using a container has the jit_symfile_container feature, which is a string of the container
+path. Readers not supporting containers (simpleperf versions before the feature is added) can't
+find symbols of JITed code in such a file.
+
 The feature section has the following structure:
     a section descriptor array, each element contains the section information of one add_feature.
     data section of feature 1
@@ -64,6 +91,17 @@ meta_info feature section:
   keys in meta_info feature section include:
     simpleperf_version,
 
+record_index feature section:
+  uint32_t version;  // currently 1
+  uint32_t entry_size;  // sizeof(RecordIndexEntry)
+  RecordIndexEntry entries[];
+
+  It records the positions of some records in the data section, so a reader can seek to a record
+  or a time without reading all records before it. An entry is added about every
+  RECORD_INDEX_INTERVAL records. Records are counted after reassembling split records and
+  decompressing compressed frames. An entry always points to a record in the file, not in a
+  compressed frame.
+
 */
 
 namespace PerfFileFormat {
@@ -93,6 +131,10 @@ enum {
   FEAT_SIMPLEPERF_START = 128,
   FEAT_FILE = FEAT_SIMPLEPERF_START,
   FEAT_META_INFO,
+  FEAT_RECORD_INDEX,
+  FEAT_BEING_WRITTEN,
+  FEAT_DATA_COMPRESSION,
+  FEAT_JIT_SYMFILE_CONTAINER,
   FEAT_MAX_NUM = 256,
 };
 
@@ -121,6 +163,15 @@ struct FileAttr {
   SectionDesc ids;
 };
 
+constexpr uint32_t RECORD_INDEX_VERSION = 1;
+constexpr uint64_t RECORD_INDEX_INTERVAL = 4096;
+
+struct RecordIndexEntry {
+  uint64_t record_id;  // The first record in the data section has id 0.
+  uint64_t offset;  // Offset of the record in the data section.
+  uint64_t max_time_before;  // Max timestamp of records before this record.
+};
+
 }  // namespace PerfFileFormat
 
 #endif  // SIMPLE_PERF_RECORD_FILE_FORMAT_H_
@@ -18,6 +18,11 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#include <algorithm>
 #include <set>
 #include <vector>
 
@@ -51,6 +56,10 @@ static const std::map<int, std::string> feature_name_map = {
     {FEAT_GROUP_DESC, "group_desc"},
     {FEAT_FILE, "file"},
     {FEAT_META_INFO, "meta_info"},
+    {FEAT_RECORD_INDEX, "record_index"},
+    {FEAT_BEING_WRITTEN, "being_written"},
+    {FEAT_DATA_COMPRESSION, "data_compression"},
+    {FEAT_JIT_SYMFILE_CONTAINER, "jit_symfile_container"},
 };
 
 std::string GetFeatureName(int feature_id) {
@@ -78,21 +87,29 @@ std::unique_ptr<RecordFileReader> RecordFileReader::CreateInstance(const std::st
   }
   auto reader = std::unique_ptr<RecordFileReader>(new RecordFileReader(filename, fp));
   if (!reader->ReadHeader() || !reader->ReadAttrSection() ||
-      !reader->ReadFeatureSectionDescriptors()) {
+      !reader->ReadFeatureSectionDescriptors() || !reader->CheckDataCompression()) {
     return nullptr;
   }
+  reader->MapFile();
   return reader;
 }
 
 RecordFileReader::RecordFileReader(const std::string& filename, FILE* fp)
     : filename_(filename), record_fp_(fp), event_id_pos_in_sample_records_(0),
-      event_id_reverse_pos_in_non_sample_records_(0), read_record_size_(0) {
+      event_id_reverse_pos_in_non_sample_records_(0), read_record_size_(0), read_record_id_(0),
+      mapped_file_(nullptr), mapped_file_size_(0), record_index_loaded_(false),
+      frame_read_pos_(0) {
 }
 
 RecordFileReader::~RecordFileReader() {
   if (record_fp_ != nullptr) {
     Close();
   }
+#if !defined(_WIN32)
+  if (mapped_file_ != nullptr) {
+    munmap(mapped_file_, mapped_file_size_);
+  }
+#endif
 }
 
 bool RecordFileReader::Close() {
@@ -105,6 +122,33 @@ bool RecordFileReader::Close() {
   return result;
 }
 
+// Reading records from a memory mapped file avoids a read call and a data copy for each record.
+// If the file can't be mapped (like a huge file on 32-bit devices), records are read by fread().
+void RecordFileReader::MapFile() {
+#if !defined(_WIN32)
+  if (IsBeingWritten()) {
+    // The file keeps growing, and records already read may point to the old mapping.
+    return;
+  }
+  struct stat st;
+  if (fstat(fileno(record_fp_), &st) != 0) {
+    return;
+  }
+  uint64_t file_size = st.st_size;
+  if (file_size > SIZE_MAX || file_size < header_.data.offset + header_.data.size) {
+    return;
+  }
+  // Use MAP_PRIVATE with PROT_WRITE, because some records are modified in place after reading.
+  void* p = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(record_fp_), 0);
+  if (p == MAP_FAILED) {
+    PLOG(DEBUG) << "failed to mmap " << filename_;
+    return;
+  }
+  mapped_file_ = static_cast<char*>(p);
+  mapped_file_size_ = file_size;
+#endif
+}
+
 bool RecordFileReader::ReadHeader() {
   if (!Read(&header_, sizeof(header_))) {
     return false;
@@ -116,6 +160,56 @@ bool RecordFileReader::ReadHeader() {
   return true;
 }
 
+bool RecordFileReader::RefreshDataSection(bool* finished) {
+  if (!IsBeingWritten()) {
+    *finished = true;
+    return true;
+  }
+  // The writer may be rewriting the header. Read it twice to avoid using a partially written one.
+  PerfFileFormat::FileHeader header;
+  PerfFileFormat::FileHeader header2;
+  if (fseek(record_fp_, 0, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  if (!Read(&header, sizeof(header))) {
+    return false;
+  }
+  if (fseek(record_fp_, 0, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  if (!Read(&header2, sizeof(header2))) {
+    return false;
+  }
+  if (memcmp(&header, &header2, sizeof(header)) == 0) {
+    if (header.data.offset != header_.data.offset || header.data.size < header_.data.size) {
+      LOG(ERROR) << filename_ << " is rewritten while being read";
+      return false;
+    }
+    header_ = header;
+    if (!IsBeingWritten()) {
+      feature_section_descriptors_.clear();
+      if (!ReadFeatureSectionDescriptors() || !CheckDataCompression()) {
+        return false;
+      }
+    }
+  }
+  // Continue from the next record.
+  if (fseek(record_fp_, header_.data.offset + read_record_size_, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  *finished = !IsBeingWritten();
+  return true;
+}
+
+// RecordFileWriter::SyncDataSection() writes a file header with only the being_written feature
+// bit set, and RecordFileWriter::Close() clears it.
+bool RecordFileReader::IsBeingWritten() const {
+  return header_.features[FEAT_BEING_WRITTEN / 8] & (1 << (FEAT_BEING_WRITTEN % 8));
+}
+
 bool RecordFileReader::ReadAttrSection() {
   size_t attr_count = header_.attrs.size / header_.attr_size;
   if (header_.attr_size != sizeof(FileAttr)) {
@@ -169,6 +263,10 @@ bool RecordFileReader::ReadAttrSection() {
 }
 
 bool RecordFileReader::ReadFeatureSectionDescriptors() {
+  if (IsBeingWritten()) {
+    // There is no feature section until the writer closes the file.
+    return true;
+  }
   std::vector<int> features;
   for (size_t i = 0; i < sizeof(header_.features); ++i) {
     for (size_t j = 0; j < 8; ++j) {
@@ -192,6 +290,21 @@ bool RecordFileReader::ReadFeatureSectionDescriptors() {
   return true;
 }
 
+// Records compressed by an unsupported method would be read as unknown records, and give an
+// empty profile. So refuse the file instead.
+bool RecordFileReader::CheckDataCompression() {
+  if (!HasFeature(FEAT_DATA_COMPRESSION)) {
+    return true;
+  }
+  std::string method = ReadFeatureString(FEAT_DATA_COMPRESSION);
+  if (method != "zlib") {
+    LOG(ERROR) << "The data section of " << filename_ << " is compressed by '" << method
+               << "', which isn't supported by this version of simpleperf.";
+    return false;
+  }
+  return true;
+}
+
 bool RecordFileReader::ReadIdsForAttr(const FileAttr& attr, std::vector<uint64_t>* ids) {
   size_t id_count = attr.ids.size / sizeof(uint64_t);
   if (fseek(record_fp_, attr.ids.offset, SEEK_SET) != 0) {
@@ -220,31 +333,179 @@ bool RecordFileReader::ReadDataSection(
 }
 
 bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record) {
-  if (read_record_size_ == 0) {
+  if (read_record_size_ == 0 && mapped_file_ == nullptr) {
     if (fseek(record_fp_, header_.data.offset, SEEK_SET) != 0) {
       PLOG(ERROR) << "fseek() failed";
       return false;
     }
   }
   record = nullptr;
-  if (read_record_size_ < header_.data.size) {
-    record = ReadRecord(&read_record_size_);
+  while (true) {
+    if (frame_read_pos_ < frame_data_.size()) {
+      record = ReadRecordFromFrame();
+    } else if (read_record_size_ < header_.data.size) {
+      record = ReadRecord(&read_record_size_);
+    } else {
+      return true;
+    }
     if (record == nullptr) {
       return false;
     }
-    if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
-      ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+    if (record->type() != SIMPLE_PERF_RECORD_COMPRESSED_DATA) {
+      break;
+    }
+    // Records in a compressed frame are returned in the following calls.
+    if (!static_cast<CompressedDataRecord*>(record.get())->Decompress(&frame_data_)) {
+      return false;
     }
+    frame_read_pos_ = 0;
+  }
+  read_record_id_++;
+  if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+    ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
   }
   return true;
 }
 
+bool RecordFileReader::SeekToRecord(uint64_t record_id) {
+  if (!ReadRecordIndex()) {
+    return false;
+  }
+  auto it = std::upper_bound(record_index_.begin(), record_index_.end(), record_id,
+                             [](uint64_t id, const RecordIndexEntry& entry) {
+                               return id < entry.record_id;
+                             });
+  uint64_t start_id = 0;
+  uint64_t start_offset = 0;
+  if (it != record_index_.begin()) {
+    start_id = std::prev(it)->record_id;
+    start_offset = std::prev(it)->offset;
+  }
+  if (record_id < read_record_id_ || start_id > read_record_id_) {
+    if (!SetReadPos(start_id, start_offset)) {
+      return false;
+    }
+  } else if (!SetReadPos(read_record_id_, read_record_size_)) {
+    return false;
+  }
+  std::unique_ptr<Record> record;
+  while (read_record_id_ < record_id) {
+    if (!ReadRecord(record)) {
+      return false;
+    }
+    if (record == nullptr) {
+      break;
+    }
+  }
+  return true;
+}
+
+bool RecordFileReader::SeekToTime(uint64_t timestamp) {
+  if (!ReadRecordIndex()) {
+    return false;
+  }
+  // Find the last entry with all records before it having time < timestamp.
+  auto it = std::partition_point(record_index_.begin(), record_index_.end(),
+                                 [&](const RecordIndexEntry& entry) {
+                                   return entry.max_time_before < timestamp;
+                                 });
+  if (it == record_index_.begin()) {
+    return SetReadPos(0, 0);
+  }
+  --it;
+  return SetReadPos(it->record_id, it->offset);
+}
+
+bool RecordFileReader::ReadRecordIndex() {
+  if (!record_index_loaded_) {
+    // Without the index, seeking needs to read records from the start of the data section.
+    if (HasFeature(FEAT_RECORD_INDEX) && !ReadRecordIndexFeature(&record_index_)) {
+      return false;
+    }
+    record_index_loaded_ = true;
+  }
+  return true;
+}
+
+bool RecordFileReader::ReadRecordIndexFeature(std::vector<RecordIndexEntry>* entries) {
+  std::vector<char> buf;
+  if (!ReadFeatureSection(FEAT_RECORD_INDEX, &buf)) {
+    return false;
+  }
+  const char* p = buf.data();
+  const char* end = buf.data() + buf.size();
+  uint32_t version;
+  uint32_t entry_size;
+  if (buf.size() < 2 * sizeof(uint32_t)) {
+    LOG(ERROR) << "invalid record_index feature section in " << filename_;
+    return false;
+  }
+  MoveFromBinaryFormat(version, p);
+  MoveFromBinaryFormat(entry_size, p);
+  if (version != RECORD_INDEX_VERSION || entry_size != sizeof(RecordIndexEntry)) {
+    LOG(ERROR) << "unsupported record_index feature section in " << filename_;
+    return false;
+  }
+  entries->resize((end - p) / sizeof(RecordIndexEntry));
+  MoveFromBinaryFormat(entries->data(), entries->size(), p);
+  return true;
+}
+
+// Set the position of the next record read by ReadRecord().
+bool RecordFileReader::SetReadPos(uint64_t record_id, uint64_t offset) {
+  if (offset > header_.data.size) {
+    LOG(ERROR) << "invalid record offset " << offset << " in " << filename_;
+    return false;
+  }
+  if (mapped_file_ == nullptr && fseek(record_fp_, header_.data.offset + offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  if (record_id != read_record_id_ || offset != read_record_size_) {
+    frame_data_.clear();
+    frame_read_pos_ = 0;
+  }
+  read_record_id_ = record_id;
+  read_record_size_ = offset;
+  return true;
+}
+
+std::unique_ptr<Record> RecordFileReader::ReadRecordFromFrame() {
+  size_t left_size = frame_data_.size() - frame_read_pos_;
+  RecordHeader header;
+  if (left_size >= Record::header_size()) {
+    header = RecordHeader(&frame_data_[frame_read_pos_]);
+  }
+  if (header.size < Record::header_size() || header.size > left_size) {
+    LOG(ERROR) << "invalid record in compressed data of " << filename_;
+    return nullptr;
+  }
+  char* p = new char[header.size];
+  memcpy(p, &frame_data_[frame_read_pos_], header.size);
+  frame_read_pos_ += header.size;
+  return CreateRecord(header, p, true);
+}
+
 std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
+  if (mapped_file_ != nullptr) {
+    return ReadRecordFromMappedFile(nbytes_read);
+  }
   char header_buf[Record::header_size()];
   if (!Read(header_buf, Record::header_size())) {
     return nullptr;
   }
   RecordHeader header(header_buf);
+  // The header is read at *nbytes_read in the data section. Check that the record is in it.
+  auto check_header = [&]() {
+    if (header.size < Record::header_size() || header.size > header_.data.size - *nbytes_read) {
+      LOG(ERROR) << "invalid record in " << filename_;
+      return false;
+    }
+    return true;
+  };
+  if (!check_header()) {
+    return nullptr;
+  }
   std::unique_ptr<char[]> p;
   if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
     // Read until meeting a RECORD_SPLIT_END record.
@@ -259,16 +520,27 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
       }
       cur_size += bytes_to_read;
       *nbytes_read += header.size;
+      if (header_.data.size - *nbytes_read < Record::header_size()) {
+        LOG(ERROR) << "invalid record in " << filename_;
+        return nullptr;
+      }
       if (!Read(header_buf, Record::header_size())) {
         return nullptr;
       }
       header = RecordHeader(header_buf);
+      if (!check_header()) {
+        return nullptr;
+      }
     }
     if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
       LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
       return nullptr;
     }
     *nbytes_read += header.size;
+    if (buf.size() < Record::header_size() || RecordHeader(buf.data()).size != buf.size()) {
+      LOG(ERROR) << "invalid split record in " << filename_;
+      return nullptr;
+    }
     header = RecordHeader(buf.data());
     p.reset(new char[header.size]);
     memcpy(p.get(), buf.data(), buf.size());
@@ -282,7 +554,69 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
     }
     *nbytes_read += header.size;
   }
+  return CreateRecord(header, p.release(), true);
+}
+
+std::unique_ptr<Record> RecordFileReader::ReadRecordFromMappedFile(uint64_t* nbytes_read) {
+  char* data = mapped_file_ + header_.data.offset;
+  uint64_t pos = *nbytes_read;
+  RecordHeader header;
+  auto read_header = [&]() {
+    if (header_.data.size - pos < Record::header_size()) {
+      return false;
+    }
+    header = RecordHeader(data + pos);
+    return header.size >= Record::header_size() && header.size <= header_.data.size - pos;
+  };
+  if (!read_header()) {
+    LOG(ERROR) << "invalid record in " << filename_;
+    return nullptr;
+  }
+  if (header.type != SIMPLE_PERF_RECORD_SPLIT) {
+    *nbytes_read += header.size;
+    // The record refers to the mapped data, which lives as long as the reader.
+    return CreateRecord(header, data + pos, false);
+  }
+  // Read until meeting a RECORD_SPLIT_END record.
+  std::vector<char> buf;
+  while (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+    buf.insert(buf.end(), data + pos + Record::header_size(), data + pos + header.size);
+    pos += header.size;
+    if (!read_header()) {
+      LOG(ERROR) << "invalid record in " << filename_;
+      return nullptr;
+    }
+  }
+  if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
+    LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
+    return nullptr;
+  }
+  pos += header.size;
+  *nbytes_read = pos;
+  if (buf.size() < Record::header_size()) {
+    LOG(ERROR) << "invalid split record in " << filename_;
+    return nullptr;
+  }
+  header = RecordHeader(buf.data());
+  if (header.size != buf.size()) {
+    LOG(ERROR) << "invalid split record in " << filename_;
+    return nullptr;
+  }
+  char* p = new char[header.size];
+  memcpy(p, buf.data(), header.size);
+  return CreateRecord(header, p, true);
+}
 
+std::unique_ptr<Record> RecordFileReader::CreateRecord(const RecordHeader& header, char* p,
+                                                       bool own_binary) {
+  if (header.type == SIMPLE_PERF_RECORD_COMPRESSED_DATA &&
+      !CompressedDataRecord::IsValid(p, header.size)) {
+    LOG(ERROR) << "invalid compressed data in " << filename_;
+    if (own_binary) {
+      delete[] p;
+    }
+    return nullptr;
+  }
   const perf_event_attr* attr = &file_attrs_[0].attr;
   if (file_attrs_.size() > 1 && header.type < PERF_RECORD_USER_DEFINED_TYPE_START) {
     bool has_event_id = false;
@@ -290,12 +624,12 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
     if (header.type == PERF_RECORD_SAMPLE) {
       if (header.size > event_id_pos_in_sample_records_ + sizeof(uint64_t)) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + event_id_pos_in_sample_records_);
+        event_id = *reinterpret_cast<uint64_t*>(p + event_id_pos_in_sample_records_);
       }
     } else {
       if (header.size > event_id_reverse_pos_in_non_sample_records_) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + header.size - event_id_reverse_pos_in_non_sample_records_);
+        event_id = *reinterpret_cast<uint64_t*>(p + header.size - event_id_reverse_pos_in_non_sample_records_);
       }
     }
     if (has_event_id) {
@@ -305,7 +639,10 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
       }
     }
   }
-  return ReadRecordFromOwnedBuffer(*attr, header.type, p.release());
+  if (own_binary) {
+    return ReadRecordFromOwnedBuffer(*attr, header.type, p);
+  }
+  return ReadRecordFromBuffer(*attr, header.type, p);
 }
 
 bool RecordFileReader::Read(void* buf, size_t len) {
@@ -483,7 +820,8 @@ bool RecordFileReader::ReadMetaInfoFeature(std::unordered_map<std::string, std::
   return true;
 }
 
-void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
+void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree,
+                                                  std::vector<Dso*>* hit_dsos) {
   std::vector<BuildIdRecord> records = ReadBuildIdFeature();
   std::vector<std::pair<std::string, BuildId>> build_ids;
   for (auto& r : records) {
@@ -500,7 +838,11 @@ void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
     size_t read_pos = 0;
     while (ReadFileFeature(
         read_pos, &file_path, &file_type, &min_vaddr, &symbols, &dex_file_offsets)) {
-      thread_tree.AddDsoInfo(file_path, file_type, min_vaddr, &symbols, dex_file_offsets);
+      Dso* dso =
+          thread_tree.AddDsoInfo(file_path, file_type, min_vaddr, &symbols, dex_file_offsets);
+      if (hit_dsos != nullptr) {
+        hit_dsos->push_back(dso);
+      }
     }
   }
 }
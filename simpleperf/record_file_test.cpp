@@ -19,8 +19,10 @@
 #include <string.h>
 
 #include <memory>
+#include <thread>
 
 #include <android-base/file.h>
+#include <android-base/stringprintf.h>
 
 #include "environment.h"
 #include "event_attr.h"
@@ -148,3 +150,310 @@ TEST_F(RecordFileTest, write_meta_info_feature_section) {
   ASSERT_TRUE(reader->ReadMetaInfoFeature(&read_info_map));
   ASSERT_EQ(read_info_map, info_map);
 }
+
+TEST_F(RecordFileTest, write_record_data) {
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  AddEventType("cpu-clock");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  SampleRecord sample(*(attr_ids_[0].attr), attr_ids_[0].ids[0], 1, 2, 3, 4, 5, 6, {}, {}, 0);
+  std::vector<char> data(sample.Binary(), sample.Binary() + sample.size());
+  ASSERT_TRUE(writer->WriteRecordData(data.data()));
+  ASSERT_EQ(writer->GetDataSectionSize(), sample.size());
+  ASSERT_TRUE(writer->Close());
+
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  std::vector<std::unique_ptr<Record>> records = reader->DataSection();
+  ASSERT_EQ(1u, records.size());
+  CheckRecordEqual(sample, *records[0]);
+}
+
+TEST_F(RecordFileTest, compress_data_section) {
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  AddEventType("cpu-clock");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  // Use a small frame size to generate multiple frames.
+  ASSERT_TRUE(writer->EnableDataCompression(4096));
+  std::vector<std::unique_ptr<Record>> records;
+  for (int i = 0; i < 1000; ++i) {
+    records.emplace_back(new MmapRecord(*(attr_ids_[0].attr), true, i, i, 0x1000 * i, 0x1000,
+                                        0, "mmap_record_" + std::to_string(i),
+                                        attr_ids_[0].ids[0]));
+  }
+  // Add a record larger than 65535 bytes.
+  std::string kallsyms;
+  for (int i = 0; i < 10000; ++i) {
+    kallsyms += android::base::StringPrintf("%x t symbol_%d\n", i, i);
+  }
+  records.emplace_back(new KernelSymbolRecord(kallsyms));
+  ASSERT_GT(records.back()->size(), 65535u);
+  for (auto& r : records) {
+    ASSERT_TRUE(writer->WriteRecord(*r));
+  }
+
+  // Read data section through the writer.
+  size_t record_count = 0;
+  ASSERT_TRUE(writer->ReadDataSection([&](const Record* r) {
+    ASSERT_LT(record_count, records.size());
+    const Record* expected = records[record_count++].get();
+    CheckRecordEqual(*expected, *r);
+    ASSERT_EQ(0, memcmp(expected->Binary(), r->Binary(), r->size()));
+  }));
+  ASSERT_EQ(record_count, records.size());
+  ASSERT_LT(writer->GetDataSectionSize(), 65535u * 2);
+  ASSERT_TRUE(writer->Close());
+
+  // Read data section through the reader.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  std::vector<std::unique_ptr<Record>> read_records = reader->DataSection();
+  ASSERT_EQ(read_records.size(), records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    CheckRecordEqual(*records[i], *read_records[i]);
+    ASSERT_EQ(0, memcmp(records[i]->Binary(), read_records[i]->Binary(), records[i]->size()));
+  }
+}
+
+TEST_F(RecordFileTest, unsupported_data_compression) {
+  AddEventType("cpu-clock");
+  MmapRecord r(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000, 0x3000, "file",
+               attr_ids_[0].ids[0]);
+  auto write_file = [&](const std::string& method) {
+    std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(writer != nullptr);
+    ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+    ASSERT_TRUE(writer->EnableDataCompression());
+    ASSERT_TRUE(writer->WriteRecord(r));
+    ASSERT_TRUE(writer->BeginWriteFeatures(1));
+    ASSERT_TRUE(writer->WriteFeatureString(FEAT_DATA_COMPRESSION, method));
+    ASSERT_TRUE(writer->EndWriteFeatures());
+    ASSERT_TRUE(writer->Close());
+  };
+  write_file("zlib");
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  std::vector<std::unique_ptr<Record>> records = reader->DataSection();
+  ASSERT_EQ(records.size(), 1u);
+  CheckRecordEqual(r, *records[0]);
+  // A file compressed by an unknown method is refused, instead of being read as empty.
+  write_file("unknown");
+  ASSERT_TRUE(RecordFileReader::CreateInstance(tmpfile_.path) == nullptr);
+}
+
+TEST_F(RecordFileTest, seek_with_record_index) {
+  for (bool compress : {false, true}) {
+    std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(writer != nullptr);
+    attrs_.clear();
+    attr_ids_.clear();
+    AddEventType("cpu-clock");
+    ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+    if (compress) {
+      ASSERT_TRUE(writer->EnableDataCompression(4096));
+    }
+    const uint64_t record_count = RECORD_INDEX_INTERVAL * 3;
+    for (uint64_t i = 0; i < record_count; ++i) {
+      SampleRecord r(*(attr_ids_[0].attr), attr_ids_[0].ids[0], i, 1, 1, i * 10, 0, 1, {}, {}, 0);
+      ASSERT_TRUE(writer->WriteRecord(r));
+    }
+    ASSERT_TRUE(writer->ReadDataSection([](const Record*) {}));
+    ASSERT_TRUE(writer->BeginWriteFeatures(1));
+    ASSERT_TRUE(writer->WriteRecordIndexFeature());
+    ASSERT_TRUE(writer->EndWriteFeatures());
+    ASSERT_TRUE(writer->Close());
+
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(reader != nullptr);
+    std::vector<RecordIndexEntry> entries;
+    ASSERT_TRUE(reader->ReadRecordIndexFeature(&entries));
+    ASSERT_FALSE(entries.empty());
+    for (auto& entry : entries) {
+      ASSERT_GE(entry.record_id, RECORD_INDEX_INTERVAL);
+    }
+    std::unique_ptr<Record> record;
+    auto check_next_record = [&](uint64_t expected_id) {
+      ASSERT_TRUE(reader->ReadRecord(record));
+      ASSERT_TRUE(record != nullptr);
+      ASSERT_EQ(record->type(), PERF_RECORD_SAMPLE);
+      ASSERT_EQ(static_cast<SampleRecord*>(record.get())->ip_data.ip, expected_id);
+    };
+    for (uint64_t id : {record_count / 2, uint64_t(0), RECORD_INDEX_INTERVAL + 1, record_count - 1}) {
+      ASSERT_TRUE(reader->SeekToRecord(id));
+      check_next_record(id);
+    }
+    // Seek to the end of the data section.
+    ASSERT_TRUE(reader->SeekToRecord(record_count));
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record == nullptr);
+
+    // Records before the timestamp are skipped, and no records after it are skipped.
+    uint64_t timestamp = (record_count - 10) * 10;
+    ASSERT_TRUE(reader->SeekToTime(timestamp));
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record != nullptr);
+    ASSERT_LE(record->Timestamp(), timestamp);
+    ASSERT_GE(record->Timestamp(), (record_count - RECORD_INDEX_INTERVAL) * 10);
+  }
+}
+
+TEST_F(RecordFileTest, follow_file_being_written) {
+  AddEventType("cpu-cycles");
+  for (bool compress : {false, true}) {
+    std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(writer != nullptr);
+    ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+    if (compress) {
+      ASSERT_TRUE(writer->EnableDataCompression());
+    }
+    MmapRecord r1(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000, 0x3000, "file1",
+                  attr_ids_[0].ids[0]);
+    MmapRecord r2(*(attr_ids_[0].attr), true, 1, 1, 0x4000, 0x2000, 0x3000, "file2",
+                  attr_ids_[0].ids[0]);
+    ASSERT_TRUE(writer->WriteRecord(r1));
+    ASSERT_TRUE(writer->SyncDataSection());
+
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(reader != nullptr);
+    // A synced file only has the being_written bit, without a feature section.
+    const FileHeader& header = reader->FileHeader();
+    ASSERT_NE(header.features[FEAT_BEING_WRITTEN / 8] & (1 << (FEAT_BEING_WRITTEN % 8)), 0);
+    ASSERT_TRUE(reader->FeatureSectionDescriptors().empty());
+    std::unique_ptr<Record> record;
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record != nullptr);
+    CheckRecordEqual(r1, *record);
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record == nullptr);
+
+    // Records aren't visible until the next sync.
+    ASSERT_TRUE(writer->WriteRecord(r2));
+    bool finished;
+    ASSERT_TRUE(reader->RefreshDataSection(&finished));
+    ASSERT_FALSE(finished);
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record == nullptr);
+    ASSERT_TRUE(writer->SyncDataSection());
+    ASSERT_TRUE(reader->RefreshDataSection(&finished));
+    ASSERT_FALSE(finished);
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record != nullptr);
+    CheckRecordEqual(r2, *record);
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record == nullptr);
+
+    // The reader stops following after the writer closes the file.
+    ASSERT_TRUE(writer->BeginWriteFeatures(1));
+    ASSERT_TRUE(writer->WriteMetaInfoFeature({{"key", "value"}}));
+    ASSERT_TRUE(writer->EndWriteFeatures());
+    ASSERT_TRUE(writer->Close());
+    ASSERT_TRUE(reader->RefreshDataSection(&finished));
+    ASSERT_TRUE(finished);
+    ASSERT_TRUE(reader->HasFeature(FEAT_META_INFO));
+    ASSERT_TRUE(reader->ReadRecord(record));
+    ASSERT_TRUE(record == nullptr);
+  }
+}
+
+TEST_F(RecordFileTest, read_file_while_syncing) {
+  AddEventType("cpu-cycles");
+  const size_t record_count = 1000;
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  ASSERT_TRUE(writer->SyncDataSection());
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+
+  bool write_success = true;
+  std::thread writer_thread([&]() {
+    for (size_t i = 0; i < record_count && write_success; ++i) {
+      MmapRecord r(*(attr_ids_[0].attr), true, i, i, 0x1000, 0x2000, 0x3000, "file",
+                   attr_ids_[0].ids[0]);
+      write_success = writer->WriteRecord(r);
+      if (write_success && i % 10 == 0) {
+        write_success = writer->SyncDataSection();
+      }
+    }
+    write_success = write_success && writer->BeginWriteFeatures(1) &&
+                    writer->WriteMetaInfoFeature({{"key", "value"}}) &&
+                    writer->EndWriteFeatures() && writer->Close();
+  });
+  // Records are read in order while the writer keeps syncing, until it closes the file.
+  size_t read_count = 0;
+  bool finished = false;
+  while (!finished) {
+    ASSERT_TRUE(reader->RefreshDataSection(&finished));
+    std::unique_ptr<Record> record;
+    while (true) {
+      ASSERT_TRUE(reader->ReadRecord(record));
+      if (record == nullptr) {
+        break;
+      }
+      ASSERT_EQ(record->type(), PERF_RECORD_MMAP);
+      ASSERT_EQ(static_cast<MmapRecord*>(record.get())->data->pid, read_count);
+      read_count++;
+    }
+  }
+  writer_thread.join();
+  ASSERT_TRUE(write_success);
+  ASSERT_EQ(read_count, record_count);
+  ASSERT_TRUE(reader->HasFeature(FEAT_META_INFO));
+}
+
+TEST_F(RecordFileTest, read_file_without_features) {
+  AddEventType("cpu-cycles");
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+  MmapRecord r(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000, 0x3000, "file",
+               attr_ids_[0].ids[0]);
+  ASSERT_TRUE(writer->WriteRecord(r));
+  ASSERT_TRUE(writer->Close());
+
+  // A closed file without features isn't treated as being written.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  ASSERT_TRUE(reader->FeatureSectionDescriptors().empty());
+  bool finished;
+  ASSERT_TRUE(reader->RefreshDataSection(&finished));
+  ASSERT_TRUE(finished);
+  std::vector<std::unique_ptr<Record>> records = reader->DataSection();
+  ASSERT_EQ(records.size(), 1u);
+  CheckRecordEqual(r, *records[0]);
+}
+
+TEST_F(RecordFileTest, read_invalid_data_section) {
+  AddEventType("cpu-cycles");
+  MmapRecord r(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000, 0x3000, "file1",
+               attr_ids_[0].ids[0]);
+  // Corrupt [value_size] bytes at [offset] of the first record in the data section, then check
+  // both the writer and the reader fail to read the data section.
+  auto check = [&](bool compress, size_t offset, uint32_t value, size_t value_size) {
+    std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(writer != nullptr);
+    ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+    if (compress) {
+      ASSERT_TRUE(writer->EnableDataCompression());
+    }
+    ASSERT_TRUE(writer->WriteRecord(r));
+    ASSERT_TRUE(writer->SyncDataSection());
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(reader != nullptr);
+    uint64_t data_offset = reader->FileHeader().data.offset;
+    reader.reset();
+    ASSERT_EQ(pwrite(tmpfile_.fd, &value, value_size, data_offset + offset),
+              static_cast<ssize_t>(value_size));
+    ASSERT_FALSE(writer->ReadDataSection([](const Record*) {}));
+    ASSERT_TRUE(writer->Close());
+    reader = RecordFileReader::CreateInstance(tmpfile_.path);
+    ASSERT_TRUE(reader != nullptr);
+    ASSERT_FALSE(reader->ReadDataSection([](std::unique_ptr<Record>) { return true; }));
+  };
+  // The record size is bigger than the data section.
+  check(false, 6, 0xfff0, 2);
+  check(true, 6, 0xfff0, 2);
+  // The compressed size doesn't match the record size.
+  check(true, 12, 1, 4);
+}
@@ -61,10 +61,14 @@ RecordFileWriter::RecordFileWriter(const std::string& filename, FILE* fp)
       data_section_offset_(0),
       data_section_size_(0),
       feature_section_offset_(0),
-      feature_count_(0) {
+      feature_count_(0),
+      compress_data_(false),
+      compression_frame_size_(0),
+      stop_compression_thread_(false) {
 }
 
 RecordFileWriter::~RecordFileWriter() {
+  StopCompressionThread();
   if (record_fp_ != nullptr) {
     fclose(record_fp_);
     unlink(filename_.c_str());
@@ -122,7 +126,25 @@ bool RecordFileWriter::WriteAttrSection(const std::vector<EventAttrWithId>& attr
   return true;
 }
 
+bool RecordFileWriter::EnableDataCompression(size_t frame_size) {
+  if (compress_data_) {
+    return true;
+  }
+  compress_data_ = true;
+  compression_frame_size_ = frame_size;
+  current_frame_.reset(new CompressionFrame);
+  compression_thread_ = std::thread(&RecordFileWriter::RunCompressionThread, this);
+  return true;
+}
+
 bool RecordFileWriter::WriteRecord(const Record& record) {
+  if (compress_data_) {
+    return AddToCompressionFrame(record.Binary(), record.size());
+  }
+  return WriteRecordToDataSection(record);
+}
+
+bool RecordFileWriter::WriteRecordToDataSection(const Record& record) {
   // linux-tools-perf only accepts records with size <= 65535 bytes. To make
   // perf.data generated by simpleperf be able to be parsed by linux-tools-perf,
   // Split simpleperf custom records which are > 65535 into a bunch of
@@ -160,6 +182,105 @@ bool RecordFileWriter::WriteRecord(const Record& record) {
   return WriteData(header_buf, Record::header_size());
 }
 
+bool RecordFileWriter::WriteRecordData(const char* data) {
+  perf_event_header header;
+  memcpy(&header, data, sizeof(header));
+  if (compress_data_) {
+    return AddToCompressionFrame(data, header.size);
+  }
+  return WriteData(data, header.size);
+}
+
+bool RecordFileWriter::AddToCompressionFrame(const char* data, size_t size) {
+  std::vector<char>& frame_data = current_frame_->data;
+  frame_data.insert(frame_data.end(), data, data + size);
+  if (frame_data.size() < compression_frame_size_) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(compression_mutex_);
+    frames_to_compress_.push(current_frame_.get());
+    pending_frames_.push_back(std::move(current_frame_));
+  }
+  compression_start_cond_.notify_one();
+  current_frame_.reset(new CompressionFrame);
+  return WriteCompressedFrames(false);
+}
+
+// Write compressed frames in order. If wait_all is true, also compress the current frame, and
+// wait until all frames are written. Otherwise, write finished frames, and only wait when there
+// are too many pending frames.
+bool RecordFileWriter::WriteCompressedFrames(bool wait_all) {
+  if (wait_all && !current_frame_->data.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(compression_mutex_);
+      frames_to_compress_.push(current_frame_.get());
+      pending_frames_.push_back(std::move(current_frame_));
+    }
+    compression_start_cond_.notify_one();
+    current_frame_.reset(new CompressionFrame);
+  }
+  while (true) {
+    std::unique_ptr<CompressionFrame> frame;
+    {
+      std::unique_lock<std::mutex> lock(compression_mutex_);
+      if (pending_frames_.empty()) {
+        break;
+      }
+      if (wait_all || pending_frames_.size() > MAX_PENDING_COMPRESSION_FRAMES) {
+        compression_finish_cond_.wait(lock, [&]() { return pending_frames_.front()->finished; });
+      } else if (!pending_frames_.front()->finished) {
+        break;
+      }
+      frame = std::move(pending_frames_.front());
+      pending_frames_.pop_front();
+    }
+    if (!frame->result) {
+      LOG(ERROR) << "failed to compress records";
+      return false;
+    }
+    CompressedDataRecord r(frame->compressed_data, frame->data.size());
+    if (!WriteRecordToDataSection(r)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void RecordFileWriter::RunCompressionThread() {
+  while (true) {
+    CompressionFrame* frame;
+    {
+      std::unique_lock<std::mutex> lock(compression_mutex_);
+      compression_start_cond_.wait(
+          lock, [&]() { return stop_compression_thread_ || !frames_to_compress_.empty(); });
+      if (frames_to_compress_.empty()) {
+        return;
+      }
+      frame = frames_to_compress_.front();
+      frames_to_compress_.pop();
+    }
+    bool result = ZlibCompress(frame->data.data(), frame->data.size(), &frame->compressed_data);
+    {
+      std::lock_guard<std::mutex> lock(compression_mutex_);
+      frame->result = result;
+      frame->finished = true;
+    }
+    compression_finish_cond_.notify_one();
+  }
+}
+
+void RecordFileWriter::StopCompressionThread() {
+  if (compression_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(compression_mutex_);
+      stop_compression_thread_ = true;
+    }
+    compression_start_cond_.notify_one();
+    compression_thread_.join();
+  }
+}
+
 bool RecordFileWriter::WriteData(const void* buf, size_t len) {
   if (!Write(buf, len)) {
     return false;
@@ -185,17 +306,43 @@ bool RecordFileWriter::Read(void* buf, size_t len) {
 }
 
 bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>& callback) {
+  if (compress_data_ && !WriteCompressedFrames(true)) {
+    return false;
+  }
   if (fseek(record_fp_, data_section_offset_, SEEK_SET) == -1) {
     PLOG(ERROR) << "fseek() failed";
     return false;
   }
   std::vector<char> record_buf(512);
+  // Data of SPLIT records, merged into one record after meeting a SPLIT_END record.
+  std::vector<char> split_buf;
+  std::vector<char> frame_data;
   uint64_t read_pos = 0;
+  // Build the record index while reading records.
+  record_index_.clear();
+  uint64_t record_id = 0;
+  uint64_t max_time = 0;
+  auto process_record = [&](const Record* r) {
+    callback(r);
+    record_id++;
+    max_time = std::max(max_time, r->Timestamp());
+  };
   while (read_pos < data_section_size_) {
-    if (!Read(record_buf.data(), Record::header_size())) {
+    if (split_buf.empty() &&
+        record_id >= (record_index_.empty() ? 0 : record_index_.back().record_id) +
+                         RECORD_INDEX_INTERVAL) {
+      record_index_.push_back(RecordIndexEntry{record_id, read_pos, max_time});
+    }
+    if (data_section_size_ - read_pos < Record::header_size() ||
+        !Read(record_buf.data(), Record::header_size())) {
+      LOG(ERROR) << "invalid data section in " << filename_;
       return false;
     }
     RecordHeader header(record_buf.data());
+    if (header.size < Record::header_size() || header.size > data_section_size_ - read_pos) {
+      LOG(ERROR) << "invalid record in " << filename_;
+      return false;
+    }
     if (record_buf.size() < header.size) {
       record_buf.resize(header.size);
     }
@@ -203,8 +350,50 @@ bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>&
       return false;
     }
     read_pos += header.size;
-    std::unique_ptr<Record> r = ReadRecordFromBuffer(event_attr_, header.type, record_buf.data());
-    callback(r.get());
+    char* data = record_buf.data();
+    if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+      split_buf.insert(split_buf.end(), data + Record::header_size(), data + header.size);
+      continue;
+    }
+    if (header.type == SIMPLE_PERF_RECORD_SPLIT_END) {
+      if (split_buf.size() < Record::header_size() ||
+          RecordHeader(split_buf.data()).size != split_buf.size()) {
+        LOG(ERROR) << "invalid split record in " << filename_;
+        return false;
+      }
+      record_buf.swap(split_buf);
+      split_buf.clear();
+      data = record_buf.data();
+      header = RecordHeader(data);
+    }
+    if (header.type == SIMPLE_PERF_RECORD_COMPRESSED_DATA &&
+        !CompressedDataRecord::IsValid(data, header.size)) {
+      LOG(ERROR) << "invalid compressed data in " << filename_;
+      return false;
+    }
+    std::unique_ptr<Record> r = ReadRecordFromBuffer(event_attr_, header.type, data);
+    if (r->type() == SIMPLE_PERF_RECORD_COMPRESSED_DATA) {
+      if (!static_cast<CompressedDataRecord*>(r.get())->Decompress(&frame_data)) {
+        return false;
+      }
+      for (size_t pos = 0; pos < frame_data.size();) {
+        size_t left_size = frame_data.size() - pos;
+        RecordHeader frame_header;
+        if (left_size >= Record::header_size()) {
+          frame_header = RecordHeader(&frame_data[pos]);
+        }
+        if (frame_header.size < Record::header_size() || frame_header.size > left_size) {
+          LOG(ERROR) << "invalid record in compressed data of " << filename_;
+          return false;
+        }
+        std::unique_ptr<Record> frame_r =
+            ReadRecordFromBuffer(event_attr_, frame_header.type, &frame_data[pos]);
+        process_record(frame_r.get());
+        pos += frame_header.size;
+      }
+    } else {
+      process_record(r.get());
+    }
   }
   return true;
 }
@@ -220,6 +409,9 @@ bool RecordFileWriter::GetFilePos(uint64_t* file_pos) {
 }
 
 bool RecordFileWriter::BeginWriteFeatures(size_t feature_count) {
+  if (compress_data_ && !WriteCompressedFrames(true)) {
+    return false;
+  }
   feature_section_offset_ = data_section_offset_ + data_section_size_;
   feature_count_ = feature_count;
   uint64_t feature_header_size = feature_count * sizeof(SectionDesc);
@@ -378,6 +570,15 @@ bool RecordFileWriter::WriteMetaInfoFeature(
   return WriteFeature(FEAT_META_INFO, buf);
 }
 
+bool RecordFileWriter::WriteRecordIndexFeature() {
+  std::vector<char> buf(2 * sizeof(uint32_t) + record_index_.size() * sizeof(RecordIndexEntry));
+  char* p = buf.data();
+  MoveToBinaryFormat(RECORD_INDEX_VERSION, p);
+  MoveToBinaryFormat(static_cast<uint32_t>(sizeof(RecordIndexEntry)), p);
+  MoveToBinaryFormat(record_index_.data(), record_index_.size(), p);
+  return WriteFeature(FEAT_RECORD_INDEX, buf);
+}
+
 bool RecordFileWriter::WriteFeature(int feature, const std::vector<char>& data) {
   return WriteFeatureBegin(feature) && Write(data.data(), data.size()) && WriteFeatureEnd(feature);
 }
@@ -423,7 +624,7 @@ bool RecordFileWriter::EndWriteFeatures() {
   return true;
 }
 
-bool RecordFileWriter::WriteFileHeader() {
+bool RecordFileWriter::WriteFileHeader(bool being_written) {
   FileHeader header;
   memset(&header, 0, sizeof(header));
   memcpy(header.magic, PERF_MAGIC, sizeof(header.magic));
@@ -433,10 +634,14 @@ bool RecordFileWriter::WriteFileHeader() {
   header.attrs.size = attr_section_size_;
   header.data.offset = data_section_offset_;
   header.data.size = data_section_size_;
-  for (const auto& pair : features_) {
-    int i = pair.first / 8;
-    int j = pair.first % 8;
-    header.features[i] |= (1 << j);
+  if (being_written) {
+    header.features[FEAT_BEING_WRITTEN / 8] |= (1 << (FEAT_BEING_WRITTEN % 8));
+  } else {
+    for (const auto& pair : features_) {
+      int i = pair.first / 8;
+      int j = pair.first % 8;
+      header.features[i] |= (1 << j);
+    }
   }
 
   if (fseek(record_fp_, 0, SEEK_SET) == -1) {
@@ -448,13 +653,41 @@ bool RecordFileWriter::WriteFileHeader() {
   return true;
 }
 
+bool RecordFileWriter::SyncDataSection() {
+  if (compress_data_ && !WriteCompressedFrames(true)) {
+    return false;
+  }
+  // Flush records before the header, so readers never see a data section size covering records
+  // not in the file.
+  if (fflush(record_fp_) != 0) {
+    PLOG(ERROR) << "failed to flush record file '" << filename_ << "'";
+    return false;
+  }
+  if (!WriteFileHeader(true)) {
+    return false;
+  }
+  if (fflush(record_fp_) != 0) {
+    PLOG(ERROR) << "failed to flush record file '" << filename_ << "'";
+    return false;
+  }
+  if (fseek(record_fp_, data_section_offset_ + data_section_size_, SEEK_SET) == -1) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  return true;
+}
+
 bool RecordFileWriter::Close() {
   CHECK(record_fp_ != nullptr);
   bool result = true;
+  if (compress_data_ && !WriteCompressedFrames(true)) {
+    result = false;
+  }
+  StopCompressionThread();
 
   // Write file header. We gather enough information to write file header only after
   // writing data section and feature section.
-  if (!WriteFileHeader()) {
+  if (!WriteFileHeader(false)) {
     result = false;
   }
 
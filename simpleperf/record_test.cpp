@@ -145,3 +145,15 @@ TEST_F(RecordTest, CommRecord) {
   ASSERT_EQ(r.sample_id.time_data.time, 4u);
   CheckRecordMatchBinary(r);
 }
+
+TEST_F(RecordTest, KernelSymbolIndexRecordMatchBinary) {
+  std::vector<char> data = {'a', 'b', 'c', 'd', 'e'};
+  KernelSymbolIndexRecord r(data, 3);
+  CheckRecordMatchBinary(r);
+  std::vector<std::unique_ptr<Record>> records =
+      ReadRecordsFromBuffer(event_attr, r.BinaryForTestingOnly(), r.size());
+  ASSERT_EQ(records.size(), 1u);
+  auto& r2 = *static_cast<KernelSymbolIndexRecord*>(records[0].get());
+  ASSERT_EQ(r2.symbol_count, 3u);
+  ASSERT_EQ(std::vector<char>(r2.data, r2.data + r2.data_size), data);
+}
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <string.h>
+
 #include <memory>
+#include <unordered_map>
 #include <utility>
 
 #include <android-base/logging.h>
@@ -25,6 +28,7 @@
 #include "event_attr.h"
 #include "event_type.h"
 #include "record_file.h"
+#include "SampleComparator.h"
 #include "thread_tree.h"
 #include "tracing.h"
 #include "utils.h"
@@ -95,6 +99,50 @@ struct FeatureSection {
   uint32_t data_size;
 };
 
+// Below structures are used to read samples in batches. Strings are referred by ids, and can be
+// read by GetStringTable().
+struct SampleInBatch {
+  uint64_t ip;
+  uint64_t time;
+  uint64_t period;
+  uint32_t pid;
+  uint32_t tid;
+  uint32_t cpu;
+  uint32_t in_kernel;
+  uint32_t thread_comm_id;
+  uint32_t event_name_id;
+  // Frames of the sample are frames[frame_start, frame_start + frame_count) in the batch. The
+  // first frame is for the sample ip, the others are for the callchain.
+  uint32_t frame_start;
+  uint32_t frame_count;
+};
+
+struct FrameInBatch {
+  uint64_t ip;
+  uint64_t vaddr_in_file;
+  uint64_t symbol_addr;
+  uint64_t symbol_len;
+  uint32_t dso_name_id;
+  uint32_t symbol_name_id;
+};
+
+// Buffers are provided by the caller.
+struct SampleBatch {
+  SampleInBatch* samples;
+  uint32_t sample_capacity;
+  uint32_t sample_count;
+  FrameInBatch* frames;
+  uint32_t frame_capacity;
+  uint32_t frame_count;
+};
+
+struct StringTable {
+  // Strings with ids in [start_id, start_id + string_count), each ending with '\0'.
+  const char* data;
+  uint32_t data_size;
+  uint32_t string_count;
+};
+
 // Create a new instance,
 // pass the instance to the other functions below.
 ReportLib* CreateReportLib() EXPORT;
@@ -104,6 +152,7 @@ void DestroyReportLib(ReportLib* report_lib) EXPORT;
 // verbose, debug, info, warning, error, fatal.
 bool SetLogSeverity(ReportLib* report_lib, const char* log_level) EXPORT;
 bool SetSymfs(ReportLib* report_lib, const char* symfs_dir) EXPORT;
+bool SetSymbolCacheDir(ReportLib* report_lib, const char* cache_dir) EXPORT;
 bool SetRecordFile(ReportLib* report_lib, const char* record_file) EXPORT;
 bool SetKallsymsFile(ReportLib* report_lib, const char* kallsyms_file) EXPORT;
 void ShowIpForUnknownSymbol(ReportLib* report_lib) EXPORT;
@@ -115,6 +164,17 @@ SymbolEntry* GetSymbolOfCurrentSample(ReportLib* report_lib) EXPORT;
 CallChain* GetCallChainOfCurrentSample(ReportLib* report_lib) EXPORT;
 const char* GetTracingDataOfCurrentSample(ReportLib* report_lib) EXPORT;
 
+// Read next samples into [batch], which avoids calling the functions above for each sample.
+// Return the number of samples read, 0 if there are no more samples, or -1 if the next sample
+// has more frames than batch->frame_capacity.
+int32_t GetNextSampleBatch(ReportLib* report_lib, SampleBatch* batch) EXPORT;
+// Return strings with ids >= start_id. Ids of strings never change.
+StringTable* GetStringTable(ReportLib* report_lib, uint32_t start_id) EXPORT;
+// Used to read a record file still being written by `simpleperf record --sync-interval`. After
+// running out of samples, call it to read samples recorded since then. Return 1 if more samples
+// may be recorded, 0 if recording has finished, or -1 on error.
+int32_t RefreshRecordFile(ReportLib* report_lib) EXPORT;
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) EXPORT;
 FeatureSection* GetFeatureSection(ReportLib* report_lib, const char* feature_name) EXPORT;
 }
@@ -137,6 +197,7 @@ class ReportLib {
             new android::base::ScopedLogSeverity(android::base::INFO)),
         record_filename_("perf.data"),
         current_thread_(nullptr),
+        current_sample_pending_(false),
         trace_offcpu_(false),
         show_art_frames_(false) {
   }
@@ -144,6 +205,7 @@ class ReportLib {
   bool SetLogSeverity(const char* log_level);
 
   bool SetSymfs(const char* symfs_dir) { return Dso::SetSymFsDir(symfs_dir); }
+  bool SetSymbolCacheDir(const char* cache_dir) { return Dso::SetSymbolCacheDir(cache_dir); }
 
   bool SetRecordFile(const char* record_file) {
     record_filename_ = record_file;
@@ -160,6 +222,9 @@ class ReportLib {
   SymbolEntry* GetSymbolOfCurrentSample() { return current_symbol_; }
   CallChain* GetCallChainOfCurrentSample() { return &current_callchain_; }
   const char* GetTracingDataOfCurrentSample() { return current_tracing_data_; }
+  int32_t GetNextSampleBatch(SampleBatch* batch);
+  StringTable* GetStringTable(uint32_t start_id);
+  int32_t RefreshRecordFile();
 
   const char* GetBuildIdForPath(const char* path);
   FeatureSection* GetFeatureSection(const char* feature_name);
@@ -171,6 +236,7 @@ class ReportLib {
 
   bool OpenRecordFileIfNecessary();
   Mapping* AddMapping(const MapEntry& map);
+  uint32_t GetStringId(const char* s);
 
   std::unique_ptr<android::base::ScopedLogSeverity> log_severity_;
   std::string record_filename_;
@@ -183,6 +249,8 @@ class ReportLib {
   SymbolEntry* current_symbol_;
   CallChain current_callchain_;
   const char* current_tracing_data_;
+  // Set when the current sample didn't fit in a batch, so it is returned by the next call.
+  bool current_sample_pending_;
   std::vector<std::unique_ptr<Mapping>> current_mappings_;
   std::vector<CallChainEntry> callchain_entries_;
   std::string build_id_string_;
@@ -194,6 +262,13 @@ class ReportLib {
   std::vector<char> feature_section_data_;
   bool show_art_frames_;
   std::unique_ptr<Tracing> tracing_;
+
+  // Strings used in sample batches.
+  StringIdMap string_ids_;
+  // Offset of each string in string_data_, indexed by string id.
+  std::vector<uint32_t> string_offsets_;
+  std::vector<char> string_data_;
+  StringTable string_table_;
 };
 
 bool ReportLib::SetLogSeverity(const char* log_level) {
@@ -242,6 +317,10 @@ bool ReportLib::OpenRecordFileIfNecessary() {
 }
 
 Sample* ReportLib::GetNextSample() {
+  if (current_sample_pending_) {
+    current_sample_pending_ = false;
+    return &current_sample_;
+  }
   if (!OpenRecordFileIfNecessary()) {
     return nullptr;
   }
@@ -354,6 +433,82 @@ void ReportLib::SetCurrentSample() {
   }
 }
 
+int32_t ReportLib::GetNextSampleBatch(SampleBatch* batch) {
+  batch->sample_count = 0;
+  batch->frame_count = 0;
+  while (batch->sample_count < batch->sample_capacity) {
+    if (GetNextSample() == nullptr) {
+      break;
+    }
+    // callchain_entries_ has the sample ip as the first entry.
+    uint32_t frame_count = callchain_entries_.size();
+    if (frame_count > batch->frame_capacity - batch->frame_count) {
+      current_sample_pending_ = true;
+      if (batch->sample_count == 0) {
+        return -1;
+      }
+      break;
+    }
+    SampleInBatch& sample = batch->samples[batch->sample_count++];
+    sample.ip = current_sample_.ip;
+    sample.time = current_sample_.time;
+    sample.period = current_sample_.period;
+    sample.pid = current_sample_.pid;
+    sample.tid = current_sample_.tid;
+    sample.cpu = current_sample_.cpu;
+    sample.in_kernel = current_sample_.in_kernel;
+    sample.thread_comm_id = GetStringId(current_sample_.thread_comm);
+    sample.event_name_id = GetStringId(current_event_.name);
+    sample.frame_start = batch->frame_count;
+    sample.frame_count = frame_count;
+    for (const CallChainEntry& entry : callchain_entries_) {
+      FrameInBatch& frame = batch->frames[batch->frame_count++];
+      frame.ip = entry.ip;
+      frame.vaddr_in_file = entry.symbol.vaddr_in_file;
+      frame.symbol_addr = entry.symbol.symbol_addr;
+      frame.symbol_len = entry.symbol.symbol_len;
+      frame.dso_name_id = GetStringId(entry.symbol.dso_name);
+      frame.symbol_name_id = GetStringId(entry.symbol.symbol_name);
+    }
+  }
+  return batch->sample_count;
+}
+
+uint32_t ReportLib::GetStringId(const char* s) {
+  uint32_t id = static_cast<uint32_t>(string_ids_.GetId(s));
+  if (id == string_offsets_.size()) {
+    // A new string.
+    string_offsets_.push_back(string_data_.size());
+    string_data_.insert(string_data_.end(), s, s + strlen(s) + 1);
+  }
+  return id;
+}
+
+StringTable* ReportLib::GetStringTable(uint32_t start_id) {
+  if (start_id >= string_offsets_.size()) {
+    string_table_.data = nullptr;
+    string_table_.data_size = 0;
+    string_table_.string_count = 0;
+  } else {
+    uint32_t offset = string_offsets_[start_id];
+    string_table_.data = string_data_.data() + offset;
+    string_table_.data_size = string_data_.size() - offset;
+    string_table_.string_count = string_offsets_.size() - start_id;
+  }
+  return &string_table_;
+}
+
+int32_t ReportLib::RefreshRecordFile() {
+  if (!OpenRecordFileIfNecessary()) {
+    return -1;
+  }
+  bool finished;
+  if (!record_file_reader_->RefreshDataSection(&finished)) {
+    return -1;
+  }
+  return finished ? 0 : 1;
+}
+
 const EventInfo* ReportLib::FindEventOfCurrentSample() {
   if (events_.empty()) {
     CreateEvents();
@@ -457,6 +612,10 @@ bool SetSymfs(ReportLib* report_lib, const char* symfs_dir) {
   return report_lib->SetSymfs(symfs_dir);
 }
 
+bool SetSymbolCacheDir(ReportLib* report_lib, const char* cache_dir) {
+  return report_lib->SetSymbolCacheDir(cache_dir);
+}
+
 bool SetRecordFile(ReportLib* report_lib, const char* record_file) {
   return report_lib->SetRecordFile(record_file);
 }
@@ -493,6 +652,18 @@ const char* GetTracingDataOfCurrentSample(ReportLib* report_lib) {
   return report_lib->GetTracingDataOfCurrentSample();
 }
 
+int32_t GetNextSampleBatch(ReportLib* report_lib, SampleBatch* batch) {
+  return report_lib->GetNextSampleBatch(batch);
+}
+
+StringTable* GetStringTable(ReportLib* report_lib, uint32_t start_id) {
+  return report_lib->GetStringTable(start_id);
+}
+
+int32_t RefreshRecordFile(ReportLib* report_lib) {
+  return report_lib->RefreshRecordFile();
+}
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) {
   return report_lib->GetBuildIdForPath(path);
 }
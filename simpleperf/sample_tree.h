@@ -17,7 +17,10 @@
 #ifndef SIMPLE_PERF_SAMPLE_TREE_H_
 #define SIMPLE_PERF_SAMPLE_TREE_H_
 
+#include <algorithm>
+#include <set>
 #include <unordered_map>
+#include <vector>
 
 #include "callchain.h"
 #include "OfflineUnwinder.h"
@@ -52,6 +55,133 @@ using namespace simpleperf;
 // 3. At last, the sorted SampleTree is passed to SampleTreeDisplayer, which
 //    displays each sample in the SampleTree.
 
+// SampleSet stores samples that are different from each other under a SampleComparator. If all
+// compare functions have key functions, samples are aggregated in an open addressing hash table
+// by their keys, which avoids calling compare functions on each lookup. Otherwise samples are
+// stored in a std::set.
+template <typename EntryT>
+class SampleSet {
+ public:
+  explicit SampleSet(const SampleComparator<EntryT>& comparator)
+      : comparator_(comparator),
+        set_(comparator),
+        use_hash_table_(comparator.HasKeyFunctions()),
+        key_count_(comparator.KeyCount()),
+        keys_buf_(key_count_),
+        sample_count_(0) {}
+
+  // Return the sample that is the same as [sample], or nullptr if not found.
+  EntryT* Find(const EntryT* sample) {
+    if (!use_hash_table_) {
+      auto it = set_.find(const_cast<EntryT*>(sample));
+      return it == set_.end() ? nullptr : *it;
+    }
+    uint64_t hash = GetKeysAndHash(sample);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; !slots_.empty() && slots_[i].sample != nullptr;
+         i = (i + 1) & mask) {
+      if (slots_[i].hash == hash && MatchKeys(i)) {
+        return slots_[i].sample;
+      }
+    }
+    return nullptr;
+  }
+
+  // Insert a sample not in the set.
+  void Insert(EntryT* sample) {
+    if (!use_hash_table_) {
+      set_.insert(sample);
+      return;
+    }
+    if ((sample_count_ + 1) * 4 > slots_.size() * 3) {
+      Rehash(slots_.empty() ? INITIAL_SLOT_COUNT : slots_.size() * 2);
+    }
+    uint64_t hash = GetKeysAndHash(sample);
+    InsertToSlot(sample, hash, keys_buf_.data());
+    samples_.push_back(sample);
+  }
+
+  // Return samples in comparator order if not using the hash table, otherwise in insertion order.
+  std::vector<EntryT*> GetSamples() const {
+    if (!use_hash_table_) {
+      return std::vector<EntryT*>(set_.begin(), set_.end());
+    }
+    return samples_;
+  }
+
+  size_t size() const { return use_hash_table_ ? sample_count_ : set_.size(); }
+
+  void clear() {
+    set_.clear();
+    slots_.clear();
+    keys_.clear();
+    samples_.clear();
+    sample_count_ = 0;
+  }
+
+ private:
+  static constexpr size_t INITIAL_SLOT_COUNT = 256;
+
+  struct Slot {
+    EntryT* sample = nullptr;
+    uint64_t hash = 0;
+  };
+
+  uint64_t GetKeysAndHash(const EntryT* sample) {
+    comparator_.GetKeys(sample, &string_ids_, keys_buf_.data());
+    uint64_t hash = 0;
+    for (uint64_t key : keys_buf_) {
+      hash = (hash ^ key) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 32;
+    }
+    return hash;
+  }
+
+  bool MatchKeys(size_t slot) const {
+    const uint64_t* keys = keys_.data() + slot * key_count_;
+    return std::equal(keys_buf_.begin(), keys_buf_.end(), keys);
+  }
+
+  void InsertToSlot(EntryT* sample, uint64_t hash, const uint64_t* keys) {
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i].sample != nullptr) {
+      i = (i + 1) & mask;
+    }
+    slots_[i].sample = sample;
+    slots_[i].hash = hash;
+    std::copy(keys, keys + key_count_, keys_.begin() + i * key_count_);
+    sample_count_++;
+  }
+
+  void Rehash(size_t slot_count) {
+    std::vector<Slot> old_slots(slot_count);
+    std::vector<uint64_t> old_keys(slot_count * key_count_);
+    old_slots.swap(slots_);
+    old_keys.swap(keys_);
+    sample_count_ = 0;
+    for (size_t i = 0; i < old_slots.size(); ++i) {
+      if (old_slots[i].sample != nullptr) {
+        InsertToSlot(old_slots[i].sample, old_slots[i].hash, old_keys.data() + i * key_count_);
+      }
+    }
+  }
+
+  const SampleComparator<EntryT> comparator_;
+  std::set<EntryT*, SampleComparator<EntryT>> set_;
+
+  const bool use_hash_table_;
+  const size_t key_count_;
+  StringIdMap string_ids_;
+  // Keys of the sample being looked up or inserted.
+  std::vector<uint64_t> keys_buf_;
+  // Slot count is a power of two. Keys of slot i are in keys_[i * key_count_].
+  std::vector<Slot> slots_;
+  std::vector<uint64_t> keys_;
+  std::vector<EntryT*> samples_;
+  size_t sample_count_;
+};
+
 template <typename EntryT, typename AccumulateInfoT>
 class SampleTreeBuilder {
  public:
@@ -81,14 +211,54 @@ class SampleTreeBuilder {
     }
   }
 
-  void ProcessSampleRecord(const SampleRecord& r) {
-    if (use_branch_address_ && (r.sample_type & PERF_SAMPLE_BRANCH_STACK)) {
-      for (uint64_t i = 0; i < r.branch_stack_data.stack_nr; ++i) {
-        auto& item = r.branch_stack_data.stack[i];
-        if (item.from != 0 && item.to != 0) {
-          CreateBranchSample(r, item);
+  // Call [callback](item) for each item in the branch stack of [r] used to create a branch sample.
+  template <typename Callback>
+  static void ForEachBranchItem(const SampleRecord& r, Callback callback) {
+    for (uint64_t i = 0; i < r.branch_stack_data.stack_nr; ++i) {
+      auto& item = r.branch_stack_data.stack[i];
+      if (item.from != 0 && item.to != 0) {
+        callback(item);
+      }
+    }
+  }
+
+  // Call [callback](ip, in_kernel) for each ip in [ips], the callchain of [r], used to create a
+  // callchain sample. Perf context marks are skipped, and so is the first ip if it is the sampled
+  // ip. Stop when [callback] returns false.
+  template <typename Callback>
+  static void ForEachCallChainIp(const SampleRecord& r, const std::vector<uint64_t>& ips,
+                                 bool in_kernel, Callback callback) {
+    bool first_ip = true;
+    for (auto& ip : ips) {
+      if (ip >= PERF_CONTEXT_MAX) {
+        switch (ip) {
+          case PERF_CONTEXT_KERNEL:
+            in_kernel = true;
+            break;
+          case PERF_CONTEXT_USER:
+            in_kernel = false;
+            break;
+          default:
+            LOG(DEBUG) << "Unexpected perf_context in callchain: " << ip;
+        }
+      } else {
+        if (first_ip) {
+          first_ip = false;
+          // Remove duplication with sampled ip.
+          if (ip == r.ip_data.ip) {
+            continue;
+          }
+        }
+        if (!callback(ip, in_kernel)) {
+          break;
         }
       }
+    }
+  }
+
+  void ProcessSampleRecord(const SampleRecord& r) {
+    if (use_branch_address_ && (r.sample_type & PERF_SAMPLE_BRANCH_STACK)) {
+      ForEachBranchItem(r, [&](const BranchStackItemType& item) { CreateBranchSample(r, item); });
       return;
     }
     bool in_kernel = r.InKernel();
@@ -123,35 +293,15 @@ class SampleTreeBuilder {
       std::vector<EntryT*> callchain;
       callchain.push_back(sample);
 
-      bool first_ip = true;
-      for (auto& ip : ips) {
-        if (ip >= PERF_CONTEXT_MAX) {
-          switch (ip) {
-            case PERF_CONTEXT_KERNEL:
-              in_kernel = true;
-              break;
-            case PERF_CONTEXT_USER:
-              in_kernel = false;
-              break;
-            default:
-              LOG(DEBUG) << "Unexpected perf_context in callchain: " << ip;
-          }
-        } else {
-          if (first_ip) {
-            first_ip = false;
-            // Remove duplication with sampled ip.
-            if (ip == r.ip_data.ip) {
-              continue;
-            }
-          }
-          EntryT* callchain_sample =
-              CreateCallChainSample(sample, ip, in_kernel, callchain, acc_info);
-          if (callchain_sample == nullptr) {
-            break;
-          }
-          callchain.push_back(callchain_sample);
+      ForEachCallChainIp(r, ips, in_kernel, [&](uint64_t ip, bool ip_in_kernel) {
+        EntryT* callchain_sample =
+            CreateCallChainSample(sample, ip, ip_in_kernel, callchain, acc_info);
+        if (callchain_sample == nullptr) {
+          return false;
         }
-      }
+        callchain.push_back(callchain_sample);
+        return true;
+      });
 
       if (build_callchain_) {
         std::set<EntryT*> added_set;
@@ -175,13 +325,78 @@ class SampleTreeBuilder {
     }
   }
 
-  std::vector<EntryT*> GetSamples() const {
-    std::vector<EntryT*> result;
-    for (auto& entry : sample_set_) {
-      result.push_back(entry);
+  // Move samples built by [other] into this builder. [other] should be created with the same
+  // comparator and options, and becomes unusable afterwards. It is used to merge sample trees
+  // built in different threads.
+  void MergeSamplesFrom(SampleTreeBuilder& other) {
+    // Map from samples in [other] to samples in this builder.
+    std::unordered_map<EntryT*, EntryT*> sample_map;
+    std::vector<EntryT*> moved_samples;
+    std::vector<EntryT*> other_samples = other.sample_set_.GetSamples();
+    for (EntryT* sample : other_samples) {
+      EntryT* found = sample_set_.Find(sample);
+      if (found == nullptr) {
+        sample_set_.Insert(sample);
+        moved_samples.push_back(sample);
+        sample_map[sample] = sample;
+      } else {
+        MergeSample(found, sample);
+        sample_map[sample] = found;
+      }
     }
-    return result;
+    for (EntryT* sample : other.callchain_sample_set_.GetSamples()) {
+      EntryT* found = callchain_sample_set_.Find(sample);
+      if (found == nullptr) {
+        callchain_sample_set_.Insert(sample);
+        sample_map[sample] = sample;
+      } else {
+        sample_map[sample] = found;
+      }
+    }
+    // Callchains refer to samples in [other], so map them to samples in this builder.
+    for (EntryT* sample : moved_samples) {
+      MapCallChainNodes(sample->callchain.children, sample_map);
+    }
+    for (EntryT* sample : other_samples) {
+      EntryT* target = sample_map[sample];
+      if (target != sample) {
+        std::vector<EntryT*> callchain;
+        for (CallChainNode<EntryT>* node : sample->callchain.children) {
+          MergeCallChainNode(target, node, sample_map, callchain);
+        }
+      }
+    }
+    for (auto& pair : other.callchain_parent_map_) {
+      EntryT* sample = sample_map[pair.first];
+      EntryT* parent = sample_map[pair.second.parent];
+      auto it = callchain_parent_map_.find(sample);
+      if (it == callchain_parent_map_.end()) {
+        CallChainParentInfo info;
+        info.parent = parent;
+        info.has_multiple_parents = pair.second.has_multiple_parents;
+        callchain_parent_map_[sample] = info;
+      } else if (it->second.parent != parent || pair.second.has_multiple_parents) {
+        it->second.has_multiple_parents = true;
+      }
+    }
+    sample_arena_.Merge(other.sample_arena_);
+    callchain_node_arena_.Merge(other.callchain_node_arena_);
+    other.sample_set_.clear();
+    other.callchain_sample_set_.clear();
+    other.callchain_parent_map_.clear();
+  }
+
+  std::vector<EntryT*> GetSamples() const {
+    return sample_set_.GetSamples();
+  }
+
+  // Memory used by sample entries and callchain nodes. It doesn't include memory allocated by
+  // them, like chains in callchain nodes.
+  size_t GetSampleMemoryUsage() const {
+    return sample_arena_.MemoryUsage() + callchain_node_arena_.MemoryUsage();
   }
+  size_t GetSampleEntryCount() const { return sample_arena_.ObjectCount(); }
+  size_t GetCallChainNodeCount() const { return callchain_node_arena_.ObjectCount(); }
 
  protected:
   virtual EntryT* CreateSample(const SampleRecord& r, bool in_kernel,
@@ -200,48 +415,40 @@ class SampleTreeBuilder {
 
   virtual void MergeSample(EntryT* sample1, EntryT* sample2) = 0;
 
-  EntryT* InsertSample(std::unique_ptr<EntryT> sample) {
-    if (sample == nullptr || !FilterSample(sample.get())) {
+  // [sample] is a temporary entry. It is moved into sample_arena_ only when no existing sample
+  // can be merged with it.
+  EntryT* InsertSample(EntryT&& sample) {
+    if (!FilterSample(&sample)) {
       return nullptr;
     }
-    UpdateSummary(sample.get());
+    UpdateSummary(&sample);
     EntryT* result;
-    auto it = sample_set_.find(sample.get());
-    if (it == sample_set_.end()) {
-      result = sample.get();
-      sample_set_.insert(sample.get());
-      sample_storage_.push_back(std::move(sample));
+    result = sample_set_.Find(&sample);
+    if (result == nullptr) {
+      result = sample_arena_.New(std::move(sample));
+      sample_set_.Insert(result);
     } else {
-      result = *it;
-      MergeSample(*it, sample.get());
+      MergeSample(result, &sample);
     }
     return result;
   }
 
-  EntryT* InsertCallChainSample(std::unique_ptr<EntryT> sample,
-                                const std::vector<EntryT*>& callchain) {
-    if (sample == nullptr) {
-      return nullptr;
-    }
-    if (!FilterSample(sample.get())) {
+  EntryT* InsertCallChainSample(EntryT&& sample, const std::vector<EntryT*>& callchain) {
+    if (!FilterSample(&sample)) {
       // Store in callchain_sample_set_ for use in other EntryT's callchain.
-      auto it = callchain_sample_set_.find(sample.get());
-      if (it != callchain_sample_set_.end()) {
-        return *it;
+      EntryT* result = callchain_sample_set_.Find(&sample);
+      if (result == nullptr) {
+        result = sample_arena_.New(std::move(sample));
+        callchain_sample_set_.Insert(result);
       }
-      EntryT* result = sample.get();
-      callchain_sample_set_.insert(sample.get());
-      sample_storage_.push_back(std::move(sample));
       return result;
     }
 
-    auto it = sample_set_.find(sample.get());
-    if (it != sample_set_.end()) {
-      EntryT* sample = *it;
+    EntryT* found = sample_set_.Find(&sample);
+    if (found != nullptr) {
       // Process only once for recursive function call.
-      if (std::find(callchain.begin(), callchain.end(), sample) !=
-          callchain.end()) {
-        return sample;
+      if (std::find(callchain.begin(), callchain.end(), found) != callchain.end()) {
+        return found;
       }
     }
     return InsertSample(std::move(sample));
@@ -251,24 +458,24 @@ class SampleTreeBuilder {
                                 const std::vector<EntryT*>& callchain,
                                 const AccumulateInfoT& acc_info) {
     uint64_t period = GetPeriodForCallChain(acc_info);
-    sample->callchain.AddCallChain(
-        callchain, period, [&](const EntryT* s1, const EntryT* s2) {
-          return sample_comparator_.IsSameSample(s1, s2);
-        });
+    sample->callchain.AddCallChain(callchain, period, &callchain_node_arena_,
+                                   [&](const EntryT* s1, const EntryT* s2) {
+                                     return sample_comparator_.IsSameSample(s1, s2);
+                                   });
   }
 
   void AddCallChainDuplicateInfo() {
     if (build_callchain_) {
-      for (EntryT* sample : sample_set_) {
+      for (EntryT* sample : sample_set_.GetSamples()) {
         auto it = callchain_parent_map_.find(sample);
-        if (it != callchain_parent_map_.end() && !it->second.has_multiple_parents) {
-          sample->callchain.duplicated = true;
-        }
+        // It can be called again after adding more samples, so also reset the flag.
+        sample->callchain.duplicated =
+            (it != callchain_parent_map_.end() && !it->second.has_multiple_parents);
       }
     }
   }
 
-  std::set<EntryT*, SampleComparator<EntryT>> sample_set_;
+  SampleSet<EntryT> sample_set_;
   bool accumulate_callchain_;
 
  private:
@@ -287,11 +494,44 @@ class SampleTreeBuilder {
     }
   }
 
+  void MapCallChainNodes(std::vector<CallChainNode<EntryT>*>& nodes,
+                         std::unordered_map<EntryT*, EntryT*>& sample_map) {
+    for (CallChainNode<EntryT>* node : nodes) {
+      for (auto& entry : node->chain) {
+        entry = sample_map[entry];
+      }
+      MapCallChainNodes(node->children, sample_map);
+    }
+  }
+
+  // Add callchains in [node] and its children to [sample]. [callchain] is the callchain from root
+  // to the parent of [node].
+  void MergeCallChainNode(EntryT* sample, const CallChainNode<EntryT>* node,
+                          std::unordered_map<EntryT*, EntryT*>& sample_map,
+                          std::vector<EntryT*>& callchain) {
+    size_t old_size = callchain.size();
+    for (EntryT* entry : node->chain) {
+      callchain.push_back(sample_map[entry]);
+    }
+    if (node->period != 0) {
+      sample->callchain.AddCallChain(callchain, node->period, &callchain_node_arena_,
+                                     [&](const EntryT* s1, const EntryT* s2) {
+                                       return sample_comparator_.IsSameSample(s1, s2);
+                                     });
+    }
+    for (CallChainNode<EntryT>* child : node->children) {
+      MergeCallChainNode(sample, child, sample_map, callchain);
+    }
+    callchain.resize(old_size);
+  }
+
   const SampleComparator<EntryT> sample_comparator_;
   // If a CallChainSample is filtered out, it is stored in callchain_sample_set_
   // and only used in other EntryT's callchain.
-  std::set<EntryT*, SampleComparator<EntryT>> callchain_sample_set_;
-  std::vector<std::unique_ptr<EntryT>> sample_storage_;
+  SampleSet<EntryT> callchain_sample_set_;
+  // Samples and callchain nodes are freed together when the builder is destroyed.
+  ObjectArena<EntryT> sample_arena_;
+  ObjectArena<CallChainNode<EntryT>> callchain_node_arena_;
 
   struct CallChainParentInfo {
     EntryT* parent;
@@ -327,7 +567,14 @@ class SampleTreeSorter {
   }
 
  protected:
-  void SortCallChain(EntryT* sample) { sample->callchain.SortByPeriod(); }
+  void SortCallChain(EntryT* sample) {
+    if (comparator_.empty()) {
+      sample->callchain.SortByPeriod();
+    } else {
+      sample->callchain.SortByPeriod(
+          [this](const EntryT* s1, const EntryT* s2) { return comparator_(s1, s2); });
+    }
+  }
 
  private:
   SampleComparator<EntryT> comparator_;
@@ -341,15 +588,17 @@ class SampleTreeDisplayer {
 
   virtual ~SampleTreeDisplayer() {}
 
+  // Only the first [max_samples] samples are printed.
   void DisplaySamples(FILE* fp, const std::vector<EntryT*>& samples,
-                      const InfoT* info) {
+                      const InfoT* info, size_t max_samples = SIZE_MAX) {
     displayer_.SetInfo(info);
-    for (const auto& sample : samples) {
-      displayer_.AdjustWidth(sample);
+    size_t count = std::min(samples.size(), max_samples);
+    for (size_t i = 0; i < count; ++i) {
+      displayer_.AdjustWidth(samples[i]);
     }
     displayer_.PrintNames(fp);
-    for (const auto& sample : samples) {
-      displayer_.PrintSample(fp, sample);
+    for (size_t i = 0; i < count; ++i) {
+      displayer_.PrintSample(fp, samples[i]);
     }
   }
 
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "sample_tree.h"
+#include "utils.h"
+
+namespace {
+
+// Items of a sample used by the default sort keys of the report command.
+struct BenchmarkSample {
+  int pid;
+  int tid;
+  const char* thread_comm;
+  const char* dso;
+  const char* symbol;
+  uint64_t sample_count;
+};
+
+BUILD_COMPARE_VALUE_FUNCTION(BenchmarkComparePid, pid);
+BUILD_COMPARE_VALUE_FUNCTION(BenchmarkCompareTid, tid);
+BUILD_COMPARE_STRING_FUNCTION(BenchmarkCompareDso, dso);
+BUILD_COMPARE_STRING_FUNCTION(BenchmarkCompareSymbol, symbol);
+BUILD_KEY_VALUE_FUNCTION(BenchmarkKeyPid, pid);
+BUILD_KEY_VALUE_FUNCTION(BenchmarkKeyTid, tid);
+BUILD_KEY_STRING_FUNCTION(BenchmarkKeyDso, dso);
+BUILD_KEY_STRING_FUNCTION(BenchmarkKeySymbol, symbol);
+
+constexpr size_t THREAD_COUNT = 16;
+constexpr size_t DSO_COUNT = 200;
+constexpr size_t SYMBOLS_PER_DSO = 200;
+constexpr size_t SAMPLE_COUNT = 100000;
+
+class SampleData {
+ public:
+  SampleData() {
+    comm_ = "com.example.app";
+    for (size_t i = 0; i < DSO_COUNT; ++i) {
+      dsos_.push_back("/data/app/com.example.app/lib/arm64/libexample" + std::to_string(i) +
+                      ".so");
+    }
+    for (size_t i = 0; i < DSO_COUNT * SYMBOLS_PER_DSO; ++i) {
+      symbols_.push_back("example::Class" + std::to_string(i / 10) + "::Function" +
+                         std::to_string(i));
+    }
+    // Samples are concentrated in a small part of the symbols.
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<size_t> thread_dist(0, THREAD_COUNT - 1);
+    std::geometric_distribution<size_t> symbol_dist(0.001);
+    for (size_t i = 0; i < SAMPLE_COUNT; ++i) {
+      size_t symbol_id = symbol_dist(gen) % symbols_.size();
+      BenchmarkSample sample;
+      sample.pid = 1000;
+      sample.tid = 1000 + thread_dist(gen);
+      sample.thread_comm = comm_.c_str();
+      sample.dso = dsos_[symbol_id / SYMBOLS_PER_DSO].c_str();
+      sample.symbol = symbols_[symbol_id].c_str();
+      sample.sample_count = 1;
+      samples_.push_back(sample);
+    }
+  }
+
+  const std::vector<BenchmarkSample>& Samples() const { return samples_; }
+
+ private:
+  std::string comm_;
+  std::vector<std::string> dsos_;
+  std::vector<std::string> symbols_;
+  std::vector<BenchmarkSample> samples_;
+};
+
+SampleComparator<BenchmarkSample> CreateComparator(bool with_key_functions) {
+  SampleComparator<BenchmarkSample> comparator;
+  if (with_key_functions) {
+    comparator.AddCompareFunction(BenchmarkComparePid, BenchmarkKeyPid);
+    comparator.AddCompareFunction(BenchmarkCompareTid, BenchmarkKeyTid);
+    comparator.AddCompareFunction(CompareComm, KeyComm);
+    comparator.AddCompareFunction(BenchmarkCompareDso, BenchmarkKeyDso);
+    comparator.AddCompareFunction(BenchmarkCompareSymbol, BenchmarkKeySymbol);
+  } else {
+    comparator.AddCompareFunction(BenchmarkComparePid);
+    comparator.AddCompareFunction(BenchmarkCompareTid);
+    comparator.AddCompareFunction(CompareComm);
+    comparator.AddCompareFunction(BenchmarkCompareDso);
+    comparator.AddCompareFunction(BenchmarkCompareSymbol);
+  }
+  return comparator;
+}
+
+// Aggregate samples like SampleTreeBuilder::InsertSample().
+void AggregateSamples(benchmark::State& state, bool with_key_functions) {
+  SampleData data;
+  SampleComparator<BenchmarkSample> comparator = CreateComparator(with_key_functions);
+  while (state.KeepRunning()) {
+    SampleSet<BenchmarkSample> sample_set(comparator);
+    ObjectArena<BenchmarkSample> arena;
+    for (const BenchmarkSample& sample : data.Samples()) {
+      BenchmarkSample* found = sample_set.Find(&sample);
+      if (found == nullptr) {
+        sample_set.Insert(arena.New(sample));
+      } else {
+        found->sample_count += sample.sample_count;
+      }
+    }
+    benchmark::DoNotOptimize(sample_set.size());
+  }
+  state.SetItemsProcessed(state.iterations() * data.Samples().size());
+}
+
+void BM_AggregateSamplesInStdSet(benchmark::State& state) {
+  AggregateSamples(state, false);
+}
+BENCHMARK(BM_AggregateSamplesInStdSet);
+
+void BM_AggregateSamplesInHashTable(benchmark::State& state) {
+  AggregateSamples(state, true);
+}
+BENCHMARK(BM_AggregateSamplesInHashTable);
+
+}  // namespace
@@ -44,6 +44,7 @@ BUILD_COMPARE_VALUE_FUNCTION(TestComparePid, pid);
 BUILD_COMPARE_VALUE_FUNCTION(TestCompareTid, tid);
 BUILD_COMPARE_STRING_FUNCTION(TestCompareDsoName, dso_name.c_str());
 BUILD_COMPARE_VALUE_FUNCTION(TestCompareMapStartAddr, map_start_addr);
+BUILD_KEY_VALUE_FUNCTION(TestKeyMapStartAddr, map_start_addr);
 
 class TestSampleComparator : public SampleComparator<SampleEntry> {
  public:
@@ -58,14 +59,15 @@ class TestSampleComparator : public SampleComparator<SampleEntry> {
 
 class TestSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, int> {
  public:
-  explicit TestSampleTreeBuilder(ThreadTree* thread_tree)
-      : SampleTreeBuilder(TestSampleComparator()), thread_tree_(thread_tree) {}
+  explicit TestSampleTreeBuilder(
+      ThreadTree* thread_tree,
+      const SampleComparator<SampleEntry>& comparator = TestSampleComparator())
+      : SampleTreeBuilder(comparator), thread_tree_(thread_tree) {}
 
   void AddSample(int pid, int tid, uint64_t ip, bool in_kernel) {
     const ThreadEntry* thread = thread_tree_->FindThreadOrNew(pid, tid);
     const MapEntry* map = thread_tree_->FindMap(thread, ip, in_kernel);
-    InsertSample(std::unique_ptr<SampleEntry>(new SampleEntry(
-        pid, tid, thread->comm, map->dso->Path(), map->start_addr)));
+    InsertSample(SampleEntry(pid, tid, thread->comm, map->dso->Path(), map->start_addr));
   }
 
  protected:
@@ -232,6 +234,44 @@ TEST(sample_tree, overlapped_map) {
   CheckSamples(sample_tree_builder.GetSamples(), expected_samples);
 }
 
+TEST(sample_tree, hash_aggregation) {
+  SampleComparator<SampleEntry> comparator;
+  comparator.AddCompareFunction(CompareComm, KeyComm);
+  comparator.AddCompareFunction(TestCompareMapStartAddr, TestKeyMapStartAddr);
+  ASSERT_TRUE(comparator.HasKeyFunctions());
+  ASSERT_FALSE(TestSampleComparator().HasKeyFunctions());
+
+  ThreadTree thread_tree;
+  // Two threads have the same comm stored in different strings.
+  thread_tree.SetThreadName(1, 1, "comm");
+  thread_tree.SetThreadName(1, 2, "comm");
+  thread_tree.SetThreadName(1, 3, "comm3");
+  const size_t map_count = 1000;
+  for (size_t i = 0; i < map_count; ++i) {
+    thread_tree.AddThreadMap(1, 1, i * 10, 10, 0, "map" + std::to_string(i));
+  }
+  TestSampleTreeBuilder sample_tree_builder(&thread_tree, comparator);
+  for (size_t i = 0; i < map_count; ++i) {
+    sample_tree_builder.AddSample(1, 1, i * 10, false);
+    sample_tree_builder.AddSample(1, 2, i * 10 + 1, false);
+    sample_tree_builder.AddSample(1, 3, i * 10 + 2, false);
+  }
+  std::vector<SampleEntry*> samples = sample_tree_builder.GetSamples();
+  ASSERT_EQ(samples.size(), map_count * 2);
+  std::sort(samples.begin(), samples.end(), comparator);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const SampleEntry* sample = samples[i];
+    if (i < map_count) {
+      ASSERT_STREQ(sample->thread_comm, "comm");
+      ASSERT_EQ(sample->sample_count, 2u);
+    } else {
+      ASSERT_STREQ(sample->thread_comm, "comm3");
+      ASSERT_EQ(sample->sample_count, 1u);
+    }
+    ASSERT_EQ(sample->map_start_addr, (i % map_count) * 10);
+  }
+}
+
 TEST(thread_tree, symbol_ULLONG_MAX) {
   ThreadTree thread_tree;
   thread_tree.ShowIpForUnknownSymbol();
@@ -218,6 +218,57 @@ class FeatureSectionStructure(ct.Structure):
                 ('data_size', ct.c_uint32)]
 
 
+class SampleBatchStructure(ct.Structure):
+    """ Buffers used to read samples in batches. Layouts of samples and frames are described
+        by SampleInBatch and FrameInBatch below.
+    """
+    _fields_ = [('samples', ct.c_void_p),
+                ('sample_capacity', ct.c_uint32),
+                ('sample_count', ct.c_uint32),
+                ('frames', ct.c_void_p),
+                ('frame_capacity', ct.c_uint32),
+                ('frame_count', ct.c_uint32)]
+
+
+class StringTableStructure(ct.Structure):
+    """ Strings used in sample batches, each ending with '\\0'. """
+    _fields_ = [('data', ct.POINTER(ct.c_char)),
+                ('data_size', ct.c_uint32),
+                ('string_count', ct.c_uint32)]
+
+
+# A sample read by ReportLib.GetNextSampleBatch(). Strings are referred by ids, which can be
+# converted to strings by ReportLib.GetString(). Frames of the sample are
+# batch.frames[frame_start : frame_start + frame_count]. The first frame is for the sample ip,
+# the others are for the callchain.
+SampleInBatch = collections.namedtuple(
+    'SampleInBatch', ['ip', 'time', 'period', 'pid', 'tid', 'cpu', 'in_kernel', 'thread_comm_id',
+                      'event_name_id', 'frame_start', 'frame_count'])
+_SAMPLE_IN_BATCH_FORMAT = struct.Struct('=QQQIIIIIIII')
+
+FrameInBatch = collections.namedtuple(
+    'FrameInBatch', ['ip', 'vaddr_in_file', 'symbol_addr', 'symbol_len', 'dso_name_id',
+                     'symbol_name_id'])
+_FRAME_IN_BATCH_FORMAT = struct.Struct('=QQQQII')
+
+
+class SampleBatch(object):
+    """ Samples read by ReportLib.GetNextSampleBatch().
+        samples: a list of SampleInBatch.
+        frames: a list of FrameInBatch.
+    """
+    def __init__(self, samples, frames):
+        self.samples = samples
+        self.frames = frames
+
+    def get_frames(self, sample):
+        return self.frames[sample.frame_start : sample.frame_start + sample.frame_count]
+
+
+def _unpack_array(struct_format, data, count):
+    return [struct_format.unpack_from(data, i * struct_format.size) for i in range(count)]
+
+
 class ReportLibStructure(ct.Structure):
     _fields_ = []
 
@@ -236,6 +287,7 @@ class ReportLib(object):
         self._DestroyReportLibFunc = self._lib.DestroyReportLib
         self._SetLogSeverityFunc = self._lib.SetLogSeverity
         self._SetSymfsFunc = self._lib.SetSymfs
+        self._SetSymbolCacheDirFunc = self._lib.SetSymbolCacheDir
         self._SetRecordFileFunc = self._lib.SetRecordFile
         self._SetKallsymsFileFunc = self._lib.SetKallsymsFile
         self._ShowIpForUnknownSymbolFunc = self._lib.ShowIpForUnknownSymbol
@@ -250,6 +302,12 @@ class ReportLib(object):
         self._GetCallChainOfCurrentSampleFunc.restype = ct.POINTER(CallChainStructure)
         self._GetTracingDataOfCurrentSampleFunc = self._lib.GetTracingDataOfCurrentSample
         self._GetTracingDataOfCurrentSampleFunc.restype = ct.POINTER(ct.c_char)
+        self._GetNextSampleBatchFunc = self._lib.GetNextSampleBatch
+        self._GetNextSampleBatchFunc.restype = ct.c_int32
+        self._GetStringTableFunc = self._lib.GetStringTable
+        self._GetStringTableFunc.restype = ct.POINTER(StringTableStructure)
+        self._RefreshRecordFileFunc = self._lib.RefreshRecordFile
+        self._RefreshRecordFileFunc.restype = ct.c_int32
         self._GetBuildIdForPathFunc = self._lib.GetBuildIdForPath
         self._GetBuildIdForPathFunc.restype = ct.c_char_p
         self._GetFeatureSection = self._lib.GetFeatureSection
@@ -260,6 +318,8 @@ class ReportLib(object):
         self.meta_info = None
         self.current_sample = None
         self.record_cmd = None
+        self._batch = None
+        self._strings = []
 
     def _load_dependent_lib(self):
         # As the windows dll is built with mingw we need to load 'libwinpthread-1.dll'.
@@ -282,6 +342,12 @@ class ReportLib(object):
         cond = self._SetSymfsFunc(self.getInstance(), _char_pt(symfs_dir))
         _check(cond, 'Failed to set symbols directory')
 
+    def SetSymbolCacheDir(self, cache_dir):
+        """ Set directory used to cache symbols of elf files. Later reports read cached
+            symbols instead of parsing elf files again."""
+        cond = self._SetSymbolCacheDirFunc(self.getInstance(), _char_pt(cache_dir))
+        _check(cond, 'Failed to set symbol cache directory')
+
     def SetRecordFile(self, record_file):
         """ Set the path of record file, like perf.data."""
         cond = self._SetRecordFileFunc(self.getInstance(), _char_pt(record_file))
@@ -336,6 +402,63 @@ class ReportLib(object):
             result[field.name] = field.parse_value(data)
         return result
 
+    def GetNextSampleBatch(self, batch_size=4096):
+        """ Read at most batch_size samples with their callchains in one call, which is much
+            faster than calling GetNextSample() and GetCallChainOfCurrentSample() for each
+            sample. Tracing data isn't included. Return a SampleBatch, or None if there are no
+            more samples.
+        """
+        if self._batch is None or self._batch.sample_capacity != batch_size:
+            self._batch = SampleBatchStructure()
+            self._sample_buffer = ct.create_string_buffer(batch_size * _SAMPLE_IN_BATCH_FORMAT.size)
+            self._batch.samples = ct.cast(self._sample_buffer, ct.c_void_p)
+            self._batch.sample_capacity = batch_size
+            self._set_frame_capacity(batch_size * 16)
+        while True:
+            count = self._GetNextSampleBatchFunc(self.getInstance(), ct.byref(self._batch))
+            if count != -1:
+                break
+            # The next sample has too many frames.
+            self._set_frame_capacity(self._batch.frame_capacity * 2)
+        if count == 0:
+            return None
+        self._update_strings()
+        sample_data = ct.string_at(self._batch.samples, count * _SAMPLE_IN_BATCH_FORMAT.size)
+        frame_data = ct.string_at(self._batch.frames,
+                                  self._batch.frame_count * _FRAME_IN_BATCH_FORMAT.size)
+        samples = [SampleInBatch._make(t) for t in
+                   _unpack_array(_SAMPLE_IN_BATCH_FORMAT, sample_data, count)]
+        frames = [FrameInBatch._make(t) for t in
+                  _unpack_array(_FRAME_IN_BATCH_FORMAT, frame_data, self._batch.frame_count)]
+        return SampleBatch(samples, frames)
+
+    def GetString(self, string_id):
+        """ Return the string of an id used in samples and frames of a SampleBatch. """
+        return self._strings[string_id]
+
+    def RefreshRecordFile(self):
+        """ Used to read a record file still being written by
+            `simpleperf record --sync-interval`. After GetNextSample() or GetNextSampleBatch()
+            returns None, call it to read samples recorded since then. Return True if more
+            samples may be recorded, or False if recording has finished.
+        """
+        result = self._RefreshRecordFileFunc(self.getInstance())
+        _check(result != -1, 'Failed to refresh record file')
+        return result == 1
+
+    def _set_frame_capacity(self, capacity):
+        self._frame_buffer = ct.create_string_buffer(capacity * _FRAME_IN_BATCH_FORMAT.size)
+        self._batch.frames = ct.cast(self._frame_buffer, ct.c_void_p)
+        self._batch.frame_capacity = capacity
+
+    def _update_strings(self):
+        table = self._GetStringTableFunc(self.getInstance(), len(self._strings))
+        if table[0].string_count == 0:
+            return
+        data = ct.string_at(table[0].data, table[0].data_size)
+        strings = data.split(b'\0')[:table[0].string_count]
+        self._strings.extend(_char_pt_to_str(s) for s in strings)
+
     def GetBuildIdForPath(self, path):
         build_id = self._GetBuildIdForPathFunc(self.getInstance(), _char_pt(path))
         assert not _is_null(build_id)
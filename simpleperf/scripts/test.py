@@ -882,6 +882,50 @@ class TestReportLib(unittest.TestCase):
                 self.assertEqual(callchain.nr, 0)
         self.assertTrue(found_sample)
 
+    def test_sample_batch(self):
+        record_file = os.path.join('testdata', 'perf_with_trace_offcpu.data')
+        self.report_lib.SetRecordFile(record_file)
+        expected_samples = []
+        while self.report_lib.GetNextSample():
+            sample = self.report_lib.GetCurrentSample()
+            symbol = self.report_lib.GetSymbolOfCurrentSample()
+            callchain = self.report_lib.GetCallChainOfCurrentSample()
+            frames = [(symbol.dso_name, symbol.symbol_name)]
+            for i in range(callchain.nr):
+                entry = callchain.entries[i]
+                frames.append((entry.symbol.dso_name, entry.symbol.symbol_name))
+            expected_samples.append((sample.ip, sample.time, sample.period, sample.thread_comm,
+                                     self.report_lib.GetEventOfCurrentSample().name, frames))
+
+        report_lib = ReportLib()
+        report_lib.SetRecordFile(record_file)
+        samples = []
+        while True:
+            # Use a small batch size to read multiple batches.
+            batch = report_lib.GetNextSampleBatch(batch_size=7)
+            if batch is None:
+                break
+            self.assertLessEqual(len(batch.samples), 7)
+            for sample in batch.samples:
+                frames = [(report_lib.GetString(frame.dso_name_id),
+                           report_lib.GetString(frame.symbol_name_id))
+                          for frame in batch.get_frames(sample)]
+                samples.append((sample.ip, sample.time, sample.period,
+                                report_lib.GetString(sample.thread_comm_id),
+                                report_lib.GetString(sample.event_name_id), frames))
+        report_lib.Close()
+        self.assertEqual(samples, expected_samples)
+
+    def test_refresh_record_file(self):
+        self.report_lib.SetRecordFile(os.path.join('testdata', 'perf_with_symbols.data'))
+        sample_count = 0
+        while self.report_lib.GetNextSample():
+            sample_count += 1
+        self.assertGreater(sample_count, 0)
+        # A record file not being written doesn't have more samples.
+        self.assertFalse(self.report_lib.RefreshRecordFile())
+        self.assertIsNone(self.report_lib.GetNextSample())
+
     def test_meta_info(self):
         self.report_lib.SetRecordFile(os.path.join('testdata', 'perf_with_trace_offcpu.data'))
         meta_info = self.report_lib.MetaInfo()
@@ -18,11 +18,13 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <limits>
 
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 
+#include "JITSymfileContainer.h"
 #include "perf_event.h"
 #include "record.h"
 
@@ -44,7 +46,10 @@ void ThreadTree::ForkThread(int pid, int tid, int ppid, int ptid) {
   if (pid != ppid) {
     // Copy maps from parent process.
     if (child->maps->maps.empty()) {
+      // Keep the version increasing, so lookup caches of the child don't match the copied maps.
+      uint64_t version = std::max(child->maps->version, parent->maps->version) + 1;
       *child->maps = *parent->maps;
+      child->maps->version = version;
     } else {
       for (auto& pair : parent->maps->maps) {
         InsertMap(*child->maps, *pair.second);
@@ -82,6 +87,8 @@ ThreadEntry* ThreadTree::CreateThread(int pid, int tid) {
     pid, tid,
     "unknown",
     maps,
+    MapLookupCache(),
+    MapLookupCache(),
   };
   auto pair = thread_tree_.insert(std::make_pair(tid, std::unique_ptr<ThreadEntry>(thread)));
   CHECK(pair.second);
@@ -114,7 +121,13 @@ Dso* ThreadTree::FindKernelDsoOrNew(const std::string& filename) {
 void ThreadTree::AddThreadMap(int pid, int tid, uint64_t start_addr, uint64_t len,
                               uint64_t pgoff, const std::string& filename, uint32_t flags) {
   ThreadEntry* thread = FindThreadOrNew(pid, tid);
-  Dso* dso = FindUserDsoOrNew(filename, start_addr);
+  Dso* dso;
+  if ((flags & map_flags::PROT_JIT_SYMFILE_MAP) && pgoff != 0) {
+    // The map refers to a symfile in a JIT symfile container, at offset pgoff.
+    dso = FindUserDsoOrNew(GetJITSymfileUrl(filename, pgoff), start_addr);
+  } else {
+    dso = FindUserDsoOrNew(filename, start_addr);
+  }
   InsertMap(*thread->maps, MapEntry(start_addr, len, pgoff, dso, false, flags));
 }
 
@@ -182,12 +195,28 @@ void ThreadTree::InsertMap(MapSet& maps, const MapEntry& entry) {
   maps.version++;
 }
 
-static const MapEntry* FindMapByAddr(const MapSet& maps, uint64_t addr) {
-  auto it = maps.maps.upper_bound(addr);
-  if (it != maps.maps.begin()) {
-    --it;
-    if (it->second->get_end_addr() > addr) {
-      return it->second;
+static const MapEntry* FindMapByAddr(MapSet& maps, uint64_t addr, MapLookupCache& cache) {
+  if (cache.map != nullptr && cache.version == maps.version && cache.map->Contains(addr)) {
+    return cache.map;
+  }
+  if (maps.sorted_maps_version != maps.version) {
+    maps.sorted_start_addrs.clear();
+    maps.sorted_maps.clear();
+    maps.sorted_start_addrs.reserve(maps.maps.size());
+    maps.sorted_maps.reserve(maps.maps.size());
+    for (auto& pair : maps.maps) {
+      maps.sorted_start_addrs.push_back(pair.first);
+      maps.sorted_maps.push_back(pair.second);
+    }
+    maps.sorted_maps_version = maps.version;
+  }
+  auto it = std::upper_bound(maps.sorted_start_addrs.begin(), maps.sorted_start_addrs.end(), addr);
+  if (it != maps.sorted_start_addrs.begin()) {
+    const MapEntry* map = maps.sorted_maps[it - maps.sorted_start_addrs.begin() - 1];
+    if (map->get_end_addr() > addr) {
+      cache.map = map;
+      cache.version = maps.version;
+      return map;
     }
   }
   return nullptr;
@@ -196,19 +225,19 @@ static const MapEntry* FindMapByAddr(const MapSet& maps, uint64_t addr) {
 const MapEntry* ThreadTree::FindMap(const ThreadEntry* thread, uint64_t ip, bool in_kernel) {
   const MapEntry* result = nullptr;
   if (!in_kernel) {
-    result = FindMapByAddr(*thread->maps, ip);
+    result = FindMapByAddr(*thread->maps, ip, thread->last_user_map);
   } else {
-    result = FindMapByAddr(kernel_maps_, ip);
+    result = FindMapByAddr(kernel_maps_, ip, thread->last_kernel_map);
   }
   return result != nullptr ? result : &unknown_map_;
 }
 
 const MapEntry* ThreadTree::FindMap(const ThreadEntry* thread, uint64_t ip) {
-  const MapEntry* result = FindMapByAddr(*thread->maps, ip);
+  const MapEntry* result = FindMapByAddr(*thread->maps, ip, thread->last_user_map);
   if (result != nullptr) {
     return result;
   }
-  result = FindMapByAddr(kernel_maps_, ip);
+  result = FindMapByAddr(kernel_maps_, ip, thread->last_kernel_map);
   return result != nullptr ? result : &unknown_map_;
 }
 
@@ -273,10 +302,11 @@ void ThreadTree::ClearThreadAndMap() {
   thread_comm_storage_.clear();
   map_set_storage_.clear();
   kernel_maps_.maps.clear();
+  kernel_maps_.version++;
   map_storage_.clear();
 }
 
-void ThreadTree::AddDsoInfo(const std::string& file_path, uint32_t file_type,
+Dso* ThreadTree::AddDsoInfo(const std::string& file_path, uint32_t file_type,
                             uint64_t min_vaddr, std::vector<Symbol>* symbols,
                             const std::vector<uint64_t>& dex_file_offsets) {
   DsoType dso_type = static_cast<DsoType>(file_type);
@@ -291,6 +321,7 @@ void ThreadTree::AddDsoInfo(const std::string& file_path, uint32_t file_type,
   for (uint64_t offset : dex_file_offsets) {
     dso->AddDexFileOffset(offset);
   }
+  return dso;
 }
 
 void ThreadTree::AddDexFileOffset(const std::string& file_path, uint64_t dex_file_offset) {
@@ -326,6 +357,15 @@ void ThreadTree::Update(const Record& record) {
   } else if (record.type() == SIMPLE_PERF_RECORD_KERNEL_SYMBOL) {
     const auto& r = *static_cast<const KernelSymbolRecord*>(&record);
     Dso::SetKallsyms(std::move(r.kallsyms));
+  } else if (record.type() == SIMPLE_PERF_RECORD_KERNEL_SYMBOL_INDEX) {
+    const auto& r = *static_cast<const KernelSymbolIndexRecord*>(&record);
+    std::unique_ptr<simpleperf::KernelSymbolIndex> index =
+        simpleperf::KernelSymbolIndex::Deserialize(r.data, r.data_size);
+    if (index) {
+      Dso::SetKernelSymbolIndex(std::move(index));
+    } else {
+      LOG(WARNING) << "invalid kernel symbol index record";
+    }
   }
 }
 
@@ -23,6 +23,7 @@
 #include <map>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "dso.h"
 
@@ -58,11 +59,24 @@ struct MapEntry {
   MapEntry() {}
 
   uint64_t get_end_addr() const { return start_addr + len; }
+  bool Contains(uint64_t addr) const { return addr >= start_addr && addr < get_end_addr(); }
 };
 
 struct MapSet {
   std::map<uint64_t, const MapEntry*> maps;  // Map from start_addr to a MapEntry.
   uint64_t version = 0u;  // incremented each time changing maps
+
+  // A flat copy of maps for fast lookup. It is rebuilt lazily when looking up an address after
+  // maps change.
+  std::vector<uint64_t> sorted_start_addrs;
+  std::vector<const MapEntry*> sorted_maps;
+  uint64_t sorted_maps_version = 0u;
+};
+
+// The last map found in a MapSet, valid when version == MapSet::version.
+struct MapLookupCache {
+  const MapEntry* map = nullptr;
+  uint64_t version = 0u;
 };
 
 struct ThreadEntry {
@@ -70,11 +84,17 @@ struct ThreadEntry {
   int tid;
   const char* comm;  // It always refers to the latest comm.
   MapSet* maps;
+  // Samples of a thread usually hit the same maps successively, so remember the last hit maps.
+  // They are updated by ThreadTree::FindMap(), which makes FindMap() not thread-safe.
+  mutable MapLookupCache last_user_map;
+  mutable MapLookupCache last_kernel_map;
 };
 
 // ThreadTree contains thread information (in ThreadEntry) and mmap information
 // (in MapEntry) of the monitored threads. It also has interface to access
 // symbols in executable binaries mapped in the monitored threads.
+// ThreadTree isn't thread-safe. Even lookups like FindMap() update the lookup caches in
+// ThreadEntry and MapSet, so a ThreadTree can only be used by one thread at a time.
 class ThreadTree {
  public:
   ThreadTree()
@@ -116,7 +136,7 @@ class ThreadTree {
   // the time to reload dso information.
   void ClearThreadAndMap();
 
-  void AddDsoInfo(const std::string& file_path, uint32_t file_type,
+  Dso* AddDsoInfo(const std::string& file_path, uint32_t file_type,
                   uint64_t min_vaddr, std::vector<Symbol>* symbols,
                   const std::vector<uint64_t>& dex_file_offsets);
   void AddDexFileOffset(const std::string& file_path, uint64_t dex_file_offset);
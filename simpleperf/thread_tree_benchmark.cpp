@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "thread_tree.h"
+
+using namespace simpleperf;
+
+// A process with as many maps as a typical app process.
+static constexpr size_t MAP_COUNT = 3000;
+static constexpr uint64_t MAP_SIZE = 0x10000;
+static constexpr uint64_t MAP_START = 0x70000000;
+static constexpr size_t ADDR_COUNT = 4096;
+
+static void CreateMaps(ThreadTree& thread_tree) {
+  for (size_t i = 0; i < MAP_COUNT; ++i) {
+    // Leave a gap between maps.
+    uint64_t start = MAP_START + i * MAP_SIZE * 2;
+    thread_tree.AddThreadMap(1, 1, start, MAP_SIZE, 0, "/system/lib/lib" + std::to_string(i) +
+                             ".so");
+  }
+}
+
+// Simulate addresses of callchains: each callchain hits a few maps repeatedly.
+static std::vector<uint64_t> CreateAddrs() {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<size_t> map_dist(0, MAP_COUNT / 10);
+  std::uniform_int_distribution<uint64_t> offset_dist(0, MAP_SIZE - 1);
+  std::vector<uint64_t> addrs;
+  while (addrs.size() < ADDR_COUNT) {
+    uint64_t map_start = MAP_START + map_dist(gen) * MAP_SIZE * 2;
+    for (size_t i = 0; i < 4 && addrs.size() < ADDR_COUNT; ++i) {
+      addrs.push_back(map_start + offset_dist(gen));
+    }
+  }
+  return addrs;
+}
+
+// The implementation used before adding lookup caches to MapSet and ThreadEntry.
+static const MapEntry* FindMapInStdMap(const MapSet& maps, uint64_t addr) {
+  auto it = maps.maps.upper_bound(addr);
+  if (it != maps.maps.begin()) {
+    --it;
+    if (it->second->get_end_addr() > addr) {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+static void BM_FindMapInStdMap(benchmark::State& state) {
+  ThreadTree thread_tree;
+  CreateMaps(thread_tree);
+  const ThreadEntry* thread = thread_tree.FindThreadOrNew(1, 1);
+  std::vector<uint64_t> addrs = CreateAddrs();
+  while (state.KeepRunning()) {
+    for (uint64_t addr : addrs) {
+      benchmark::DoNotOptimize(FindMapInStdMap(*thread->maps, addr));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * addrs.size());
+}
+BENCHMARK(BM_FindMapInStdMap);
+
+static void BM_ThreadTree_FindMap(benchmark::State& state) {
+  ThreadTree thread_tree;
+  CreateMaps(thread_tree);
+  const ThreadEntry* thread = thread_tree.FindThreadOrNew(1, 1);
+  std::vector<uint64_t> addrs = CreateAddrs();
+  while (state.KeepRunning()) {
+    for (uint64_t addr : addrs) {
+      benchmark::DoNotOptimize(thread_tree.FindMap(thread, addr, false));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * addrs.size());
+}
+BENCHMARK(BM_ThreadTree_FindMap);
@@ -105,3 +105,19 @@ TEST_F(ThreadTreeTest, jit_maps_before_fork) {
   ASSERT_TRUE(map != nullptr);
   ASSERT_EQ(map->flags, map_flags::PROT_JIT_SYMFILE_MAP);
 }
+
+TEST_F(ThreadTreeTest, find_map_after_maps_change) {
+  thread_tree_.AddKernelMap(0x1000, 0x1000, 0, "[kernel.kallsyms]");
+  thread_tree_.AddThreadMap(0, 0, 0x1000, 0x1000, 0, "0");
+  ThreadEntry* thread = thread_tree_.FindThreadOrNew(0, 0);
+  ASSERT_EQ(thread_tree_.FindMap(thread, 0x1800, false)->dso->Path(), "0");
+  ASSERT_EQ(thread_tree_.FindMap(thread, 0x1800, true)->dso->Path(), "[kernel.kallsyms]");
+  // The last hit map is replaced.
+  thread_tree_.AddThreadMap(0, 0, 0x1000, 0x1000, 0, "1");
+  ASSERT_EQ(thread_tree_.FindMap(thread, 0x1800, false)->dso->Path(), "1");
+  // Maps are removed.
+  thread_tree_.ClearThreadAndMap();
+  thread = thread_tree_.FindThreadOrNew(0, 0);
+  ASSERT_TRUE(thread_tree_.IsUnknownDso(thread_tree_.FindMap(thread, 0x1800, false)->dso));
+  ASSERT_TRUE(thread_tree_.IsUnknownDso(thread_tree_.FindMap(thread, 0x1800, true)->dso));
+}
@@ -23,6 +23,9 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 #include <unistd.h>
 
 #include <algorithm>
@@ -36,6 +39,7 @@
 #include <7zCrc.h>
 #include <Xz.h>
 #include <XzCrc64.h>
+#include <zlib.h>
 
 void OneTimeFreeAllocator::Clear() {
   for (auto& p : v_) {
@@ -61,6 +65,13 @@ const char* OneTimeFreeAllocator::AllocateString(std::string_view s) {
   return result;
 }
 
+void OneTimeFreeAllocator::Merge(OneTimeFreeAllocator& other) {
+  v_.insert(v_.end(), other.v_.begin(), other.v_.end());
+  other.v_.clear();
+  other.cur_ = nullptr;
+  other.end_ = nullptr;
+}
+
 
 android::base::unique_fd FileHelper::OpenReadOnly(const std::string& filename) {
     int fd = TEMP_FAILURE_RETRY(open(filename.c_str(), O_RDONLY | O_BINARY));
@@ -295,6 +306,36 @@ bool XzDecompress(const std::string& compressed_data, std::string* decompressed_
   return true;
 }
 
+bool ZlibCompress(const char* data, size_t size, std::vector<char>* compressed_data) {
+  uLongf compressed_size = compressBound(size);
+  compressed_data->resize(compressed_size);
+  int res = compress2(reinterpret_cast<Bytef*>(compressed_data->data()), &compressed_size,
+                      reinterpret_cast<const Bytef*>(data), size, Z_BEST_SPEED);
+  if (res != Z_OK) {
+    LOG(ERROR) << "zlib compression failed with error " << res;
+    return false;
+  }
+  compressed_data->resize(compressed_size);
+  return true;
+}
+
+bool ZlibDecompress(const char* compressed_data, size_t compressed_size, size_t decompressed_size,
+                    std::vector<char>* decompressed_data) {
+  decompressed_data->resize(decompressed_size);
+  uLongf dest_size = decompressed_size;
+  int res = uncompress(reinterpret_cast<Bytef*>(decompressed_data->data()), &dest_size,
+                       reinterpret_cast<const Bytef*>(compressed_data), compressed_size);
+  if (res != Z_OK) {
+    LOG(ERROR) << "zlib decompression failed with error " << res;
+    return false;
+  }
+  if (dest_size != decompressed_size) {
+    LOG(ERROR) << "zlib decompression failed due to unexpected data size " << dest_size;
+    return false;
+  }
+  return true;
+}
+
 static std::map<std::string, android::base::LogSeverity> log_severity_map = {
     {"verbose", android::base::VERBOSE},
     {"debug", android::base::DEBUG},
@@ -383,6 +424,25 @@ size_t GetPageSize() {
 #endif
 }
 
+bool GetPeakRss(uint64_t* peak_rss_in_bytes) {
+#if defined(_WIN32)
+  return false;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    PLOG(ERROR) << "getrusage() failed";
+    return false;
+  }
+#if defined(__APPLE__)
+  *peak_rss_in_bytes = usage.ru_maxrss;
+#else
+  // ru_maxrss is in kilobytes on linux.
+  *peak_rss_in_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+  return true;
+#endif
+}
+
 uint64_t ConvertBytesToValue(const char* bytes, uint32_t size) {
   if (size > 8) {
     LOG(FATAL) << "unexpected size " << size << " in ConvertBytesToValue";
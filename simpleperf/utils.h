@@ -21,7 +21,11 @@
 #include <time.h>
 
 #include <functional>
+#include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -55,6 +59,8 @@ class OneTimeFreeAllocator {
 
   void Clear();
   const char* AllocateString(std::string_view s);
+  // Take the memory allocated by [other], which becomes empty.
+  void Merge(OneTimeFreeAllocator& other);
 
  private:
   const size_t unit_size_;
@@ -63,6 +69,74 @@ class OneTimeFreeAllocator {
   char* end_;
 };
 
+// ObjectArena allocates objects of type T in blocks, and destroys them all at once in Clear() or
+// the destructor. It avoids a heap allocation for each object. Allocated objects never move.
+template <typename T, size_t OBJECTS_PER_BLOCK = 1024>
+class ObjectArena {
+ public:
+  ObjectArena() : object_count_(0) {}
+
+  ~ObjectArena() {
+    Clear();
+  }
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    if (blocks_.empty() || blocks_.back().used == OBJECTS_PER_BLOCK) {
+      blocks_.emplace_back();
+      blocks_.back().data.reset(new Storage[OBJECTS_PER_BLOCK]);
+    }
+    Block& block = blocks_.back();
+    T* result = new (&block.data[block.used]) T(std::forward<Args>(args)...);
+    block.used++;
+    object_count_++;
+    return result;
+  }
+
+  // Take all objects allocated in [other], without moving them.
+  void Merge(ObjectArena& other) {
+    // Keep the last block, which may not be full, at the end.
+    auto pos = blocks_.empty() ? blocks_.end() : blocks_.end() - 1;
+    blocks_.insert(pos, std::make_move_iterator(other.blocks_.begin()),
+                   std::make_move_iterator(other.blocks_.end()));
+    object_count_ += other.object_count_;
+    other.blocks_.clear();
+    other.object_count_ = 0;
+  }
+
+  void Clear() {
+    for (auto& block : blocks_) {
+      for (size_t i = 0; i < block.used; ++i) {
+        reinterpret_cast<T*>(&block.data[i])->~T();
+      }
+    }
+    blocks_.clear();
+    object_count_ = 0;
+  }
+
+  size_t ObjectCount() const {
+    return object_count_;
+  }
+
+  // Return bytes of blocks, not including memory owned by the objects.
+  size_t MemoryUsage() const {
+    return blocks_.size() * OBJECTS_PER_BLOCK * sizeof(Storage);
+  }
+
+ private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+  struct Block {
+    std::unique_ptr<Storage[]> data;
+    size_t used = 0;
+  };
+
+  std::vector<Block> blocks_;
+  size_t object_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(ObjectArena);
+};
+
 class FileHelper {
  public:
   static android::base::unique_fd OpenReadOnly(const std::string& filename);
@@ -139,6 +213,9 @@ uint64_t GetFileSize(const std::string& filename);
 bool MkdirWithParents(const std::string& path);
 
 bool XzDecompress(const std::string& compressed_data, std::string* decompressed_data);
+bool ZlibCompress(const char* data, size_t size, std::vector<char>* compressed_data);
+bool ZlibDecompress(const char* compressed_data, size_t compressed_size, size_t decompressed_size,
+                    std::vector<char>* decompressed_data);
 
 bool GetLogSeverity(const std::string& name, android::base::LogSeverity* severity);
 std::string GetLogSeverityName();
@@ -156,6 +233,8 @@ bool ProcessKernelSymbols(std::string& symbol_data,
                           const std::function<bool(const KernelSymbol&)>& callback);
 
 size_t GetPageSize();
+// Get the max resident set size of the current process.
+bool GetPeakRss(uint64_t* peak_rss_in_bytes);
 
 uint64_t ConvertBytesToValue(const char* bytes, uint32_t size);
 
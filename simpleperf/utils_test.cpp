@@ -99,3 +99,57 @@ TEST(utils, ArchiveHelper) {
   ASSERT_FALSE(ArchiveHelper::CreateInstance(GetTestData(ELF_FILE)));
   ASSERT_FALSE(ArchiveHelper::CreateInstance("/dev/zero"));
 }
+
+TEST(utils, ZlibCompress) {
+  std::string s;
+  for (int i = 0; i < 1000; ++i) {
+    s += "data_" + std::to_string(i % 10);
+  }
+  std::vector<char> compressed_data;
+  ASSERT_TRUE(ZlibCompress(s.data(), s.size(), &compressed_data));
+  ASSERT_LT(compressed_data.size(), s.size());
+  std::vector<char> data;
+  ASSERT_TRUE(ZlibDecompress(compressed_data.data(), compressed_data.size(), s.size(), &data));
+  ASSERT_EQ(std::string(data.begin(), data.end()), s);
+  // Fail if the decompressed size doesn't match.
+  ASSERT_FALSE(ZlibDecompress(compressed_data.data(), compressed_data.size(), s.size() - 1, &data));
+}
+
+TEST(utils, ObjectArena) {
+  static int live_objects = 0;
+  struct Object {
+    int value;
+    explicit Object(int value) : value(value) { live_objects++; }
+    ~Object() { live_objects--; }
+  };
+  {
+    ObjectArena<Object, 4> arena;
+    std::vector<Object*> objects;
+    for (int i = 0; i < 10; ++i) {
+      objects.push_back(arena.New(i));
+    }
+    ASSERT_EQ(arena.ObjectCount(), 10u);
+    ASSERT_EQ(arena.MemoryUsage(), 3 * 4 * sizeof(Object));
+    ObjectArena<Object, 4> other;
+    objects.push_back(other.New(10));
+    arena.Merge(other);
+    ASSERT_EQ(arena.ObjectCount(), 11u);
+    ASSERT_EQ(other.ObjectCount(), 0u);
+    objects.push_back(arena.New(11));
+    // Objects don't move when more objects are allocated or arenas are merged.
+    for (int i = 0; i < 12; ++i) {
+      ASSERT_EQ(objects[i]->value, i);
+    }
+    ASSERT_EQ(live_objects, 12);
+    arena.Clear();
+    ASSERT_EQ(live_objects, 0);
+    arena.New(0);
+  }
+  ASSERT_EQ(live_objects, 0);
+}
+
+TEST(utils, GetPeakRss) {
+  uint64_t peak_rss;
+  ASSERT_TRUE(GetPeakRss(&peak_rss));
+  ASSERT_GT(peak_rss, 0u);
+}